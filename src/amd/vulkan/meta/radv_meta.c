@@ -29,6 +29,8 @@
 #include "vk_pipeline_cache.h"
 #include "vk_util.h"
 
+#include "util/u_rcu_hash.h"
+
 #include <fcntl.h>
 #include <limits.h>
 #ifndef _WIN32
@@ -325,7 +327,7 @@ radv_builtin_cache_path(char *path)
 static uint32_t
 num_cache_entries(VkPipelineCache cache)
 {
-   struct set *s = vk_pipeline_cache_from_handle(cache)->object_cache;
+   struct util_rcu_hash *s = vk_pipeline_cache_from_handle(cache)->object_cache;
    if (!s)
       return 0;
    return s->entries;
@@ -290,20 +290,35 @@ radv_pipeline_cache_object_deserialize(struct vk_pipeline_cache *cache, const vo
 
    object->base.data_size = total_size;
 
+   /* The shader hashes are stored back to back, look them all up at once so that the ones missing
+    * from memory are loaded from the disk cache in parallel.
+    */
+   const uint8_t *hashes = blob_read_bytes(blob, num_shaders * sizeof(blake3_hash));
+   STACK_ARRAY(struct vk_pipeline_cache_object *, shaders, num_shaders);
+   if (blob->overrun || !shaders) {
+      STACK_ARRAY_FINISH(shaders);
+      vk_pipeline_cache_object_unref(&device->vk, &object->base);
+      return NULL;
+   }
+
+   vk_pipeline_cache_lookup_objects(cache, hashes, sizeof(blake3_hash), num_shaders, &radv_shader_ops, shaders);
+
+   bool complete = true;
    for (unsigned i = 0; i < num_shaders; i++) {
-      const uint8_t *hash = blob_read_bytes(blob, sizeof(blake3_hash));
-      struct vk_pipeline_cache_object *shader =
-         vk_pipeline_cache_lookup_object(cache, hash, sizeof(blake3_hash), &radv_shader_ops, NULL);
-
-      if (!shader) {
-         /* If some shader could not be created from cache, better return NULL here than having
-          * an incomplete cache object which needs to be fixed up later.
-          */
-         vk_pipeline_cache_object_unref(&device->vk, &object->base);
-         return NULL;
-      }
+      if (shaders[i])
+         object->shaders[i] = container_of(shaders[i], struct radv_shader, base);
+      else
+         complete = false;
+   }
 
-      object->shaders[i] = container_of(shader, struct radv_shader, base);
+   STACK_ARRAY_FINISH(shaders);
+
+   if (!complete) {
+      /* If some shader could not be created from cache, better return NULL here than having
+       * an incomplete cache object which needs to be fixed up later.
+       */
+      vk_pipeline_cache_object_unref(&device->vk, &object->base);
+      return NULL;
    }
 
    blob_copy_bytes(blob, object->data, data_size);
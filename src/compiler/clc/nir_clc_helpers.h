@@ -13,6 +13,7 @@ extern "C" {
 #endif
 
 struct disk_cache;
+struct nir_lazy_shader;
 struct spirv_to_nir_options;
 
 bool nir_can_find_libclc(unsigned ptr_bit_size);
@@ -24,6 +25,13 @@ nir_load_libclc_shader(unsigned ptr_bit_size,
                        const nir_shader_compiler_options *nir_options,
                        bool optimize);
 
+struct nir_lazy_shader *
+nir_load_libclc_lazy(unsigned ptr_bit_size,
+                     struct disk_cache *disk_cache,
+                     const struct spirv_to_nir_options *spirv_options,
+                     const nir_shader_compiler_options *nir_options,
+                     bool optimize);
+
 #ifdef __cplusplus
 }
 #endif
@@ -299,49 +299,23 @@ libclc_add_generic_variants(nir_shader *shader)
    }
 }
 
-nir_shader *
-nir_load_libclc_shader(unsigned ptr_bit_size,
-                       struct disk_cache *disk_cache,
-                       const struct spirv_to_nir_options *spirv_options,
-                       const nir_shader_compiler_options *nir_options,
-                       bool optimize)
+/* Translates libclc to NIR, lowers it so the functions are ready to be
+ * linked and optionally optimizes it.
+ */
+static nir_shader *
+build_libclc_shader(struct clc_data *clc,
+                    const struct spirv_to_nir_options *spirv_options,
+                    const nir_shader_compiler_options *nir_options,
+                    bool optimize)
 {
-   assert(ptr_bit_size ==
-          nir_address_format_bit_size(spirv_options->global_addr_format));
-
-   struct clc_data clc;
-   if (!open_clc_data(&clc, ptr_bit_size))
+   if (!map_clc_data(clc))
       return NULL;
 
-#ifdef ENABLE_SHADER_CACHE
-   cache_key cache_key;
-   if (disk_cache) {
-      disk_cache_compute_key(disk_cache, clc.cache_key,
-                             sizeof(clc.cache_key), cache_key);
-
-      size_t buffer_size;
-      uint8_t *buffer = disk_cache_get(disk_cache, cache_key, &buffer_size);
-      if (buffer) {
-         struct blob_reader blob;
-         blob_reader_init(&blob, buffer, buffer_size);
-         nir_shader *nir = nir_deserialize(NULL, nir_options, &blob);
-         free(buffer);
-         close_clc_data(&clc);
-         return nir;
-      }
-   }
-#endif
-
-   if (!map_clc_data(&clc)) {
-      close_clc_data(&clc);
-      return NULL;
-   }
-
    struct spirv_to_nir_options spirv_lib_options = *spirv_options;
    spirv_lib_options.create_library = true;
 
-   assert(clc.size % SPIRV_WORD_SIZE == 0);
-   nir_shader *nir = spirv_to_nir(clc.data, clc.size / SPIRV_WORD_SIZE,
+   assert(clc->size % SPIRV_WORD_SIZE == 0);
+   nir_shader *nir = spirv_to_nir(clc->data, clc->size / SPIRV_WORD_SIZE,
                                   NULL, 0, MESA_SHADER_KERNEL, NULL,
                                   &spirv_lib_options, nir_options);
    nir_validate_shader(nir, "after nir_load_clc_shader");
@@ -387,6 +361,49 @@ nir_load_libclc_shader(unsigned ptr_bit_size,
       nir_sweep(nir);
    }
 
+   return nir;
+}
+
+nir_shader *
+nir_load_libclc_shader(unsigned ptr_bit_size,
+                       struct disk_cache *disk_cache,
+                       const struct spirv_to_nir_options *spirv_options,
+                       const nir_shader_compiler_options *nir_options,
+                       bool optimize)
+{
+   assert(ptr_bit_size ==
+          nir_address_format_bit_size(spirv_options->global_addr_format));
+
+   struct clc_data clc;
+   if (!open_clc_data(&clc, ptr_bit_size))
+      return NULL;
+
+#ifdef ENABLE_SHADER_CACHE
+   cache_key cache_key;
+   if (disk_cache) {
+      disk_cache_compute_key(disk_cache, clc.cache_key,
+                             sizeof(clc.cache_key), cache_key);
+
+      size_t buffer_size;
+      uint8_t *buffer = disk_cache_get(disk_cache, cache_key, &buffer_size);
+      if (buffer) {
+         struct blob_reader blob;
+         blob_reader_init(&blob, buffer, buffer_size);
+         nir_shader *nir = nir_deserialize(NULL, nir_options, &blob);
+         free(buffer);
+         close_clc_data(&clc);
+         return nir;
+      }
+   }
+#endif
+
+   nir_shader *nir = build_libclc_shader(&clc, spirv_options, nir_options,
+                                         optimize);
+   if (nir == NULL) {
+      close_clc_data(&clc);
+      return NULL;
+   }
+
 #ifdef ENABLE_SHADER_CACHE
    if (disk_cache) {
       struct blob blob;
@@ -400,3 +417,103 @@ nir_load_libclc_shader(unsigned ptr_bit_size,
    close_clc_data(&clc);
    return nir;
 }
+
+static void
+free_libclc_blob(void *ptr)
+{
+   free(*(void **)ptr);
+}
+
+/* Wraps the lazy shader around a malloc'ed serialized libclc, which it
+ * then owns.
+ */
+static struct nir_lazy_shader *
+deserialize_libclc_lazy(const nir_shader_compiler_options *nir_options,
+                        void *data, size_t size)
+{
+   void **blob_ref = ralloc(NULL, void *);
+   *blob_ref = data;
+   ralloc_set_destructor(blob_ref, free_libclc_blob);
+
+   struct nir_lazy_shader *lazy =
+      nir_deserialize_lazy(NULL, nir_options, data, size);
+   if (lazy == NULL) {
+      ralloc_free(blob_ref);
+      return NULL;
+   }
+
+   ralloc_steal(lazy, blob_ref);
+   return lazy;
+}
+
+/**
+ * Loads libclc like nir_load_libclc_shader, but only reads the function
+ * declarations: the impls are read when nir_link_shader_functions_lazy
+ * first links them into a kernel, so kernels only pay for the builtins
+ * they call.  The functions can be looked up by name with
+ * nir_lazy_shader_get_function, or by spirv_to_nir through
+ * spirv_to_nir_options::clc_library.
+ *
+ * The library is always read from its serialized form, which is stored in
+ * the disk cache when there is one.  Free it with ralloc_free.
+ */
+struct nir_lazy_shader *
+nir_load_libclc_lazy(unsigned ptr_bit_size,
+                     struct disk_cache *disk_cache,
+                     const struct spirv_to_nir_options *spirv_options,
+                     const nir_shader_compiler_options *nir_options,
+                     bool optimize)
+{
+   assert(ptr_bit_size ==
+          nir_address_format_bit_size(spirv_options->global_addr_format));
+
+   struct clc_data clc;
+   if (!open_clc_data(&clc, ptr_bit_size))
+      return NULL;
+
+#ifdef ENABLE_SHADER_CACHE
+   cache_key cache_key;
+   if (disk_cache) {
+      disk_cache_compute_key(disk_cache, clc.cache_key,
+                             sizeof(clc.cache_key), cache_key);
+
+      size_t buffer_size;
+      void *buffer = disk_cache_get(disk_cache, cache_key, &buffer_size);
+      if (buffer) {
+         struct nir_lazy_shader *lazy =
+            deserialize_libclc_lazy(nir_options, buffer, buffer_size);
+         if (lazy) {
+            close_clc_data(&clc);
+            return lazy;
+         }
+      }
+   }
+#endif
+
+   nir_shader *nir = build_libclc_shader(&clc, spirv_options, nir_options,
+                                         optimize);
+   close_clc_data(&clc);
+   if (nir == NULL)
+      return NULL;
+
+   struct blob blob;
+   blob_init(&blob);
+   nir_serialize(&blob, nir, false);
+   ralloc_free(nir);
+
+   if (blob.out_of_memory) {
+      blob_finish(&blob);
+      return NULL;
+   }
+
+#ifdef ENABLE_SHADER_CACHE
+   if (disk_cache)
+      disk_cache_put(disk_cache, cache_key, blob.data, blob.size, NULL);
+#endif
+
+   size_t size;
+   void *data;
+   blob_finish_get_buffer(&blob, &data, &size);
+
+   return deserialize_libclc_lazy(nir_options, data, size);
+}
@@ -87,6 +87,7 @@
 #include <math.h>
 #include "builtin_functions.h"
 #include "util/hash_table.h"
+#include "util/set.h"
 
 #ifndef M_PIf
 #define M_PIf   ((float) M_PI)
@@ -986,22 +987,38 @@ public:
    void release();
    ir_function_signature *find(_mesa_glsl_parse_state *state,
                                const char *name, exec_list *actual_parameters);
+   ir_function *get_function(const char *name);
 
    /**
-    * A shader to hold all the built-in signatures; created by this module.
+    * A shader to hold the built-in signatures; created by this module.
     *
-    * This includes signatures for every built-in, regardless of version or
-    * enabled extensions.  The availability predicate associated with each
-    * signature allows matching_signature() to filter out the irrelevant ones.
+    * This includes signatures for every built-in looked up so far,
+    * regardless of version or enabled extensions.  The availability
+    * predicate associated with each signature allows matching_signature()
+    * to filter out the irrelevant ones.
     */
    gl_shader *shader;
 
 private:
    void *mem_ctx;
 
+   /**
+    * The only function create_builtins() creates, or NULL to create all of
+    * them.
+    */
+   const char *only_function;
+
+   /**
+    * The names of all built-in functions, collected by create_builtins()
+    * without creating any of them.
+    */
+   struct set *builtin_names;
+   bool collect_names;
+
    void create_shader();
    void create_intrinsics();
    void create_builtins();
+   bool wants_function(const char *name);
 
    /**
     * IR builder helpers:
@@ -1390,6 +1407,9 @@ builtin_builder::builtin_builder()
    : shader(NULL)
 {
    mem_ctx = NULL;
+   only_function = NULL;
+   builtin_names = NULL;
+   collect_names = false;
 }
 
 builtin_builder::~builtin_builder()
@@ -1418,7 +1438,7 @@ builtin_builder::find(_mesa_glsl_parse_state *state,
     */
    state->uses_builtin_functions = true;
 
-   ir_function *f = shader->symbols->get_function(name);
+   ir_function *f = get_function(name);
    if (f == NULL)
       return NULL;
 
@@ -1430,6 +1450,45 @@ builtin_builder::find(_mesa_glsl_parse_state *state,
    return sig;
 }
 
+/**
+ * Look up a built-in function, creating its signatures the first time it is
+ * asked for.
+ *
+ * Only a small part of the built-ins is used by any given application, so
+ * building the IR for all of them up front is mostly wasted time and memory.
+ */
+ir_function *
+builtin_builder::get_function(const char *name)
+{
+   /* Most lookups are for the shader's own functions. */
+   if (!_mesa_set_search(builtin_names, name))
+      return NULL;
+
+   ir_function *f = shader->symbols->get_function(name);
+   if (f != NULL)
+      return f;
+
+   /* Creating a built-in always adds its function, so this only happens
+    * once per name.
+    */
+   only_function = name;
+   create_builtins();
+   only_function = NULL;
+
+   return shader->symbols->get_function(name);
+}
+
+bool
+builtin_builder::wants_function(const char *name)
+{
+   if (collect_names) {
+      _mesa_set_add(builtin_names, name);
+      return false;
+   }
+
+   return only_function == NULL || strcmp(name, only_function) == 0;
+}
+
 void
 builtin_builder::initialize()
 {
@@ -1441,8 +1500,18 @@ builtin_builder::initialize()
 
    mem_ctx = ralloc_context(NULL);
    create_shader();
+
+   /* Intrinsics have no body and are called by the built-ins, so create
+    * them all now.  Built-ins are created by get_function() on first use.
+    */
    create_intrinsics();
+
+   /* The names are string literals, so the set can point to them. */
+   builtin_names = _mesa_set_create(mem_ctx, _mesa_hash_string,
+                                    _mesa_key_string_equal);
+   collect_names = true;
    create_builtins();
+   collect_names = false;
 }
 
 void
@@ -1450,6 +1519,7 @@ builtin_builder::release()
 {
    ralloc_free(mem_ctx);
    mem_ctx = NULL;
+   builtin_names = NULL;
 
    ralloc_free(shader);
    shader = NULL;
@@ -1728,6 +1798,13 @@ builtin_builder::create_intrinsics()
 void
 builtin_builder::create_builtins()
 {
+   /* Skip building the signatures of the functions not asked for. */
+#define add_function(NAME, ...)                          \
+   do {                                                  \
+      if (wants_function(NAME))                          \
+         add_function(NAME, __VA_ARGS__);                \
+   } while (0)
+
 #define F(NAME)                                 \
    add_function(#NAME,                          \
                 _##NAME(&glsl_type_builtin_float), \
@@ -5413,6 +5490,7 @@ builtin_builder::create_builtins()
 #undef FIUD_VEC
 #undef FIUBD_VEC
 #undef FIU2_MIXED
+#undef add_function
 }
 
 void
@@ -5449,6 +5527,9 @@ builtin_builder::add_image_function(const char *name,
                                     unsigned flags,
                                     enum ir_intrinsic_id intrinsic_id)
 {
+   if (!wants_function(name))
+      return;
+
    static const glsl_type *const types[] = {
       &glsl_type_builtin_image1D,
       &glsl_type_builtin_image2D,
@@ -8572,7 +8653,7 @@ _mesa_glsl_has_builtin_function(_mesa_glsl_parse_state *state, const char *name)
    ir_function *f;
    bool ret = false;
    simple_mtx_lock(&builtins_lock);
-   f = builtins.shader->symbols->get_function(name);
+   f = builtins.get_function(name);
    if (f != NULL) {
       foreach_in_list(ir_function_signature, sig, &f->signatures) {
          if (sig->is_builtin_available(state)) {
@@ -8586,10 +8667,21 @@ _mesa_glsl_has_builtin_function(_mesa_glsl_parse_state *state, const char *name)
    return ret;
 }
 
-gl_shader *
-_mesa_glsl_get_builtin_function_shader()
+/**
+ * Look up a built-in function by name, regardless of its availability.
+ *
+ * The returned function doesn't change anymore, so it can be used without
+ * holding the lock.
+ */
+ir_function *
+_mesa_glsl_get_builtin_function(const char *name)
 {
-   return builtins.shader;
+   ir_function *f;
+   simple_mtx_lock(&builtins_lock);
+   f = builtins.get_function(name);
+   simple_mtx_unlock(&builtins_lock);
+
+   return f;
 }
 
 
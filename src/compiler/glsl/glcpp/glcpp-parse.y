@@ -1537,12 +1537,15 @@ glcpp_parser_create(struct gl_context *gl_ctx,
 
    parser->is_gles = false;
 
+   parser->lex_memo = glcpp_lex_memo_create(parser);
+
    return parser;
 }
 
 void
 glcpp_parser_destroy(glcpp_parser_t *parser)
 {
+   glcpp_lex_memo_destroy(parser->lex_memo);
    glcpp_lex_destroy (parser->scanner);
    _mesa_hash_table_destroy(parser->defines, NULL);
    ralloc_free (parser);
@@ -2340,7 +2343,7 @@ glcpp_parser_lex(YYSTYPE *yylval, YYLTYPE *yylloc, glcpp_parser_t *parser)
    int ret;
 
    if (parser->lex_from_list == NULL) {
-      ret = glcpp_lex(yylval, yylloc, parser->scanner);
+      ret = glcpp_lex_memo_lex(yylval, yylloc, parser);
 
       /* XXX: This ugly block of code exists for the sole
        * purpose of converting a NEWLINE token into a SPACE
@@ -229,6 +229,7 @@ struct glcpp_parser {
 	bool has_new_source_number;
 	int new_source_number;
 	bool is_gles;
+	struct glcpp_lex_memo *lex_memo;
 };
 
 glcpp_parser_t *
@@ -271,6 +272,38 @@ glcpp_lex (YYSTYPE *lvalp, YYLTYPE *llocp, yyscan_t scanner);
 int
 glcpp_lex_destroy (yyscan_t scanner);
 
+int
+glcpp_get_lineno (yyscan_t scanner);
+
+int
+glcpp_lex_update_state_per_token (glcpp_parser_t *parser, int token);
+
+const char *
+glcpp_lex_get_text(glcpp_parser_t *parser);
+
+void
+glcpp_lex_skip(glcpp_parser_t *parser, size_t length, int lineno, int column);
+
+/* Functions in lex_memo.c */
+
+void
+glcpp_lex_memo_init_or_ref(void);
+
+void
+glcpp_lex_memo_decref(void);
+
+void
+glcpp_lex_memo_get_stats(unsigned *hits, unsigned *misses);
+
+struct glcpp_lex_memo *
+glcpp_lex_memo_create(glcpp_parser_t *parser);
+
+void
+glcpp_lex_memo_destroy(struct glcpp_lex_memo *memo);
+
+int
+glcpp_lex_memo_lex(YYSTYPE *lvalp, YYLTYPE *llocp, glcpp_parser_t *parser);
+
 /* Generated by glcpp-parse.y to glcpp-parse.c */
 
 int
@@ -0,0 +1,221 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Preprocessing benchmark for glcpp.
+ *
+ * Generates a large header with object and function-like macros,
+ * conditionals and comments, the way uber-shaders are written, and measures
+ * preprocessing it behind a different #define prelude each time, as when
+ * compiling variants of a shader.  The preludes only differ in a macro the
+ * header doesn't use, so every variant expands the same code.
+ *
+ * The variants are preprocessed once with the memo of lexed chunks dropped
+ * after each of them, and once with it kept across them, as a context does.
+ *
+ * With file arguments, each file is preprocessed twice instead, replaying
+ * its chunks from the memo the second time, and both outputs are compared.
+ *
+ * Usage: glcpp_bench [iterations]
+ *        glcpp_bench file...
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glcpp.h"
+#include "main/mtypes.h"
+#include "main/shaderobj.h"
+#include "util/os_time.h"
+#include "util/strtod.h"
+
+void
+_mesa_reference_shader(struct gl_context *ctx, struct gl_shader **ptr,
+                       struct gl_shader *sh)
+{
+   (void) ctx;
+   *ptr = sh;
+}
+
+static struct gl_context gl_ctx;
+
+static int
+preprocess(void *mem_ctx, const char *source, const char **output,
+           char **info_log)
+{
+   *output = source;
+   *info_log = ralloc_strdup(mem_ctx, "");
+   return glcpp_preprocess(mem_ctx, output, info_log, NULL, NULL, &gl_ctx);
+}
+
+static char *
+generate_header(void)
+{
+   char *header = ralloc_strdup(NULL, "");
+
+   for (unsigned i = 0; i < 200; i++) {
+      ralloc_asprintf_append(&header,
+                             "#define CONST_%u (%u + 0x%x)\n"
+                             "#define SCALE_%u(x, y) ((x) * CONST_%u + (y))\n",
+                             i, i, i * 3, i, i);
+   }
+
+   for (unsigned i = 0; i < 400; i++) {
+      ralloc_asprintf_append(&header,
+                             "/* Function %u of the uber-shader, selected by\n"
+                             " * the variant defines.\n"
+                             " */\n"
+                             "#if defined(VARIANT_%u) || VARIANT_LEVEL > %u\n"
+                             "vec4 function_%u(vec4 color, float weight)\n"
+                             "{\n"
+                             "   vec4 result = color * SCALE_%u(weight, 1.0);\n"
+                             "#ifdef USE_FOG\n"
+                             "   result.rgb = mix(result.rgb, vec3(0.5), 0.25); // fog\n"
+                             "#else\n"
+                             "   result.a = clamp(result.a, 0.0, 1.0);\n"
+                             "#endif\n"
+                             "   return result + vec4(CONST_%u);\n"
+                             "}\n"
+                             "#endif\n",
+                             i, i % 32, i % 4, i, i % 200, (i * 7) % 200);
+   }
+
+   return header;
+}
+
+static void
+run(const char *name, const char *header, unsigned iterations)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   unsigned hits, misses, start_hits, start_misses;
+   size_t bytes = 0;
+
+   glcpp_lex_memo_get_stats(&start_hits, &start_misses);
+
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < iterations; i++) {
+      void *iter_ctx = ralloc_context(mem_ctx);
+      char *source = ralloc_asprintf(iter_ctx,
+                                     "#version 450\n"
+                                     "#define VARIANT_ID %u\n"
+                                     "#define VARIANT_3 1\n"
+                                     "#define VARIANT_LEVEL 2\n"
+                                     "#define USE_FOG\n"
+                                     "%s",
+                                     i, header);
+      const char *output;
+      char *info_log;
+
+      if (preprocess(iter_ctx, source, &output, &info_log)) {
+         fprintf(stderr, "%s: preprocessing failed:\n%s", name, info_log);
+         exit(1);
+      }
+
+      bytes += strlen(source);
+      ralloc_free(iter_ctx);
+   }
+
+   int64_t ns = os_time_get_nano() - start;
+
+   glcpp_lex_memo_get_stats(&hits, &misses);
+   hits -= start_hits;
+   misses -= start_misses;
+
+   printf("%-10s %6u sources %10.3f ms/source %8.1f MB/s, "
+          "chunk memo: %u hits, %u misses\n", name, iterations,
+          ns / 1e6 / iterations, bytes * 1e3 / ns, hits, misses);
+
+   ralloc_free(mem_ctx);
+}
+
+static char *
+load_file(void *mem_ctx, const char *filename)
+{
+   FILE *fp = fopen(filename, "rb");
+   if (fp == NULL) {
+      perror(filename);
+      exit(1);
+   }
+
+   fseek(fp, 0, SEEK_END);
+   long size = ftell(fp);
+   fseek(fp, 0, SEEK_SET);
+
+   char *text = ralloc_size(mem_ctx, size + 1);
+   if (fread(text, 1, size, fp) != (size_t)size) {
+      perror(filename);
+      exit(1);
+   }
+   text[size] = '\0';
+
+   fclose(fp);
+   return text;
+}
+
+static bool
+time_files(int count, char **filenames)
+{
+   bool ok = true;
+
+   glcpp_lex_memo_init_or_ref();
+
+   for (int i = 0; i < count; i++) {
+      void *mem_ctx = ralloc_context(NULL);
+      const char *source = load_file(mem_ctx, filenames[i]);
+      const char *output[2];
+      char *info_log[2];
+      int errors[2];
+      int64_t ns[2];
+
+      for (unsigned j = 0; j < 2; j++) {
+         int64_t start = os_time_get_nano();
+         errors[j] = preprocess(mem_ctx, source, &output[j], &info_log[j]);
+         ns[j] = os_time_get_nano() - start;
+      }
+
+      bool same = errors[0] == errors[1] &&
+                  strcmp(output[0], output[1]) == 0 &&
+                  strcmp(info_log[0], info_log[1]) == 0;
+
+      printf("%s: %s %10.3f ms, %10.3f ms from the chunk memo%s\n",
+             filenames[i], errors[0] ? "failed" : "ok", ns[0] / 1e6,
+             ns[1] / 1e6, same ? "" : ", OUTPUT DIFFERS");
+      ok &= same;
+
+      ralloc_free(mem_ctx);
+   }
+
+   glcpp_lex_memo_decref();
+
+   return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+   memset(&gl_ctx, 0, sizeof(gl_ctx));
+   gl_ctx.API = API_OPENGL_CORE;
+
+   _mesa_locale_init();
+
+   if (argc > 1 && atoi(argv[1]) == 0)
+      return time_files(argc - 1, argv + 1) ? 0 : 1;
+
+   unsigned iterations = argc > 1 ? atoi(argv[1]) : 200;
+   char *header = generate_header();
+
+   printf("header: %zu bytes\n", strlen(header));
+   run("cold", header, iterations);
+
+   glcpp_lex_memo_init_or_ref();
+   run("warm", header, iterations);
+   glcpp_lex_memo_decref();
+
+   ralloc_free(header);
+   _mesa_locale_fini();
+
+   return 0;
+}
@@ -0,0 +1,498 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Memo of the tokens lexed from chunks of shader text.
+ *
+ * Shaders are often compiled many times over with a different prelude of
+ * #defines, or with the same headers pasted in, so most of their text is
+ * lexed again and again.  Outside of directives, the tokens lexed from a
+ * line only depend on its text and on a few bits of lexer state, so the
+ * runs of lines between two directives are lexed once, and their tokens
+ * are kept in a process-wide cache keyed by a hash of their text.  Lexing
+ * the same run of lines again replays these tokens instead, and moves the
+ * scanner past them.
+ *
+ * A chunk is only recorded if the scanner went through it in the INITIAL
+ * start condition without seeing a '#', and without writing to the info
+ * log, so the tokens of a chunk never depend on the macros or conditions
+ * in effect.
+ */
+
+#include <string.h>
+
+#include "glcpp.h"
+#include "glcpp-parse.h"
+
+#include "util/list.h"
+#include "util/simple_mtx.h"
+#include "util/u_atomic.h"
+#include "util/u_dynarray.h"
+
+#define XXH_INLINE_ALL
+#include "util/xxhash.h"
+
+/* Chunks are cached up to this many bytes altogether. */
+#define LEX_MEMO_SIZE (4 * 1024 * 1024)
+
+/* Smaller chunks are lexed about as fast as they are looked up. */
+#define LEX_MEMO_MIN_CHUNK 48
+
+/* Larger runs of lines are split into chunks of at most this many bytes. */
+#define LEX_MEMO_MAX_CHUNK (64 * 1024)
+
+enum lex_chunk_flags {
+	LEX_CHUNK_SKIPPING = 1 << 0,
+	LEX_CHUNK_GLES = 1 << 1,
+};
+
+struct lex_chunk_key {
+	uint64_t hash;
+	uint32_t length;
+	uint32_t flags;
+	const char *text;
+};
+
+/* A token recorded in a chunk, with its location relative to the first
+ * line of the chunk.
+ */
+struct lex_chunk_token {
+	int type;
+	int str; /* offset of the string of the token, or -1 */
+	int first_line;
+	int first_column;
+	int last_line;
+	int last_column;
+};
+
+struct lex_chunk {
+	struct lex_chunk_key key;
+	struct list_head link;
+	uint32_t ref_count;
+	size_t size;
+
+	struct lex_chunk_token *tokens;
+	unsigned num_tokens;
+	const char *strings;
+
+	/* Line of the scanner after the chunk, relative to its first line. */
+	int end_line;
+};
+
+struct glcpp_lex_memo {
+	/* Chunk being replayed, and the index of its next token */
+	struct lex_chunk *replay;
+	unsigned next;
+
+	/* Chunk being recorded, with the strings of its tokens */
+	bool recording;
+	struct lex_chunk_key key;
+	struct util_dynarray tokens;
+	struct util_dynarray strings;
+	unsigned info_log_length;
+
+	/* First line of the chunk being replayed or recorded */
+	int line;
+
+	/* Whether the last token lexed was a NEWLINE, and where the scanner
+	 * can next start a chunk. */
+	bool at_line_start;
+	const char *retry_at;
+};
+
+static simple_mtx_t lex_memo_lock = SIMPLE_MTX_INITIALIZER;
+static unsigned lex_memo_users;
+static struct hash_table *lex_memo;
+static struct list_head lex_memo_lru;
+static size_t lex_memo_size;
+static unsigned lex_memo_hits;
+static unsigned lex_memo_misses;
+
+static uint32_t
+lex_chunk_key_hash(const void *key)
+{
+	const struct lex_chunk_key *k = key;
+
+	return (uint32_t) k->hash;
+}
+
+static bool
+lex_chunk_key_equal(const void *a, const void *b)
+{
+	const struct lex_chunk_key *ka = a, *kb = b;
+
+	return ka->hash == kb->hash && ka->length == kb->length &&
+	       ka->flags == kb->flags &&
+	       memcmp(ka->text, kb->text, ka->length) == 0;
+}
+
+static void
+lex_chunk_unref(struct lex_chunk *chunk)
+{
+	if (p_atomic_dec_zero(&chunk->ref_count))
+		free(chunk);
+}
+
+/* Takes a reference on the cache, which lives as long as anyone holds one.
+ * Each parser holds one; contexts hold one so that it lives across shaders.
+ */
+void
+glcpp_lex_memo_init_or_ref(void)
+{
+	simple_mtx_lock(&lex_memo_lock);
+
+	if (lex_memo_users++ == 0) {
+		lex_memo = _mesa_hash_table_create(NULL, lex_chunk_key_hash,
+						   lex_chunk_key_equal);
+		list_inithead(&lex_memo_lru);
+		lex_memo_size = 0;
+	}
+
+	simple_mtx_unlock(&lex_memo_lock);
+}
+
+void
+glcpp_lex_memo_decref(void)
+{
+	simple_mtx_lock(&lex_memo_lock);
+
+	assert(lex_memo_users > 0);
+	if (--lex_memo_users == 0) {
+		list_for_each_entry_safe(struct lex_chunk, chunk, &lex_memo_lru,
+					 link)
+			lex_chunk_unref(chunk);
+		_mesa_hash_table_destroy(lex_memo, NULL);
+		lex_memo = NULL;
+		lex_memo_size = 0;
+	}
+
+	simple_mtx_unlock(&lex_memo_lock);
+}
+
+void
+glcpp_lex_memo_get_stats(unsigned *hits, unsigned *misses)
+{
+	simple_mtx_lock(&lex_memo_lock);
+	*hits = lex_memo_hits;
+	*misses = lex_memo_misses;
+	simple_mtx_unlock(&lex_memo_lock);
+}
+
+static struct lex_chunk *
+lex_memo_lookup(const struct lex_chunk_key *key)
+{
+	struct lex_chunk *chunk = NULL;
+
+	simple_mtx_lock(&lex_memo_lock);
+
+	struct hash_entry *entry =
+		_mesa_hash_table_search_pre_hashed(lex_memo,
+						   (uint32_t) key->hash, key);
+	if (entry) {
+		chunk = entry->data;
+		p_atomic_inc(&chunk->ref_count);
+		list_del(&chunk->link);
+		list_add(&chunk->link, &lex_memo_lru);
+		lex_memo_hits++;
+	} else {
+		lex_memo_misses++;
+	}
+
+	simple_mtx_unlock(&lex_memo_lock);
+
+	return chunk;
+}
+
+static void
+lex_memo_insert(struct lex_chunk *chunk)
+{
+	simple_mtx_lock(&lex_memo_lock);
+
+	/* Another parser may have recorded the same chunk meanwhile. */
+	if (_mesa_hash_table_search_pre_hashed(lex_memo,
+					       (uint32_t) chunk->key.hash,
+					       &chunk->key)) {
+		simple_mtx_unlock(&lex_memo_lock);
+		free(chunk);
+		return;
+	}
+
+	_mesa_hash_table_insert_pre_hashed(lex_memo,
+					   (uint32_t) chunk->key.hash,
+					   &chunk->key, chunk);
+	list_add(&chunk->link, &lex_memo_lru);
+	lex_memo_size += chunk->size;
+
+	while (lex_memo_size > LEX_MEMO_SIZE) {
+		struct lex_chunk *lru =
+			list_last_entry(&lex_memo_lru, struct lex_chunk, link);
+		list_del(&lru->link);
+		_mesa_hash_table_remove_key(lex_memo, &lru->key);
+		lex_memo_size -= lru->size;
+		lex_chunk_unref(lru);
+	}
+
+	simple_mtx_unlock(&lex_memo_lock);
+}
+
+struct glcpp_lex_memo *
+glcpp_lex_memo_create(glcpp_parser_t *parser)
+{
+	struct glcpp_lex_memo *memo = rzalloc(parser, struct glcpp_lex_memo);
+
+	util_dynarray_init(&memo->tokens, memo);
+	util_dynarray_init(&memo->strings, memo);
+
+	glcpp_lex_memo_init_or_ref();
+
+	return memo;
+}
+
+void
+glcpp_lex_memo_destroy(struct glcpp_lex_memo *memo)
+{
+	if (memo->replay)
+		lex_chunk_unref(memo->replay);
+
+	ralloc_free(memo);
+
+	glcpp_lex_memo_decref();
+}
+
+/* Returns the length of the chunk at the start of a line of text: the lines
+ * up to the next one with a '#' outside of comments, which may start a
+ * directive.  Newlines are matched the way the scanner does, and the chunk
+ * ends at the start of a line outside of any comment.
+ */
+static size_t
+chunk_length(const char *text)
+{
+	const char *p = text;
+	const char *end = text;
+	bool in_comment = false;
+
+	while (*p != '\0' && p - text < LEX_MEMO_MAX_CHUNK) {
+		if (*p == '\n' || *p == '\r') {
+			char other = *p == '\n' ? '\r' : '\n';
+
+			p += p[1] == other ? 2 : 1;
+			if (!in_comment)
+				end = p;
+		} else if (in_comment) {
+			if (p[0] == '*' && p[1] == '/') {
+				in_comment = false;
+				p += 2;
+			} else {
+				p++;
+			}
+		} else if (p[0] == '#') {
+			break;
+		} else if (p[0] == '/' && p[1] == '*') {
+			in_comment = true;
+			p += 2;
+		} else if (p[0] == '/' && p[1] == '/') {
+			while (*p != '\0' && *p != '\n' && *p != '\r')
+				p++;
+		} else {
+			p++;
+		}
+	}
+
+	return end - text;
+}
+
+static bool
+token_has_string(int token)
+{
+	switch (token) {
+	case IDENTIFIER:
+	case INTEGER_STRING:
+	case OTHER:
+	case PATH:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Looks the chunk at the scanner up at the start of a line, to replay it if
+ * it was recorded, or to record it otherwise.
+ */
+static void
+start_chunk(glcpp_parser_t *parser, struct glcpp_lex_memo *memo)
+{
+	if (parser->lexing_directive || parser->lexing_version_directive ||
+	    !parser->space_tokens || parser->commented_newlines ||
+	    !parser->first_non_space_token_this_line ||
+	    parser->last_token_was_space || !parser->version_set ||
+	    parser->has_new_line_number || parser->has_new_source_number)
+		return;
+
+	const char *text = glcpp_lex_get_text(parser);
+	if (text == NULL || text < memo->retry_at)
+		return;
+
+	size_t length = chunk_length(text);
+	memo->retry_at = text + length;
+	if (length < LEX_MEMO_MIN_CHUNK)
+		return;
+
+	struct lex_chunk_key key = {
+		.hash = XXH64(text, length, 0),
+		.length = length,
+		.flags = (parser->is_gles ? LEX_CHUNK_GLES : 0),
+		.text = text,
+	};
+	if (parser->skip_stack && parser->skip_stack->type != SKIP_NO_SKIP)
+		key.flags |= LEX_CHUNK_SKIPPING;
+
+	memo->line = glcpp_get_lineno(parser->scanner);
+	memo->replay = lex_memo_lookup(&key);
+
+	if (memo->replay) {
+		memo->next = 0;
+		glcpp_lex_skip(parser, length, memo->line + memo->replay->end_line, 0);
+	} else {
+		memo->recording = true;
+		memo->key = key;
+		memo->info_log_length = parser->info_log->length;
+		util_dynarray_clear(&memo->tokens);
+		util_dynarray_clear(&memo->strings);
+	}
+}
+
+static int
+replay_token(glcpp_parser_t *parser, struct glcpp_lex_memo *memo,
+	     YYSTYPE *yylval, YYLTYPE *yylloc)
+{
+	struct lex_chunk *chunk = memo->replay;
+	const struct lex_chunk_token *token = &chunk->tokens[memo->next++];
+
+	if (token->str >= 0) {
+		const char *str = chunk->strings + token->str;
+		size_t length = strlen(str);
+
+		yylval->str = linear_alloc_child(parser->linalloc, length + 1);
+		memcpy(yylval->str, str, length + 1);
+	}
+
+	yylloc->first_line = memo->line + token->first_line;
+	yylloc->first_column = token->first_column;
+	yylloc->last_line = memo->line + token->last_line;
+	yylloc->last_column = token->last_column;
+
+	glcpp_lex_update_state_per_token(parser, token->type);
+
+	if (memo->next == chunk->num_tokens) {
+		lex_chunk_unref(chunk);
+		memo->replay = NULL;
+	}
+
+	return token->type;
+}
+
+static void
+finish_chunk(glcpp_parser_t *parser, struct glcpp_lex_memo *memo)
+{
+	unsigned num_tokens =
+		util_dynarray_num_elements(&memo->tokens, struct lex_chunk_token);
+	size_t tokens_size = memo->tokens.size;
+	size_t size = sizeof(struct lex_chunk) + tokens_size +
+		      memo->strings.size + memo->key.length;
+	struct lex_chunk *chunk = malloc(size);
+
+	if (chunk == NULL)
+		return;
+
+	char *data = (char *) (chunk + 1);
+
+	chunk->tokens = (struct lex_chunk_token *) data;
+	memcpy(chunk->tokens, memo->tokens.data, tokens_size);
+	data += tokens_size;
+
+	chunk->strings = data;
+	memcpy(data, memo->strings.data, memo->strings.size);
+	data += memo->strings.size;
+
+	memcpy(data, memo->key.text, memo->key.length);
+	chunk->key = memo->key;
+	chunk->key.text = data;
+
+	chunk->num_tokens = num_tokens;
+	chunk->end_line = glcpp_get_lineno(parser->scanner) - memo->line;
+	chunk->ref_count = 1;
+	chunk->size = size;
+
+	lex_memo_insert(chunk);
+}
+
+static void
+record_token(glcpp_parser_t *parser, struct glcpp_lex_memo *memo,
+	     int type, YYSTYPE *yylval, YYLTYPE *yylloc)
+{
+	/* A '#' may start a directive, whose effects the chunk can't replay. */
+	if (type == HASH_TOKEN) {
+		memo->recording = false;
+		return;
+	}
+
+	struct lex_chunk_token token = {
+		.type = type,
+		.str = -1,
+		.first_line = yylloc->first_line - memo->line,
+		.first_column = yylloc->first_column,
+		.last_line = yylloc->last_line - memo->line,
+		.last_column = yylloc->last_column,
+	};
+
+	if (token_has_string(type)) {
+		size_t length = strlen(yylval->str);
+
+		token.str = memo->strings.size;
+		memcpy(util_dynarray_grow_bytes(&memo->strings, 1, length + 1),
+		       yylval->str, length + 1);
+	}
+
+	util_dynarray_append(&memo->tokens, struct lex_chunk_token, token);
+
+	const char *text = glcpp_lex_get_text(parser);
+	const char *end = memo->key.text + memo->key.length;
+
+	if (text == NULL) {
+		/* Still in a comment, or catching up with commented newlines. */
+		return;
+	}
+
+	if (text > end) {
+		memo->recording = false;
+	} else if (text == end && parser->commented_newlines == 0) {
+		memo->recording = false;
+		if (parser->info_log->length == memo->info_log_length)
+			finish_chunk(parser, memo);
+	}
+}
+
+/* Lexes the next token, from the memo if the scanner is at a chunk it has
+ * recorded.
+ */
+int
+glcpp_lex_memo_lex(YYSTYPE *yylval, YYLTYPE *yylloc, glcpp_parser_t *parser)
+{
+	struct glcpp_lex_memo *memo = parser->lex_memo;
+	int token;
+
+	if (memo->at_line_start && !memo->recording && memo->replay == NULL)
+		start_chunk(parser, memo);
+
+	if (memo->replay) {
+		token = replay_token(parser, memo, yylval, yylloc);
+	} else {
+		token = glcpp_lex(yylval, yylloc, parser->scanner);
+		if (memo->recording)
+			record_token(parser, memo, token, yylval, yylloc);
+	}
+
+	memo->at_line_start = token == NEWLINE;
+
+	return token;
+}
@@ -1110,6 +1110,10 @@ extern int glcpp_preprocess(void *ctx, const char **shader, char **info_log,
                             struct _mesa_glsl_parse_state *state,
                             struct gl_context *gl_ctx);
 
+extern void glcpp_lex_memo_init_or_ref(void);
+
+extern void glcpp_lex_memo_decref(void);
+
 extern void
 _mesa_glsl_copy_symbols_from_table(struct exec_list *shader_ir,
                                    struct glsl_symbol_table *src,
@@ -90,6 +90,10 @@ static const struct debug_named_value nir_debug_control[] = {
      "Print shaders even if they are marked as internal" },
    { "print_pass_flags", NIR_DEBUG_PRINT_PASS_FLAGS,
      "Print pass_flags for every instruction when pass_flags are non-zero" },
+   { "pass_stats", NIR_DEBUG_PASS_STATS,
+     "Collect the time, progress and instruction count change of each pass, and print them at exit" },
+   { "no_incremental", NIR_DEBUG_NO_INCREMENTAL,
+     "Make incremental passes always visit the whole shader" },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -554,6 +558,9 @@ nir_function_impl_create_bare(nir_shader *shader)
    impl->num_blocks = 0;
    impl->valid_metadata = nir_metadata_none;
    impl->structured = true;
+   impl->change_gen = 0;
+   impl->change_base = 0;
+   memset(impl->change_passes, 0, sizeof(impl->change_passes));
 
    /* create start & end blocks */
    nir_block *start_block = nir_block_create(shader);
@@ -660,6 +667,7 @@ instr_init(nir_instr *instr, nir_instr_type type)
 {
    instr->type = type;
    instr->block = NULL;
+   instr->change_gen = 0;
    exec_node_init(&instr->node);
 }
 
@@ -1030,6 +1038,45 @@ nir_cursors_equal(nir_cursor a, nir_cursor b)
    return a.block == b.block && a.option == b.option;
 }
 
+static void
+stamp_instr(nir_function_impl *impl, nir_instr *instr)
+{
+   if (instr->block == NULL)
+      return;
+
+   /* Instructions and blocks coming from another impl, like after inlining,
+    * can have newer stamps.  Keep them, they only cause extra visits.
+    */
+   instr->change_gen = MAX2(instr->change_gen, impl->change_gen);
+   instr->block->change_gen = MAX2(instr->block->change_gen, impl->change_gen);
+}
+
+void
+nir_instr_mark_changed(nir_instr *instr)
+{
+   nir_function_impl *impl = nir_instr_changes_impl(instr);
+   if (impl)
+      stamp_instr(impl, instr);
+}
+
+static bool
+mark_src_parent_changed_cb(nir_src *src, void *state)
+{
+   if (src->ssa)
+      stamp_instr(state, src->ssa->parent_instr);
+   return true;
+}
+
+void
+nir_src_mark_changed_impl(nir_function_impl *impl, nir_src *src,
+                          nir_def *old_ssa)
+{
+   if (!nir_src_is_if(src))
+      stamp_instr(impl, nir_src_parent_instr(src));
+   stamp_instr(impl, old_ssa->parent_instr);
+   stamp_instr(impl, src->ssa->parent_instr);
+}
+
 static bool
 add_use_cb(nir_src *src, void *state)
 {
@@ -1114,6 +1161,12 @@ nir_instr_insert(nir_cursor cursor, nir_instr *instr)
 
    nir_function_impl *impl = nir_cf_node_get_function(&instr->block->cf_node);
    impl->valid_metadata &= ~nir_metadata_instr_index;
+
+   /* The uses of the sources change along with the instruction. */
+   if (impl->valid_metadata & nir_metadata_instr_changes) {
+      stamp_instr(impl, instr);
+      nir_foreach_src(instr, mark_src_parent_changed_cb, impl);
+   }
 }
 
 bool
@@ -1158,6 +1211,10 @@ remove_defs_uses(nir_instr *instr)
 void
 nir_instr_remove_v(nir_instr *instr)
 {
+   nir_function_impl *impl = nir_instr_changes_impl(instr);
+   if (impl)
+      nir_foreach_src(instr, mark_src_parent_changed_cb, impl);
+
    remove_defs_uses(instr);
    exec_node_remove(&instr->node);
 
@@ -1235,6 +1292,7 @@ nir_instr_dce_add_dead_srcs_cb(nir_src *src, void *state)
 {
    nir_instr_worklist *wl = state;
 
+   nir_instr_mark_changed(src->ssa->parent_instr);
    list_del(&src->use_link);
    if (!nir_instr_free_and_dce_is_live(src->ssa->parent_instr))
       nir_instr_worklist_push_tail(wl, src->ssa->parent_instr);
@@ -1476,11 +1534,14 @@ nir_instr_init_src(nir_instr *instr, nir_src *src, nir_def *def)
 {
    *src = nir_src_for_ssa(def);
    src_add_all_uses(src, instr, NULL);
+   nir_src_mark_changed(src, def);
 }
 
 void
 nir_instr_clear_src(nir_instr *instr, nir_src *src)
 {
+   if (src_is_valid(src))
+      nir_src_mark_changed(src, src->ssa);
    src_remove_all_uses(src);
    *src = NIR_SRC_INIT;
 }
@@ -1490,11 +1551,19 @@ nir_instr_move_src(nir_instr *dest_instr, nir_src *dest, nir_src *src)
 {
    assert(!src_is_valid(dest) || nir_src_parent_instr(dest) == dest_instr);
 
+   if (src_is_valid(dest))
+      nir_src_mark_changed(dest, dest->ssa);
+   if (src_is_valid(src))
+      nir_src_mark_changed(src, src->ssa);
+
    src_remove_all_uses(dest);
    src_remove_all_uses(src);
    *dest = *src;
    *src = NIR_SRC_INIT;
    src_add_all_uses(dest, dest_instr, NULL);
+
+   if (src_is_valid(dest))
+      nir_src_mark_changed(dest, dest->ssa);
 }
 
 void
@@ -90,6 +90,8 @@ extern bool nir_debug_print_shader[MESA_SHADER_KERNEL + 1];
 #define NIR_DEBUG_PRINT_NO_INLINE_CONSTS (1u << 20)
 #define NIR_DEBUG_PRINT_INTERNAL         (1u << 21)
 #define NIR_DEBUG_PRINT_PASS_FLAGS       (1u << 22)
+#define NIR_DEBUG_PASS_STATS             (1u << 23)
+#define NIR_DEBUG_NO_INCREMENTAL         (1u << 24)
 
 #define NIR_DEBUG_PRINT (NIR_DEBUG_PRINT_VS |  \
                          NIR_DEBUG_PRINT_TCS | \
@@ -111,6 +113,7 @@ extern bool nir_debug_print_shader[MESA_SHADER_KERNEL + 1];
 #define NIR_TRUE               (~0u)
 #define NIR_MAX_VEC_COMPONENTS 16
 #define NIR_MAX_MATRIX_COLUMNS 4
+#define NIR_MAX_INCREMENTAL_PASSES 8
 #define NIR_STREAM_PACKED      (1 << 8)
 typedef uint16_t nir_component_mask_t;
 
@@ -943,6 +946,9 @@ typedef struct nir_instr {
 
    /** generic instruction index. */
    uint32_t index;
+
+   /** Generation of the last change, see nir_metadata_instr_changes. */
+   uint32_t change_gen;
 } nir_instr;
 
 static inline nir_instr *
@@ -2940,6 +2946,9 @@ typedef struct nir_block {
     */
    BITSET_WORD *live_in;
    BITSET_WORD *live_out;
+
+   /* Latest nir_instr::change_gen of the instructions in this block. */
+   uint32_t change_gen;
 } nir_block;
 
 static inline bool
@@ -3258,6 +3267,25 @@ typedef enum {
     */
    nir_metadata_instr_index = 0x20,
 
+   /** Indicates that instruction change generations are complete.
+    *
+    * This includes:
+    *
+    *   - nir_instr::change_gen
+    *   - nir_block::change_gen
+    *
+    * While this is valid, the core helpers that insert or remove
+    * instructions, or rewrite their sources, stamp the instructions whose
+    * sources or uses they change with the current generation of the
+    * nir_function_impl.  Incremental passes use this to only visit what
+    * changed since they last ran, see nir_instr_changes_begin().
+    *
+    * A pass can preserve this metadata type if it only changes instructions
+    * through these helpers, or calls nir_instr_mark_changed() on the
+    * instructions it modifies in place.
+    */
+   nir_metadata_instr_changes = 0x40,
+
    /** All metadata
     *
     * This includes all nir_metadata flags except not_properly_reset.  Passes
@@ -3303,6 +3331,16 @@ typedef struct {
    bool structured;
 
    nir_metadata valid_metadata;
+
+   /** Current and first valid generation of nir_metadata_instr_changes */
+   uint32_t change_gen;
+   uint32_t change_base;
+
+   /** Generation at which each incremental pass last ran */
+   struct {
+      const void *pass;
+      uint32_t gen;
+   } change_passes[NIR_MAX_INCREMENTAL_PASSES];
 } nir_function_impl;
 
 #define nir_foreach_function_temp_variable(var, impl) \
@@ -4290,6 +4328,48 @@ void nir_metadata_preserve(nir_function_impl *impl, nir_metadata preserved);
 /** Preserves all metadata for the given shader */
 void nir_shader_preserve_all_metadata(nir_shader *shader);
 
+/** Instructions an incremental pass has to visit, see nir_instr_changes_begin */
+typedef struct {
+   /** Set of nir_instr, or NULL when everything has to be visited */
+   struct set *instrs;
+
+   /** Blocks containing any of the instrs, indexed by nir_block::index */
+   BITSET_WORD *blocks;
+} nir_instr_changes;
+
+/** Starts a run of an incremental pass
+ *
+ * Collects the instructions changed since the pass identified by the given
+ * key last ran on the impl, and their users up to the given depth.  Deref
+ * chains count as a single level.  When the pass hasn't run since
+ * nir_metadata_instr_changes was last invalidated, or NIR_DEBUG=no_incremental
+ * is set, everything has to be visited and this returns false.
+ *
+ * Requires nir_metadata_block_index.  The pass should preserve
+ * nir_metadata_instr_changes, and call nir_instr_changes_finish() when done.
+ */
+bool nir_instr_changes_begin(nir_function_impl *impl, const void *pass,
+                             unsigned user_depth, nir_instr_changes *changes);
+void nir_instr_changes_finish(nir_instr_changes *changes);
+
+static inline bool
+nir_instr_changes_has_block(const nir_instr_changes *changes,
+                            const nir_block *block)
+{
+   return changes->instrs == NULL || BITSET_TEST(changes->blocks, block->index);
+}
+
+static inline bool
+nir_instr_changes_has_instr(const nir_instr_changes *changes,
+                            const nir_instr *instr)
+{
+   return changes->instrs == NULL ||
+          _mesa_set_search(changes->instrs, instr) != NULL;
+}
+
+/** Stamps an instruction modified in place for nir_metadata_instr_changes */
+void nir_instr_mark_changed(nir_instr *instr);
+
 /** creates an instruction with default swizzle/writemask/etc. with NULL registers */
 nir_alu_instr *nir_alu_instr_create(nir_shader *shader, nir_op op);
 
@@ -4631,14 +4711,56 @@ bool nir_src_is_always_uniform(nir_src src);
 bool nir_srcs_equal(nir_src src1, nir_src src2);
 bool nir_instrs_equal(const nir_instr *instr1, const nir_instr *instr2);
 
+/** Returns the impl of an instruction if it tracks changes for
+ * nir_metadata_instr_changes, and NULL otherwise.
+ */
+static inline nir_function_impl *
+nir_instr_changes_impl(const nir_instr *instr)
+{
+   if (instr->block == NULL)
+      return NULL;
+
+   /* Extracted control flow isn't attached to any impl. */
+   nir_cf_node *node = &instr->block->cf_node;
+   while (node->parent)
+      node = node->parent;
+
+   if (node->type != nir_cf_node_function)
+      return NULL;
+
+   nir_function_impl *impl = nir_cf_node_as_function(node);
+   if (!(impl->valid_metadata & nir_metadata_instr_changes))
+      return NULL;
+
+   return impl;
+}
+
+void nir_src_mark_changed_impl(nir_function_impl *impl, nir_src *src,
+                               nir_def *old_ssa);
+
+/** Stamps the instructions whose sources or uses changed with a source
+ * for nir_metadata_instr_changes.
+ */
+static inline void
+nir_src_mark_changed(nir_src *src, nir_def *old_ssa)
+{
+   nir_instr *instr = nir_src_is_if(src) ? old_ssa->parent_instr
+                                         : nir_src_parent_instr(src);
+   nir_function_impl *impl = nir_instr_changes_impl(instr);
+   if (impl)
+      nir_src_mark_changed_impl(impl, src, old_ssa);
+}
+
 static inline void
 nir_src_rewrite(nir_src *src, nir_def *new_ssa)
 {
    assert(src->ssa);
    assert(nir_src_is_if(src) ? (nir_src_parent_if(src) != NULL) : (nir_src_parent_instr(src) != NULL));
+   nir_def *old_ssa = src->ssa;
    list_del(&src->use_link);
    src->ssa = new_ssa;
    list_addtail(&src->use_link, &new_ssa->uses);
+   nir_src_mark_changed(src, old_ssa);
 }
 
 /** Initialize a nir_src
@@ -4893,6 +5015,110 @@ should_print_nir(UNUSED nir_shader *shader)
 }
 #endif /* NDEBUG */
 
+/* Per-pass statistics for NIR_DEBUG=pass_stats, aggregated per pass name
+ * and stage over the process, see nir_pass_stats.c.
+ */
+struct nir_pass_stats {
+   uint64_t invocations;
+
+   /* Invocations that made progress, or not.  NIR_PASS_V counts in neither,
+    * as it doesn't know.
+    */
+   uint64_t progress;
+   uint64_t no_progress;
+
+   uint64_t time_ns;
+   int64_t instr_delta;
+
+   /* Runs of incremental passes that only visited what changed, and how
+    * many of them had to visit the rest of the shader as well.
+    */
+   uint64_t incremental;
+   uint64_t forced_full;
+};
+
+struct nir_pass_stats_sample {
+   int64_t start_ns;
+   unsigned num_instrs;
+   uint64_t incremental;
+   uint64_t forced_full;
+};
+
+#ifndef NDEBUG
+void nir_pass_stats_begin_impl(nir_shader *shader,
+                               struct nir_pass_stats_sample *sample);
+void nir_pass_stats_end_impl(nir_shader *shader, const char *pass,
+                             const struct nir_pass_stats_sample *sample,
+                             int progress);
+void nir_pass_stats_count_incremental_impl(bool forced_full);
+
+/* Called for every pass and stage with statistics, with the statistics
+ * locked, so the callback must not run NIR passes.
+ */
+typedef void (*nir_pass_stats_cb)(const char *pass, gl_shader_stage stage,
+                                  const struct nir_pass_stats *stats,
+                                  void *data);
+
+bool nir_pass_stats_get(const char *pass, gl_shader_stage stage,
+                        struct nir_pass_stats *stats);
+void nir_pass_stats_foreach(nir_pass_stats_cb cb, void *data);
+void nir_pass_stats_print(FILE *fp);
+void nir_pass_stats_reset(void);
+#else
+typedef void (*nir_pass_stats_cb)(const char *pass, gl_shader_stage stage,
+                                  const struct nir_pass_stats *stats,
+                                  void *data);
+
+static inline bool
+nir_pass_stats_get(UNUSED const char *pass, UNUSED gl_shader_stage stage,
+                   UNUSED struct nir_pass_stats *stats)
+{
+   return false;
+}
+static inline void
+nir_pass_stats_foreach(UNUSED nir_pass_stats_cb cb, UNUSED void *data)
+{
+}
+static inline void
+nir_pass_stats_print(UNUSED FILE *fp)
+{
+}
+static inline void
+nir_pass_stats_reset(void)
+{
+}
+#endif
+
+static inline void
+nir_pass_stats_begin(nir_shader *shader, struct nir_pass_stats_sample *sample)
+{
+#ifndef NDEBUG
+   if (NIR_DEBUG(PASS_STATS))
+      nir_pass_stats_begin_impl(shader, sample);
+#endif
+}
+
+/* Counts a run of an incremental pass towards the pass being measured. */
+static inline void
+nir_pass_stats_count_incremental(UNUSED bool forced_full)
+{
+#ifndef NDEBUG
+   if (NIR_DEBUG(PASS_STATS))
+      nir_pass_stats_count_incremental_impl(forced_full);
+#endif
+}
+
+/* progress is -1 when unknown. */
+static inline void
+nir_pass_stats_end(nir_shader *shader, const char *pass,
+                   const struct nir_pass_stats_sample *sample, int progress)
+{
+#ifndef NDEBUG
+   if (NIR_DEBUG(PASS_STATS))
+      nir_pass_stats_end_impl(shader, pass, sample, progress);
+#endif
+}
+
 #define _PASS(pass, nir, do_pass)                                       \
    do {                                                                 \
       if (should_skip_nir(#pass)) {                                     \
@@ -4909,24 +5135,32 @@ should_print_nir(UNUSED nir_shader *shader)
       }                                                                 \
    } while (0)
 
-#define NIR_PASS(progress, nir, pass, ...) _PASS(pass, nir, {   \
-   nir_metadata_set_validation_flag(nir);                       \
-   if (should_print_nir(nir))                                   \
-      printf("%s\n", #pass);                                    \
-   if (pass(nir, ##__VA_ARGS__)) {                              \
-      nir_validate_shader(nir, "after " #pass " in " __FILE__); \
-      UNUSED bool _;                                            \
-      progress = true;                                          \
-      if (should_print_nir(nir))                                \
-         nir_print_shader(nir, stdout);                         \
-      nir_metadata_check_validation_flag(nir);                  \
-   }                                                            \
+#define NIR_PASS(progress, nir, pass, ...) _PASS(pass, nir, {    \
+   nir_metadata_set_validation_flag(nir);                        \
+   if (should_print_nir(nir))                                    \
+      printf("%s\n", #pass);                                     \
+   struct nir_pass_stats_sample _nir_pass_stats;                 \
+   nir_pass_stats_begin(nir, &_nir_pass_stats);                  \
+   bool _nir_pass_progress = pass(nir, ##__VA_ARGS__);           \
+   nir_pass_stats_end(nir, #pass, &_nir_pass_stats,              \
+                      _nir_pass_progress);                       \
+   if (_nir_pass_progress) {                                     \
+      nir_validate_shader(nir, "after " #pass " in " __FILE__);  \
+      UNUSED bool _;                                             \
+      progress = true;                                           \
+      if (should_print_nir(nir))                                 \
+         nir_print_shader(nir, stdout);                          \
+      nir_metadata_check_validation_flag(nir);                   \
+   }                                                             \
 })
 
 #define NIR_PASS_V(nir, pass, ...) _PASS(pass, nir, {        \
    if (should_print_nir(nir))                                \
       printf("%s\n", #pass);                                 \
+   struct nir_pass_stats_sample _nir_pass_stats;             \
+   nir_pass_stats_begin(nir, &_nir_pass_stats);              \
    pass(nir, ##__VA_ARGS__);                                 \
+   nir_pass_stats_end(nir, #pass, &_nir_pass_stats, -1);     \
    nir_validate_shader(nir, "after " #pass " in " __FILE__); \
    if (should_print_nir(nir))                                \
       nir_print_shader(nir, stdout);                         \
@@ -5092,6 +5326,9 @@ bool nir_inline_functions(nir_shader *shader);
 void nir_cleanup_functions(nir_shader *shader);
 bool nir_link_shader_functions(nir_shader *shader,
                                const nir_shader *link_shader);
+struct nir_lazy_shader;
+bool nir_link_shader_functions_lazy(nir_shader *shader,
+                                    struct nir_lazy_shader *library);
 
 void nir_find_inlinable_uniforms(nir_shader *shader);
 void nir_inline_uniforms(nir_shader *shader, unsigned num_uniforms,
@@ -6309,6 +6546,8 @@ bool nir_opt_fragdepth(nir_shader *shader);
 
 bool nir_opt_gcm(nir_shader *shader, bool value_number);
 
+bool nir_opt_gvn(nir_shader *shader, bool licm);
+
 bool nir_opt_idiv_const(nir_shader *shader, unsigned min_bit_size);
 
 typedef enum {
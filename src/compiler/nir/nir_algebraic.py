@@ -398,6 +398,9 @@ class Expression(Value):
       # nir_search_expression::srcs is hard-coded to 4
       assert len(self.sources) <= 4
 
+      self.depth = 1 + max([s.depth for s in self.sources
+                            if isinstance(s, Expression)], default=0)
+
       if self.opcode in conv_opcode_types:
          assert self._bit_size is None, \
                 'Expression cannot use an unsized conversion opcode with ' \
@@ -1165,6 +1168,7 @@ static const nir_algebraic_table ${pass_name}_table = {
    .values = ${pass_name}_values,
    .expression_cond = ${ pass_name + "_expression_cond" if expression_cond else "NULL" },
    .variable_cond = ${ pass_name + "_variable_cond" if variable_cond else "NULL" },
+   .search_depth = ${max([xform.search.depth for xform in xforms], default=0)},
 };
 
 bool
@@ -24,6 +24,7 @@
 #include "nir.h"
 #include "nir_builder.h"
 #include "nir_control_flow.h"
+#include "nir_serialize.h"
 #include "nir_vla.h"
 
 /*
@@ -290,8 +291,34 @@ struct lower_link_state {
    struct hash_table *shader_var_remap;
    const nir_shader *link_shader;
    unsigned printf_index_offset;
+
+   /* Either the library was loaded lazily, and impls are read from it when
+    * first linked, or its functions are indexed by name here.
+    */
+   struct nir_lazy_shader *link_library;
+   struct hash_table *link_functions;
 };
 
+static nir_function *
+link_shader_get_function(struct lower_link_state *state, const char *name)
+{
+   if (state->link_library)
+      return nir_lazy_shader_get_function(state->link_library, name);
+
+   struct hash_entry *entry =
+      _mesa_hash_table_search(state->link_functions, name);
+   return entry ? entry->data : NULL;
+}
+
+static const nir_function_impl *
+link_shader_get_impl(struct lower_link_state *state, nir_function *func)
+{
+   if (state->link_library)
+      return nir_lazy_shader_get_impl(state->link_library, func);
+
+   return func->impl;
+}
+
 static bool
 lower_calls_vars_instr(struct nir_builder *b,
                        nir_instr *instr,
@@ -331,7 +358,7 @@ lower_calls_vars_instr(struct nir_builder *b,
       }
 
       nir_function *new_func;
-      new_func = nir_shader_get_function_for_name(state->link_shader, ncall->callee->name);
+      new_func = link_shader_get_function(state, ncall->callee->name);
       if (new_func)
          ncall->callee = nir_function_clone(b->shader, new_func);
       break;
@@ -394,28 +421,23 @@ function_link_pass(struct nir_builder *b,
    if (call->callee->impl)
       return false;
 
-   func = nir_shader_get_function_for_name(state->link_shader, call->callee->name);
-   if (!func || !func->impl) {
+   func = link_shader_get_function(state, call->callee->name);
+   if (!func)
       return false;
-   }
-   return lower_call_function_impl(b, call->callee,
-                                   func->impl,
-                                   state);
+
+   const nir_function_impl *impl = link_shader_get_impl(state, func);
+   if (!impl)
+      return false;
+
+   return lower_call_function_impl(b, call->callee, impl, state);
 }
 
-bool
-nir_link_shader_functions(nir_shader *shader,
-                          const nir_shader *link_shader)
+static bool
+link_shader_functions(nir_shader *shader, struct lower_link_state *state)
 {
-   void *ra_ctx = ralloc_context(NULL);
-   struct hash_table *copy_vars = _mesa_pointer_hash_table_create(ra_ctx);
+   const nir_shader *link_shader = state->link_shader;
    bool progress = false, overall_progress = false;
 
-   struct lower_link_state state = {
-      .shader_var_remap = copy_vars,
-      .link_shader = link_shader,
-      .printf_index_offset = shader->printf_info_count,
-   };
    /* do progress passes inside the pass */
    do {
       progress = false;
@@ -423,7 +445,7 @@ nir_link_shader_functions(nir_shader *shader,
          bool this_progress = nir_function_instructions_pass(impl,
                                                              function_link_pass,
                                                              nir_metadata_none,
-                                                             &state);
+                                                             state);
          if (this_progress)
             nir_index_ssa_defs(impl);
          progress |= this_progress;
@@ -452,9 +474,62 @@ nir_link_shader_functions(nir_shader *shader,
       }
    }
 
+   return overall_progress;
+}
+
+bool
+nir_link_shader_functions(nir_shader *shader,
+                          const nir_shader *link_shader)
+{
+   void *ra_ctx = ralloc_context(NULL);
+
+   /* Libraries have many more functions than a shader calls, so index them
+    * once instead of walking the list for every call.
+    */
+   struct hash_table *link_functions =
+      _mesa_hash_table_create(ra_ctx, _mesa_hash_string,
+                              _mesa_key_string_equal);
+   nir_foreach_function(func, link_shader) {
+      if (func->name && !_mesa_hash_table_search(link_functions, func->name))
+         _mesa_hash_table_insert(link_functions, func->name, func);
+   }
+
+   struct lower_link_state state = {
+      .shader_var_remap = _mesa_pointer_hash_table_create(ra_ctx),
+      .link_shader = link_shader,
+      .printf_index_offset = shader->printf_info_count,
+      .link_functions = link_functions,
+   };
+   bool progress = link_shader_functions(shader, &state);
+
    ralloc_free(ra_ctx);
 
-   return overall_progress;
+   return progress;
+}
+
+/**
+ * Like nir_link_shader_functions, but with a library from
+ * nir_deserialize_lazy: only the impls of the functions the shader ends up
+ * calling are read, when they are first linked.  Several threads can link
+ * against the same library at once.
+ */
+bool
+nir_link_shader_functions_lazy(nir_shader *shader,
+                               struct nir_lazy_shader *library)
+{
+   void *ra_ctx = ralloc_context(NULL);
+
+   struct lower_link_state state = {
+      .shader_var_remap = _mesa_pointer_hash_table_create(ra_ctx),
+      .link_shader = nir_lazy_shader_get_shader(library),
+      .printf_index_offset = shader->printf_info_count,
+      .link_library = library,
+   };
+   bool progress = link_shader_functions(shader, &state);
+
+   ralloc_free(ra_ctx);
+
+   return progress;
 }
 
 static void
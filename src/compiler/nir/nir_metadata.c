@@ -22,6 +22,7 @@
  */
 
 #include "nir.h"
+#include "util/u_dynarray.h"
 
 /*
  * Handles management of the metadata.
@@ -40,6 +41,8 @@ nir_metadata_require(nir_function_impl *impl, nir_metadata required, ...)
       nir_calc_dominance_impl(impl);
    if (NEEDS_UPDATE(nir_metadata_live_defs))
       nir_live_defs_impl(impl);
+   if (NEEDS_UPDATE(nir_metadata_instr_changes))
+      impl->change_base = ++impl->change_gen;
    if (NEEDS_UPDATE(nir_metadata_loop_analysis)) {
       va_list ap;
       va_start(ap, required);
@@ -72,6 +75,115 @@ nir_shader_preserve_all_metadata(nir_shader *shader)
    }
 }
 
+static bool
+add_changed_instr(nir_instr_changes *changes, nir_instr *instr)
+{
+   bool found;
+   _mesa_set_search_or_add(changes->instrs, instr, &found);
+   if (!found)
+      BITSET_SET(changes->blocks, instr->block->index);
+
+   return !found;
+}
+
+bool
+nir_instr_changes_begin(nir_function_impl *impl, const void *pass,
+                        unsigned user_depth, nir_instr_changes *changes)
+{
+   nir_metadata_require(impl, nir_metadata_block_index |
+                                 nir_metadata_instr_changes);
+
+   changes->instrs = NULL;
+   changes->blocks = NULL;
+
+   /* Find when the pass last ran, or evict the least recently run one. */
+   unsigned slot = 0;
+   for (unsigned i = 0; i < NIR_MAX_INCREMENTAL_PASSES; i++) {
+      if (impl->change_passes[i].pass == pass) {
+         slot = i;
+         break;
+      }
+      if (impl->change_passes[i].gen < impl->change_passes[slot].gen)
+         slot = i;
+   }
+
+   uint32_t since = 0;
+   if (impl->change_passes[slot].pass == pass)
+      since = impl->change_passes[slot].gen;
+
+   /* Whatever changes from now on has to be visited by the next run,
+    * including the changes made by this one.
+    */
+   impl->change_passes[slot].pass = pass;
+   impl->change_passes[slot].gen = ++impl->change_gen;
+
+   if (since < impl->change_base || NIR_DEBUG(NO_INCREMENTAL))
+      return false;
+
+   nir_pass_stats_count_incremental(false);
+
+   changes->instrs = _mesa_pointer_set_create(NULL);
+   changes->blocks = rzalloc_array(changes->instrs, BITSET_WORD,
+                                   BITSET_WORDS(impl->num_blocks));
+
+   struct util_dynarray level, next;
+   util_dynarray_init(&level, NULL);
+   util_dynarray_init(&next, NULL);
+
+   nir_foreach_block(block, impl) {
+      if (block->change_gen < since)
+         continue;
+
+      nir_foreach_instr(instr, block) {
+         if (instr->change_gen >= since && add_changed_instr(changes, instr))
+            util_dynarray_append(&level, nir_instr *, instr);
+      }
+   }
+
+   /* Walk the users breadth-first, so that each instruction is reached at
+    * its smallest depth.  The users of a deref stay at its level, the way
+    * passes look through whole deref chains.
+    */
+   for (unsigned depth = 0; level.size > 0; depth++) {
+      for (unsigned i = 0; i < util_dynarray_num_elements(&level, nir_instr *); i++) {
+         nir_instr *instr = *util_dynarray_element(&level, nir_instr *, i);
+         nir_def *def = nir_instr_def(instr);
+         if (def == NULL)
+            continue;
+
+         nir_foreach_use(use, def) {
+            nir_instr *user = nir_src_parent_instr(use);
+
+            if (user->type == nir_instr_type_deref) {
+               if (add_changed_instr(changes, user))
+                  util_dynarray_append(&level, nir_instr *, user);
+            } else if (depth < user_depth) {
+               if (add_changed_instr(changes, user))
+                  util_dynarray_append(&next, nir_instr *, user);
+            }
+         }
+      }
+
+      struct util_dynarray tmp = level;
+      level = next;
+      next = tmp;
+      util_dynarray_clear(&next);
+   }
+
+   util_dynarray_fini(&level);
+   util_dynarray_fini(&next);
+
+   return true;
+}
+
+void
+nir_instr_changes_finish(nir_instr_changes *changes)
+{
+   ralloc_free(changes->instrs);
+   changes->instrs = NULL;
+   changes->blocks = NULL;
+}
+
 #ifndef NDEBUG
 /**
  * Make sure passes properly invalidate metadata (part 1).
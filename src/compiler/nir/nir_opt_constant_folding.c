@@ -394,6 +394,20 @@ try_fold_instr(nir_builder *b, nir_instr *instr, void *_state)
    }
 }
 
+static bool
+has_load_constant(nir_function_impl *impl)
+{
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block) {
+         if (instr->type == nir_instr_type_intrinsic &&
+             nir_instr_as_intrinsic(instr)->intrinsic == nir_intrinsic_load_constant)
+            return true;
+      }
+   }
+
+   return false;
+}
+
 bool
 nir_opt_constant_folding(nir_shader *shader)
 {
@@ -401,10 +415,52 @@ nir_opt_constant_folding(nir_shader *shader)
    state.has_load_constant = false;
    state.has_indirect_load_const = false;
 
-   bool progress = nir_shader_instructions_pass(shader, try_fold_instr,
-                                                nir_metadata_block_index |
-                                                   nir_metadata_dominance,
-                                                &state);
+   bool progress = false;
+   bool incremental = false;
+
+   nir_foreach_function_impl(impl, shader) {
+      /* Folding looks at the sources, and through vecs and movs for texture
+       * offsets, so the users of what changed are enough.
+       */
+      nir_instr_changes changes;
+      incremental |= nir_instr_changes_begin(impl,
+                                             (const void *)nir_opt_constant_folding,
+                                             2, &changes);
+
+      bool impl_progress = false;
+      nir_builder b = nir_builder_create(impl);
+
+      nir_foreach_block_safe(block, impl) {
+         if (!nir_instr_changes_has_block(&changes, block))
+            continue;
+
+         nir_foreach_instr_safe(instr, block) {
+            if (nir_instr_changes_has_instr(&changes, instr))
+               impl_progress |= try_fold_instr(&b, instr, &state);
+         }
+      }
+
+      nir_instr_changes_finish(&changes);
+
+      if (impl_progress) {
+         nir_metadata_preserve(impl, nir_metadata_block_index |
+                                        nir_metadata_dominance |
+                                        nir_metadata_instr_changes);
+         progress = true;
+      } else {
+         nir_metadata_preserve(impl, nir_metadata_all);
+      }
+   }
+
+   /* Only the loads that were visited have been seen, the others could be
+    * indirect.  The direct ones were all folded.
+    */
+   if (incremental && state.has_load_constant && !state.has_indirect_load_const) {
+      nir_foreach_function_impl(impl, shader) {
+         if (has_load_constant(impl))
+            state.has_indirect_load_const = true;
+      }
+   }
 
    /* This doesn't free the constant data if there are no constant loads because
     * the data might still be used but the loads have been lowered to load_ubo
@@ -151,15 +151,28 @@ nir_copy_prop_impl(nir_function_impl *impl)
 {
    bool progress = false;
 
+   /* A copy only has to be propagated again if it is new or has new uses,
+    * both of which stamp it.
+    */
+   nir_instr_changes changes;
+   nir_instr_changes_begin(impl, (const void *)nir_copy_prop_impl, 0, &changes);
+
    nir_foreach_block(block, impl) {
+      if (!nir_instr_changes_has_block(&changes, block))
+         continue;
+
       nir_foreach_instr_safe(instr, block) {
-         progress |= copy_prop_instr(instr);
+         if (nir_instr_changes_has_instr(&changes, instr))
+            progress |= copy_prop_instr(instr);
       }
    }
 
+   nir_instr_changes_finish(&changes);
+
    if (progress) {
       nir_metadata_preserve(impl, nir_metadata_block_index |
-                                     nir_metadata_dominance);
+                                     nir_metadata_dominance |
+                                     nir_metadata_instr_changes);
    } else {
       nir_metadata_preserve(impl, nir_metadata_all);
    }
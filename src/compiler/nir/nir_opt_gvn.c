@@ -0,0 +1,418 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "nir.h"
+#include "nir_instr_set.h"
+#include "util/u_dynarray.h"
+
+/*
+ * Global value numbering with loop-invariant code motion.
+ *
+ * This walks the dominance tree with a scoped instruction set, so that every
+ * instruction is compared against the ones that dominate it, like
+ * nir_opt_cse does.  Loads that can be reordered (UBOs, push constants, and
+ * SSBOs and global memory marked ACCESS_CAN_REORDER) are numbered along with
+ * ALU instructions.
+ *
+ * With loop-invariant code motion, instructions whose sources are all defined
+ * outside of a loop are moved to the block before the loop before numbering
+ * them, as far out as they stay invariant.  That is the partial redundancy
+ * which matters the most in practice, and it lets the hoisted instructions be
+ * numbered against the ones before the loop in the same sweep.  Constants and
+ * undefs used by a hoisted instruction are copied along instead of being
+ * moved, so that other users in the loop keep them close.
+ *
+ * ALU instructions never trap, so they are hoisted from anywhere in the loop.
+ * Loads are only hoisted if they can be speculated, or if they are in a block
+ * which runs on the first iteration of the loop whenever the loop is entered.
+ */
+
+struct gvn_scope {
+   nir_block *block;
+
+   /* Instructions added to the set while the scope is open. */
+   struct util_dynarray instrs;
+};
+
+struct gvn_state {
+   nir_shader *shader;
+   struct set *instr_set;
+   bool licm;
+
+   /* Stack of struct gvn_scope along the path in the dominance tree. */
+   struct util_dynarray scopes;
+
+   /* nir_loop -> set of body blocks always run by the first iteration */
+   struct hash_table *first_iteration_blocks;
+
+   bool progress;
+};
+
+static nir_loop *
+innermost_loop(nir_block *block)
+{
+   for (nir_cf_node *node = block->cf_node.parent; node; node = node->parent) {
+      if (node->type == nir_cf_node_loop)
+         return nir_cf_node_as_loop(node);
+   }
+
+   return NULL;
+}
+
+static bool
+block_in_loop(nir_block *block, nir_loop *loop)
+{
+   for (nir_cf_node *node = block->cf_node.parent; node; node = node->parent) {
+      if (node == &loop->cf_node)
+         return true;
+   }
+
+   return false;
+}
+
+static bool
+is_rematerializable(const nir_instr *instr)
+{
+   return instr->type == nir_instr_type_load_const ||
+          instr->type == nir_instr_type_undef;
+}
+
+/* Whether the block can leave the current iteration of the loop, or stop the
+ * invocation, before the blocks after it in the loop body run.
+ */
+static bool
+block_may_leave(nir_block *block, nir_loop *loop)
+{
+   nir_foreach_instr(instr, block) {
+      if (instr->type == nir_instr_type_intrinsic) {
+         switch (nir_instr_as_intrinsic(instr)->intrinsic) {
+         case nir_intrinsic_discard:
+         case nir_intrinsic_discard_if:
+         case nir_intrinsic_terminate:
+         case nir_intrinsic_terminate_if:
+            return true;
+         default:
+            break;
+         }
+      } else if (instr->type == nir_instr_type_jump) {
+         switch (nir_instr_as_jump(instr)->type) {
+         case nir_jump_break:
+         case nir_jump_continue:
+            /* Jumps in a nested loop stay in it. */
+            if (innermost_loop(block) == loop)
+               return true;
+            break;
+         default:
+            return true;
+         }
+      }
+   }
+
+   return false;
+}
+
+static struct set *
+get_first_iteration_blocks(struct gvn_state *state, nir_loop *loop)
+{
+   struct hash_entry *entry =
+      _mesa_hash_table_search(state->first_iteration_blocks, loop);
+   if (entry)
+      return entry->data;
+
+   struct set *blocks =
+      _mesa_pointer_set_create(state->first_iteration_blocks);
+
+   /* The body is always entered, and runs on until something jumps. */
+   foreach_list_typed(nir_cf_node, node, node, &loop->body) {
+      if (node->type == nir_cf_node_block) {
+         nir_block *block = nir_cf_node_as_block(node);
+         if (block_may_leave(block, loop))
+            break;
+
+         _mesa_set_add(blocks, block);
+      } else {
+         bool may_leave = false;
+         nir_foreach_block_in_cf_node(block, node)
+            may_leave |= block_may_leave(block, loop);
+
+         if (may_leave)
+            break;
+      }
+   }
+
+   _mesa_hash_table_insert(state->first_iteration_blocks, loop, blocks);
+   return blocks;
+}
+
+static bool
+is_binding_uniform(nir_src src)
+{
+   nir_binding binding = nir_chase_binding(src);
+   if (!binding.success)
+      return false;
+
+   for (unsigned i = 0; i < binding.num_indices; i++) {
+      if (!nir_src_is_always_uniform(binding.indices[i]))
+         return false;
+   }
+
+   return true;
+}
+
+enum hoist_kind {
+   HOIST_NEVER,
+   HOIST_ALWAYS,
+   HOIST_FIRST_ITERATION,
+};
+
+static enum hoist_kind
+get_hoist_kind(nir_instr *instr)
+{
+   switch (instr->type) {
+   case nir_instr_type_alu:
+      /* Derivatives need the control flow they are in. */
+      if (nir_op_is_derivative(nir_instr_as_alu(instr)->op))
+         return HOIST_NEVER;
+      return HOIST_ALWAYS;
+
+   case nir_instr_type_intrinsic: {
+      nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+      if (!nir_intrinsic_can_reorder(intrin))
+         return HOIST_NEVER;
+
+      /* Loads with a descriptor need it to be uniform among the invocations
+       * running them, which could be more outside of the loop.
+       */
+      bool non_uniform = nir_intrinsic_has_access(intrin) &&
+                         (nir_intrinsic_access(intrin) & ACCESS_NON_UNIFORM);
+
+      switch (intrin->intrinsic) {
+      case nir_intrinsic_load_ubo:
+      case nir_intrinsic_load_ubo_vec4:
+      case nir_intrinsic_load_ssbo:
+         if (!non_uniform && !is_binding_uniform(intrin->src[0]))
+            return HOIST_NEVER;
+         break;
+      case nir_intrinsic_load_push_constant:
+      case nir_intrinsic_load_uniform:
+      case nir_intrinsic_load_constant:
+      case nir_intrinsic_load_global_constant:
+         break;
+      default:
+         return HOIST_NEVER;
+      }
+
+      if (nir_intrinsic_has_access(intrin) &&
+          (nir_intrinsic_access(intrin) & ACCESS_CAN_SPECULATE))
+         return HOIST_ALWAYS;
+
+      return HOIST_FIRST_ITERATION;
+   }
+
+   default:
+      return HOIST_NEVER;
+   }
+}
+
+struct invariant_state {
+   nir_loop *loop;
+   bool invariant;
+};
+
+static bool
+src_is_invariant_cb(nir_src *src, void *_state)
+{
+   struct invariant_state *state = _state;
+   nir_instr *parent = src->ssa->parent_instr;
+
+   if (block_in_loop(parent->block, state->loop) &&
+       !is_rematerializable(parent)) {
+      state->invariant = false;
+      return false;
+   }
+
+   return true;
+}
+
+static void number_instr(struct gvn_state *state, nir_instr *instr);
+
+struct rematerialize_state {
+   struct gvn_state *gvn;
+   nir_loop *loop;
+};
+
+static bool
+rematerialize_src_cb(nir_src *src, void *_state)
+{
+   struct rematerialize_state *state = _state;
+   nir_instr *instr = nir_src_parent_instr(src);
+   nir_instr *parent = src->ssa->parent_instr;
+
+   if (!block_in_loop(parent->block, state->loop))
+      return true;
+
+   nir_instr *clone;
+   if (parent->type == nir_instr_type_load_const) {
+      nir_load_const_instr *lc = nir_instr_as_load_const(parent);
+      nir_load_const_instr *nlc =
+         nir_load_const_instr_create(state->gvn->shader, lc->def.num_components,
+                                     lc->def.bit_size);
+      memcpy(nlc->value, lc->value, sizeof(*lc->value) * lc->def.num_components);
+      clone = &nlc->instr;
+   } else {
+      nir_undef_instr *undef = nir_instr_as_undef(parent);
+      clone = &nir_undef_instr_create(state->gvn->shader,
+                                      undef->def.num_components,
+                                      undef->def.bit_size)->instr;
+   }
+
+   nir_instr_insert_before(instr, clone);
+   nir_src_rewrite(src, nir_instr_def(clone));
+   number_instr(state->gvn, clone);
+
+   return true;
+}
+
+/* Moves the instruction out of the loops it is invariant in. */
+static void
+hoist_instr(struct gvn_state *state, nir_instr *instr)
+{
+   enum hoist_kind kind = get_hoist_kind(instr);
+   if (kind == HOIST_NEVER)
+      return;
+
+   nir_loop *target = NULL;
+   nir_block *block = instr->block;
+   for (nir_loop *loop = innermost_loop(block); loop;
+        loop = innermost_loop(block)) {
+      struct invariant_state inv = { loop, true };
+      nir_foreach_src(instr, src_is_invariant_cb, &inv);
+      if (!inv.invariant)
+         break;
+
+      if (kind == HOIST_FIRST_ITERATION &&
+          !_mesa_set_search(get_first_iteration_blocks(state, loop), block))
+         break;
+
+      target = loop;
+      block = nir_cf_node_as_block(nir_cf_node_prev(&loop->cf_node));
+   }
+
+   if (target == NULL)
+      return;
+
+   nir_instr_move(nir_after_block_before_jump(block), instr);
+
+   struct rematerialize_state remat = { state, target };
+   nir_foreach_src(instr, rematerialize_src_cb, &remat);
+
+   state->progress = true;
+}
+
+static void
+add_to_scope(struct gvn_state *state, nir_instr *instr)
+{
+   /* Hoisted instructions belong to the scope of the block they were moved
+    * to, which dominates the current one.
+    */
+   for (unsigned i = util_dynarray_num_elements(&state->scopes, struct gvn_scope); i-- > 0;) {
+      struct gvn_scope *scope =
+         util_dynarray_element(&state->scopes, struct gvn_scope, i);
+      if (scope->block == instr->block) {
+         util_dynarray_append(&scope->instrs, nir_instr *, instr);
+         return;
+      }
+   }
+
+   unreachable("instruction outside of the dominance tree path");
+}
+
+/* Hoisted instructions are numbered after the ones in the loop block they
+ * were moved from, so the match may be one they dominate instead.  In that
+ * case the set takes the hoisted instruction as the representative.
+ */
+static bool
+dominates(const nir_instr *old_instr, const nir_instr *new_instr)
+{
+   return nir_block_dominates(old_instr->block, new_instr->block);
+}
+
+static void
+number_instr(struct gvn_state *state, nir_instr *instr)
+{
+   if (nir_instr_set_add_or_rewrite(state->instr_set, instr, dominates))
+      state->progress = true;
+   else
+      add_to_scope(state, instr);
+}
+
+static void
+gvn_block(struct gvn_state *state, nir_block *block)
+{
+   struct gvn_scope new_scope = { .block = block };
+   util_dynarray_init(&new_scope.instrs, NULL);
+   util_dynarray_append(&state->scopes, struct gvn_scope, new_scope);
+
+   nir_foreach_instr_safe(instr, block) {
+      if (state->licm)
+         hoist_instr(state, instr);
+
+      number_instr(state, instr);
+   }
+
+   for (unsigned i = 0; i < block->num_dom_children; i++)
+      gvn_block(state, block->dom_children[i]);
+
+   struct gvn_scope scope = util_dynarray_pop(&state->scopes, struct gvn_scope);
+
+   util_dynarray_foreach(&scope.instrs, nir_instr *, instr)
+      nir_instr_set_remove(state->instr_set, *instr);
+   util_dynarray_fini(&scope.instrs);
+}
+
+static bool
+nir_opt_gvn_impl(nir_function_impl *impl, bool licm)
+{
+   nir_metadata_require(impl, nir_metadata_dominance);
+
+   struct gvn_state state = {
+      .shader = impl->function->shader,
+      .instr_set = nir_instr_set_create(NULL),
+      .licm = licm,
+      .first_iteration_blocks = _mesa_pointer_hash_table_create(NULL),
+   };
+   util_dynarray_init(&state.scopes, NULL);
+
+   gvn_block(&state, nir_start_block(impl));
+
+   util_dynarray_fini(&state.scopes);
+   ralloc_free(state.first_iteration_blocks);
+   nir_instr_set_destroy(state.instr_set);
+
+   if (state.progress) {
+      nir_metadata_preserve(impl, nir_metadata_block_index |
+                                     nir_metadata_dominance);
+   } else {
+      nir_metadata_preserve(impl, nir_metadata_all);
+   }
+
+   return state.progress;
+}
+
+/**
+ * Eliminates the instructions computing a value already computed by one
+ * dominating them, and with licm, first moves loop-invariant instructions
+ * out of their loops.
+ */
+bool
+nir_opt_gvn(nir_shader *shader, bool licm)
+{
+   bool progress = false;
+
+   nir_foreach_function_impl(impl, shader) {
+      progress |= nir_opt_gvn_impl(impl, licm);
+   }
+
+   return progress;
+}
@@ -0,0 +1,266 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Per-pass compile time statistics, collected by NIR_PASS and NIR_PASS_V
+ * with NIR_DEBUG=pass_stats.
+ *
+ * Statistics are aggregated per pass name and shader stage for the whole
+ * process, and printed to stderr at exit.  Times include the passes called
+ * by a pass, but not validation, printing or the NIR_DEBUG clone and
+ * serialize tests.
+ */
+
+#include "nir.h"
+
+#ifndef NDEBUG
+
+#include <stdlib.h>
+
+#include "c11/threads.h"
+#include "util/hash_table.h"
+#include "util/os_time.h"
+#include "util/simple_mtx.h"
+
+#define NUM_STAGES (MESA_SHADER_KERNEL + 1)
+
+struct pass_entry {
+   const char *name;
+   struct nir_pass_stats stages[NUM_STAGES];
+};
+
+static simple_mtx_t pass_stats_lock = SIMPLE_MTX_INITIALIZER;
+static struct hash_table *pass_stats;
+
+/* Incremental runs on this thread so far.  A pass gets the difference over
+ * its invocation, like its time.
+ */
+static thread_local uint64_t num_incremental;
+static thread_local uint64_t num_forced_full;
+
+static unsigned
+count_instrs(const nir_shader *shader)
+{
+   unsigned count = 0;
+
+   nir_foreach_function_impl(impl, shader) {
+      nir_foreach_block(block, impl)
+         count += exec_list_length(&block->instr_list);
+   }
+
+   return count;
+}
+
+static void
+print_at_exit(void)
+{
+   nir_pass_stats_print(stderr);
+}
+
+void
+nir_pass_stats_begin_impl(nir_shader *shader,
+                          struct nir_pass_stats_sample *sample)
+{
+   sample->num_instrs = count_instrs(shader);
+   sample->incremental = num_incremental;
+   sample->forced_full = num_forced_full;
+   sample->start_ns = os_time_get_nano();
+}
+
+void
+nir_pass_stats_count_incremental_impl(bool forced_full)
+{
+   if (forced_full)
+      num_forced_full++;
+   else
+      num_incremental++;
+}
+
+void
+nir_pass_stats_end_impl(nir_shader *shader, const char *pass,
+                        const struct nir_pass_stats_sample *sample,
+                        int progress)
+{
+   int64_t time_ns = os_time_get_nano() - sample->start_ns;
+   int64_t instr_delta = (int64_t)count_instrs(shader) - sample->num_instrs;
+
+   if (shader->info.stage < 0 || shader->info.stage >= NUM_STAGES)
+      return;
+
+   simple_mtx_lock(&pass_stats_lock);
+
+   if (pass_stats == NULL) {
+      pass_stats = _mesa_hash_table_create(NULL, _mesa_hash_string,
+                                           _mesa_key_string_equal);
+      atexit(print_at_exit);
+   }
+
+   /* Pass names are string literals, but not necessarily the same one for
+    * every caller, so look them up by their content.
+    */
+   struct hash_entry *he = _mesa_hash_table_search(pass_stats, pass);
+   struct pass_entry *entry;
+   if (he) {
+      entry = he->data;
+   } else {
+      entry = rzalloc(pass_stats, struct pass_entry);
+      entry->name = pass;
+      _mesa_hash_table_insert(pass_stats, pass, entry);
+   }
+
+   struct nir_pass_stats *stats = &entry->stages[shader->info.stage];
+   stats->invocations++;
+   if (progress > 0)
+      stats->progress++;
+   else if (progress == 0)
+      stats->no_progress++;
+   stats->time_ns += time_ns;
+   stats->instr_delta += instr_delta;
+   stats->incremental += num_incremental - sample->incremental;
+   stats->forced_full += num_forced_full - sample->forced_full;
+
+   simple_mtx_unlock(&pass_stats_lock);
+}
+
+bool
+nir_pass_stats_get(const char *pass, gl_shader_stage stage,
+                   struct nir_pass_stats *stats)
+{
+   bool found = false;
+
+   simple_mtx_lock(&pass_stats_lock);
+   struct hash_entry *he =
+      pass_stats ? _mesa_hash_table_search(pass_stats, pass) : NULL;
+   if (he && stage >= 0 && stage < NUM_STAGES) {
+      struct pass_entry *entry = he->data;
+      *stats = entry->stages[stage];
+      found = stats->invocations > 0;
+   }
+   simple_mtx_unlock(&pass_stats_lock);
+
+   return found;
+}
+
+void
+nir_pass_stats_foreach(nir_pass_stats_cb cb, void *data)
+{
+   simple_mtx_lock(&pass_stats_lock);
+   if (pass_stats) {
+      hash_table_foreach(pass_stats, he) {
+         struct pass_entry *entry = he->data;
+         for (unsigned s = 0; s < NUM_STAGES; s++) {
+            if (entry->stages[s].invocations > 0)
+               cb(entry->name, s, &entry->stages[s], data);
+         }
+      }
+   }
+   simple_mtx_unlock(&pass_stats_lock);
+}
+
+void
+nir_pass_stats_reset(void)
+{
+   simple_mtx_lock(&pass_stats_lock);
+   if (pass_stats) {
+      hash_table_foreach(pass_stats, he) {
+         struct pass_entry *entry = he->data;
+         memset(entry->stages, 0, sizeof(entry->stages));
+      }
+   }
+   simple_mtx_unlock(&pass_stats_lock);
+}
+
+struct print_row {
+   const char *name;
+   gl_shader_stage stage;
+   const struct nir_pass_stats *stats;
+};
+
+static int
+compare_rows(const void *_a, const void *_b)
+{
+   const struct print_row *a = _a, *b = _b;
+
+   /* Most expensive first. */
+   if (a->stats->time_ns != b->stats->time_ns)
+      return a->stats->time_ns < b->stats->time_ns ? 1 : -1;
+
+   int cmp = strcmp(a->name, b->name);
+   return cmp ? cmp : (int)a->stage - (int)b->stage;
+}
+
+void
+nir_pass_stats_print(FILE *fp)
+{
+   simple_mtx_lock(&pass_stats_lock);
+
+   if (pass_stats == NULL) {
+      simple_mtx_unlock(&pass_stats_lock);
+      return;
+   }
+
+   unsigned num_rows = 0;
+   struct print_row *rows =
+      malloc(sizeof(*rows) * pass_stats->entries * NUM_STAGES);
+   uint64_t total_ns = 0;
+
+   hash_table_foreach(pass_stats, he) {
+      struct pass_entry *entry = he->data;
+      for (unsigned s = 0; s < NUM_STAGES; s++) {
+         if (entry->stages[s].invocations == 0)
+            continue;
+
+         if (rows) {
+            rows[num_rows].name = entry->name;
+            rows[num_rows].stage = s;
+            rows[num_rows].stats = &entry->stages[s];
+            num_rows++;
+         }
+         total_ns += entry->stages[s].time_ns;
+      }
+   }
+
+   if (num_rows == 0) {
+      simple_mtx_unlock(&pass_stats_lock);
+      free(rows);
+      return;
+   }
+
+   qsort(rows, num_rows, sizeof(*rows), compare_rows);
+
+   fprintf(fp, "NIR pass statistics (%.3f ms total):\n", total_ns / 1e6);
+   fprintf(fp, "%-40s %-5s %10s %10s %8s %12s %10s %12s %12s %8s\n",
+           "pass", "stage", "calls", "progress", "ratio", "total ms",
+           "avg us", "instr delta", "incremental", "forced");
+
+   for (unsigned i = 0; i < num_rows; i++) {
+      const struct nir_pass_stats *stats = rows[i].stats;
+      uint64_t known = stats->progress + stats->no_progress;
+
+      fprintf(fp, "%-40s %-5s %10" PRIu64 " ", rows[i].name,
+              _mesa_shader_stage_to_abbrev(rows[i].stage), stats->invocations);
+
+      /* NIR_PASS_V doesn't know whether the pass made progress. */
+      if (known)
+         fprintf(fp, "%10" PRIu64 " %7.1f%%", stats->progress,
+                 100.0 * stats->progress / known);
+      else
+         fprintf(fp, "%10s %8s", "-", "-");
+
+      fprintf(fp, " %12.3f %10.2f %12" PRId64, stats->time_ns / 1e6,
+              stats->time_ns / 1e3 / stats->invocations, stats->instr_delta);
+
+      /* Only passes using nir_instr_changes run incrementally. */
+      if (stats->incremental)
+         fprintf(fp, " %12" PRIu64 " %8" PRIu64 "\n", stats->incremental,
+                 stats->forced_full);
+      else
+         fprintf(fp, " %12s %8s\n", "-", "-");
+   }
+
+   simple_mtx_unlock(&pass_stats_lock);
+   free(rows);
+}
+
+#endif /* NDEBUG */
@@ -866,6 +866,57 @@ nir_algebraic_instr(nir_builder *build, nir_instr *instr,
    return false;
 }
 
+/* Puts the ALU instructions that changed, or the ones that didn't, into the
+ * worklist.
+ */
+static void
+nir_algebraic_push_instrs(nir_instr_worklist *worklist,
+                          nir_function_impl *impl,
+                          const nir_instr_changes *changes, bool changed)
+{
+   /* Put our instrs in the worklist such that we're popping the last instr
+    * first.  This will encourage us to match the biggest source patterns when
+    * possible.
+    */
+   nir_foreach_block_reverse(block, impl) {
+      if (changed && !nir_instr_changes_has_block(changes, block))
+         continue;
+
+      nir_foreach_instr_reverse(instr, block) {
+         if (instr->type == nir_instr_type_alu &&
+             nir_instr_changes_has_instr(changes, instr) == changed)
+            nir_instr_worklist_push_tail(worklist, instr);
+      }
+   }
+}
+
+static bool
+nir_algebraic_worklist(nir_builder *build, nir_instr_worklist *worklist,
+                       struct hash_table *range_ht,
+                       const bool *condition_flags,
+                       const nir_algebraic_table *table,
+                       struct util_dynarray *states,
+                       struct exec_list *dead_instrs)
+{
+   bool progress = false;
+
+   nir_instr *instr;
+   while ((instr = nir_instr_worklist_pop_head(worklist))) {
+      /* The worklist can have an instr pushed to it multiple times if it was
+       * the src of multiple instrs that also got optimized, so make sure that
+       * we don't try to re-optimize an instr we already handled.
+       */
+      if (instr->pass_flags)
+         continue;
+
+      progress |= nir_algebraic_instr(build, instr,
+                                      range_ht, condition_flags,
+                                      table, states, worklist, dead_instrs);
+   }
+
+   return progress;
+}
+
 bool
 nir_algebraic_impl(nir_function_impl *impl,
                    const bool *condition_flags,
@@ -890,42 +941,46 @@ nir_algebraic_impl(nir_function_impl *impl,
 
    nir_instr_worklist *worklist = nir_instr_worklist_create();
 
-   /* Walk top-to-bottom setting up the automaton state. */
+   /* Walk top-to-bottom setting up the automaton state.  This has to cover
+    * the whole shader, since the states of the sources are needed for any
+    * instruction we visit.
+    */
    nir_foreach_block(block, impl) {
       nir_foreach_instr(instr, block) {
+         instr->pass_flags = 0;
          nir_algebraic_automaton(instr, &states, table->pass_op_table);
       }
    }
 
-   /* Put our instrs in the worklist such that we're popping the last instr
-    * first.  This will encourage us to match the biggest source patterns when
-    * possible.
+   /* A pattern can only start matching where something changed within its
+    * depth.
     */
-   nir_foreach_block_reverse(block, impl) {
-      nir_foreach_instr_reverse(instr, block) {
-         instr->pass_flags = 0;
-         if (instr->type == nir_instr_type_alu)
-            nir_instr_worklist_push_tail(worklist, instr);
-      }
-   }
+   nir_instr_changes changes;
+   bool incremental =
+      nir_instr_changes_begin(impl, table, table->search_depth, &changes);
 
    struct exec_list dead_instrs;
    exec_list_make_empty(&dead_instrs);
 
-   nir_instr *instr;
-   while ((instr = nir_instr_worklist_pop_head(worklist))) {
-      /* The worklist can have an instr pushed to it multiple times if it was
-       * the src of multiple instrs that also got optimized, so make sure that
-       * we don't try to re-optimize an instr we already handled.
-       */
-      if (instr->pass_flags)
-         continue;
+   nir_algebraic_push_instrs(worklist, impl, &changes, true);
+   progress = nir_algebraic_worklist(&build, worklist, range_ht,
+                                     condition_flags, table, &states,
+                                     &dead_instrs);
 
-      progress |= nir_algebraic_instr(&build, instr,
-                                      range_ht, condition_flags,
-                                      table, &states, worklist, &dead_instrs);
+   /* Conditions relying on range analysis can look further than the
+    * patterns.  Visit the rest of the shader before reporting no progress,
+    * so that an optimization loop doesn't stop before a full run.
+    */
+   if (incremental && !progress && table->variable_cond) {
+      nir_pass_stats_count_incremental(true);
+      nir_algebraic_push_instrs(worklist, impl, &changes, false);
+      progress = nir_algebraic_worklist(&build, worklist, range_ht,
+                                        condition_flags, table, &states,
+                                        &dead_instrs);
    }
 
+   nir_instr_changes_finish(&changes);
+
    nir_instr_free_list(&dead_instrs);
 
    nir_instr_worklist_destroy(worklist);
@@ -934,7 +989,8 @@ nir_algebraic_impl(nir_function_impl *impl,
 
    if (progress) {
       nir_metadata_preserve(impl, nir_metadata_block_index |
-                                     nir_metadata_dominance);
+                                     nir_metadata_dominance |
+                                     nir_metadata_instr_changes);
    } else {
       nir_metadata_preserve(impl, nir_metadata_all);
    }
@@ -212,6 +212,9 @@ typedef struct {
     * nir_search_variable->cond.
     */
    const nir_search_variable_cond *variable_cond;
+
+   /** Maximum depth of the expressions in the search patterns. */
+   unsigned search_depth;
 } nir_algebraic_table;
 
 /* Note: these must match the start states created in
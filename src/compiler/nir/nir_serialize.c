@@ -22,6 +22,7 @@
  */
 
 #include "nir_serialize.h"
+#include "util/simple_mtx.h"
 #include "util/u_dynarray.h"
 #include "util/u_math.h"
 #include "nir_control_flow.h"
@@ -1969,6 +1970,40 @@ read_xfb_info(read_ctx *ctx)
    return xfb;
 }
 
+/*
+ * Layout of a serialized shader:
+ *
+ *    header   magic, version, object counts, offset of the tail
+ *    toc      offset of each function's impl, or 0 if it has none
+ *    info     shader_info and its strings
+ *    globals  shader variables and function declarations
+ *    impls    one section per function_impl, in function order
+ *    tail     constant data, xfb info and printf info
+ *
+ * Offsets are relative to the header, which is aligned to 8 bytes.  Objects
+ * in an impl are numbered after the global objects, starting over for every
+ * impl, and the "same as last" state is reset at the start of each of them,
+ * so that an impl can be read on its own once the globals are read.
+ */
+#define NIR_SERIALIZE_MAGIC   0x6e697262 /* "nirb" */
+#define NIR_SERIALIZE_VERSION 1
+
+static void
+reset_last_state(write_ctx *ctx)
+{
+   ctx->last_type = NULL;
+   ctx->last_interface_type = NULL;
+   memset(&ctx->last_var_data, 0, sizeof(ctx->last_var_data));
+}
+
+static void
+read_reset_last_state(read_ctx *ctx)
+{
+   ctx->last_type = NULL;
+   ctx->last_interface_type = NULL;
+   memset(&ctx->last_var_data, 0, sizeof(ctx->last_var_data));
+}
+
 /**
  * Serialize NIR into a binary blob.
  *
@@ -1986,7 +2021,20 @@ nir_serialize(struct blob *blob, const nir_shader *nir, bool strip)
    ctx.strip = strip;
    util_dynarray_init(&ctx.phi_fixups, NULL);
 
+   blob_align(blob, 8);
+   size_t start = blob->size;
+
+   unsigned num_functions = exec_list_length(&nir->functions);
+   blob_write_uint32(blob, NIR_SERIALIZE_MAGIC);
+   blob_write_uint32(blob, NIR_SERIALIZE_VERSION);
    size_t idx_size_offset = blob_reserve_uint32(blob);
+   size_t num_globals_offset = blob_reserve_uint32(blob);
+   size_t tail_offset = blob_reserve_uint32(blob);
+   blob_write_uint32(blob, num_functions);
+
+   size_t toc_offset = blob->size;
+   for (unsigned i = 0; i < num_functions; i++)
+      blob_write_uint32(blob, 0);
 
    struct shader_info info = nir->info;
    uint32_t strings = 0;
@@ -2009,15 +2057,31 @@ nir_serialize(struct blob *blob, const nir_shader *nir, bool strip)
    blob_write_uint32(blob, nir->num_outputs);
    blob_write_uint32(blob, nir->scratch_size);
 
-   blob_write_uint32(blob, exec_list_length(&nir->functions));
    nir_foreach_function(fxn, nir) {
       write_function(&ctx, fxn);
    }
 
-   nir_foreach_function_impl(impl, nir) {
-      write_function_impl(&ctx, impl);
+   uint32_t num_global_objects = ctx.next_idx;
+   uint32_t num_objects = num_global_objects;
+
+   unsigned i = 0;
+   nir_foreach_function(fxn, nir) {
+      if (fxn->impl) {
+         ctx.next_idx = num_global_objects;
+         reset_last_state(&ctx);
+
+         blob_overwrite_uint32(blob, toc_offset + i * sizeof(uint32_t),
+                               blob->size - start);
+         write_function_impl(&ctx, fxn->impl);
+
+         num_objects = MAX2(num_objects, ctx.next_idx);
+      }
+      i++;
    }
 
+   blob_align(blob, sizeof(uint32_t));
+   blob_overwrite_uint32(blob, tail_offset, blob->size - start);
+
    blob_write_uint32(blob, nir->constant_data_size);
    if (nir->constant_data_size > 0)
       blob_write_bytes(blob, nir->constant_data, nir->constant_data_size);
@@ -2027,74 +2091,353 @@ nir_serialize(struct blob *blob, const nir_shader *nir, bool strip)
    if (nir->info.uses_printf)
       nir_serialize_printf_info(blob, nir->printf_info, nir->printf_info_count);
 
-   blob_overwrite_uint32(blob, idx_size_offset, ctx.next_idx);
+   blob_overwrite_uint32(blob, idx_size_offset, num_objects);
+   blob_overwrite_uint32(blob, num_globals_offset, num_global_objects);
 
    _mesa_hash_table_destroy(ctx.remap_table, NULL);
    util_dynarray_fini(&ctx.phi_fixups);
 }
 
+struct serialized_header {
+   uint32_t num_objects;
+   uint32_t num_global_objects;
+   uint32_t tail_offset;
+   uint32_t num_functions;
+   const uint8_t *toc;
+};
+
+static bool
+read_header(struct blob_reader *blob, struct serialized_header *header)
+{
+   blob_reader_align(blob, 8);
+
+   if (blob_read_uint32(blob) != NIR_SERIALIZE_MAGIC ||
+       blob_read_uint32(blob) != NIR_SERIALIZE_VERSION) {
+      blob->overrun = true;
+      return false;
+   }
+
+   header->num_objects = blob_read_uint32(blob);
+   header->num_global_objects = blob_read_uint32(blob);
+   header->tail_offset = blob_read_uint32(blob);
+   header->num_functions = blob_read_uint32(blob);
+   header->toc = blob_read_bytes(blob, header->num_functions *
+                                       sizeof(uint32_t));
+
+   return !blob->overrun &&
+          header->num_global_objects <= header->num_objects;
+}
+
+static uint32_t
+read_toc_entry(const struct serialized_header *header, unsigned i)
+{
+   uint32_t offset;
+   memcpy(&offset, header->toc + i * sizeof(uint32_t), sizeof(offset));
+   return offset;
+}
+
+static void
+read_info(struct blob_reader *blob, void *mem_ctx, shader_info *info)
+{
+   uint32_t strings = blob_read_uint32(blob);
+   char *name = (strings & 0x1) ? blob_read_string(blob) : NULL;
+   char *label = (strings & 0x2) ? blob_read_string(blob) : NULL;
+
+   blob_copy_bytes(blob, (uint8_t *)info, sizeof(*info));
+
+   info->name = name ? ralloc_strdup(mem_ctx, name) : NULL;
+   info->label = label ? ralloc_strdup(mem_ctx, label) : NULL;
+}
+
+static void
+read_globals(read_ctx *ctx, unsigned num_functions)
+{
+   read_var_list(ctx, &ctx->nir->variables);
+
+   ctx->nir->num_inputs = blob_read_uint32(ctx->blob);
+   ctx->nir->num_uniforms = blob_read_uint32(ctx->blob);
+   ctx->nir->num_outputs = blob_read_uint32(ctx->blob);
+   ctx->nir->scratch_size = blob_read_uint32(ctx->blob);
+
+   for (unsigned i = 0; i < num_functions; i++)
+      read_function(ctx);
+}
+
+static void
+read_tail(read_ctx *ctx)
+{
+   ctx->nir->constant_data_size = blob_read_uint32(ctx->blob);
+   if (ctx->nir->constant_data_size > 0) {
+      ctx->nir->constant_data =
+         ralloc_size(ctx->nir, ctx->nir->constant_data_size);
+      blob_copy_bytes(ctx->blob, ctx->nir->constant_data,
+                      ctx->nir->constant_data_size);
+   }
+
+   ctx->nir->xfb_info = read_xfb_info(ctx);
+
+   if (ctx->nir->info.uses_printf) {
+      ctx->nir->printf_info =
+         nir_deserialize_printf_info(ctx->nir, ctx->blob,
+                                     &ctx->nir->printf_info_count);
+   }
+}
+
+/**
+ * Deserialize a whole shader written by nir_serialize.
+ *
+ * Returns NULL and marks the blob as overrun if it wasn't written by this
+ * version of nir_serialize.
+ */
 nir_shader *
 nir_deserialize(void *mem_ctx,
                 const struct nir_shader_compiler_options *options,
                 struct blob_reader *blob)
 {
+   struct serialized_header header;
+   if (!read_header(blob, &header))
+      return NULL;
+
    read_ctx ctx = { 0 };
    ctx.blob = blob;
    list_inithead(&ctx.phi_srcs);
-   ctx.idx_table_len = blob_read_uint32(blob);
+   ctx.idx_table_len = header.num_objects;
    ctx.idx_table = calloc(ctx.idx_table_len, sizeof(uintptr_t));
 
-   uint32_t strings = blob_read_uint32(blob);
-   char *name = (strings & 0x1) ? blob_read_string(blob) : NULL;
-   char *label = (strings & 0x2) ? blob_read_string(blob) : NULL;
-
    struct shader_info info;
-   blob_copy_bytes(blob, (uint8_t *)&info, sizeof(info));
+   read_info(blob, NULL, &info);
 
    ctx.nir = nir_shader_create(mem_ctx, info.stage, options, NULL);
 
-   info.name = name ? ralloc_strdup(ctx.nir, name) : NULL;
-   info.label = label ? ralloc_strdup(ctx.nir, label) : NULL;
-
+   ralloc_steal(ctx.nir, (char *)info.name);
+   ralloc_steal(ctx.nir, (char *)info.label);
    ctx.nir->info = info;
 
-   read_var_list(&ctx, &ctx.nir->variables);
+   read_globals(&ctx, header.num_functions);
 
-   ctx.nir->num_inputs = blob_read_uint32(blob);
-   ctx.nir->num_uniforms = blob_read_uint32(blob);
-   ctx.nir->num_outputs = blob_read_uint32(blob);
-   ctx.nir->scratch_size = blob_read_uint32(blob);
+   nir_foreach_function(fxn, ctx.nir) {
+      if (fxn->impl == NIR_SERIALIZE_FUNC_HAS_IMPL) {
+         ctx.next_idx = header.num_global_objects;
+         read_reset_last_state(&ctx);
+         nir_function_set_impl(fxn, read_function_impl(&ctx));
+      }
+   }
 
-   unsigned num_functions = blob_read_uint32(blob);
-   for (unsigned i = 0; i < num_functions; i++)
-      read_function(&ctx);
+   read_tail(&ctx);
+
+   free(ctx.idx_table);
 
+   nir_validate_shader(ctx.nir, "after deserialize");
+
+   return ctx.nir;
+}
+
+/**
+ * Read only the shader_info of a serialized shader.
+ *
+ * The strings in the info are allocated on mem_ctx.  Returns false if the
+ * data wasn't written by this version of nir_serialize.
+ */
+bool
+nir_deserialize_shader_info(void *mem_ctx, const void *data, size_t size,
+                            shader_info *info)
+{
+   struct blob_reader blob;
+   blob_reader_init(&blob, data, size);
+
+   struct serialized_header header;
+   if (!read_header(&blob, &header))
+      return false;
+
+   read_info(&blob, mem_ctx, info);
+   return !blob.overrun;
+}
+
+struct nir_lazy_shader {
+   nir_shader *shader;
+
+   /* The serialized shader, which is not copied. */
+   const uint8_t *data;
+   size_t size;
+
+   uint32_t num_objects;
+   uint32_t num_global_objects;
+
+   /* Index -> variable or function, for the objects read with the globals. */
+   void **global_objects;
+
+   /* nir_function -> offset of its impl, for the ones not read yet. */
+   struct hash_table *pending_impls;
+
+   /* Function name -> nir_function, for libraries linked by name. */
+   struct hash_table *functions_by_name;
+
+   /* Serializes reading impls, so threads can share a library. */
+   simple_mtx_t lock;
+};
+
+static void
+lazy_shader_destroy(void *ptr)
+{
+   struct nir_lazy_shader *lazy = ptr;
+   simple_mtx_destroy(&lazy->lock);
+}
+
+/**
+ * Deserialize the metadata, variables and function declarations of a
+ * serialized shader, leaving every function_impl to be read on demand by
+ * nir_lazy_shader_get_impl.
+ *
+ * The data is referenced, not copied, so it can come straight from a mapped
+ * cache file.  It must outlive the lazy shader, as well as the variables and
+ * functions of the shader while any impl is still unread.
+ *
+ * Until they are read, functions have a NULL impl, so passes see them as
+ * declarations.  Returns NULL if the data wasn't written by this version of
+ * nir_serialize.
+ */
+struct nir_lazy_shader *
+nir_deserialize_lazy(void *mem_ctx,
+                     const struct nir_shader_compiler_options *options,
+                     const void *data, size_t size)
+{
+   struct blob_reader blob;
+   blob_reader_init(&blob, data, size);
+
+   struct serialized_header header;
+   if (!read_header(&blob, &header) || header.tail_offset >= size)
+      return NULL;
+
+   struct nir_lazy_shader *lazy = rzalloc(mem_ctx, struct nir_lazy_shader);
+   lazy->data = data;
+   lazy->size = size;
+   lazy->num_objects = header.num_objects;
+   lazy->num_global_objects = header.num_global_objects;
+   lazy->pending_impls = _mesa_pointer_hash_table_create(lazy);
+   lazy->functions_by_name = _mesa_hash_table_create(lazy, _mesa_hash_string,
+                                                     _mesa_key_string_equal);
+   simple_mtx_init(&lazy->lock, mtx_plain);
+   ralloc_set_destructor(lazy, lazy_shader_destroy);
+
+   read_ctx ctx = { 0 };
+   ctx.blob = &blob;
+   list_inithead(&ctx.phi_srcs);
+   ctx.idx_table_len = header.num_global_objects;
+   ctx.idx_table = ralloc_array(lazy, void *, ctx.idx_table_len);
+
+   struct shader_info info;
+   read_info(&blob, NULL, &info);
+
+   ctx.nir = nir_shader_create(lazy, info.stage, options, NULL);
+
+   ralloc_steal(ctx.nir, (char *)info.name);
+   ralloc_steal(ctx.nir, (char *)info.label);
+   ctx.nir->info = info;
+
+   read_globals(&ctx, header.num_functions);
+
+   unsigned i = 0;
    nir_foreach_function(fxn, ctx.nir) {
-      if (fxn->impl == NIR_SERIALIZE_FUNC_HAS_IMPL)
-         nir_function_set_impl(fxn, read_function_impl(&ctx));
+      if (fxn->impl == NIR_SERIALIZE_FUNC_HAS_IMPL) {
+         uint32_t offset = read_toc_entry(&header, i);
+         _mesa_hash_table_insert(lazy->pending_impls, fxn,
+                                 (void *)(uintptr_t)offset);
+         fxn->impl = NULL;
+      }
+
+      /* The first function of a name wins, as with
+       * nir_shader_get_function_for_name.
+       */
+      if (fxn->name &&
+          !_mesa_hash_table_search(lazy->functions_by_name, fxn->name))
+         _mesa_hash_table_insert(lazy->functions_by_name, fxn->name, fxn);
+      i++;
    }
 
-   ctx.nir->constant_data_size = blob_read_uint32(blob);
-   if (ctx.nir->constant_data_size > 0) {
-      ctx.nir->constant_data =
-         ralloc_size(ctx.nir, ctx.nir->constant_data_size);
-      blob_copy_bytes(blob, ctx.nir->constant_data,
-                      ctx.nir->constant_data_size);
+   blob.current = blob.data + header.tail_offset;
+   read_tail(&ctx);
+
+   if (blob.overrun) {
+      ralloc_free(lazy);
+      return NULL;
    }
 
-   ctx.nir->xfb_info = read_xfb_info(&ctx);
+   lazy->shader = ctx.nir;
+   lazy->global_objects = ctx.idx_table;
+
+   nir_validate_shader(ctx.nir, "after lazy deserialize");
+
+   return lazy;
+}
+
+nir_shader *
+nir_lazy_shader_get_shader(const struct nir_lazy_shader *lazy)
+{
+   return lazy->shader;
+}
+
+/** Looks a function of the lazy shader up by name, without a linear walk. */
+nir_function *
+nir_lazy_shader_get_function(const struct nir_lazy_shader *lazy,
+                             const char *name)
+{
+   struct hash_entry *entry =
+      _mesa_hash_table_search(lazy->functions_by_name, name);
+   return entry ? entry->data : NULL;
+}
+
+/**
+ * Returns the impl of a function of the lazy shader, reading it first if
+ * needed.  Returns NULL for functions without an impl.
+ *
+ * This may be called from several threads at once, as long as nothing else
+ * modifies the shader.
+ */
+nir_function_impl *
+nir_lazy_shader_get_impl(struct nir_lazy_shader *lazy, nir_function *func)
+{
+   assert(func->shader == lazy->shader);
+
+   simple_mtx_lock(&lazy->lock);
 
-   if (ctx.nir->info.uses_printf) {
-      ctx.nir->printf_info =
-         nir_deserialize_printf_info(ctx.nir, blob,
-                                     &ctx.nir->printf_info_count);
+   struct hash_entry *entry =
+      _mesa_hash_table_search(lazy->pending_impls, func);
+   if (entry == NULL) {
+      simple_mtx_unlock(&lazy->lock);
+      return func->impl;
    }
 
+   struct blob_reader blob;
+   blob_reader_init(&blob, lazy->data, lazy->size);
+   blob.current = blob.data + (uintptr_t)entry->data;
+
+   read_ctx ctx = { 0 };
+   ctx.nir = lazy->shader;
+   ctx.blob = &blob;
+   list_inithead(&ctx.phi_srcs);
+   ctx.idx_table_len = lazy->num_objects;
+   ctx.idx_table = malloc(ctx.idx_table_len * sizeof(void *));
+   memcpy(ctx.idx_table, lazy->global_objects,
+          lazy->num_global_objects * sizeof(void *));
+   ctx.next_idx = lazy->num_global_objects;
+
+   nir_function_set_impl(func, read_function_impl(&ctx));
+   assert(!blob.overrun);
+
    free(ctx.idx_table);
+   _mesa_hash_table_remove(lazy->pending_impls, entry);
 
-   nir_validate_shader(ctx.nir, "after deserialize");
+   simple_mtx_unlock(&lazy->lock);
 
-   return ctx.nir;
+   return func->impl;
+}
+
+/** Reads every function_impl of the lazy shader that wasn't read yet. */
+void
+nir_lazy_shader_materialize(struct nir_lazy_shader *lazy)
+{
+   nir_foreach_function(fxn, lazy->shader)
+      nir_lazy_shader_get_impl(lazy, fxn);
 }
 
 void
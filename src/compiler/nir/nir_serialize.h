@@ -44,6 +44,22 @@ nir_shader *nir_deserialize(void *mem_ctx,
                             const struct nir_shader_compiler_options *options,
                             struct blob_reader *blob);
 
+bool nir_deserialize_shader_info(void *mem_ctx, const void *data, size_t size,
+                                 shader_info *info);
+
+struct nir_lazy_shader;
+
+struct nir_lazy_shader *
+nir_deserialize_lazy(void *mem_ctx,
+                     const struct nir_shader_compiler_options *options,
+                     const void *data, size_t size);
+nir_shader *nir_lazy_shader_get_shader(const struct nir_lazy_shader *lazy);
+nir_function *nir_lazy_shader_get_function(const struct nir_lazy_shader *lazy,
+                                           const char *name);
+nir_function_impl *nir_lazy_shader_get_impl(struct nir_lazy_shader *lazy,
+                                            nir_function *func);
+void nir_lazy_shader_materialize(struct nir_lazy_shader *lazy);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -117,4 +117,210 @@ TEST_F(nir_core_test, nir_instr_free_and_dce_multiple_src_test)
    nir_validate_shader(b->shader, "after remove_and_dce");
 }
 
+TEST_F(nir_core_test, pass_stats)
+{
+#ifdef NDEBUG
+   GTEST_SKIP() << "NIR_DEBUG is only available in debug builds";
+#else
+   uint32_t saved_nir_debug = nir_debug;
+   nir_debug |= NIR_DEBUG_PASS_STATS;
+   nir_pass_stats_reset();
+
+   nir_def *one = nir_imm_int(b, 1);
+   nir_iadd(b, one, one);
+
+   bool progress = false;
+   NIR_PASS(progress, b->shader, nir_opt_dce);
+   NIR_PASS(progress, b->shader, nir_opt_dce);
+   NIR_PASS_V(b->shader, nir_opt_dce);
+
+   nir_debug = saved_nir_debug;
+
+   struct nir_pass_stats stats;
+   ASSERT_TRUE(nir_pass_stats_get("nir_opt_dce", MESA_SHADER_COMPUTE, &stats));
+   EXPECT_EQ(stats.invocations, 3);
+   EXPECT_EQ(stats.progress, 1);
+   EXPECT_EQ(stats.no_progress, 1);
+   EXPECT_EQ(stats.instr_delta, -2);
+   EXPECT_FALSE(nir_pass_stats_get("nir_opt_dce", MESA_SHADER_FRAGMENT, &stats));
+
+   unsigned dce_rows = 0;
+   nir_pass_stats_foreach([](const char *pass, gl_shader_stage stage,
+                             const struct nir_pass_stats *stats, void *data) {
+      if (strcmp(pass, "nir_opt_dce") == 0) {
+         EXPECT_EQ(stage, MESA_SHADER_COMPUTE);
+         EXPECT_EQ(stats->invocations, 3);
+         (*(unsigned *)data)++;
+      }
+   }, &dce_rows);
+   EXPECT_EQ(dce_rows, 1);
+
+   nir_pass_stats_reset();
+   EXPECT_FALSE(nir_pass_stats_get("nir_opt_dce", MESA_SHADER_COMPUTE, &stats));
+#endif
+}
+
+TEST_F(nir_core_test, instr_changes)
+{
+   uint32_t saved_nir_debug = nir_debug;
+   nir_debug &= ~NIR_DEBUG_NO_INCREMENTAL;
+
+   nir_def *x = nir_load_local_invocation_index(b);
+   nir_def *p = nir_iadd(b, x, x);
+   nir_def *q = nir_imul(b, p, p);
+   nir_def *r = nir_ineg(b, q);
+   nir_def *s = nir_iabs(b, r);
+
+   static const char pass = 0;
+   nir_instr_changes changes;
+
+   /* The first run visits everything. */
+   EXPECT_FALSE(nir_instr_changes_begin(b->impl, &pass, 1, &changes));
+   EXPECT_TRUE(nir_instr_changes_has_instr(&changes, s->parent_instr));
+   nir_instr_changes_finish(&changes);
+   nir_metadata_preserve(b->impl, nir_metadata_all);
+
+   EXPECT_TRUE(nir_instr_changes_begin(b->impl, &pass, 1, &changes));
+   EXPECT_EQ(changes.instrs->entries, 0);
+   nir_instr_changes_finish(&changes);
+
+   b->cursor = nir_before_instr(x->parent_instr);
+   nir_def *y = nir_imm_int(b, 3);
+   nir_src_rewrite(&nir_instr_as_alu(q->parent_instr)->src[1].src, y);
+
+   /* The new instruction, the rewritten one, the one that lost a use, and
+    * the users of those.
+    */
+   EXPECT_TRUE(nir_instr_changes_begin(b->impl, &pass, 1, &changes));
+   EXPECT_EQ(changes.instrs->entries, 4);
+   EXPECT_TRUE(nir_instr_changes_has_instr(&changes, y->parent_instr));
+   EXPECT_TRUE(nir_instr_changes_has_instr(&changes, p->parent_instr));
+   EXPECT_TRUE(nir_instr_changes_has_instr(&changes, q->parent_instr));
+   EXPECT_TRUE(nir_instr_changes_has_instr(&changes, r->parent_instr));
+   EXPECT_FALSE(nir_instr_changes_has_instr(&changes, s->parent_instr));
+   EXPECT_FALSE(nir_instr_changes_has_instr(&changes, x->parent_instr));
+   nir_instr_changes_finish(&changes);
+
+   /* Passes that don't preserve the stamps make the next run visit
+    * everything.
+    */
+   nir_metadata_preserve(b->impl, nir_metadata_block_index);
+   EXPECT_FALSE(nir_instr_changes_begin(b->impl, &pass, 1, &changes));
+   nir_instr_changes_finish(&changes);
+
+   nir_debug = saved_nir_debug;
+}
+
+TEST_F(nir_core_test, instr_changes_opt_loop)
+{
+   nir_def *x = nir_load_local_invocation_index(b);
+   nir_def *v = nir_iadd(b, nir_imul(b, x, x), x);
+   nir_def *mov = nir_mov(b, v);
+   nir_def *sum = nir_iadd(b, mov, nir_iadd_imm(b, nir_imm_int(b, 1), 2));
+   nir_store_global(b, nir_imm_int64(b, 0), 4, sum, 0x1);
+
+   /* Full runs. */
+   EXPECT_TRUE(nir_opt_constant_folding(b->shader));
+   EXPECT_TRUE(nir_copy_prop(b->shader));
+   nir_opt_algebraic(b->shader);
+   ASSERT_TRUE(b->impl->valid_metadata & nir_metadata_instr_changes);
+
+   /* Something the incremental runs have to find again: (x + 0) * 1. */
+   b->cursor = nir_after_instr(x->parent_instr);
+   nir_def *mul = nir_imul(b, nir_iadd_imm(b, x, 0), nir_imm_int(b, 1));
+   nir_src_rewrite(&nir_instr_as_alu(v->parent_instr)->src[1].src, mul);
+
+   bool progress;
+   do {
+      progress = false;
+      progress |= nir_opt_constant_folding(b->shader);
+      progress |= nir_copy_prop(b->shader);
+      progress |= nir_opt_algebraic(b->shader);
+      progress |= nir_opt_dce(b->shader);
+   } while (progress);
+
+   nir_validate_shader(b->shader, "after incremental optimization");
+
+   nir_foreach_block(block, b->impl) {
+      nir_foreach_instr(instr, block) {
+         if (instr->type != nir_instr_type_alu)
+            continue;
+
+         nir_alu_instr *alu = nir_instr_as_alu(instr);
+         EXPECT_NE(alu->op, nir_op_mov);
+         for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+            EXPECT_FALSE(nir_src_is_const(alu->src[i].src) &&
+                         alu->op == nir_op_iadd &&
+                         nir_alu_src_as_uint(alu->src[i]) == 0);
+            EXPECT_FALSE(nir_src_is_const(alu->src[i].src) &&
+                         alu->op == nir_op_imul &&
+                         nir_alu_src_as_uint(alu->src[i]) == 1);
+         }
+      }
+   }
+}
+
+/* Range analysis can find matches further away from a change than the
+ * deepest search pattern.  The incremental runs may miss them, but the
+ * optimization loop must not stop before a full run found them.
+ */
+TEST_F(nir_core_test, instr_changes_range_analysis)
+{
+   uint32_t saved_nir_debug = nir_debug;
+   nir_debug &= ~NIR_DEBUG_NO_INCREMENTAL;
+#ifndef NDEBUG
+   nir_debug |= NIR_DEBUG_PASS_STATS;
+   nir_pass_stats_reset();
+#endif
+
+   /* fabs(v) of a v of unknown sign, a long chain of fadd(v, v) away from
+    * where its sign comes from.
+    */
+   nir_def *index = nir_load_local_invocation_index(b);
+   nir_def *signed_val = nir_i2f32(b, index);
+   nir_def *v = signed_val;
+   nir_def *first = NULL;
+   for (unsigned i = 0; i < 20; i++) {
+      v = nir_fadd(b, v, v);
+      if (first == NULL)
+         first = v;
+   }
+   nir_store_global(b, nir_imm_int64(b, 0), 4, nir_fabs(b, v), 0x1);
+
+   bool progress = false;
+   NIR_PASS(progress, b->shader, nir_opt_algebraic);
+   ASSERT_TRUE(b->impl->valid_metadata & nir_metadata_instr_changes);
+
+   /* Make v non-negative at the start of the chain. */
+   b->cursor = nir_after_instr(signed_val->parent_instr);
+   nir_def *unsigned_val = nir_u2f32(b, index);
+   nir_alu_instr *first_alu = nir_instr_as_alu(first->parent_instr);
+   nir_src_rewrite(&first_alu->src[0].src, unsigned_val);
+   nir_src_rewrite(&first_alu->src[1].src, unsigned_val);
+
+   do {
+      progress = false;
+      NIR_PASS(progress, b->shader, nir_opt_algebraic);
+      NIR_PASS(progress, b->shader, nir_opt_dce);
+   } while (progress);
+
+   nir_debug = saved_nir_debug;
+
+   nir_foreach_block(block, b->impl) {
+      nir_foreach_instr(instr, block) {
+         EXPECT_FALSE(instr->type == nir_instr_type_alu &&
+                      nir_instr_as_alu(instr)->op == nir_op_fabs);
+      }
+   }
+
+#ifndef NDEBUG
+   struct nir_pass_stats stats;
+   ASSERT_TRUE(nir_pass_stats_get("nir_opt_algebraic", MESA_SHADER_COMPUTE,
+                                  &stats));
+   EXPECT_GE(stats.incremental, 1);
+   EXPECT_GE(stats.forced_full, 1);
+   nir_pass_stats_reset();
+#endif
+}
+
 }
@@ -0,0 +1,175 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "nir_test.h"
+
+class nir_opt_gvn_test : public nir_test {
+protected:
+   nir_opt_gvn_test();
+
+   void break_if(nir_def *cond);
+   nir_def *load_ubo(unsigned binding, enum gl_access_qualifier access);
+
+   nir_def *in_def;
+   nir_def *index_def;
+};
+
+nir_opt_gvn_test::nir_opt_gvn_test()
+   : nir_test::nir_test("nir_opt_gvn_test")
+{
+   in_def = nir_load_local_invocation_index(b);
+   index_def = nir_load_workgroup_id(b);
+}
+
+void
+nir_opt_gvn_test::break_if(nir_def *cond)
+{
+   nir_push_if(b, cond);
+   nir_jump(b, nir_jump_break);
+   nir_pop_if(b, NULL);
+}
+
+nir_def *
+nir_opt_gvn_test::load_ubo(unsigned binding, enum gl_access_qualifier access)
+{
+   nir_def *def = nir_load_ubo(b, 1, 32, nir_imm_int(b, binding), in_def);
+   nir_intrinsic_instr *load = nir_instr_as_intrinsic(def->parent_instr);
+   nir_intrinsic_set_access(load, access);
+   nir_intrinsic_set_range(load, ~0);
+   return def;
+}
+
+static nir_def *
+load_ssbo(nir_builder *b, nir_def *offset, enum gl_access_qualifier access)
+{
+   nir_def *def = nir_load_ssbo(b, 1, 32, nir_imm_int(b, 0), offset);
+   nir_intrinsic_set_access(nir_instr_as_intrinsic(def->parent_instr), access);
+   return def;
+}
+
+static void
+use(nir_builder *b, nir_def *def)
+{
+   nir_store_global(b, nir_imm_int64(b, 0), 4, def, 0x1);
+}
+
+TEST_F(nir_opt_gvn_test, dominating_only)
+{
+   nir_def *a = nir_iadd(b, in_def, in_def);
+
+   nir_push_if(b, nir_ieq_imm(b, in_def, 0));
+   nir_def *then_def = nir_imul(b, in_def, in_def);
+   nir_def *dup = nir_iadd(b, in_def, in_def);
+   use(b, dup);
+   use(b, then_def);
+   nir_push_else(b, NULL);
+   nir_def *else_def = nir_imul(b, in_def, in_def);
+   use(b, else_def);
+   nir_pop_if(b, NULL);
+
+   ASSERT_TRUE(nir_opt_gvn(b->shader, false));
+   nir_validate_shader(b->shader, NULL);
+
+   /* The add in the then block is replaced, but the multiplications in the
+    * two branches don't dominate each other.
+    */
+   EXPECT_TRUE(list_is_empty(&dup->uses));
+   EXPECT_FALSE(list_is_empty(&a->uses));
+   EXPECT_FALSE(list_is_empty(&then_def->uses));
+   EXPECT_FALSE(list_is_empty(&else_def->uses));
+}
+
+TEST_F(nir_opt_gvn_test, hoist_invariant_alu)
+{
+   nir_def *before = nir_imul(b, in_def, index_def);
+
+   nir_loop *loop = nir_push_loop(b);
+   nir_def *counter = nir_iadd_imm(b, in_def, 1);
+   break_if(nir_ieq_imm(b, counter, 7));
+   nir_def *invariant = nir_imul(b, in_def, index_def);
+   nir_def *scaled = nir_iadd_imm(b, invariant, 3);
+   use(b, nir_iadd(b, scaled, counter));
+   nir_pop_loop(b, loop);
+
+   ASSERT_TRUE(nir_opt_gvn(b->shader, true));
+   nir_validate_shader(b->shader, NULL);
+
+   nir_block *preheader = nir_cf_node_as_block(nir_cf_node_prev(&loop->cf_node));
+
+   /* The multiplication is replaced by the one before the loop, and the add
+    * of a constant follows it out with a copy of the constant.
+    */
+   EXPECT_TRUE(list_is_empty(&invariant->uses));
+   EXPECT_EQ(scaled->parent_instr->block, preheader);
+   EXPECT_EQ(nir_instr_as_alu(scaled->parent_instr)->src[0].src.ssa, before);
+   EXPECT_EQ(nir_instr_as_alu(scaled->parent_instr)->src[1].src.ssa->parent_instr->block,
+             preheader);
+
+   /* Instructions before a break are hoisted too. */
+   EXPECT_EQ(counter->parent_instr->block, preheader);
+}
+
+TEST_F(nir_opt_gvn_test, hoist_loads_run_on_first_iteration)
+{
+   nir_loop *loop = nir_push_loop(b);
+   nir_def *first = load_ubo(0, (gl_access_qualifier)0);
+   break_if(nir_ieq_imm(b, first, 0));
+   nir_def *conditional = load_ubo(1, (gl_access_qualifier)0);
+   nir_def *speculated = load_ubo(2, ACCESS_CAN_SPECULATE);
+   use(b, nir_iadd(b, conditional, speculated));
+   nir_pop_loop(b, loop);
+
+   ASSERT_TRUE(nir_opt_gvn(b->shader, true));
+   nir_validate_shader(b->shader, NULL);
+
+   nir_block *preheader = nir_cf_node_as_block(nir_cf_node_prev(&loop->cf_node));
+
+   /* The second load could fault if the loop was left before it. */
+   EXPECT_EQ(first->parent_instr->block, preheader);
+   EXPECT_NE(conditional->parent_instr->block, preheader);
+   EXPECT_EQ(speculated->parent_instr->block, preheader);
+}
+
+TEST_F(nir_opt_gvn_test, ssbo_loads)
+{
+   nir_def *offset = nir_imm_int(b, 16);
+   nir_def *a = load_ssbo(b, offset, ACCESS_CAN_REORDER);
+   nir_def *b_def = load_ssbo(b, offset, ACCESS_CAN_REORDER);
+   nir_def *c = load_ssbo(b, offset, (gl_access_qualifier)0);
+   nir_def *d = load_ssbo(b, offset, (gl_access_qualifier)0);
+   use(b, nir_iadd(b, nir_iadd(b, a, b_def), nir_iadd(b, c, d)));
+
+   ASSERT_TRUE(nir_opt_gvn(b->shader, false));
+   nir_validate_shader(b->shader, NULL);
+
+   /* Only the loads known not to alias with stores are numbered. */
+   EXPECT_TRUE(list_is_empty(&b_def->uses));
+   EXPECT_FALSE(list_is_empty(&c->uses));
+   EXPECT_FALSE(list_is_empty(&d->uses));
+}
+
+TEST_F(nir_opt_gvn_test, hoist_out_of_nested_loops)
+{
+   nir_loop *outer = nir_push_loop(b);
+   break_if(nir_ieq_imm(b, nir_load_subgroup_invocation(b), 3));
+
+   nir_loop *inner = nir_push_loop(b);
+   nir_def *load = load_ubo(0, (gl_access_qualifier)0);
+   nir_def *invariant = nir_fmul(b, load, load);
+   break_if(nir_feq_imm(b, invariant, 1.0));
+   nir_pop_loop(b, inner);
+
+   nir_pop_loop(b, outer);
+
+   ASSERT_TRUE(nir_opt_gvn(b->shader, true));
+   nir_validate_shader(b->shader, NULL);
+
+   /* The load is on the first iteration of the inner loop, but the inner
+    * loop is after a break in the outer one.
+    */
+   nir_block *inner_preheader =
+      nir_cf_node_as_block(nir_cf_node_prev(&inner->cf_node));
+   EXPECT_EQ(load->parent_instr->block, inner_preheader);
+   EXPECT_EQ(invariant->parent_instr->block, inner_preheader);
+}
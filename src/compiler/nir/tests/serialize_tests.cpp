@@ -195,3 +195,135 @@ TEST_P(nir_serialize_all_but_one_test, single_channel)
 
    ASSERT_SWIZZLE_EQ(vec_alu, vec_alu_dup, 1, 0);
 }
+
+TEST_F(nir_serialize_test, lazy_functions)
+{
+   nir_variable *global =
+      nir_variable_create(b->shader, nir_var_mem_shared, glsl_uint_type(),
+                          "global");
+
+   nir_function *helper = nir_function_create(b->shader, "helper");
+   nir_function_impl *helper_impl = nir_function_impl_create(helper);
+   nir_builder hb = nir_builder_at(nir_after_impl(helper_impl));
+   nir_variable *local =
+      nir_local_variable_create(helper_impl, glsl_uint_type(), "local");
+   nir_store_var(&hb, local, nir_load_var(&hb, global), 0x1);
+   nir_store_var(&hb, global, nir_iadd_imm(&hb, nir_load_var(&hb, local), 1),
+                 0x1);
+
+   nir_store_var(b, global, nir_imm_int(b, 7), 0x1);
+   nir_call(b, helper);
+
+   struct blob blob;
+   blob_init(&blob);
+   nir_serialize(&blob, b->shader, false);
+
+   shader_info info;
+   ASSERT_TRUE(nir_deserialize_shader_info(b->shader, blob.data, blob.size,
+                                           &info));
+   EXPECT_EQ(info.stage, MESA_SHADER_COMPUTE);
+   EXPECT_STREQ(info.name, "serialize test");
+
+   struct nir_lazy_shader *lazy =
+      nir_deserialize_lazy(b->shader, &options, blob.data, blob.size);
+   ASSERT_NE(lazy, nullptr);
+   dup = nir_lazy_shader_get_shader(lazy);
+
+   nir_function *dup_main = nir_shader_get_function_for_name(dup, "main");
+   nir_function *dup_helper = nir_shader_get_function_for_name(dup, "helper");
+   EXPECT_EQ(dup_main->impl, nullptr);
+   EXPECT_EQ(dup_helper->impl, nullptr);
+
+   /* Impls are read one at a time. */
+   EXPECT_NE(nir_lazy_shader_get_impl(lazy, dup_helper), nullptr);
+   EXPECT_EQ(dup_main->impl, nullptr);
+   EXPECT_EQ(nir_lazy_shader_get_impl(lazy, dup_helper), dup_helper->impl);
+
+   nir_lazy_shader_materialize(lazy);
+   nir_validate_shader(dup, "after materializing");
+
+   EXPECT_STREQ(nir_shader_as_str(b->shader, b->shader),
+                nir_shader_as_str(dup, b->shader));
+
+   blob_finish(&blob);
+}
+
+TEST_F(nir_serialize_test, link_lazy_library)
+{
+   nir_variable *global =
+      nir_variable_create(b->shader, nir_var_mem_shared, glsl_uint_type(),
+                          "global");
+
+   nir_function *dep = nir_function_create(b->shader, "dep");
+   nir_builder db = nir_builder_at(nir_after_impl(nir_function_impl_create(dep)));
+   nir_store_var(&db, global, nir_imm_int(&db, 3), 0x1);
+
+   nir_function *used = nir_function_create(b->shader, "used");
+   nir_builder ub = nir_builder_at(nir_after_impl(nir_function_impl_create(used)));
+   nir_call(&ub, dep);
+
+   nir_function *unused = nir_function_create(b->shader, "unused");
+   nir_builder nb = nir_builder_at(nir_after_impl(nir_function_impl_create(unused)));
+   nir_store_var(&nb, global, nir_imm_int(&nb, 4), 0x1);
+
+   struct blob blob;
+   blob_init(&blob);
+   nir_serialize(&blob, b->shader, false);
+
+   struct nir_lazy_shader *lazy =
+      nir_deserialize_lazy(b->shader, &options, blob.data, blob.size);
+   ASSERT_NE(lazy, nullptr);
+   dup = nir_lazy_shader_get_shader(lazy);
+
+   nir_function *lib_unused = nir_lazy_shader_get_function(lazy, "unused");
+   ASSERT_NE(lib_unused, nullptr);
+   EXPECT_EQ(lib_unused, nir_shader_get_function_for_name(dup, "unused"));
+   EXPECT_EQ(nir_lazy_shader_get_function(lazy, "missing"), nullptr);
+
+   nir_builder kb = nir_builder_init_simple_shader(MESA_SHADER_KERNEL, &options,
+                                                   "kernel");
+   nir_call(&kb, nir_function_create(kb.shader, "used"));
+
+   ASSERT_TRUE(nir_link_shader_functions_lazy(kb.shader, lazy));
+   nir_validate_shader(kb.shader, "after linking");
+
+   /* The called functions are linked, with their callees and variables, and
+    * the other ones were never read.
+    */
+   nir_function *kernel_used = nir_shader_get_function_for_name(kb.shader, "used");
+   nir_function *kernel_dep = nir_shader_get_function_for_name(kb.shader, "dep");
+   EXPECT_NE(kernel_used->impl, nullptr);
+   ASSERT_NE(kernel_dep, nullptr);
+   EXPECT_NE(kernel_dep->impl, nullptr);
+   EXPECT_EQ(nir_shader_get_function_for_name(kb.shader, "unused"), nullptr);
+   EXPECT_FALSE(exec_list_is_empty(&kb.shader->variables));
+   EXPECT_EQ(lib_unused->impl, nullptr);
+
+   ralloc_free(kb.shader);
+   blob_finish(&blob);
+}
+
+TEST_F(nir_serialize_test, wrong_version)
+{
+   struct blob blob;
+   blob_init(&blob);
+   nir_serialize(&blob, b->shader, false);
+
+   /* Bump the version after the magic. */
+   blob.data[4]++;
+
+   struct blob_reader reader;
+   blob_reader_init(&reader, blob.data, blob.size);
+   EXPECT_EQ(nir_deserialize(b->shader, &options, &reader), nullptr);
+   EXPECT_TRUE(reader.overrun);
+
+   EXPECT_EQ(nir_deserialize_lazy(b->shader, &options, blob.data, blob.size),
+             nullptr);
+
+   shader_info info;
+   EXPECT_FALSE(nir_deserialize_shader_info(b->shader, blob.data, blob.size,
+                                            &info));
+
+   dup = b->shader;
+   blob_finish(&blob);
+}
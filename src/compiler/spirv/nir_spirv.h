@@ -106,6 +106,11 @@ struct spirv_to_nir_options {
 
    const nir_shader *clc_shader;
 
+   /** libclc loaded with nir_load_libclc_lazy, used instead of clc_shader
+    * when set.  Its functions are looked up by name through an index.
+    */
+   const struct nir_lazy_shader *clc_library;
+
    struct {
       void (*func)(void *private_data,
                    enum nir_spirv_debug_level level,
@@ -0,0 +1,592 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Compile-time benchmark for the SPIR-V frontend and NIR.
+ *
+ * Translates every entry point of every SPIR-V module found in the given
+ * files and directories with spirv_to_nir, then runs the generic part of a
+ * backend's NIR pipeline on the result: inlining, lowering variables to
+ * SSA, the usual optimization loop and going out of SSA.  Both steps are
+ * timed.  On Linux, the peak RSS of the process is reset before each shader
+ * so that how far a shader raised it above the RSS it started from can be
+ * reported per shader.
+ *
+ * With --passes, the time spent in each NIR pass is reported as well,
+ * using the statistics NIR_DEBUG=pass_stats collects.  These are only
+ * available in debug builds.
+ *
+ * With --json, a single JSON object is printed instead of the table, for
+ * tracking regressions with scripts.
+ *
+ * Usage: spirv_bench [--iterations N] [--passes] [--json] file|dir...
+ */
+
+#include "nir.h"
+#include "nir_spirv.h"
+#include "spirv.h"
+#include "vtn_private.h"
+#include "util/os_file.h"
+#include "util/os_time.h"
+#include "util/u_dynarray.h"
+
+#include <dirent.h>
+#include <getopt.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+struct bench_shader {
+   const char *filename;
+   const char *entry_point;
+   gl_shader_stage stage;
+
+   bool failed;
+   unsigned num_instrs;
+   int64_t spirv_ns;
+   int64_t nir_ns;
+   uint64_t rss_delta_kb;
+};
+
+struct bench_totals {
+   unsigned num_shaders;
+   unsigned num_failed;
+   int64_t spirv_ns;
+   int64_t nir_ns;
+   uint64_t peak_rss_kb;
+};
+
+/* Whether the peak RSS can be reset and read, so per-shader deltas mean
+ * something.
+ */
+static bool have_rss;
+
+/* Reads a field such as "VmRSS:" of /proc/self/status, in KiB. */
+static bool
+read_status_kb(const char *field, uint64_t *kb)
+{
+   FILE *f = fopen("/proc/self/status", "r");
+   if (f == NULL)
+      return false;
+
+   size_t len = strlen(field);
+   char line[256];
+   bool found = false;
+   while (!found && fgets(line, sizeof(line), f)) {
+      if (strncmp(line, field, len) == 0)
+         found = sscanf(line + len, "%" SCNu64, kb) == 1;
+   }
+
+   fclose(f);
+   return found;
+}
+
+/* Resets the peak RSS of the process to its current RSS, after handing
+ * the memory freed by the previous shader back to the system so that it
+ * isn't reused without showing up in the next delta.
+ */
+static bool
+reset_peak_rss(void)
+{
+#ifdef __GLIBC__
+   malloc_trim(0);
+#endif
+
+   FILE *f = fopen("/proc/self/clear_refs", "w");
+   if (f == NULL)
+      return false;
+
+   bool ok = fputs("5", f) >= 0;
+   return fclose(f) == 0 && ok;
+}
+
+static int
+compare_strings(const void *a, const void *b)
+{
+   return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static bool
+has_suffix(const char *s, const char *suffix)
+{
+   size_t len = strlen(s), suffix_len = strlen(suffix);
+   return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+/* Appends the .spv files under path to files, recursing into directories
+ * in name order, so the order of the report doesn't depend on the order of
+ * directory entries on disk.
+ */
+static void
+collect_files(void *mem_ctx, const char *path, struct util_dynarray *files)
+{
+   struct stat st;
+   if (stat(path, &st) != 0) {
+      perror(path);
+      return;
+   }
+
+   if (!S_ISDIR(st.st_mode)) {
+      util_dynarray_append(files, const char *, ralloc_strdup(mem_ctx, path));
+      return;
+   }
+
+   DIR *dir = opendir(path);
+   if (dir == NULL) {
+      perror(path);
+      return;
+   }
+
+   struct util_dynarray entries;
+   util_dynarray_init(&entries, mem_ctx);
+
+   struct dirent *entry;
+   while ((entry = readdir(dir)) != NULL) {
+      if (entry->d_name[0] == '.')
+         continue;
+
+      char *child = ralloc_asprintf(mem_ctx, "%s/%s", path, entry->d_name);
+      if (stat(child, &st) != 0)
+         continue;
+
+      if (S_ISDIR(st.st_mode) || has_suffix(entry->d_name, ".spv"))
+         util_dynarray_append(&entries, const char *, child);
+   }
+   closedir(dir);
+
+   qsort(entries.data,
+         util_dynarray_num_elements(&entries, const char *),
+         sizeof(const char *), compare_strings);
+
+   util_dynarray_foreach(&entries, const char *, child)
+      collect_files(mem_ctx, *child, files);
+}
+
+static void
+add_entry_points(void *mem_ctx, const char *filename,
+                 const uint32_t *words, size_t word_count,
+                 struct util_dynarray *shaders)
+{
+   const uint32_t *w = words + 5;
+   const uint32_t *end = words + word_count;
+   bool seen_entry_point = false;
+
+   while (w < end) {
+      SpvOp opcode = w[0] & SpvOpCodeMask;
+      unsigned count = w[0] >> SpvWordCountShift;
+      if (count == 0 || w + count > end)
+         break;
+
+      if (opcode == SpvOpEntryPoint) {
+         seen_entry_point = true;
+
+         /* The name is a nul-terminated literal starting at the fourth
+          * word.  Copy it, as the module is freed before the results are
+          * printed.
+          */
+         if (count <= 3)
+            break;
+
+         const char *name = (const char *)&w[3];
+         size_t max_len = (count - 3) * sizeof(uint32_t);
+         size_t len = strnlen(name, max_len);
+         if (len == max_len) {
+            fprintf(stderr, "%s: malformed OpEntryPoint\n", filename);
+            break;
+         }
+
+         struct bench_shader shader = {
+            .filename = filename,
+            .entry_point = ralloc_strndup(mem_ctx, name, len),
+            .stage = vtn_stage_for_execution_model(w[1]),
+         };
+         util_dynarray_append(shaders, struct bench_shader, shader);
+      } else if (seen_entry_point) {
+         break;
+      }
+
+      w += count;
+   }
+}
+
+static bool
+optimize(nir_shader *nir)
+{
+   bool progress = false;
+
+   NIR_PASS(progress, nir, nir_opt_dce);
+   NIR_PASS(progress, nir, nir_opt_cse);
+   NIR_PASS(progress, nir, nir_opt_dead_cf);
+   NIR_PASS(progress, nir, nir_lower_vars_to_ssa);
+   NIR_PASS(progress, nir, nir_copy_prop);
+   NIR_PASS(progress, nir, nir_opt_deref);
+   NIR_PASS(progress, nir, nir_opt_constant_folding);
+   NIR_PASS(progress, nir, nir_opt_copy_prop_vars);
+   NIR_PASS(progress, nir, nir_opt_dead_write_vars);
+   NIR_PASS(progress, nir, nir_opt_combine_stores, nir_var_all);
+   NIR_PASS(progress, nir, nir_remove_dead_variables, nir_var_function_temp,
+            NULL);
+   NIR_PASS(progress, nir, nir_opt_algebraic);
+   NIR_PASS(progress, nir, nir_opt_if, 0);
+   NIR_PASS(progress, nir, nir_opt_loop_unroll);
+
+   return progress;
+}
+
+static void
+compile_nir(nir_shader *nir)
+{
+   NIR_PASS_V(nir, nir_lower_variable_initializers, nir_var_function_temp);
+   NIR_PASS_V(nir, nir_lower_returns);
+   NIR_PASS_V(nir, nir_inline_functions);
+   NIR_PASS_V(nir, nir_opt_deref);
+   nir_remove_non_entrypoints(nir);
+
+   NIR_PASS_V(nir, nir_split_var_copies);
+   NIR_PASS_V(nir, nir_lower_vars_to_ssa);
+
+   while (optimize(nir));
+
+   NIR_PASS_V(nir, nir_convert_from_ssa, true);
+}
+
+static unsigned
+count_instrs(nir_shader *nir)
+{
+   unsigned count = 0;
+   nir_foreach_function_impl(impl, nir) {
+      nir_foreach_block(block, impl) {
+         count += exec_list_length(&block->instr_list);
+      }
+   }
+   return count;
+}
+
+static void
+run_shader(struct bench_shader *shader, struct bench_totals *totals,
+           const uint32_t *words, size_t word_count, unsigned iterations)
+{
+   const struct nir_shader_compiler_options nir_opts = {0};
+   struct spirv_to_nir_options spirv_opts = {
+      .environment = NIR_SPIRV_VULKAN,
+   };
+
+   if (shader->stage == MESA_SHADER_KERNEL) {
+      spirv_opts.environment = NIR_SPIRV_OPENCL;
+      spirv_opts.caps.address = true;
+      spirv_opts.caps.float64 = true;
+      spirv_opts.caps.int8 = true;
+      spirv_opts.caps.int16 = true;
+      spirv_opts.caps.int64 = true;
+      spirv_opts.caps.kernel = true;
+   }
+
+   shader->spirv_ns = INT64_MAX;
+   shader->nir_ns = INT64_MAX;
+
+   uint64_t start_rss_kb = 0;
+   if (have_rss)
+      have_rss = reset_peak_rss() && read_status_kb("VmRSS:", &start_rss_kb);
+
+   for (unsigned i = 0; i < iterations; i++) {
+      int64_t start = os_time_get_nano();
+      nir_shader *nir = spirv_to_nir(words, word_count, NULL, 0,
+                                     shader->stage, shader->entry_point,
+                                     &spirv_opts, &nir_opts);
+      int64_t translated = os_time_get_nano();
+
+      if (nir == NULL) {
+         shader->failed = true;
+         break;
+      }
+
+      compile_nir(nir);
+      int64_t compiled = os_time_get_nano();
+
+      shader->spirv_ns = MIN2(shader->spirv_ns, translated - start);
+      shader->nir_ns = MIN2(shader->nir_ns, compiled - translated);
+      shader->num_instrs = count_instrs(nir);
+
+      ralloc_free(nir);
+   }
+
+   uint64_t peak_rss_kb;
+   if (have_rss && read_status_kb("VmHWM:", &peak_rss_kb)) {
+      if (peak_rss_kb > start_rss_kb)
+         shader->rss_delta_kb = peak_rss_kb - start_rss_kb;
+      totals->peak_rss_kb = MAX2(totals->peak_rss_kb, peak_rss_kb);
+   } else {
+      have_rss = false;
+   }
+}
+
+static void
+print_json_string(const char *s)
+{
+   putchar('"');
+   for (; *s; s++) {
+      if (*s == '"' || *s == '\\')
+         printf("\\%c", *s);
+      else if ((unsigned char)*s < 0x20)
+         printf("\\u%04x", *s);
+      else
+         putchar(*s);
+   }
+   putchar('"');
+}
+
+static void
+print_json_pass(const char *pass, gl_shader_stage stage,
+                const struct nir_pass_stats *stats, void *data)
+{
+   bool *first = data;
+
+   printf("%s\n    {\"pass\": ", *first ? "" : ",");
+   print_json_string(pass);
+   printf(", \"stage\": \"%s\", \"invocations\": %" PRIu64
+          ", \"progress\": %" PRIu64 ", \"time_ns\": %" PRIu64
+          ", \"instr_delta\": %" PRId64 "}",
+          _mesa_shader_stage_to_abbrev(stage), stats->invocations,
+          stats->progress, stats->time_ns, stats->instr_delta);
+
+   *first = false;
+}
+
+static void
+print_json(struct util_dynarray *shaders, const struct bench_totals *totals,
+           bool passes)
+{
+   bool first = true;
+
+   printf("{\n  \"shaders\": [");
+   util_dynarray_foreach(shaders, struct bench_shader, shader) {
+      printf("%s\n    {\"file\": ", first ? "" : ",");
+      print_json_string(shader->filename);
+      printf(", \"entry_point\": ");
+      print_json_string(shader->entry_point);
+      printf(", \"stage\": \"%s\", ",
+             _mesa_shader_stage_to_abbrev(shader->stage));
+      if (shader->failed) {
+         printf("\"failed\": true}");
+      } else {
+         printf("\"instrs\": %u, \"spirv_to_nir_ns\": %" PRId64
+                ", \"nir_ns\": %" PRId64, shader->num_instrs,
+                shader->spirv_ns, shader->nir_ns);
+         if (have_rss)
+            printf(", \"rss_delta_kb\": %" PRIu64, shader->rss_delta_kb);
+         printf("}");
+      }
+      first = false;
+   }
+   printf("\n  ],\n");
+
+   printf("  \"total\": {\"shaders\": %u, \"failed\": %u, "
+          "\"spirv_to_nir_ns\": %" PRId64 ", \"nir_ns\": %" PRId64,
+          totals->num_shaders, totals->num_failed, totals->spirv_ns,
+          totals->nir_ns);
+   if (have_rss)
+      printf(", \"peak_rss_kb\": %" PRIu64, totals->peak_rss_kb);
+   printf("}");
+
+   if (passes) {
+      first = true;
+      printf(",\n  \"passes\": [");
+      nir_pass_stats_foreach(print_json_pass, &first);
+      printf("\n  ]");
+   }
+
+   printf("\n}\n");
+}
+
+static void
+print_table(struct util_dynarray *shaders, const struct bench_totals *totals,
+            bool passes)
+{
+   printf("%-40s %-6s %8s %12s %12s", "shader", "stage", "instrs",
+          "spirv ms", "nir ms");
+   if (have_rss)
+      printf(" %10s", "+rss MB");
+   printf("\n");
+
+   util_dynarray_foreach(shaders, struct bench_shader, shader) {
+      const char *name = strrchr(shader->filename, '/');
+      char *label = ralloc_asprintf(NULL, "%s:%s",
+                                    name ? name + 1 : shader->filename,
+                                    shader->entry_point);
+
+      if (shader->failed) {
+         printf("%-40s %-6s %8s\n", label,
+                _mesa_shader_stage_to_abbrev(shader->stage), "FAILED");
+      } else {
+         printf("%-40s %-6s %8u %12.3f %12.3f", label,
+                _mesa_shader_stage_to_abbrev(shader->stage),
+                shader->num_instrs, shader->spirv_ns / 1e6,
+                shader->nir_ns / 1e6);
+         if (have_rss)
+            printf(" %10.1f", shader->rss_delta_kb / 1024.0);
+         printf("\n");
+      }
+
+      ralloc_free(label);
+   }
+
+   printf("%-40s %-6s %8u %12.3f %12.3f", "total", "",
+          totals->num_shaders - totals->num_failed,
+          totals->spirv_ns / 1e6, totals->nir_ns / 1e6);
+   if (have_rss)
+      printf(" %10.1f", totals->peak_rss_kb / 1024.0);
+   printf("\n");
+
+   if (totals->num_failed)
+      printf("%u shaders failed to compile\n", totals->num_failed);
+
+   if (passes) {
+      printf("\n");
+      nir_pass_stats_print(stdout);
+   }
+}
+
+static void
+print_usage(const char *exec_name, FILE *f)
+{
+   fprintf(f,
+           "Usage: %s [options] file|dir...\n"
+           "Options:\n"
+           "  -h, --help              Print this help.\n"
+           "  -n, --iterations <n>    Compile each shader n times and report\n"
+           "                          the fastest run.\n"
+           "  -p, --passes            Report the time spent in each NIR pass\n"
+           "                          (debug builds only).\n"
+           "  -j, --json              Print the results as JSON.\n"
+           "\n"
+           "Directories are searched recursively for .spv files.\n",
+           exec_name);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned iterations = 1;
+   bool passes = false;
+   bool json = false;
+   int ch;
+
+   static struct option long_options[] = {
+      {"help",       no_argument,       0, 'h'},
+      {"iterations", required_argument, 0, 'n'},
+      {"passes",     no_argument,       0, 'p'},
+      {"json",       no_argument,       0, 'j'},
+      {0, 0,                            0, 0}
+   };
+
+   while ((ch = getopt_long(argc, argv, "hn:pj", long_options, NULL)) != -1) {
+      switch (ch) {
+      case 'h':
+         print_usage(argv[0], stdout);
+         return 0;
+      case 'n':
+         iterations = MAX2(atoi(optarg), 1);
+         break;
+      case 'p':
+         passes = true;
+         break;
+      case 'j':
+         json = true;
+         break;
+      default:
+         print_usage(argv[0], stderr);
+         return 1;
+      }
+   }
+
+   if (optind >= argc) {
+      print_usage(argv[0], stderr);
+      return 1;
+   }
+
+   if (passes) {
+#ifndef NDEBUG
+      nir_process_debug_variable();
+      nir_debug |= NIR_DEBUG_PASS_STATS;
+#else
+      fprintf(stderr, "Pass statistics are only collected in debug builds\n");
+      passes = false;
+#endif
+   }
+
+   void *mem_ctx = ralloc_context(NULL);
+
+   struct util_dynarray files, shaders;
+   util_dynarray_init(&files, mem_ctx);
+   util_dynarray_init(&shaders, mem_ctx);
+
+   for (int i = optind; i < argc; i++)
+      collect_files(mem_ctx, argv[i], &files);
+
+   glsl_type_singleton_init_or_ref();
+
+   struct bench_totals totals = {0};
+   have_rss = true;
+
+   util_dynarray_foreach(&files, const char *, filename) {
+      size_t size;
+      char *data = os_read_file(*filename, &size);
+      if (data == NULL) {
+         perror(*filename);
+         totals.num_shaders++;
+         totals.num_failed++;
+         continue;
+      }
+
+      const uint32_t *words = (const uint32_t *)data;
+      size_t word_count = size / 4;
+      if (size % 4 != 0 || word_count < 5 || words[0] != SpvMagicNumber) {
+         fprintf(stderr, "%s: not a SPIR-V module\n", *filename);
+         totals.num_shaders++;
+         totals.num_failed++;
+         free(data);
+         continue;
+      }
+
+      unsigned first = util_dynarray_num_elements(&shaders,
+                                                  struct bench_shader);
+      add_entry_points(mem_ctx, *filename, words, word_count, &shaders);
+
+      unsigned num_shaders = util_dynarray_num_elements(&shaders,
+                                                        struct bench_shader);
+      for (unsigned i = first; i < num_shaders; i++) {
+         struct bench_shader *shader =
+            util_dynarray_element(&shaders, struct bench_shader, i);
+
+         run_shader(shader, &totals, words, word_count, iterations);
+
+         totals.num_shaders++;
+         if (shader->failed) {
+            totals.num_failed++;
+         } else {
+            totals.spirv_ns += shader->spirv_ns;
+            totals.nir_ns += shader->nir_ns;
+         }
+      }
+
+      free(data);
+   }
+
+   if (json)
+      print_json(&shaders, &totals, passes);
+   else
+      print_table(&shaders, &totals, passes);
+
+   /* The statistics were reported above, don't dump them again at exit. */
+   if (passes)
+      nir_pass_stats_reset();
+
+   glsl_type_singleton_decref();
+   ralloc_free(mem_ctx);
+
+   return totals.num_failed ? 1 : 0;
+}
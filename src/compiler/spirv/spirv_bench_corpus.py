@@ -0,0 +1,370 @@
+# SPDX-License-Identifier: MIT
+
+"""Generates the SPIR-V corpus of the spirv_bench benchmark.
+
+The modules are synthetic fragment shaders, each stressing a different part
+of the compiler: long chains of selections, nested loops, large switches and
+call graphs with functions the entry point never calls.  They read a flat
+integer input and write an integer output, so the work they do survives
+dead code elimination.
+
+Usage: spirv_bench_corpus.py output...
+
+Each output is named after its shape, e.g. bench_loops.spv.
+"""
+
+import argparse
+import os
+import struct
+
+# Opcodes
+OP_SOURCE = 3
+OP_NAME = 5
+OP_MEMORY_MODEL = 14
+OP_ENTRY_POINT = 15
+OP_EXECUTION_MODE = 16
+OP_CAPABILITY = 17
+OP_TYPE_VOID = 19
+OP_TYPE_BOOL = 20
+OP_TYPE_INT = 21
+OP_TYPE_POINTER = 32
+OP_TYPE_FUNCTION = 33
+OP_CONSTANT = 43
+OP_FUNCTION = 54
+OP_FUNCTION_PARAMETER = 55
+OP_FUNCTION_END = 56
+OP_FUNCTION_CALL = 57
+OP_VARIABLE = 59
+OP_LOAD = 61
+OP_STORE = 62
+OP_DECORATE = 71
+OP_IADD = 128
+OP_ISUB = 130
+OP_IMUL = 132
+OP_IEQUAL = 170
+OP_SLESS_THAN = 177
+OP_SHIFT_LEFT_LOGICAL = 196
+OP_BITWISE_XOR = 198
+OP_BITWISE_AND = 199
+OP_PHI = 245
+OP_LOOP_MERGE = 246
+OP_SELECTION_MERGE = 247
+OP_LABEL = 248
+OP_BRANCH = 249
+OP_BRANCH_CONDITIONAL = 250
+OP_SWITCH = 251
+OP_RETURN = 253
+OP_RETURN_VALUE = 254
+
+CAPABILITY_SHADER = 1
+ADDRESSING_LOGICAL = 0
+MEMORY_MODEL_GLSL450 = 1
+EXECUTION_MODEL_FRAGMENT = 4
+EXECUTION_MODE_ORIGIN_UPPER_LEFT = 7
+STORAGE_CLASS_INPUT = 1
+STORAGE_CLASS_OUTPUT = 3
+DECORATION_FLAT = 14
+DECORATION_LOCATION = 30
+
+
+def string_words(s):
+    data = s.encode() + b'\0'
+    data += b'\0' * (-len(data) % 4)
+    return list(struct.unpack('<%dI' % (len(data) // 4), data))
+
+
+class Module:
+    def __init__(self):
+        self.bound = 1
+        self.preamble = []
+        self.debug = []
+        self.annotations = []
+        self.globals = []
+        self.functions = []
+        self.constants = {}
+
+        self.void = self.id()
+        self.bool = self.id()
+        self.int = self.id()
+        self.void_fn = self.id()
+        self.int_fn = self.id()
+        self.int_in_ptr = self.id()
+        self.int_out_ptr = self.id()
+        self.global_op(OP_TYPE_VOID, self.void)
+        self.global_op(OP_TYPE_BOOL, self.bool)
+        self.global_op(OP_TYPE_INT, self.int, 32, 1)
+        self.global_op(OP_TYPE_FUNCTION, self.void_fn, self.void)
+        self.global_op(OP_TYPE_FUNCTION, self.int_fn, self.int, self.int)
+        self.global_op(OP_TYPE_POINTER, self.int_in_ptr, STORAGE_CLASS_INPUT,
+                       self.int)
+        self.global_op(OP_TYPE_POINTER, self.int_out_ptr,
+                       STORAGE_CLASS_OUTPUT, self.int)
+
+    def id(self):
+        self.bound += 1
+        return self.bound - 1
+
+    @staticmethod
+    def encode(section, opcode, *operands):
+        section.append(((len(operands) + 1) << 16) | opcode)
+        section.extend(operands)
+
+    def global_op(self, opcode, *operands):
+        self.encode(self.globals, opcode, *operands)
+
+    def op(self, opcode, *operands):
+        self.encode(self.functions, opcode, *operands)
+
+    def const(self, value):
+        if value not in self.constants:
+            c = self.id()
+            self.global_op(OP_CONSTANT, self.int, c, value & 0xffffffff)
+            self.constants[value] = c
+        return self.constants[value]
+
+    def name(self, target, name):
+        self.encode(self.debug, OP_NAME, target, *string_words(name))
+
+    def binop(self, opcode, result_type, a, b):
+        r = self.id()
+        self.op(opcode, result_type, r, a, b)
+        return r
+
+    def label(self, label=None):
+        label = label or self.id()
+        self.op(OP_LABEL, label)
+        return label
+
+    def begin_function(self, name):
+        fn = self.id()
+        self.name(fn, name)
+        self.op(OP_FUNCTION, self.int, fn, 0, self.int_fn)
+        param = self.id()
+        self.op(OP_FUNCTION_PARAMETER, self.int, param)
+        self.label()
+        return fn, param
+
+    def end_function(self, value):
+        self.op(OP_RETURN_VALUE, value)
+        self.op(OP_FUNCTION_END)
+
+    def call(self, fn, arg):
+        r = self.id()
+        self.op(OP_FUNCTION_CALL, self.int, r, fn, arg)
+        return r
+
+    def finish(self, callee):
+        """Adds main(), which calls callee on the input and writes the
+        result to the output, and returns the module as bytes."""
+        main = self.id()
+        inp = self.id()
+        out = self.id()
+        self.name(main, 'main')
+        self.global_op(OP_VARIABLE, self.int_in_ptr, inp, STORAGE_CLASS_INPUT)
+        self.global_op(OP_VARIABLE, self.int_out_ptr, out,
+                       STORAGE_CLASS_OUTPUT)
+        self.encode(self.annotations, OP_DECORATE, inp, DECORATION_FLAT)
+        self.encode(self.annotations, OP_DECORATE, inp, DECORATION_LOCATION, 0)
+        self.encode(self.annotations, OP_DECORATE, out, DECORATION_LOCATION, 0)
+
+        self.op(OP_FUNCTION, self.void, main, 0, self.void_fn)
+        self.label()
+        x = self.id()
+        self.op(OP_LOAD, self.int, x, inp)
+        self.op(OP_STORE, out, self.call(callee, x))
+        self.op(OP_RETURN)
+        self.op(OP_FUNCTION_END)
+
+        self.encode(self.preamble, OP_CAPABILITY, CAPABILITY_SHADER)
+        self.encode(self.preamble, OP_MEMORY_MODEL, ADDRESSING_LOGICAL,
+                    MEMORY_MODEL_GLSL450)
+        self.encode(self.preamble, OP_ENTRY_POINT, EXECUTION_MODEL_FRAGMENT,
+                    main, *string_words('main'), inp, out)
+        self.encode(self.preamble, OP_EXECUTION_MODE, main,
+                    EXECUTION_MODE_ORIGIN_UPPER_LEFT)
+
+        words = [0x07230203, 0x00010000, 0, self.bound, 0]
+        words += self.preamble + self.debug + self.annotations
+        words += self.globals + self.functions
+        return struct.pack('<%dI' % len(words), *words)
+
+
+def diamond(m, v, i):
+    """if (v == i) v = v * 3 + i; else v = (v << 1) ^ i;"""
+    cond = m.binop(OP_IEQUAL, m.bool, v, m.const(i))
+    then_label, else_label, merge = m.id(), m.id(), m.id()
+    m.op(OP_SELECTION_MERGE, merge, 0)
+    m.op(OP_BRANCH_CONDITIONAL, cond, then_label, else_label)
+
+    m.label(then_label)
+    a = m.binop(OP_IADD, m.int, m.binop(OP_IMUL, m.int, v, m.const(3)),
+                m.const(i))
+    m.op(OP_BRANCH, merge)
+
+    m.label(else_label)
+    b = m.binop(OP_BITWISE_XOR, m.int,
+                m.binop(OP_SHIFT_LEFT_LOGICAL, m.int, v, m.const(1)),
+                m.const(i))
+    m.op(OP_BRANCH, merge)
+
+    m.label(merge)
+    r = m.id()
+    m.op(OP_PHI, m.int, r, a, then_label, b, else_label)
+    return r
+
+
+def loop(m, v, trip_count, body):
+    """for (i = 0; i < trip_count; i++) v = body(v, i);"""
+    pre = m.id()
+    m.op(OP_BRANCH, pre)
+    m.label(pre)
+    header, cond_label, body_label, cont, merge = (m.id() for _ in range(5))
+    m.op(OP_BRANCH, header)
+
+    m.label(header)
+    i, acc, i_next, acc_next = m.id(), m.id(), m.id(), m.id()
+    m.op(OP_PHI, m.int, i, m.const(0), pre, i_next, cont)
+    m.op(OP_PHI, m.int, acc, v, pre, acc_next, cont)
+    m.op(OP_LOOP_MERGE, merge, cont, 0)
+    m.op(OP_BRANCH, cond_label)
+
+    m.label(cond_label)
+    cond = m.binop(OP_SLESS_THAN, m.bool, i, trip_count)
+    m.op(OP_BRANCH_CONDITIONAL, cond, body_label, merge)
+
+    m.label(body_label)
+    result = body(acc, i)
+    m.op(OP_BRANCH, cont)
+
+    m.label(cont)
+    m.op(OP_IADD, m.int, i_next, i, m.const(1))
+    m.op(OP_ISUB, m.int, acc_next, result, i)
+    m.op(OP_BRANCH, header)
+
+    m.label(merge)
+    return acc
+
+
+def gen_diamonds():
+    """Functions made of long chains of if/else with phis."""
+    m = Module()
+    fns = []
+    for f in range(40):
+        fn, v = m.begin_function('diamonds%d' % f)
+        for i in range(60):
+            v = diamond(m, v, i * 7 + f)
+        m.end_function(v)
+        fns.append(fn)
+
+    fn, v = m.begin_function('all_diamonds')
+    for callee in fns:
+        v = m.call(callee, v)
+    m.end_function(v)
+    return m.finish(fn)
+
+
+def gen_loops():
+    """Nested loops, with constant and input-dependent trip counts."""
+    m = Module()
+    fns = []
+    for f in range(40):
+        fn, x = m.begin_function('loops%d' % f)
+        limit = m.binop(OP_BITWISE_AND, m.int, x, m.const(31))
+
+        def inner(acc, i, f=f):
+            return diamond(m, m.binop(OP_IADD, m.int, acc, i), f)
+
+        def outer(acc, i, limit=limit, inner=inner):
+            acc = loop(m, acc, m.const(4), inner)
+            return loop(m, m.binop(OP_BITWISE_XOR, m.int, acc, i), limit,
+                        inner)
+
+        v = x
+        for _ in range(4):
+            v = loop(m, v, limit, outer)
+        m.end_function(v)
+        fns.append(fn)
+
+    fn, v = m.begin_function('all_loops')
+    for callee in fns:
+        v = m.call(callee, v)
+    m.end_function(v)
+    return m.finish(fn)
+
+
+def gen_switch():
+    """Large switches, each case doing a little arithmetic."""
+    m = Module()
+    fn, v = m.begin_function('switches')
+    for s in range(30):
+        sel = m.binop(OP_BITWISE_AND, m.int, v, m.const(63))
+        merge = m.id()
+        cases = [m.id() for _ in range(64)]
+        default = m.id()
+        m.op(OP_SELECTION_MERGE, merge, 0)
+        targets = []
+        for c, label in enumerate(cases):
+            targets += [c, label]
+        m.op(OP_SWITCH, sel, default, *targets)
+
+        phi_args = []
+        for c, label in enumerate(cases + [default]):
+            m.label(label)
+            r = m.binop(OP_IMUL, m.int, v, m.const(c * 13 + s + 1))
+            r = m.binop(OP_BITWISE_XOR, m.int, r, m.const(c + s))
+            m.op(OP_BRANCH, merge)
+            phi_args += [r, label]
+
+        m.label(merge)
+        v = m.id()
+        m.op(OP_PHI, m.int, v, *phi_args)
+    m.end_function(v)
+    return m.finish(fn)
+
+
+def gen_calls():
+    """Short call chains, with as many functions main never reaches, like
+    the libraries of helpers shipped with large shaders."""
+    m = Module()
+    chains = []
+    prev = None
+    for f in range(400):
+        fn, v = m.begin_function('helper%d' % f)
+        for i in range(8):
+            v = diamond(m, v, f + i)
+        if f % 10 != 0:
+            v = m.call(prev, v)
+        m.end_function(v)
+        prev = fn
+        if f % 10 == 9 and f < 200:
+            chains.append(fn)
+
+    fn, v = m.begin_function('all_calls')
+    for callee in chains:
+        v = m.call(callee, v)
+    m.end_function(v)
+    return m.finish(fn)
+
+
+SHAPES = {
+    'diamonds': gen_diamonds,
+    'loops': gen_loops,
+    'switch': gen_switch,
+    'calls': gen_calls,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('outputs', nargs='+')
+    args = parser.parse_args()
+
+    for output in args.outputs:
+        shape = os.path.basename(output)
+        shape = shape[len('bench_'):-len('.spv')]
+        with open(output, 'wb') as f:
+            f.write(SHAPES[shape]())
+
+
+if __name__ == '__main__':
+    main()
@@ -2002,7 +2002,7 @@ vtn_handle_type(struct vtn_builder *b, SpvOp opcode,
 static nir_constant *
 vtn_null_constant(struct vtn_builder *b, struct vtn_type *type)
 {
-   nir_constant *c = rzalloc(b, nir_constant);
+   nir_constant *c = vtn_zalloc(b, nir_constant);
 
    switch (type->base_type) {
    case vtn_base_type_scalar:
@@ -2036,7 +2036,7 @@ vtn_null_constant(struct vtn_builder *b, struct vtn_type *type)
       vtn_assert(type->length > 0);
       c->is_null_constant = true;
       c->num_elements = type->length;
-      c->elements = ralloc_array(b, nir_constant *, c->num_elements);
+      c->elements = vtn_alloc_array(b, nir_constant *, c->num_elements);
 
       c->elements[0] = vtn_null_constant(b, type->array_element);
       for (unsigned i = 1; i < c->num_elements; i++)
@@ -2046,7 +2046,7 @@ vtn_null_constant(struct vtn_builder *b, struct vtn_type *type)
    case vtn_base_type_struct:
       c->is_null_constant = true;
       c->num_elements = type->length;
-      c->elements = ralloc_array(b, nir_constant *, c->num_elements);
+      c->elements = vtn_alloc_array(b, nir_constant *, c->num_elements);
       for (unsigned i = 0; i < c->num_elements; i++)
          c->elements[i] = vtn_null_constant(b, type->members[i]);
       break;
@@ -2097,7 +2097,7 @@ vtn_handle_constant(struct vtn_builder *b, SpvOp opcode,
                     const uint32_t *w, unsigned count)
 {
    struct vtn_value *val = vtn_push_value(b, w[2], vtn_value_type_constant);
-   val->constant = rzalloc(b, nir_constant);
+   val->constant = vtn_zalloc(b, nir_constant);
    switch (opcode) {
    case SpvOpConstantTrue:
    case SpvOpConstantFalse:
@@ -2158,7 +2158,7 @@ vtn_handle_constant(struct vtn_builder *b, SpvOp opcode,
                   "%s has %u constituents, expected %u",
                   spirv_op_to_string(opcode), elem_count, expected_length);
 
-      nir_constant **elems = ralloc_array(b, nir_constant *, elem_count);
+      nir_constant **elems = vtn_alloc_array(b, nir_constant *, elem_count);
       val->is_undef_constant = true;
       for (unsigned i = 0; i < elem_count; i++) {
          struct vtn_value *elem_val = vtn_untyped_value(b, w[i + 3]);
@@ -2187,7 +2187,6 @@ vtn_handle_constant(struct vtn_builder *b, SpvOp opcode,
       case vtn_base_type_matrix:
       case vtn_base_type_struct:
       case vtn_base_type_array:
-         ralloc_steal(val->constant, elems);
          val->constant->num_elements = elem_count;
          val->constant->elements = elems;
          break;
@@ -7005,9 +7004,7 @@ spirv_to_nir(const uint32_t *words, size_t word_count,
       b->shader->info.workgroup_size[2] = const_size[2].u32;
    }
 
-   /* Set types on all vtn_values */
-   vtn_foreach_instruction(b, words, word_end, vtn_set_instruction_result_type);
-
+   /* Set types on the vtn_values of the functions and find their blocks */
    vtn_build_cfg(b, words, word_end);
 
    if (!options->create_library) {
@@ -7314,9 +7311,7 @@ spirv_library_to_nir_builder(FILE *fp, const uint32_t *words, size_t word_count,
    words = vtn_foreach_instruction(b, words, word_end,
                                    vtn_handle_variable_or_type_instruction);
 
-   /* Set types on all vtn_values */
-   vtn_foreach_instruction(b, words, word_end, vtn_set_instruction_result_type);
-
+   /* Set types on the vtn_values of the functions and find their blocks */
    vtn_build_cfg(b, words, word_end);
 
    fprintf(fp, "#include \"compiler/nir/nir_builder.h\"\n\n");
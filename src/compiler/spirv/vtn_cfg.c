@@ -169,6 +169,8 @@ bool
 vtn_cfg_handle_prepass_instruction(struct vtn_builder *b, SpvOp opcode,
                                    const uint32_t *w, unsigned count)
 {
+   vtn_set_instruction_result_type(b, opcode, w, count);
+
    switch (opcode) {
    case SpvOpFunction: {
       vtn_assert(b->func == NULL);
@@ -388,16 +390,16 @@ vtn_parse_switch(struct vtn_builder *b,
    _mesa_hash_table_destroy(block_to_case, NULL);
 }
 
+/* Walks the functions once, setting the result types of the instructions
+ * and finding the blocks.  The structured CFG of a function is only built
+ * when it's emitted, so the functions the entry point never calls are not
+ * analysed.
+ */
 void
 vtn_build_cfg(struct vtn_builder *b, const uint32_t *words, const uint32_t *end)
 {
    vtn_foreach_instruction(b, words, end,
                            vtn_cfg_handle_prepass_instruction);
-
-   if (b->shader->info.stage == MESA_SHADER_KERNEL)
-      return;
-
-   vtn_build_structured_cfg(b, words, end);
 }
 
 bool
@@ -639,6 +641,7 @@ vtn_function_emit(struct vtn_builder *b, struct vtn_function *func,
       impl->structured = false;
       vtn_emit_cf_func_unstructured(b, func, instruction_handler);
    } else {
+      vtn_build_structured_cfg(b, func);
       vtn_emit_cf_func_structured(b, func, instruction_handler);
    }
 
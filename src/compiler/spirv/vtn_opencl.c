@@ -26,6 +26,7 @@
 
 #include "math.h"
 #include "nir/nir_builtin_builder.h"
+#include "nir/nir_serialize.h"
 
 #include "util/u_printf.h"
 #include "vtn_private.h"
@@ -146,17 +147,21 @@ static nir_function *mangle_and_find(struct vtn_builder *b,
    nir_function *found = nir_shader_get_function_for_name(b->shader, mname);
 
    /* if not found here find in clc shader and create a decl mirroring it */
-   if (!found && b->options->clc_shader && b->options->clc_shader != b->shader) {
+   if (!found && b->options->clc_library) {
+      found = nir_lazy_shader_get_function(b->options->clc_library, mname);
+   } else if (!found && b->options->clc_shader &&
+              b->options->clc_shader != b->shader) {
       found = nir_shader_get_function_for_name(b->options->clc_shader, mname);
-      if (found) {
-         nir_function *decl = nir_function_create(b->shader, mname);
-         decl->num_params = found->num_params;
-         decl->params = ralloc_array(b->shader, nir_parameter, decl->num_params);
-         for (unsigned i = 0; i < decl->num_params; i++) {
-            decl->params[i] = found->params[i];
-         }
-         found = decl;
+   }
+
+   if (found && found->shader != b->shader) {
+      nir_function *decl = nir_function_create(b->shader, mname);
+      decl->num_params = found->num_params;
+      decl->params = ralloc_array(b->shader, nir_parameter, decl->num_params);
+      for (unsigned i = 0; i < decl->num_params; i++) {
+         decl->params[i] = found->params[i];
       }
+      found = decl;
    }
    if (!found)
       vtn_fail("Can't find clc function %s\n", mname);
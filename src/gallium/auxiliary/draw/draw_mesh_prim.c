@@ -40,8 +40,6 @@
 
 struct draw_mesh_prim
 {
-   struct draw_context *draw;
-
    struct draw_prim_info *output_prims;
    struct draw_vertex_info *output_verts;
 
@@ -60,7 +58,7 @@ add_prim(struct draw_mesh_prim *asmblr, unsigned length)
 {
    struct draw_prim_info *output_prims = asmblr->output_prims;
 
-   output_prims->primitive_lengths = realloc(output_prims->primitive_lengths, sizeof(unsigned) * (output_prims->primitive_count + 1));
+   /* primitive_lengths is sized for every input primitive up front. */
    output_prims->primitive_lengths[output_prims->primitive_count] = length;
    output_prims->primitive_count++;
 }
@@ -173,8 +171,7 @@ prim_tri(struct draw_mesh_prim *asmblr,
 
 
 void
-draw_mesh_prim_run(struct draw_context *draw,
-                   unsigned num_per_prim_inputs,
+draw_mesh_prim_run(unsigned num_per_prim_inputs,
                    void *per_prim_inputs,
                    int cull_prim_idx,
                    const struct draw_prim_info *input_prims,
@@ -202,7 +199,8 @@ draw_mesh_prim_run(struct draw_context *draw,
    output_prims->start = 0;
    output_prims->prim = input_prims->prim;
    output_prims->flags = 0x0;
-   output_prims->primitive_lengths = MALLOC(sizeof(unsigned));
+   output_prims->primitive_lengths =
+      MALLOC(sizeof(unsigned) * MAX2(max_primitives, 1));
    output_prims->primitive_lengths[0] = 0;
    output_prims->primitive_count = 0;
 
@@ -26,13 +26,15 @@
 #ifndef DRAW_MESH_PRIM_H
 #define DRAW_MESH_PRIM_H
 
-struct draw_context;
 struct draw_prim_info;
 struct draw_vertex_info;
 
+/*
+ * Doesn't touch any draw context state, so it may be called from the
+ * driver's worker threads, one mesh workgroup at a time.
+ */
 void
-draw_mesh_prim_run(struct draw_context *draw,
-                   unsigned num_per_prim_inputs,
+draw_mesh_prim_run(unsigned num_per_prim_inputs,
                    void *per_prim_inputs,
                    int cull_prim_idx,
                    const struct draw_prim_info *in_prim_info,
@@ -41,18 +41,49 @@
 #include "util/u_memory.h"
 
 
+/**
+ * A single copy from a vertex into a stream output buffer.  Offsets are in
+ * bytes; src_offset is relative to the vertex header so that it can address
+ * either the attributes or the pre-clip position.
+ */
+struct pt_so_copy {
+   unsigned src_offset;
+   unsigned dst_offset;
+   unsigned size;
+   unsigned buffer;
+};
+
+/**
+ * Stream output layout of one vertex stream, flattened from the
+ * pipe_stream_output_info at prepare time so that emitting a vertex is
+ * just a list of memcpys.  Adjacent components that are contiguous in both
+ * the vertex and the buffer are merged into a single copy.
+ */
+struct pt_so_stream_layout {
+   struct pt_so_copy copies[PIPE_MAX_SO_OUTPUTS];
+   unsigned num_copies;
+
+   /** buffers written by this stream */
+   unsigned buffer_mask;
+   /** end of the furthest write into each buffer, relative to a vertex */
+   unsigned buffer_write_end[PIPE_MAX_SO_BUFFERS];
+};
+
 struct pt_so_emit {
    struct draw_context *draw;
 
    unsigned input_vertex_stride;
-   const float (*inputs)[4];
-   const float *pre_clip_pos;
+   const struct vertex_header *inputs;
    bool has_so;
    bool use_pre_clip_pos;
    int pos_idx;
    unsigned emitted_primitives;
    unsigned generated_primitives;
    unsigned stream;
+
+   /** per-buffer vertex stride in bytes */
+   unsigned buffer_stride[PIPE_MAX_SO_BUFFERS];
+   struct pt_so_stream_layout layout[PIPE_MAX_VERTEX_STREAMS];
 };
 
 
@@ -85,6 +116,59 @@ draw_has_so(const struct draw_context *draw)
    return false;
 }
 
+static void
+so_emit_build_layout(struct pt_so_emit *emit,
+                     const struct pipe_stream_output_info *state)
+{
+   memset(emit->layout, 0, sizeof(emit->layout));
+
+   for (unsigned ob = 0; ob < PIPE_MAX_SO_BUFFERS; ob++)
+      emit->buffer_stride[ob] = state->stride[ob] * sizeof(float);
+
+   for (unsigned slot = 0; slot < state->num_outputs; ++slot) {
+      const struct pipe_stream_output *output = &state->output[slot];
+      struct pt_so_stream_layout *layout = &emit->layout[output->stream];
+      unsigned ob = output->output_buffer;
+      unsigned src_offset;
+
+      /* The pre-clip position is only substituted on stream 0. */
+      if (output->register_index == emit->pos_idx &&
+          emit->use_pre_clip_pos && output->stream == 0) {
+         src_offset = offsetof(struct vertex_header, clip_pos) +
+                      output->start_component * sizeof(float);
+      } else {
+         src_offset = offsetof(struct vertex_header, data) +
+                      (output->register_index * 4 + output->start_component) *
+                      sizeof(float);
+      }
+
+      unsigned dst_offset = output->dst_offset * sizeof(float);
+      unsigned size = output->num_components * sizeof(float);
+
+      layout->buffer_mask |= 1u << ob;
+      layout->buffer_write_end[ob] = MAX2(layout->buffer_write_end[ob],
+                                          dst_offset + size);
+
+      if (layout->num_copies) {
+         struct pt_so_copy *prev = &layout->copies[layout->num_copies - 1];
+         if (prev->buffer == ob &&
+             prev->src_offset + prev->size == src_offset &&
+             prev->dst_offset + prev->size == dst_offset) {
+            prev->size += size;
+            continue;
+         }
+      }
+
+      layout->copies[layout->num_copies++] = (struct pt_so_copy) {
+         .src_offset = src_offset,
+         .dst_offset = dst_offset,
+         .size = size,
+         .buffer = ob,
+      };
+   }
+}
+
+
 void
 draw_pt_so_emit_prepare(struct pt_so_emit *emit, bool use_pre_clip_pos)
 {
@@ -108,8 +192,13 @@ draw_pt_so_emit_prepare(struct pt_so_emit *emit, bool use_pre_clip_pos)
       emit->has_so = has_valid_buffer;
    }
 
-   if (!emit->has_so)
+   if (!emit->has_so) {
+      /* Still used to count generated primitives. */
+      memset(emit->layout, 0, sizeof(emit->layout));
       return;
+   }
+
+   so_emit_build_layout(emit, draw_so_info(draw));
 
    /* XXX: need to flush to get prim_vbuf.c to release its allocation??
     */
@@ -122,112 +211,57 @@ so_emit_prim(struct pt_so_emit *so,
              unsigned *indices,
              unsigned num_vertices)
 {
-   unsigned input_vertex_stride = so->input_vertex_stride;
    struct draw_context *draw = so->draw;
-   const float (*input_ptr)[4];
-   const float *pcp_ptr = NULL;
-   const struct pipe_stream_output_info *state = draw_so_info(draw);
-   int buffer_total_bytes[PIPE_MAX_SO_BUFFERS];
-   bool buffer_written[PIPE_MAX_SO_BUFFERS] = {0};
-
-   input_ptr = so->inputs;
-   if (so->use_pre_clip_pos)
-      pcp_ptr = so->pre_clip_pos;
+   const struct pt_so_stream_layout *layout = &so->layout[so->stream];
+   char *buffer_ptr[PIPE_MAX_SO_BUFFERS];
 
    ++so->generated_primitives;
 
-   for (unsigned i = 0; i < draw->so.num_targets; i++) {
-      struct draw_so_target *target = draw->so.targets[i];
-      if (target) {
-         buffer_total_bytes[i] = target->internal_offset;
-      } else {
-         buffer_total_bytes[i] = 0;
-      }
-   }
-
-   /* check have we space to emit prim first - if not don't do anything */
-   for (unsigned i = 0; i < num_vertices; ++i) {
-      for (unsigned slot = 0; slot < state->num_outputs; ++slot) {
-         unsigned num_comps = state->output[slot].num_components;
-         int ob = state->output[slot].output_buffer;
-         unsigned dst_offset = state->output[slot].dst_offset * sizeof(float);
-         unsigned write_size = num_comps * sizeof(float);
-
-         if (state->output[slot].stream != so->stream)
-            continue;
-         /* If a buffer is missing then that's equivalent to
-          * an overflow */
-         if (!draw->so.targets[ob]) {
-            return;
-         }
-         if ((buffer_total_bytes[ob] + write_size + dst_offset) >
-             draw->so.targets[ob]->target.buffer_size) {
-            return;
-         }
-      }
-      for (unsigned ob = 0; ob < draw->so.num_targets; ++ob) {
-         buffer_total_bytes[ob] += state->stride[ob] * sizeof(float);
-      }
+   /* An empty primitive writes nothing and always fits. */
+   if (num_vertices == 0) {
+      ++so->emitted_primitives;
+      return;
    }
 
-   for (unsigned i = 0; i < num_vertices; ++i) {
-      const float (*input)[4];
-      const float *pre_clip_pos = NULL;
-
-      input = (const float (*)[4])(
-         (const char *)input_ptr + (indices[i] * input_vertex_stride));
-
-      if (pcp_ptr)
-         pre_clip_pos = (const float *)(
-         (const char *)pcp_ptr + (indices[i] * input_vertex_stride));
+   /* Check we have space to emit the whole prim first - if not, don't do
+    * anything.  Every target's offset advances by its stride per vertex, so
+    * only the last vertex of the primitive needs checking.
+    */
+   u_foreach_bit(ob, layout->buffer_mask) {
+      struct draw_so_target *target = draw->so.targets[ob];
 
-      for (unsigned slot = 0; slot < state->num_outputs; ++slot) {
-         unsigned idx = state->output[slot].register_index;
-         unsigned start_comp = state->output[slot].start_component;
-         unsigned num_comps = state->output[slot].num_components;
-         unsigned stream = state->output[slot].stream;
+      /* If a buffer is missing then that's equivalent to an overflow */
+      if (!target)
+         return;
 
-         if (stream != so->stream)
-            continue;
+      if (target->internal_offset +
+          (num_vertices - 1) * so->buffer_stride[ob] +
+          layout->buffer_write_end[ob] > target->target.buffer_size)
+         return;
 
-         unsigned ob = state->output[slot].output_buffer;
-         buffer_written[ob] = true;
+      buffer_ptr[ob] = (char *)target->mapping +
+                       target->target.buffer_offset + target->internal_offset;
+   }
 
-         float *buffer = (float *)((char *)draw->so.targets[ob]->mapping +
-                            draw->so.targets[ob]->target.buffer_offset +
-                            draw->so.targets[ob]->internal_offset) +
-            state->output[slot].dst_offset;
+   for (unsigned i = 0; i < num_vertices; ++i) {
+      const char *input = (const char *)so->inputs +
+                          indices[i] * so->input_vertex_stride;
 
-         if (idx == so->pos_idx && pcp_ptr && so->stream == 0) {
-            memcpy(buffer, &pre_clip_pos[start_comp],
-                   num_comps * sizeof(float));
-         } else {
-            memcpy(buffer, &input[idx][start_comp],
-                   num_comps * sizeof(float));
-         }
+      for (unsigned c = 0; c < layout->num_copies; ++c) {
+         const struct pt_so_copy *copy = &layout->copies[c];
 
-#if 0
-         {
-            debug_printf("VERT[%d], stream = %d, offset = %d, slot[%d] sc = %d, num_c = %d, idx = %d = [",
-                         i, stream,
-                         draw->so.targets[ob]->internal_offset + (4 * state->output[slot].dst_offset),
-                         slot, start_comp, num_comps, idx);
-            for (unsigned j = 0; j < num_comps; ++j) {
-               unsigned *ubuffer = (unsigned*)buffer;
-               debug_printf("%d (0x%x), ", ubuffer[j], ubuffer[j]);
-            }
-            debug_printf("]\n");
-         }
-#endif
+         memcpy(buffer_ptr[copy->buffer] + copy->dst_offset,
+                input + copy->src_offset, copy->size);
       }
 
-      for (unsigned ob = 0; ob < draw->so.num_targets; ++ob) {
-         struct draw_so_target *target = draw->so.targets[ob];
-         if (target && buffer_written[ob]) {
-            target->internal_offset += state->stride[ob] * sizeof(float);
-         }
-      }
+      u_foreach_bit(ob, layout->buffer_mask)
+         buffer_ptr[ob] += so->buffer_stride[ob];
    }
+
+   u_foreach_bit(ob, layout->buffer_mask)
+      draw->so.targets[ob]->internal_offset +=
+         num_vertices * so->buffer_stride[ob];
+
    ++so->emitted_primitives;
 }
 
@@ -304,11 +338,8 @@ draw_pt_so_emit(struct pt_so_emit *emit,
    for (unsigned stream = 0; stream < num_vertex_streams; stream++) {
       emit->emitted_primitives = 0;
       emit->generated_primitives = 0;
-      if (emit->use_pre_clip_pos)
-         emit->pre_clip_pos = input_verts[stream].verts->clip_pos;
-
       emit->input_vertex_stride = input_verts[stream].stride;
-      emit->inputs = (const float (*)[4])input_verts[stream].verts->data;
+      emit->inputs = input_verts[stream].verts;
       emit->stream = stream;
 
       unsigned start, i;
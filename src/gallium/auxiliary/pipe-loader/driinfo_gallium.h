@@ -46,6 +46,7 @@ DRI_CONF_SECTION_DEBUG
    DRI_CONF_TRANSCODE_ETC(false)
    DRI_CONF_TRANSCODE_ASTC(true)
    DRI_CONF_TRANSCODE_CACHE(false)
+   DRI_CONF_DECODE_CACHE(false)
    DRI_CONF_ASTC_FALLBACK(true)
    DRI_CONF_FORCE_GL_VENDOR()
    DRI_CONF_FORCE_GL_RENDERER()
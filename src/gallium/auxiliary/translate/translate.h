@@ -44,6 +44,10 @@
 #include "util/format/u_formats.h"
 #include "pipe/p_state.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Translate has to work on two more attributes because
  * the draw module has to be able to pass a few fixed
@@ -173,4 +177,8 @@ struct translate *translate_generic_create( const struct translate_key *key );
 
 bool translate_generic_is_output_format_supported(enum pipe_format format);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -25,6 +25,8 @@
  *
  **************************************************************************/
 
+#include "util/hash_table.h"
+#include "util/simple_mtx.h"
 #include "util/u_memory.h"
 #include "pipe/p_state.h"
 #include "translate.h"
@@ -104,3 +106,142 @@ struct translate * translate_cache_find(struct translate_cache *cache,
 
    return translate;
 }
+
+
+/*
+ * Process-wide translate program cache.
+ *
+ * All programs live in program_cache.ht.  Programs with no references are
+ * also kept on program_cache.idle, most recently released first, so that
+ * eviction can pop from the tail.  Once the last reference is dropped, i.e.
+ * every translate using a program is gone, the whole cache is freed.
+ */
+static struct {
+   simple_mtx_t lock;
+   struct hash_table *ht;
+   struct list_head idle;
+   unsigned num_programs;
+   unsigned num_refs;
+} program_cache = {
+   .lock = SIMPLE_MTX_INITIALIZER,
+};
+
+static uint32_t
+translate_program_key_hash(const void *key)
+{
+   const struct translate_key *k = key;
+   return _mesa_hash_data(k, translate_keysize(k));
+}
+
+static bool
+translate_program_key_equal(const void *a, const void *b)
+{
+   return translate_key_compare(a, b) == 0;
+}
+
+static void
+translate_program_cache_evict(void)
+{
+   list_for_each_entry_safe_rev(struct translate_program, program,
+                                &program_cache.idle, lru) {
+      if (program_cache.num_programs <= TRANSLATE_PROGRAM_CACHE_SIZE)
+         break;
+
+      assert(program->refcount == 0);
+      list_del(&program->lru);
+      _mesa_hash_table_remove(program_cache.ht,
+         _mesa_hash_table_search_pre_hashed(program_cache.ht, program->hash,
+                                            &program->key));
+      program_cache.num_programs--;
+      program->destroy(program);
+   }
+}
+
+static void
+translate_program_cache_free(void)
+{
+   list_for_each_entry_safe(struct translate_program, program,
+                            &program_cache.idle, lru) {
+      assert(program->refcount == 0);
+      program->destroy(program);
+   }
+
+   _mesa_hash_table_destroy(program_cache.ht, NULL);
+   program_cache.ht = NULL;
+   program_cache.num_programs = 0;
+}
+
+struct translate_program *
+translate_program_cache_get(const struct translate_key *key,
+                            translate_program_create_func create,
+                            void *data)
+{
+   struct translate_program *program = NULL;
+   uint32_t hash = translate_program_key_hash(key);
+
+   simple_mtx_lock(&program_cache.lock);
+
+   if (!program_cache.ht) {
+      program_cache.ht = _mesa_hash_table_create(NULL,
+                                                 translate_program_key_hash,
+                                                 translate_program_key_equal);
+      list_inithead(&program_cache.idle);
+      if (!program_cache.ht)
+         goto out;
+   }
+
+   struct hash_entry *entry =
+      _mesa_hash_table_search_pre_hashed(program_cache.ht, hash, key);
+   if (entry) {
+      program = entry->data;
+      if (program->refcount++ == 0)
+         list_del(&program->lru);
+      program_cache.num_refs++;
+      goto out;
+   }
+
+   /* Generate under the lock so that contexts racing on the same key don't
+    * all compile it.
+    */
+   program = create(key, data);
+   if (!program) {
+      if (program_cache.num_refs == 0)
+         translate_program_cache_free();
+      goto out;
+   }
+
+   program->key = *key;
+   program->hash = hash;
+   program->refcount = 1;
+   list_inithead(&program->lru);
+   program_cache.num_refs++;
+
+   _mesa_hash_table_insert_pre_hashed(program_cache.ht, hash,
+                                      &program->key, program);
+   program_cache.num_programs++;
+   translate_program_cache_evict();
+
+out:
+   simple_mtx_unlock(&program_cache.lock);
+   return program;
+}
+
+void
+translate_program_cache_put(struct translate_program *program)
+{
+   if (!program)
+      return;
+
+   simple_mtx_lock(&program_cache.lock);
+
+   assert(program->refcount > 0);
+   if (--program->refcount == 0) {
+      list_add(&program->lru, &program_cache.idle);
+      translate_program_cache_evict();
+   }
+
+   if (--program_cache.num_refs == 0)
+      translate_program_cache_free();
+
+   simple_mtx_unlock(&program_cache.lock);
+}
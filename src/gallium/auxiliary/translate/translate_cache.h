@@ -24,6 +24,12 @@
 #ifndef _TRANSLATE_CACHE_H
 #define _TRANSLATE_CACHE_H
 
+#include "util/list.h"
+#include "translate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /*******************************************************************************
  * Translate cache.
@@ -51,4 +57,54 @@ void translate_cache_destroy(struct translate_cache *cache);
 struct translate *translate_cache_find(struct translate_cache *cache,
                                        struct translate_key *key);
 
+
+/*******************************************************************************
+ * Translate program cache.
+ * Process-wide, thread-safe cache of the generated code backing translate
+ * objects.  A translate object carries per-user state (buffer pointers,
+ * instance ids) and can't be shared between contexts, but the code generated
+ * for a given translate_key can, so backends that JIT their run functions
+ * look the code up here instead of regenerating it for every context.
+ *
+ * Programs are refcounted.  Unreferenced programs stay cached until the
+ * cache grows past TRANSLATE_PROGRAM_CACHE_SIZE entries, at which point the
+ * least recently used ones are destroyed, and all of them are destroyed
+ * along with the cache itself once the last reference is dropped.
+ */
+#define TRANSLATE_PROGRAM_CACHE_SIZE 256
+
+struct translate_program {
+   struct translate_key key;
+
+   void (*destroy)(struct translate_program *program);
+
+   /* Private to translate_cache.c */
+   uint32_t hash;
+   unsigned refcount;
+   struct list_head lru;
+};
+
+typedef struct translate_program *
+(*translate_program_create_func)(const struct translate_key *key,
+                                 void *data);
+
+/**
+ * Return a referenced program matching the given key, calling create() to
+ * generate one if none is cached.  Returns NULL if create() fails.
+ */
+struct translate_program *
+translate_program_cache_get(const struct translate_key *key,
+                            translate_program_create_func create,
+                            void *data);
+
+/**
+ * Drop a reference obtained through translate_program_cache_get().
+ */
+void
+translate_program_cache_put(struct translate_program *program);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
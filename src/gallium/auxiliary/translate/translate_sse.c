@@ -34,6 +34,7 @@
 #include "util/format/u_format.h"
 
 #include "translate.h"
+#include "translate_cache.h"
 
 
 #if DETECT_ARCH_X86 || DETECT_ARCH_X86_64
@@ -101,14 +102,25 @@ static unsigned uconsts[NUM_UNSIGNED_CONSTS][4] = {
    {0x7fffffff, 0x7fffffff, 0x7fffffff, 0x7fffffff},
 };
 
-struct translate_sse
+/* The generated code only addresses the translate_sse through the machine
+ * pointer passed as its first argument, so it can be shared by every
+ * translate_sse created from the same key.
+ */
+struct translate_sse_program
 {
-   struct translate translate;
+   struct translate_program base;
 
    struct x86_function linear_func;
    struct x86_function elt_func;
    struct x86_function elt16_func;
    struct x86_function elt8_func;
+};
+
+struct translate_sse
+{
+   struct translate translate;
+
+   struct translate_sse_program *program;
    struct x86_function *func;
 
    alignas(16) float consts[NUM_FLOAT_CONSTS][4];
@@ -1489,15 +1501,54 @@ translate_sse_set_buffer(struct translate *translate,
 }
 
 
+static void
+translate_sse_program_destroy(struct translate_program *program)
+{
+   struct translate_sse_program *prog =
+      (struct translate_sse_program *) program;
+
+   x86_release_func(&prog->elt8_func);
+   x86_release_func(&prog->elt16_func);
+   x86_release_func(&prog->elt_func);
+   x86_release_func(&prog->linear_func);
+
+   FREE(prog);
+}
+
+
+static struct translate_program *
+translate_sse_program_create(const struct translate_key *key, void *data)
+{
+   struct translate_sse *p = data;
+   struct translate_sse_program *prog = CALLOC_STRUCT(translate_sse_program);
+   if (!prog)
+      return NULL;
+
+   prog->base.destroy = translate_sse_program_destroy;
+
+   if (!build_vertex_emit(p, &prog->linear_func, 0) ||
+       !build_vertex_emit(p, &prog->elt_func, 4) ||
+       !build_vertex_emit(p, &prog->elt16_func, 2) ||
+       !build_vertex_emit(p, &prog->elt8_func, 1) ||
+       !x86_get_func(&prog->linear_func) ||
+       !x86_get_func(&prog->elt_func) ||
+       !x86_get_func(&prog->elt16_func) ||
+       !x86_get_func(&prog->elt8_func)) {
+      translate_sse_program_destroy(&prog->base);
+      return NULL;
+   }
+
+   return &prog->base;
+}
+
+
 static void
 translate_sse_release(struct translate *translate)
 {
    struct translate_sse *p = (struct translate_sse *) translate;
 
-   x86_release_func(&p->elt8_func);
-   x86_release_func(&p->elt16_func);
-   x86_release_func(&p->elt_func);
-   x86_release_func(&p->linear_func);
+   if (p->program)
+      translate_program_cache_put(&p->program->base);
 
    os_free_aligned(p);
 }
@@ -1566,33 +1617,17 @@ translate_sse2_create(const struct translate_key *key)
    if (0)
       debug_printf("nr_buffers: %d\n", p->nr_buffers);
 
-   if (!build_vertex_emit(p, &p->linear_func, 0))
+   p->program = (struct translate_sse_program *)
+      translate_program_cache_get(key, translate_sse_program_create, p);
+   if (!p->program)
       goto fail;
 
-   if (!build_vertex_emit(p, &p->elt_func, 4))
-      goto fail;
-
-   if (!build_vertex_emit(p, &p->elt16_func, 2))
-      goto fail;
-
-   if (!build_vertex_emit(p, &p->elt8_func, 1))
-      goto fail;
-
-   p->translate.run = (run_func) x86_get_func(&p->linear_func);
-   if (p->translate.run == NULL)
-      goto fail;
-
-   p->translate.run_elts = (run_elts_func) x86_get_func(&p->elt_func);
-   if (p->translate.run_elts == NULL)
-      goto fail;
-
-   p->translate.run_elts16 = (run_elts16_func) x86_get_func(&p->elt16_func);
-   if (p->translate.run_elts16 == NULL)
-      goto fail;
-
-   p->translate.run_elts8 = (run_elts8_func) x86_get_func(&p->elt8_func);
-   if (p->translate.run_elts8 == NULL)
-      goto fail;
+   p->translate.run = (run_func) x86_get_func(&p->program->linear_func);
+   p->translate.run_elts = (run_elts_func) x86_get_func(&p->program->elt_func);
+   p->translate.run_elts16 =
+      (run_elts16_func) x86_get_func(&p->program->elt16_func);
+   p->translate.run_elts8 =
+      (run_elts8_func) x86_get_func(&p->program->elt8_func);
 
    return &p->translate;
 
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <string.h>
+
+#include "translate.h"
+#include "translate_cache.h"
+#include <gtest/gtest.h>
+
+static struct translate_key
+test_key(unsigned output_stride)
+{
+   struct translate_key key;
+   memset(&key, 0, sizeof(key));
+
+   key.output_stride = output_stride;
+   key.nr_elements = 1;
+   key.element[0].type = TRANSLATE_ELEMENT_NORMAL;
+   key.element[0].input_format = PIPE_FORMAT_R8G8B8A8_UNORM;
+   key.element[0].output_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   key.element[0].input_buffer = 0;
+   key.element[0].input_offset = 0;
+   key.element[0].instance_divisor = 0;
+   key.element[0].output_offset = 0;
+
+   return key;
+}
+
+struct test_program {
+   struct translate_program base;
+   unsigned *num_destroyed;
+};
+
+static void
+test_program_destroy(struct translate_program *program)
+{
+   struct test_program *prog = (struct test_program *)program;
+   (*prog->num_destroyed)++;
+   delete prog;
+}
+
+static struct translate_program *
+test_program_create(const struct translate_key *key, void *data)
+{
+   struct test_program *prog = new test_program();
+   prog->base.destroy = test_program_destroy;
+   prog->num_destroyed = (unsigned *)data;
+   return &prog->base;
+}
+
+static struct translate_program *
+test_program_fail(const struct translate_key *key, void *data)
+{
+   return NULL;
+}
+
+TEST(translate_program_cache, shared_and_freed)
+{
+   struct translate_key key = test_key(32);
+   unsigned num_destroyed = 0;
+
+   struct translate_program *a =
+      translate_program_cache_get(&key, test_program_create, &num_destroyed);
+   struct translate_program *b =
+      translate_program_cache_get(&key, test_program_fail, &num_destroyed);
+   ASSERT_NE(a, nullptr);
+   EXPECT_EQ(a, b);
+
+   /* Still referenced by b. */
+   translate_program_cache_put(a);
+   EXPECT_EQ(num_destroyed, 0u);
+
+   /* The last reference frees the cache along with its programs. */
+   translate_program_cache_put(b);
+   EXPECT_EQ(num_destroyed, 1u);
+
+   EXPECT_EQ(translate_program_cache_get(&key, test_program_fail, NULL),
+             nullptr);
+
+   a = translate_program_cache_get(&key, test_program_create, &num_destroyed);
+   ASSERT_NE(a, nullptr);
+   translate_program_cache_put(a);
+   EXPECT_EQ(num_destroyed, 2u);
+}
+
+TEST(translate_program_cache, two_contexts)
+{
+   static const uint8_t input[2][4] = {
+      { 0, 51, 102, 255 },
+      { 255, 204, 153, 0 },
+   };
+   struct translate_key key = test_key(4 * sizeof(float));
+
+   struct translate_cache *cache_a = translate_cache_create();
+   struct translate_cache *cache_b = translate_cache_create();
+   ASSERT_NE(cache_a, nullptr);
+   ASSERT_NE(cache_b, nullptr);
+
+   struct translate *a = translate_cache_find(cache_a, &key);
+   struct translate *b = translate_cache_find(cache_b, &key);
+   ASSERT_NE(a, nullptr);
+   ASSERT_NE(b, nullptr);
+
+   /* Per-context state, one program. */
+   EXPECT_NE(a, b);
+   EXPECT_EQ(a->run, b->run);
+   EXPECT_EQ(a->run_elts, b->run_elts);
+
+   float out_a[2][4], out_b[2][4];
+   a->set_buffer(a, 0, input, sizeof(input[0]), 1);
+   b->set_buffer(b, 0, input[1], sizeof(input[0]), 0);
+   a->run(a, 0, 2, 0, 0, out_a);
+
+   /* Running b must not disturb a's buffers. */
+   b->run(b, 0, 1, 0, 0, out_b);
+   a->run(a, 0, 2, 0, 0, out_a);
+
+   for (unsigned i = 0; i < 2; i++) {
+      for (unsigned c = 0; c < 4; c++)
+         EXPECT_FLOAT_EQ(out_a[i][c], input[i][c] / 255.0f);
+   }
+   for (unsigned c = 0; c < 4; c++)
+      EXPECT_FLOAT_EQ(out_b[0][c], input[1][c] / 255.0f);
+
+   translate_cache_destroy(cache_a);
+   translate_cache_destroy(cache_b);
+}
@@ -72,6 +72,7 @@ u_driconf_fill_st_options(struct st_config_options *options,
    query_bool_option(transcode_etc);
    query_bool_option(transcode_astc);
    query_bool_option(transcode_cache);
+   query_bool_option(decode_cache);
    query_bool_option(astc_fallback);
    query_string_option(force_gl_vendor);
    query_string_option(force_gl_renderer);
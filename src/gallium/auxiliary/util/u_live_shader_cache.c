@@ -31,7 +31,6 @@
 #include "compiler/nir/nir_serialize.h"
 
 #include "util/blob.h"
-#include "util/hash_table.h"
 #include "util/mesa-sha1.h"
 
 static uint32_t key_hash(const void *key)
@@ -46,6 +45,20 @@ static bool key_equals(const void *a, const void *b)
    return memcmp(a, b, 20) == 0;
 }
 
+/* Take a reference unless the shader is already being destroyed. */
+static bool try_reference(struct pipe_reference *reference)
+{
+   int32_t count = p_atomic_read(&reference->count);
+
+   while (count != 0) {
+      int32_t old = p_atomic_cmpxchg(&reference->count, count, count + 1);
+      if (old == count)
+         return true;
+      count = old;
+   }
+   return false;
+}
+
 void
 util_live_shader_cache_init(struct util_live_shader_cache *cache,
                             void *(*create_shader)(struct pipe_context *,
@@ -53,7 +66,7 @@ util_live_shader_cache_init(struct util_live_shader_cache *cache,
                             void (*destroy_shader)(struct pipe_context *, void *))
 {
    simple_mtx_init(&cache->lock, mtx_plain);
-   cache->hashtable = _mesa_hash_table_create(NULL, key_hash, key_equals);
+   cache->hashtable = util_rcu_hash_create(key_equals);
    cache->create_shader = create_shader;
    cache->destroy_shader = destroy_shader;
 }
@@ -63,7 +76,7 @@ util_live_shader_cache_deinit(struct util_live_shader_cache *cache)
 {
    if (cache->hashtable) {
       /* The hash table should be empty at this point. */
-      _mesa_hash_table_destroy(cache->hashtable, NULL);
+      util_rcu_hash_destroy(cache->hashtable, NULL);
       simple_mtx_destroy(&cache->lock);
    }
 }
@@ -113,17 +126,21 @@ util_live_shader_cache_get(struct pipe_context *ctx,
    if (ir_binary == blob.data)
       blob_finish(&blob);
 
-   /* Find the shader in the live cache. */
-   simple_mtx_lock(&cache->lock);
-   struct hash_entry *entry = _mesa_hash_table_search(cache->hashtable, sha1);
+   /* Find the shader in the live cache. Shaders stay allocated until the
+    * read-side section ends, but one whose refcount already dropped to 0 is
+    * being destroyed and is treated as a miss.
+    */
+   unsigned token = util_rcu_hash_read_lock(cache->hashtable);
+   struct util_rcu_hash_entry *entry =
+      util_rcu_hash_search(cache->hashtable, key_hash(sha1), sha1);
    struct util_live_shader *shader = entry ? entry->data : NULL;
 
    /* Increase the refcount. */
-   if (shader) {
-      pipe_reference(NULL, &shader->reference);
-      cache->hits++;
-   }
-   simple_mtx_unlock(&cache->lock);
+   if (shader && try_reference(&shader->reference))
+      p_atomic_inc(&cache->hits);
+   else
+      shader = NULL;
+   util_rcu_hash_read_unlock(cache->hashtable, token);
 
    if (cache_hit)
       *cache_hit = (shader != NULL);
@@ -144,9 +161,11 @@ util_live_shader_cache_get(struct pipe_context *ctx,
 
    simple_mtx_lock(&cache->lock);
    /* The same shader might have been created in parallel. This is rare.
-    * If so, keep the one already in cache.
+    * If so, keep the one already in cache. Shaders are removed under the
+    * lock when their refcount drops to 0, so this one is still alive.
     */
-   struct hash_entry *entry2 = _mesa_hash_table_search(cache->hashtable, sha1);
+   struct util_rcu_hash_entry *entry2 =
+      util_rcu_hash_search(cache->hashtable, key_hash(sha1), sha1);
    struct util_live_shader *shader2 = entry2 ? entry2->data : NULL;
 
    if (shader2) {
@@ -155,7 +174,8 @@ util_live_shader_cache_get(struct pipe_context *ctx,
       /* Increase the refcount. */
       pipe_reference(NULL, &shader->reference);
    } else {
-      _mesa_hash_table_insert(cache->hashtable, shader->sha1, shader);
+      util_rcu_hash_insert(cache->hashtable, key_hash(shader->sha1),
+                           shader->sha1, shader);
    }
    cache->misses++;
    simple_mtx_unlock(&cache->lock);
@@ -177,15 +197,18 @@ util_shader_reference(struct pipe_context *ctx,
    simple_mtx_lock(&cache->lock);
    bool destroy = pipe_reference(&dst_shader->reference, &src_shader->reference);
    if (destroy) {
-      struct hash_entry *entry = _mesa_hash_table_search(cache->hashtable,
-                                                         dst_shader->sha1);
-      assert(entry);
-      _mesa_hash_table_remove(cache->hashtable, entry);
+      ASSERTED bool removed =
+         util_rcu_hash_remove(cache->hashtable, key_hash(dst_shader->sha1),
+                              dst_shader->sha1);
+      assert(removed);
    }
    simple_mtx_unlock(&cache->lock);
 
-   if (destroy)
+   if (destroy) {
+      /* Wait for the lookups that may still be looking at the shader. */
+      util_rcu_hash_synchronize(cache->hashtable);
       cache->destroy_shader(ctx, dst_shader);
+   }
 
    *dst = src;
 }
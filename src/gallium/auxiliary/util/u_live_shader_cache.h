@@ -50,6 +50,7 @@
 #define U_LIVE_SHADER_CACHE_H
 
 #include "util/simple_mtx.h"
+#include "util/u_rcu_hash.h"
 #include "pipe/p_state.h"
 
 #ifdef __cplusplus
@@ -57,8 +58,9 @@ extern "C" {
 #endif
 
 struct util_live_shader_cache {
+   /* Lookups don't lock, the lock serializes insertions and removals. */
    simple_mtx_t lock;
-   struct hash_table *hashtable;
+   struct util_rcu_hash *hashtable;
 
    void *(*create_shader)(struct pipe_context *,
                           const struct pipe_shader_state *state);
@@ -2031,18 +2031,56 @@ llvmpipe_delete_ms_state(struct pipe_context *pipe, void *_mesh)
    FREE(shader);
 }
 
+/* Mesh workgroup output layout, shared by every workgroup of a draw. */
+struct lp_mesh_assemble_info {
+   enum mesa_prim prim;
+   int prim_out_idx;
+   int cull_prim_idx;
+   size_t task_out_size;
+   int vsize;
+   int psize;
+   int per_prim_count;
+   size_t prim_offset;
+};
+
+/* Primitives assembled from the output of a single mesh workgroup. */
+struct lp_mesh_wg_output {
+   struct draw_vertex_info vert_out;
+   struct draw_prim_info prim_out;
+};
+
+/* One mesh shader dispatch queued on the cs thread pool. */
+struct lp_mesh_launch {
+   struct lp_cs_job_info job_info;
+   const struct lp_mesh_assemble_info *asm_info;
+   void *vbuf;
+   unsigned num_wgs;
+   struct lp_mesh_wg_output *outputs;
+   struct lp_cs_tpool_task *task;
+};
+
+/*
+ * Mesh dispatches are queued without waiting so that the (often small)
+ * grids emitted by each task shader invocation run concurrently.  The batch
+ * is flushed once it holds LP_MESH_BATCH_MAX_WGS workgroups, which also
+ * bounds the vbuf memory in flight.
+ */
+#define LP_MESH_BATCH_MAX_LAUNCHES 64
+#define LP_MESH_BATCH_MAX_WGS 4096
+
+struct lp_mesh_batch {
+   struct lp_mesh_launch launches[LP_MESH_BATCH_MAX_LAUNCHES];
+   unsigned num_launches;
+   unsigned num_wgs;
+};
+
 static void
-lp_mesh_call_draw(struct llvmpipe_context *lp,
-                  enum mesa_prim prim,
-                  int prim_out_idx,
-                  int cull_prim_idx,
-                  int task_idx,
-                  void *vbuf, size_t task_out_size,
-                  int vsize, int psize, int per_prim_count,
-                  size_t prim_offset)
+lp_mesh_assemble(const struct lp_mesh_assemble_info *info,
+                 void *vbuf, int wg_idx,
+                 struct lp_mesh_wg_output *out)
 {
-   unsigned prim_len = mesa_vertices_per_prim(prim);
-   uint32_t *ptr = (uint32_t *)((char *)vbuf + task_out_size * task_idx);
+   unsigned prim_len = mesa_vertices_per_prim(info->prim);
+   uint32_t *ptr = (uint32_t *)((char *)vbuf + info->task_out_size * wg_idx);
    uint32_t vertex_count = ptr[1];
    uint32_t prim_count = ptr[2];
 
@@ -2051,17 +2089,17 @@ lp_mesh_call_draw(struct llvmpipe_context *lp,
 
    struct draw_vertex_info vinfo;
    vinfo.verts = (struct vertex_header *)ptr;
-   vinfo.vertex_size = vsize / 8;
-   vinfo.stride = vsize;
+   vinfo.vertex_size = info->vsize / 8;
+   vinfo.stride = info->vsize;
    vinfo.count = vertex_count;
 
    unsigned elts_size = prim_len * prim_count;
    unsigned short *elts = calloc(sizeof(uint16_t), elts_size);
    uint32_t *prim_lengths = calloc(prim_count, sizeof(uint32_t));
    int elts_idx = 0;
-   char *prim_ptr = (char *)ptr + prim_offset;
+   char *prim_ptr = (char *)ptr + info->prim_offset;
    for (unsigned p = 0; p < prim_count; p++) {
-      uint32_t *prim_idxs = (uint32_t *)(prim_ptr + p * psize + prim_out_idx * 4 * sizeof(float));
+      uint32_t *prim_idxs = (uint32_t *)(prim_ptr + p * info->psize + info->prim_out_idx * 4 * sizeof(float));
       for (unsigned elt = 0; elt < prim_len; elt++){
          elts[elts_idx++] = prim_idxs[elt];
       }
@@ -2069,33 +2107,108 @@ lp_mesh_call_draw(struct llvmpipe_context *lp,
    }
 
    struct draw_prim_info prim_info = { 0 };
-   prim_info.prim = prim;
+   prim_info.prim = info->prim;
    prim_info.linear = false;
    prim_info.elts = elts;
    prim_info.count = prim_count;
    prim_info.primitive_count = prim_count;
    prim_info.primitive_lengths = prim_lengths;
 
-   struct draw_vertex_info vert_out = { 0 };
-   struct draw_prim_info prim_out = { 0 };
-   draw_mesh_prim_run(lp->draw,
-                      per_prim_count,
+   draw_mesh_prim_run(info->per_prim_count,
                       prim_ptr,
-                      cull_prim_idx,
+                      info->cull_prim_idx,
                       &prim_info,
                       &vinfo,
-                      &prim_out,
-                      &vert_out);
+                      &out->prim_out,
+                      &out->vert_out);
    free(elts);
    free(prim_lengths);
+}
 
-   draw_collect_primitives_generated(lp->draw,
-                                     lp->active_primgen_queries &&
-                                     !lp->queries_disabled);
-   draw_mesh(lp->draw, &vert_out, &prim_out);
+/*
+ * Runs one mesh workgroup and assembles its primitives on the same pool
+ * thread, leaving only the in-order submission to draw on the app thread.
+ */
+static void
+mesh_exec_fn(void *init_data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+   struct lp_mesh_launch *launch = init_data;
 
-   free(vert_out.verts);
-   free(prim_out.primitive_lengths);
+   cs_exec_fn(&launch->job_info, iter_idx, lmem);
+   lp_mesh_assemble(launch->asm_info, launch->vbuf, iter_idx,
+                    &launch->outputs[iter_idx]);
+}
+
+static void
+lp_mesh_batch_flush(struct llvmpipe_context *lp, struct lp_mesh_batch *batch)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+   for (unsigned l = 0; l < batch->num_launches; l++) {
+      struct lp_mesh_launch *launch = &batch->launches[l];
+
+      if (launch->task)
+         lp_cs_tpool_wait_for_task(screen->cs_tpool, &launch->task);
+
+      /* Submit in workgroup order so primitive order is preserved. */
+      for (unsigned t = 0; t < launch->num_wgs; t++) {
+         struct lp_mesh_wg_output *out = &launch->outputs[t];
+
+         if (!out->vert_out.verts)
+            continue;
+
+         draw_collect_primitives_generated(lp->draw,
+                                           lp->active_primgen_queries &&
+                                           !lp->queries_disabled);
+         draw_mesh(lp->draw, &out->vert_out, &out->prim_out);
+
+         free(out->vert_out.verts);
+         free(out->prim_out.primitive_lengths);
+      }
+      free(launch->outputs);
+      free(launch->vbuf);
+   }
+
+   batch->num_launches = 0;
+   batch->num_wgs = 0;
+}
+
+static bool
+lp_mesh_batch_queue(struct llvmpipe_context *lp,
+                    struct lp_mesh_batch *batch,
+                    const struct lp_cs_job_info *job_info,
+                    const struct lp_mesh_assemble_info *asm_info,
+                    unsigned num_wgs)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+   if (batch->num_launches == LP_MESH_BATCH_MAX_LAUNCHES ||
+       (batch->num_wgs && batch->num_wgs + num_wgs > LP_MESH_BATCH_MAX_WGS))
+      lp_mesh_batch_flush(lp, batch);
+
+   struct lp_mesh_launch *launch = &batch->launches[batch->num_launches];
+   launch->vbuf = CALLOC(num_wgs, asm_info->task_out_size);
+   launch->outputs = CALLOC(num_wgs, sizeof(*launch->outputs));
+   if (!launch->vbuf || !launch->outputs) {
+      FREE(launch->vbuf);
+      FREE(launch->outputs);
+      return false;
+   }
+
+   launch->job_info = *job_info;
+   launch->job_info.io = launch->vbuf;
+   launch->asm_info = asm_info;
+   launch->num_wgs = num_wgs;
+   launch->task = NULL;
+
+   mtx_lock(&screen->cs_mutex);
+   launch->task = lp_cs_tpool_queue_task(screen->cs_tpool, mesh_exec_fn,
+                                         launch, num_wgs);
+   mtx_unlock(&screen->cs_mutex);
+
+   batch->num_launches++;
+   batch->num_wgs += num_wgs;
+   return true;
 }
 
 static void
@@ -2159,6 +2272,21 @@ llvmpipe_draw_mesh_tasks(struct pipe_context *pipe,
    size_t prim_offset = vsize * (mhs_shader->info.mesh.max_vertices_out + 8);
    size_t task_out_size = prim_offset + psize * (mhs_shader->info.mesh.max_primitives_out + 8);
 
+   const struct lp_mesh_assemble_info asm_info = {
+      .prim = mhs_shader->info.mesh.primitive_type,
+      .prim_out_idx = prim_out_idx - first_per_prim_idx,
+      .cull_prim_idx = cull_prim_idx,
+      .task_out_size = task_out_size,
+      .vsize = vsize,
+      .psize = psize,
+      .per_prim_count = per_prim_count,
+      .prim_offset = prim_offset,
+   };
+
+   struct lp_mesh_batch *batch = CALLOC_STRUCT(lp_mesh_batch);
+   if (!batch)
+      return;
+
    for (unsigned dr = 0; dr < draw_count; dr++) {
       fill_grid_size(pipe, dr, info, job_info.grid_size);
 
@@ -2200,7 +2328,8 @@ llvmpipe_draw_mesh_tasks(struct pipe_context *pipe,
          num_mesh_invocs = num_tasks;
       }
 
-      for (unsigned i = 0; i < num_mesh_invocs; i++) {
+      bool oom = false;
+      for (unsigned i = 0; i < num_mesh_invocs && !oom; i++) {
          if (payload) {
             void *this_payload = (char *)payload + (payload_stride * i);
             uint32_t *payload_grid = (uint32_t *)this_payload;
@@ -2230,51 +2359,44 @@ llvmpipe_draw_mesh_tasks(struct pipe_context *pipe,
             }
          }
 
-         for (unsigned grid_z = 0; grid_z < total_grid[2]; grid_z += job_strides[2]) {
+         for (unsigned grid_z = 0; grid_z < total_grid[2] && !oom; grid_z += job_strides[2]) {
             int this_z = MIN2(total_grid[2] - grid_z, max_tasks);
             job_info.grid_base[2] = grid_z;
-            for (unsigned grid_y = 0; grid_y < total_grid[1]; grid_y += job_strides[1]) {
+            for (unsigned grid_y = 0; grid_y < total_grid[1] && !oom; grid_y += job_strides[1]) {
                int this_y = MIN2(total_grid[1] - grid_y, max_tasks);
                job_info.grid_base[1] = grid_y;
-               for (unsigned grid_x = 0; grid_x < total_grid[0]; grid_x += job_strides[0]) {
+               for (unsigned grid_x = 0; grid_x < total_grid[0] && !oom; grid_x += job_strides[0]) {
                   int this_x = MIN2(total_grid[0] - grid_x, max_tasks);
                   job_info.grid_base[0] = grid_x;
                   num_tasks = this_x * this_y * this_z;
+                  if (!num_tasks)
+                     continue;
 
                   job_info.iter_size[0] = this_x;
                   job_info.iter_size[1] = this_y;
                   job_info.iter_size[2] = this_z;
                   job_info.use_iters = true;
 
-                  void *vbuf = CALLOC(num_tasks, task_out_size);
-                  if (!vbuf)
-                     return;
-
-                  job_info.io = vbuf;
-                  if (num_tasks) {
-                     struct lp_cs_tpool_task *task;
-                     mtx_lock(&screen->cs_mutex);
-                     task = lp_cs_tpool_queue_task(screen->cs_tpool, cs_exec_fn, &job_info, num_tasks);
-                     mtx_unlock(&screen->cs_mutex);
-
-                     lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+                  if (!lp_mesh_batch_queue(lp, batch, &job_info, &asm_info,
+                                           num_tasks)) {
+                     oom = true;
+                     break;
                   }
+
                   if (!lp->queries_disabled)
                      lp->pipeline_statistics.ms_invocations += num_tasks * job_info.block_size[0] * job_info.block_size[1] * job_info.block_size[2];
-
-                  for (unsigned t = 0; t < num_tasks; t++)
-                     lp_mesh_call_draw(lp,
-                                       mhs_shader->info.mesh.primitive_type,
-                                       prim_out_idx - first_per_prim_idx,
-                                       cull_prim_idx, t, vbuf, task_out_size,
-                                       vsize, psize, per_prim_count, prim_offset);
-                  free(vbuf);
                }
             }
          }
       }
+
+      /* Launches reference the task payload. */
+      lp_mesh_batch_flush(lp, batch);
       free(payload);
+      if (oom)
+         break;
    }
+   FREE(batch);
    draw_flush(lp->draw);
 }
 
@@ -45,7 +45,7 @@ pub struct Device {
     pub spirv_extensions: Vec<CString>,
     pub clc_features: Vec<cl_name_version>,
     pub formats: HashMap<cl_image_format, HashMap<cl_mem_object_type, cl_mem_flags>>,
-    pub lib_clc: NirShader,
+    pub lib_clc: NirLibrary,
     helper_ctx: Mutex<PipeContext>,
 }
 
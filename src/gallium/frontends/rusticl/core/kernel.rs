@@ -397,7 +397,7 @@ fn lower_and_optimize_nir(
     dev: &Device,
     nir: &mut NirShader,
     args: &[spirv::SPIRVKernelArg],
-    lib_clc: &NirShader,
+    lib_clc: &NirLibrary,
 ) -> (Vec<KernelArg>, Vec<InternalKernelArg>) {
     let address_bits_base_type;
     let address_bits_ptr_type;
@@ -301,7 +301,7 @@ impl SPIRVBin {
 
     fn get_spirv_options(
         library: bool,
-        clc_shader: *const nir_shader,
+        clc_library: *const nir_lazy_shader,
         address_bits: u32,
         log: Option<&mut Vec<String>>,
     ) -> spirv_to_nir_options {
@@ -324,7 +324,7 @@ impl SPIRVBin {
         spirv_to_nir_options {
             create_library: library,
             environment: nir_spirv_execution_environment::NIR_SPIRV_OPENCL,
-            clc_shader: clc_shader,
+            clc_library: clc_library,
             float_controls_execution_mode: float_controls::FLOAT_CONTROLS_DENORM_FLUSH_TO_ZERO_FP32
                 as u32,
 
@@ -361,13 +361,13 @@ impl SPIRVBin {
         &self,
         entry_point: &str,
         nir_options: *const nir_shader_compiler_options,
-        libclc: &NirShader,
+        libclc: &NirLibrary,
         spec_constants: &mut [nir_spirv_specialization],
         address_bits: u32,
         log: Option<&mut Vec<String>>,
     ) -> Option<NirShader> {
         let c_entry = CString::new(entry_point.as_bytes()).unwrap();
-        let spirv_options = Self::get_spirv_options(false, libclc.get_nir(), address_bits, log);
+        let spirv_options = Self::get_spirv_options(false, libclc.as_ptr(), address_bits, log);
 
         let nir = unsafe {
             spirv_to_nir(
@@ -385,14 +385,14 @@ impl SPIRVBin {
         NirShader::new(nir)
     }
 
-    pub fn get_lib_clc(screen: &PipeScreen) -> Option<NirShader> {
+    pub fn get_lib_clc(screen: &PipeScreen) -> Option<NirLibrary> {
         let nir_options = screen.nir_shader_compiler_options(pipe_shader_type::PIPE_SHADER_COMPUTE);
         let address_bits = screen.compute_param(pipe_compute_cap::PIPE_COMPUTE_CAP_ADDRESS_BITS);
         let spirv_options = Self::get_spirv_options(true, ptr::null(), address_bits, None);
         let shader_cache = DiskCacheBorrowed::as_ptr(&screen.shader_cache());
 
-        NirShader::new(unsafe {
-            nir_load_libclc_shader(
+        NirLibrary::new(unsafe {
+            nir_load_libclc_lazy(
                 address_bits,
                 shader_cache,
                 &spirv_options,
@@ -140,6 +140,31 @@ impl Drop for NirPrintfInfo {
     }
 }
 
+/// A library of functions whose bodies are only read when they get linked into a shader.
+pub struct NirLibrary {
+    lib: NonNull<nir_lazy_shader>,
+}
+
+// SAFETY: Reading function bodies is serialized by the library itself.
+unsafe impl Send for NirLibrary {}
+unsafe impl Sync for NirLibrary {}
+
+impl NirLibrary {
+    pub fn new(lib: *mut nir_lazy_shader) -> Option<Self> {
+        NonNull::new(lib).map(|lib| Self { lib: lib })
+    }
+
+    pub fn as_ptr(&self) -> *mut nir_lazy_shader {
+        self.lib.as_ptr()
+    }
+}
+
+impl Drop for NirLibrary {
+    fn drop(&mut self) {
+        unsafe { ralloc_free(self.lib.as_ptr().cast()) };
+    }
+}
+
 pub struct NirShader {
     nir: NonNull<nir_shader>,
 }
@@ -270,14 +295,14 @@ impl NirShader {
         nir_pass!(self, nir_opt_dead_cf);
     }
 
-    pub fn inline(&mut self, libclc: &NirShader) {
+    pub fn inline(&mut self, libclc: &NirLibrary) {
         nir_pass!(
             self,
             nir_lower_variable_initializers,
             nir_variable_mode::nir_var_function_temp,
         );
         nir_pass!(self, nir_lower_returns);
-        nir_pass!(self, nir_link_shader_functions, libclc.nir.as_ptr());
+        nir_pass!(self, nir_link_shader_functions_lazy, libclc.as_ptr());
         nir_pass!(self, nir_inline_functions);
     }
 
@@ -201,6 +201,7 @@ struct st_config_options
    bool transcode_etc;
    bool transcode_astc;
    bool transcode_cache;
+   bool decode_cache;
    bool astc_fallback;
    char *force_gl_vendor;
    char *force_gl_renderer;
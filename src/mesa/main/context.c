@@ -183,6 +183,7 @@ GLfloat _mesa_ubyte_to_float_color_tab[256];
 static void
 one_time_fini(void)
 {
+   glcpp_lex_memo_decref();
    glsl_type_singleton_decref();
 }
 
@@ -233,6 +234,9 @@ one_time_init(const char *extensions_override)
     */
    glsl_type_singleton_init_or_ref();
 
+   /* Likewise, keep the tokens lexed from shader text across shaders. */
+   glcpp_lex_memo_init_or_ref();
+
    _mesa_init_remap_table();
 }
 
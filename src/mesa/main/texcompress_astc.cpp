@@ -39,6 +39,10 @@
 #include <stdio.h>
 #include <cstdlib>  // for abort() on windows
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static bool VERBOSE_DECODE = false;
 static bool VERBOSE_WRITE = false;
 
@@ -270,14 +274,18 @@ static uint32_t hash52(uint32_t p)
    return p;
 }
 
-static int select_partition(int seed, int x, int y, int z, int partitioncount,
-                            int small_block)
+/* The partition hash of a block, reduced to per-partition factors of x, y
+ * and z plus a constant, as these only depend on the partition index and
+ * count.
+ */
+struct partition_hash
+{
+   int x[4], y[4], z[4], base[4];
+};
+
+static void init_partition_hash(partition_hash &h, int seed, int partitioncount,
+                                int small_block)
 {
-   if (small_block) {
-      x <<= 1;
-      y <<= 1;
-      z <<= 1;
-   }
    seed += (partitioncount - 1) * 1024;
    uint32_t rnum = hash52(seed);
    uint8_t seed1 = rnum & 0xF;
@@ -329,20 +337,37 @@ static int select_partition(int seed, int x, int y, int z, int partitioncount,
    seed11 >>= sh3;
    seed12 >>= sh3;
 
-   int a = seed1 * x + seed2 * y + seed11 * z + (rnum >> 14);
-   int b = seed3 * x + seed4 * y + seed12 * z + (rnum >> 10);
-   int c = seed5 * x + seed6 * y + seed9 * z + (rnum >> 6);
-   int d = seed7 * x + seed8 * y + seed10 * z + (rnum >> 2);
-
-   a &= 0x3F;
-   b &= 0x3F;
-   c &= 0x3F;
-   d &= 0x3F;
+   /* Small blocks double the coordinates. */
+   int shc = small_block ? 1 : 0;
+
+   h.x[0] = seed1 << shc;
+   h.y[0] = seed2 << shc;
+   h.z[0] = seed11 << shc;
+   h.base[0] = rnum >> 14;
+   h.x[1] = seed3 << shc;
+   h.y[1] = seed4 << shc;
+   h.z[1] = seed12 << shc;
+   h.base[1] = rnum >> 10;
+   h.x[2] = seed5 << shc;
+   h.y[2] = seed6 << shc;
+   h.z[2] = seed9 << shc;
+   h.base[2] = rnum >> 6;
+   h.x[3] = seed7 << shc;
+   h.y[3] = seed8 << shc;
+   h.z[3] = seed10 << shc;
+   h.base[3] = rnum >> 2;
+
+   /* Unused partitions hash to 0. */
+   for (int i = partitioncount; i < 4; i++)
+      h.x[i] = h.y[i] = h.z[i] = h.base[i] = 0;
+}
 
-   if (partitioncount < 4)
-      d = 0;
-   if (partitioncount < 3)
-      c = 0;
+static int select_partition(const partition_hash &h, int x, int y, int z)
+{
+   int a = (h.x[0] * x + h.y[0] * y + h.z[0] * z + h.base[0]) & 0x3F;
+   int b = (h.x[1] * x + h.y[1] * y + h.z[1] * z + h.base[1]) & 0x3F;
+   int c = (h.x[2] * x + h.y[2] * y + h.z[2] * z + h.base[2]) & 0x3F;
+   int d = (h.x[3] * x + h.y[3] * y + h.z[3] * z + h.base[3]) & 0x3F;
 
    if (a >= b && a >= c && a >= d)
       return 0;
@@ -354,6 +379,50 @@ static int select_partition(int seed, int x, int y, int z, int partitioncount,
       return 3;
 }
 
+#ifdef __SSE2__
+/* select_partition() for a row of texels, 8 at a time.  Writes up to 7
+ * bytes past the end of the row.
+ */
+static void select_partitions_row_sse2(const partition_hash &h, int y, int z,
+                                       int width, uint8_t *out)
+{
+   const __m128i mask = _mm_set1_epi16(0x3F);
+   __m128i fx[4], row[4];
+
+   /* The hash is masked to 6 bits, so 16-bit arithmetic is enough. */
+   for (int i = 0; i < 4; i++) {
+      fx[i] = _mm_set1_epi16(h.x[i]);
+      row[i] = _mm_set1_epi16(h.y[i] * y + h.z[i] * z + h.base[i]);
+   }
+
+   for (int x = 0; x < width; x += 8) {
+      __m128i xs = _mm_add_epi16(_mm_set1_epi16(x),
+                                 _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7));
+      __m128i v[4];
+
+      for (int i = 0; i < 4; i++) {
+         v[i] = _mm_and_si128(_mm_add_epi16(_mm_mullo_epi16(xs, fx[i]),
+                                            row[i]), mask);
+      }
+
+      __m128i not0 = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi16(v[0], v[1]),
+                                               _mm_cmplt_epi16(v[0], v[2])),
+                                  _mm_cmplt_epi16(v[0], v[3]));
+      __m128i not1 = _mm_or_si128(_mm_cmplt_epi16(v[1], v[2]),
+                                  _mm_cmplt_epi16(v[1], v[3]));
+      __m128i not2 = _mm_cmplt_epi16(v[2], v[3]);
+
+      /* 0, else 1, else 2, else 3. */
+      __m128i p = _mm_sub_epi16(_mm_set1_epi16(2), not2);
+      p = _mm_or_si128(_mm_andnot_si128(not1, _mm_set1_epi16(1)),
+                       _mm_and_si128(not1, p));
+      p = _mm_and_si128(not0, p);
+
+      _mm_storel_epi64((__m128i *)(out + x), _mm_packus_epi16(p, p));
+   }
+}
+#endif
+
 
 struct InputBitVector
 {
@@ -611,7 +680,10 @@ struct Block
    int ce_bits;
 
    /* Calculated by compute_infill_weights(); */
-   uint8_t infill_weights[2][216]; /* large enough for 6x6x6 */
+   uint8_t infill_weights[2][216 + 8]; /* large enough for 6x6x6, plus padding for vector stores */
+
+   /* Calculated by compute_partitions(); */
+   uint8_t partitions[216 + 8]; /* large enough for 6x6x6, plus padding for vector stores */
 
    /* Calculated by decode_colour_endpoints(); */
    uint8x4_t endpoints_decoded[2][4];
@@ -632,6 +704,7 @@ struct Block
    void decode_colour_endpoints();
    void unpack_weights(InputBitVector in);
    void compute_infill_weights(int block_w, int block_h, int block_d);
+   void compute_partitions(int block_w, int block_h, int block_d);
 
    void write_decoded(const Decoder &decoder, uint16_t *output);
 };
@@ -1254,10 +1327,88 @@ void Block::unquantise_weights()
    }
 }
 
+#ifdef __SSE2__
+/* Bilinear interpolation of a row of texels between two rows of a plane of
+ * the weight grid, 8 texels at a time.  js and fs hold the grid column and
+ * fraction of each texel, and must be readable up to a multiple of 8.
+ * Writes up to 7 bytes past the end of the row.
+ */
+static void infill_row_sse2(const uint8_t *row0, const uint8_t *row1,
+                            int stride, const int16_t *js, const int16_t *fs,
+                            int ft, int width, uint8_t *out)
+{
+   const __m128i ftv = _mm_set1_epi16(ft);
+
+   for (int s = 0; s < width; s += 8) {
+      alignas(16) int16_t p[4][8];
+
+      for (int l = 0; l < 8; l++) {
+         int j = js[s + l] * stride;
+         p[0][l] = row0[j];
+         p[1][l] = row0[j + stride];
+         p[2][l] = row1[j];
+         p[3][l] = row1[j + stride];
+      }
+
+      /* All terms fit in 16 bits: weights are at most 64 and the bilinear
+       * factors sum to 16.
+       */
+      __m128i fsv = _mm_load_si128((const __m128i *)(fs + s));
+      __m128i w11 = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(fsv, ftv),
+                                                 _mm_set1_epi16(8)), 4);
+      __m128i w10 = _mm_sub_epi16(ftv, w11);
+      __m128i w01 = _mm_sub_epi16(fsv, w11);
+      __m128i w00 = _mm_add_epi16(_mm_sub_epi16(_mm_sub_epi16(_mm_set1_epi16(16),
+                                                              fsv), ftv), w11);
+
+      __m128i i =
+         _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_load_si128((const __m128i *)p[0]), w00),
+                                     _mm_mullo_epi16(_mm_load_si128((const __m128i *)p[1]), w01)),
+                       _mm_add_epi16(_mm_mullo_epi16(_mm_load_si128((const __m128i *)p[2]), w10),
+                                     _mm_mullo_epi16(_mm_load_si128((const __m128i *)p[3]), w11)));
+      i = _mm_srli_epi16(_mm_add_epi16(i, _mm_set1_epi16(8)), 4);
+
+      _mm_storel_epi64((__m128i *)(out + s), _mm_packus_epi16(i, i));
+   }
+}
+#endif
+
 void Block::compute_infill_weights(int block_w, int block_h, int block_d)
 {
    int Ds = block_w <= 1 ? 0 : (1024 + block_w / 2) / (block_w - 1);
    int Dt = block_h <= 1 ? 0 : (1024 + block_h / 2) / (block_h - 1);
+#ifdef __SSE2__
+   /* The grid column of a texel doesn't depend on its row. */
+   alignas(16) int16_t js[16] = { 0 };
+   alignas(16) int16_t fs[16] = { 0 };
+   assert(block_w <= 16);
+   for (int s = 0; s < block_w; ++s) {
+      int gs = (Ds * s * (wt_w - 1) + 32) >> 6;
+      assert(gs >= 0 && gs <= 176);
+      js[s] = gs >> 4;
+      fs[s] = gs & 0xf;
+   }
+
+   int stride = 1 + dual_plane;
+   for (int r = 0; r < block_d; ++r) {
+      for (int t = 0; t < block_h; ++t) {
+         int gt = (Dt * t * (wt_h - 1) + 32) >> 6;
+         assert(gt >= 0 && gt <= 176);
+         int jt = gt >> 4;
+         int ft = gt & 0xf;
+
+         /* TODO: 3D */
+         assert(((jt + 1) * wt_w + js[block_w - 1] + 2) * stride <=
+                (int)ARRAY_SIZE(weights));
+         for (int plane = 0; plane < stride; ++plane) {
+            const uint8_t *row0 = &weights[jt * wt_w * stride + plane];
+            infill_row_sse2(row0, row0 + wt_w * stride, stride, js, fs, ft,
+                            block_w,
+                            &infill_weights[plane][t*block_w + r*block_w*block_h]);
+         }
+      }
+   }
+#else
    int Dr = block_d <= 1 ? 0 : (1024 + block_d / 2) / (block_d - 1);
    for (int r = 0; r < block_d; ++r) {
       for (int t = 0; t < block_h; ++t) {
@@ -1319,6 +1470,27 @@ void Block::compute_infill_weights(int block_w, int block_h, int block_d)
          }
       }
    }
+#endif
+}
+
+void Block::compute_partitions(int block_w, int block_h, int block_d)
+{
+   int small_block = (block_w * block_h * block_d) < 31;
+   partition_hash h;
+   init_partition_hash(h, partition_index, num_parts, small_block);
+
+   int idx = 0;
+   for (int z = 0; z < block_d; ++z) {
+      for (int y = 0; y < block_h; ++y) {
+#ifdef __SSE2__
+         select_partitions_row_sse2(h, y, z, block_w, &partitions[idx]);
+         idx += block_w;
+#else
+         for (int x = 0; x < block_w; ++x)
+            partitions[idx++] = select_partition(h, x, y, z);
+#endif
+      }
+   }
 }
 
 void Block::unquantise_colour_endpoints()
@@ -1576,6 +1748,9 @@ decode_error::type Block::decode(const Decoder &decoder, InputBitVector in)
 
    compute_infill_weights(decoder.block_w, decoder.block_h, decoder.block_d);
 
+   if (num_parts > 1)
+      compute_partitions(decoder.block_w, decoder.block_h, decoder.block_d);
+
    if (VERBOSE_DECODE) {
       for (int plane = 0; plane <= dual_plane; ++plane) {
          printf("infilled weights (plane %d):\n", plane);
@@ -1623,20 +1798,13 @@ void Block::write_decoded(const Decoder &decoder, uint16_t *output)
       return;
    }
 
-   int small_block = (decoder.block_w * decoder.block_h * decoder.block_d) < 31;
-
    int idx = 0;
    for (int z = 0; z < decoder.block_d; ++z) {
       for (int y = 0; y < decoder.block_h; ++y) {
          for (int x = 0; x < decoder.block_w; ++x) {
 
-            int partition;
-            if (num_parts > 1) {
-               partition = select_partition(partition_index, x, y, z, num_parts, small_block);
-               assert(partition < num_parts);
-            } else {
-               partition = 0;
-            }
+            int partition = num_parts > 1 ? partitions[idx] : 0;
+            assert(partition < num_parts);
 
             /* TODO: HDR */
 
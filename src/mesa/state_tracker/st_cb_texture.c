@@ -67,6 +67,7 @@
 #include "state_tracker/st_atom.h"
 #include "state_tracker/st_sampler_view.h"
 #include "state_tracker/st_texcompress_compute.h"
+#include "state_tracker/st_texcompress_cpu.h"
 #include "state_tracker/st_util.h"
 #include "state_tracker/astc_cache.h"
 
@@ -805,32 +806,13 @@ st_UnmapTextureImage(struct gl_context *ctx,
             void *tmp = malloc(size);
 
             /* Decompress to tmp. */
-            if (texImage->TexFormat == MESA_FORMAT_ETC1_RGB8) {
-               _mesa_etc1_unpack_rgba8888(tmp, transfer->box.width * 4,
-                                          itransfer->temp_data,
-                                          itransfer->temp_stride,
-                                          transfer->box.width,
-                                          transfer->box.height);
-            } else if (_mesa_is_format_etc2(texImage->TexFormat)) {
-               bool bgra = texImage->pt->format == PIPE_FORMAT_B8G8R8A8_SRGB;
-
-               _mesa_unpack_etc2_format(tmp, transfer->box.width * 4,
-                                        itransfer->temp_data,
-                                        itransfer->temp_stride,
-                                        transfer->box.width,
-                                        transfer->box.height,
-                                        texImage->TexFormat,
-                                        bgra);
-            } else if (_mesa_is_format_astc_2d(texImage->TexFormat)) {
-               _mesa_unpack_astc_2d_ldr(tmp, transfer->box.width * 4,
-                                        itransfer->temp_data,
-                                        itransfer->temp_stride,
-                                        transfer->box.width,
-                                        transfer->box.height,
-                                        texImage->TexFormat);
-            } else {
-               unreachable("unexpected format for a compressed format fallback");
-            }
+            st_decompress_image(st, texImage->TexFormat,
+                                tmp, transfer->box.width * 4,
+                                PIPE_FORMAT_R8G8B8A8_UNORM,
+                                itransfer->temp_data,
+                                itransfer->temp_stride,
+                                transfer->box.width,
+                                transfer->box.height);
 
             /* Compress it to the target format. */
             struct gl_pixelstore_attrib pack = {0};
@@ -844,49 +826,13 @@ st_UnmapTextureImage(struct gl_context *ctx,
             free(tmp);
          } else {
             /* Decompress into an uncompressed format. */
-            if (texImage->TexFormat == MESA_FORMAT_ETC1_RGB8) {
-               _mesa_etc1_unpack_rgba8888(map, transfer->stride,
-                                          itransfer->temp_data,
-                                          itransfer->temp_stride,
-                                          transfer->box.width,
-                                          transfer->box.height);
-            } else if (_mesa_is_format_etc2(texImage->TexFormat)) {
-               bool bgra = texImage->pt->format == PIPE_FORMAT_B8G8R8A8_SRGB;
-
-               _mesa_unpack_etc2_format(map, transfer->stride,
-                                        itransfer->temp_data,
-                                        itransfer->temp_stride,
-                                        transfer->box.width, transfer->box.height,
-                                        texImage->TexFormat,
-                                        bgra);
-            } else if (_mesa_is_format_astc_2d(texImage->TexFormat)) {
-               _mesa_unpack_astc_2d_ldr(map, transfer->stride,
-                                        itransfer->temp_data,
-                                        itransfer->temp_stride,
-                                        transfer->box.width, transfer->box.height,
-                                        texImage->TexFormat);
-            } else if (_mesa_is_format_s3tc(texImage->TexFormat)) {
-               _mesa_unpack_s3tc(map, transfer->stride,
-                                 itransfer->temp_data,
-                                 itransfer->temp_stride,
-                                 transfer->box.width, transfer->box.height,
-                                 texImage->TexFormat);
-            } else if (_mesa_is_format_rgtc(texImage->TexFormat) ||
-                       _mesa_is_format_latc(texImage->TexFormat)) {
-               _mesa_unpack_rgtc(map, transfer->stride,
-                                 itransfer->temp_data,
-                                 itransfer->temp_stride,
-                                 transfer->box.width, transfer->box.height,
-                                 texImage->TexFormat);
-            } else if (_mesa_is_format_bptc(texImage->TexFormat)) {
-               _mesa_unpack_bptc(map, transfer->stride,
-                                 itransfer->temp_data,
-                                 itransfer->temp_stride,
-                                 transfer->box.width, transfer->box.height,
-                                 texImage->TexFormat);
-            } else {
-               unreachable("unexpected format for a compressed format fallback");
-            }
+            st_decompress_image(st, texImage->TexFormat,
+                                map, transfer->stride,
+                                texImage->pt->format,
+                                itransfer->temp_data,
+                                itransfer->temp_stride,
+                                transfer->box.width,
+                                transfer->box.height);
          }
 
          st_texture_image_unmap(st, texImage, slice);
@@ -555,6 +555,7 @@ st_create_context_priv(struct gl_context *ctx, struct pipe_context *pipe,
                                                     PIPE_BIND_SAMPLER_VIEW));
    st->transcode_cache = options->transcode_cache &&
                          st->transcode_astc;
+   st->decode_cache = options->decode_cache;
    st->has_astc_2d_ldr =
       screen->is_format_supported(screen, PIPE_FORMAT_ASTC_4x4_SRGB,
                                   PIPE_TEXTURE_2D, 0, 0, PIPE_BIND_SAMPLER_VIEW);
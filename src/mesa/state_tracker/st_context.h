@@ -52,6 +52,7 @@ struct gen_mipmap_state;
 struct st_context;
 struct st_program;
 struct u_upload_mgr;
+struct util_queue;
 
 #define ST_L3_PINNING_DISABLED 0xffffffff
 
@@ -147,6 +148,7 @@ struct st_context
    bool transcode_etc;
    bool transcode_astc;
    bool transcode_cache;
+   bool decode_cache;
    bool has_astc_2d_ldr;
    bool has_astc_5x5_ldr;
    bool astc_void_extents_need_denorm_flush;
@@ -517,6 +519,12 @@ st_api_destroy_drawable(struct pipe_frontend_drawable *drawable);
 void
 st_screen_destroy(struct pipe_frontend_screen *fscreen);
 
+struct util_queue *
+st_screen_get_link_queue(struct st_context *st);
+
+struct util_queue *
+st_screen_get_decompress_queue(struct st_context *st, int max_threads);
+
 typedef void (*st_update_func_t)(struct st_context *st);
 
 extern st_update_func_t st_update_functions[ST_NUM_ATOMS];
@@ -54,6 +54,7 @@
 #include "compiler/glsl/program.h"
 #include "compiler/glsl/shader_cache.h"
 #include "compiler/glsl/string_to_uint_map.h"
+#include "util/u_queue.h"
 
 static int
 type_size(const struct glsl_type *type)
@@ -267,15 +268,16 @@ filter_64_bit_instr(const nir_instr *const_instr, UNUSED const void *data)
    return lower;
 }
 
-/* Second third of converting glsl_to_nir. This creates uniforms, gathers
- * info on varyings, etc after NIR link time opts have been applied.
+/* Creates the uniforms of a stage after NIR link time opts have been
+ * applied.  This fills the uniform storage shared by all the stages, so
+ * unlike st_glsl_to_nir_post_opts() it must run on one stage at a time.
  */
-static char *
-st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
-                         struct gl_shader_program *shader_program)
+static void
+st_glsl_to_nir_associate_uniforms(struct st_context *st,
+                                  struct gl_program *prog,
+                                  struct gl_shader_program *shader_program)
 {
    nir_shader *nir = prog->nir;
-   struct pipe_screen *screen = st->screen;
 
    /* Make a pass over the IR to add state references for any built-in
     * uniforms that are used.  This has to be done now (during linking).
@@ -313,6 +315,18 @@ st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
     * This should be enough for Bitmap and DrawPixels constants.
     */
    _mesa_ensure_and_associate_uniform_storage(st->ctx, shader_program, prog, 28);
+}
+
+/* Second third of converting glsl_to_nir. This lowers uniforms, gathers
+ * info on varyings, etc after st_glsl_to_nir_associate_uniforms().  It only
+ * touches the given stage, so the stages run it in parallel.
+ */
+static char *
+st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
+                         struct gl_shader_program *shader_program)
+{
+   nir_shader *nir = prog->nir;
+   struct pipe_screen *screen = st->screen;
 
    /* None of the builtins being lowered here can be produced by SPIR-V.  See
     * _mesa_builtin_uniform_desc. Also drivers that support packed uniform
@@ -388,15 +402,6 @@ st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
    if (st->allow_st_finalize_nir_twice)
       msg = st_finalize_nir(st, prog, shader_program, nir, true, true);
 
-   if (st->ctx->_Shader->Flags & GLSL_DUMP) {
-      _mesa_log("\n");
-      _mesa_log("NIR IR for linked %s program %d:\n",
-             _mesa_shader_stage_to_string(prog->info.stage),
-             shader_program->Name);
-      nir_print_shader(nir, _mesa_get_log_file());
-      _mesa_log("\n\n");
-   }
-
    return msg;
 }
 
@@ -483,12 +488,135 @@ st_nir_lower_wpos_ytransform(struct nir_shader *nir,
    }
 }
 
+/* The per-stage work of st_link_glsl_to_nir(), which runs on the link
+ * queue for all the stages but the first one.
+ */
+struct st_link_stage {
+   struct st_context *st;
+   struct gl_shader_program *shader_program;
+   struct gl_linked_shader *shader;
+   struct util_queue_fence fence;
+
+   /* Error from the driver's finalize_nir, if any. */
+   char *msg;
+};
+
+/* Runs execute() for every stage and waits for all of them. */
+static void
+st_link_run_stages(struct st_context *st, struct st_link_stage *stages,
+                   unsigned num_stages, util_queue_execute_func execute)
+{
+   struct util_queue *queue =
+      num_stages > 1 ? st_screen_get_link_queue(st) : NULL;
+   bool parallel = queue != NULL;
+
+   if (parallel) {
+      for (unsigned i = 1; i < num_stages; i++) {
+         util_queue_fence_init(&stages[i].fence);
+         util_queue_add_job(queue, &stages[i], &stages[i].fence,
+                            execute, NULL, 0);
+      }
+   }
+
+   execute(&stages[0], NULL, 0);
+
+   for (unsigned i = 1; i < num_stages; i++) {
+      if (parallel) {
+         util_queue_fence_wait(&stages[i].fence);
+         util_queue_fence_destroy(&stages[i].fence);
+      } else {
+         execute(&stages[i], NULL, 0);
+      }
+   }
+}
+
+static void
+st_link_stage_to_nir(void *data, void *gdata, int thread_index)
+{
+   struct st_link_stage *stage = (struct st_link_stage *)data;
+   struct gl_context *ctx = stage->st->ctx;
+   struct gl_shader_program *shader_program = stage->shader_program;
+   struct gl_linked_shader *shader = stage->shader;
+   struct gl_program *prog = shader->Program;
+   const nir_shader_compiler_options *options =
+      ctx->Const.ShaderCompilerOptions[shader->Stage].NirOptions;
+
+   if (shader_program->data->spirv)
+      prog->nir = _mesa_spirv_to_nir(ctx, shader_program, shader->Stage, options);
+   else
+      prog->nir = glsl_to_nir(&ctx->Const, shader_program, shader->Stage, options);
+
+   memcpy(prog->nir->info.source_sha1, shader->linked_source_sha1,
+          SHA1_DIGEST_LENGTH);
+
+   nir_shader_gather_info(prog->nir, nir_shader_get_entrypoint(prog->nir));
+}
+
+static void
+st_link_stage_lower(void *data, void *gdata, int thread_index)
+{
+   struct st_link_stage *stage = (struct st_link_stage *)data;
+   struct st_context *st = stage->st;
+   struct gl_shader_program *shader_program = stage->shader_program;
+   struct gl_linked_shader *shader = stage->shader;
+   nir_shader *nir = shader->Program->nir;
+   const struct gl_shader_compiler_options *options =
+         &st->ctx->Const.ShaderCompilerOptions[shader->Stage];
+
+   /* If there are forms of indirect addressing that the driver
+    * cannot handle, perform the lowering pass.
+    */
+   if (options->EmitNoIndirectInput || options->EmitNoIndirectOutput ||
+       options->EmitNoIndirectTemp || options->EmitNoIndirectUniform) {
+      nir_variable_mode mode = options->EmitNoIndirectInput ?
+         nir_var_shader_in : (nir_variable_mode)0;
+      mode |= options->EmitNoIndirectOutput ?
+         nir_var_shader_out : (nir_variable_mode)0;
+      mode |= options->EmitNoIndirectTemp ?
+         nir_var_function_temp : (nir_variable_mode)0;
+      mode |= options->EmitNoIndirectUniform ?
+         nir_var_uniform | nir_var_mem_ubo | nir_var_mem_ssbo :
+         (nir_variable_mode)0;
+
+      nir_lower_indirect_derefs(nir, mode, UINT32_MAX);
+   }
+
+   /* This needs to run after the initial pass of nir_lower_vars_to_ssa, so
+    * that the buffer indices are constants in nir where they where
+    * constants in GLSL. */
+   NIR_PASS_V(nir, gl_nir_lower_buffers, shader_program);
+
+   /* Remap the locations to slots so those requiring two slots will occupy
+    * two locations. For instance, if we have in the IR code a dvec3 attr0 in
+    * location 0 and vec4 attr1 in location 1, in NIR attr0 will use
+    * locations/slots 0 and 1, and attr1 will use location/slot 2
+    */
+   if (nir->info.stage == MESA_SHADER_VERTEX && !shader_program->data->spirv)
+      nir_remap_dual_slot_attributes(nir, &shader->Program->DualSlotInputs);
+
+   NIR_PASS_V(nir, st_nir_lower_wpos_ytransform, shader->Program,
+              st->screen);
+
+   NIR_PASS_V(nir, nir_lower_system_values);
+   NIR_PASS_V(nir, nir_lower_compute_system_values, NULL);
+}
+
+static void
+st_link_stage_post_opts(void *data, void *gdata, int thread_index)
+{
+   struct st_link_stage *stage = (struct st_link_stage *)data;
+
+   stage->msg = st_glsl_to_nir_post_opts(stage->st, stage->shader->Program,
+                                         stage->shader_program);
+}
+
 static bool
 st_link_glsl_to_nir(struct gl_context *ctx,
                     struct gl_shader_program *shader_program)
 {
    struct st_context *st = st_context(ctx);
    struct gl_linked_shader *linked_shader[MESA_SHADER_STAGES];
+   struct st_link_stage stages[MESA_SHADER_STAGES];
    unsigned num_shaders = 0;
 
    /* Return early if we are loading the shader from on-disk cache */
@@ -507,8 +635,6 @@ st_link_glsl_to_nir(struct gl_context *ctx,
 
    for (unsigned i = 0; i < num_shaders; i++) {
       struct gl_linked_shader *shader = linked_shader[i];
-      const nir_shader_compiler_options *options =
-         st->ctx->Const.ShaderCompilerOptions[shader->Stage].NirOptions;
       struct gl_program *prog = shader->Program;
 
       _mesa_copy_linked_program_data(shader_program, shader);
@@ -520,26 +646,32 @@ st_link_glsl_to_nir(struct gl_context *ctx,
       /* Parameters will be filled during NIR linking. */
       prog->Parameters = _mesa_new_parameter_list();
 
-      if (shader_program->data->spirv) {
-         prog->nir = _mesa_spirv_to_nir(ctx, shader_program, shader->Stage, options);
-      } else {
-         if (ctx->_Shader->Flags & GLSL_DUMP) {
-            _mesa_log("\n");
-            _mesa_log("GLSL IR for linked %s program %d:\n",
-                      _mesa_shader_stage_to_string(shader->Stage),
-                      shader_program->Name);
-            _mesa_print_ir(_mesa_get_log_file(), shader->ir, NULL);
-            _mesa_log("\n\n");
-         }
-
-         prog->nir = glsl_to_nir(&st->ctx->Const, shader_program, shader->Stage, options);
+      if (!shader_program->data->spirv && (ctx->_Shader->Flags & GLSL_DUMP)) {
+         _mesa_log("\n");
+         _mesa_log("GLSL IR for linked %s program %d:\n",
+                   _mesa_shader_stage_to_string(shader->Stage),
+                   shader_program->Name);
+         _mesa_print_ir(_mesa_get_log_file(), shader->ir, NULL);
+         _mesa_log("\n\n");
       }
 
-      memcpy(prog->nir->info.source_sha1, shader->linked_source_sha1,
-             SHA1_DIGEST_LENGTH);
+      stages[i].st = st;
+      stages[i].shader_program = shader_program;
+      stages[i].shader = shader;
+      stages[i].msg = NULL;
+   }
+
+   /* The stages are converted to NIR, lowered and finalized in parallel.
+    * Only the steps which look at more than one stage run in between.
+    */
+   st_link_run_stages(st, stages, num_shaders, st_link_stage_to_nir);
+
+   for (unsigned i = 0; i < num_shaders; i++) {
+      const nir_shader_compiler_options *options =
+         ctx->Const.ShaderCompilerOptions[linked_shader[i]->Stage].NirOptions;
+      nir_shader *nir = linked_shader[i]->Program->nir;
 
-      nir_shader_gather_info(prog->nir, nir_shader_get_entrypoint(prog->nir));
-      if (!st->ctx->SoftFP64 && ((prog->nir->info.bit_sizes_int | prog->nir->info.bit_sizes_float) & 64) &&
+      if (!st->ctx->SoftFP64 && ((nir->info.bit_sizes_int | nir->info.bit_sizes_float) & 64) &&
           (options->lower_doubles_options & nir_lower_fp64_full_software) != 0) {
 
          /* It's not possible to use float64 on GLSL ES, so don't bother trying to
@@ -573,65 +705,23 @@ st_link_glsl_to_nir(struct gl_context *ctx,
    nir_build_program_resource_list(&ctx->Const, shader_program,
                                    shader_program->data->spirv);
 
-   for (unsigned i = 0; i < num_shaders; i++) {
-      struct gl_linked_shader *shader = linked_shader[i];
-      nir_shader *nir = shader->Program->nir;
-      gl_shader_stage stage = shader->Stage;
-      const struct gl_shader_compiler_options *options =
-            &ctx->Const.ShaderCompilerOptions[stage];
-
-      /* If there are forms of indirect addressing that the driver
-       * cannot handle, perform the lowering pass.
-       */
-      if (options->EmitNoIndirectInput || options->EmitNoIndirectOutput ||
-          options->EmitNoIndirectTemp || options->EmitNoIndirectUniform) {
-         nir_variable_mode mode = options->EmitNoIndirectInput ?
-            nir_var_shader_in : (nir_variable_mode)0;
-         mode |= options->EmitNoIndirectOutput ?
-            nir_var_shader_out : (nir_variable_mode)0;
-         mode |= options->EmitNoIndirectTemp ?
-            nir_var_function_temp : (nir_variable_mode)0;
-         mode |= options->EmitNoIndirectUniform ?
-            nir_var_uniform | nir_var_mem_ubo | nir_var_mem_ssbo :
-            (nir_variable_mode)0;
-
-         nir_lower_indirect_derefs(nir, mode, UINT32_MAX);
-      }
+   st_link_run_stages(st, stages, num_shaders, st_link_stage_lower);
 
-      /* This needs to run after the initial pass of nir_lower_vars_to_ssa, so
-       * that the buffer indices are constants in nir where they where
-       * constants in GLSL. */
-      NIR_PASS_V(nir, gl_nir_lower_buffers, shader_program);
+   for (unsigned i = 1; i < num_shaders; i++) {
+      nir_shader *nir = linked_shader[i]->Program->nir;
+      struct gl_program *prev_shader = linked_shader[i - 1]->Program;
 
-      /* Remap the locations to slots so those requiring two slots will occupy
-       * two locations. For instance, if we have in the IR code a dvec3 attr0 in
-       * location 0 and vec4 attr1 in location 1, in NIR attr0 will use
-       * locations/slots 0 and 1, and attr1 will use location/slot 2
+      /* We can't use nir_compact_varyings with transform feedback, since
+       * the pipe_stream_output->output_register field is based on the
+       * pre-compacted driver_locations.
        */
-      if (nir->info.stage == MESA_SHADER_VERTEX && !shader_program->data->spirv)
-         nir_remap_dual_slot_attributes(nir, &shader->Program->DualSlotInputs);
-
-      NIR_PASS_V(nir, st_nir_lower_wpos_ytransform, shader->Program,
-                 st->screen);
-
-      NIR_PASS_V(nir, nir_lower_system_values);
-      NIR_PASS_V(nir, nir_lower_compute_system_values, NULL);
-
-      if (i >= 1) {
-         struct gl_program *prev_shader = linked_shader[i - 1]->Program;
-
-         /* We can't use nir_compact_varyings with transform feedback, since
-          * the pipe_stream_output->output_register field is based on the
-          * pre-compacted driver_locations.
-          */
-         if (!(prev_shader->sh.LinkedTransformFeedback &&
-               prev_shader->sh.LinkedTransformFeedback->NumVarying > 0))
-            nir_compact_varyings(prev_shader->nir,
-                                 nir, ctx->API != API_OPENGL_COMPAT);
+      if (!(prev_shader->sh.LinkedTransformFeedback &&
+            prev_shader->sh.LinkedTransformFeedback->NumVarying > 0))
+         nir_compact_varyings(prev_shader->nir,
+                              nir, ctx->API != API_OPENGL_COMPAT);
 
-         if (ctx->Const.ShaderCompilerOptions[shader->Stage].NirOptions->vectorize_io)
-            st_nir_vectorize_io(prev_shader->nir, nir);
-      }
+      if (ctx->Const.ShaderCompilerOptions[linked_shader[i]->Stage].NirOptions->vectorize_io)
+         st_nir_vectorize_io(prev_shader->nir, nir);
    }
 
    /* If the program is a separate shader program check if we need to vectorise
@@ -651,16 +741,38 @@ st_link_glsl_to_nir(struct gl_context *ctx,
       }
    }
 
+   for (unsigned i = 0; i < num_shaders; i++) {
+      st_glsl_to_nir_associate_uniforms(st, linked_shader[i]->Program,
+                                        shader_program);
+   }
+
+   st_link_run_stages(st, stages, num_shaders, st_link_stage_post_opts);
+
+   /* Report the error of the first stage which failed. */
+   bool failed = false;
+   for (unsigned i = 0; i < num_shaders; i++) {
+      if (stages[i].msg && !failed) {
+         linker_error(shader_program, stages[i].msg);
+         failed = true;
+      }
+      free(stages[i].msg);
+   }
+   if (failed)
+      return false;
+
    struct shader_info *prev_info = NULL;
 
    for (unsigned i = 0; i < num_shaders; i++) {
       struct gl_linked_shader *shader = linked_shader[i];
       struct shader_info *info = &shader->Program->nir->info;
 
-      char *msg = st_glsl_to_nir_post_opts(st, shader->Program, shader_program);
-      if (msg) {
-         linker_error(shader_program, msg);
-         return false;
+      if (ctx->_Shader->Flags & GLSL_DUMP) {
+         _mesa_log("\n");
+         _mesa_log("NIR IR for linked %s program %d:\n",
+                   _mesa_shader_stage_to_string(shader->Stage),
+                   shader_program->Name);
+         nir_print_shader(shader->Program->nir, _mesa_get_log_file());
+         _mesa_log("\n\n");
       }
 
       if (prev_info &&
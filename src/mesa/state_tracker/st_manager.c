@@ -62,6 +62,8 @@
 #include "util/u_surface.h"
 #include "util/list.h"
 #include "util/u_memory.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_queue.h"
 #include "util/perf/cpu_trace.h"
 
 struct hash_table;
@@ -70,6 +72,13 @@ struct st_screen
 {
    struct hash_table *drawable_ht; /* pipe_frontend_drawable objects hash table */
    simple_mtx_t st_mutex;
+
+   /* Shared by all contexts of the screen and created on first use: the
+    * per-stage parts of GLSL linking, and the bands of images decompressed
+    * for compressed format fallbacks.
+    */
+   struct util_queue link_queue;
+   struct util_queue decompress_queue;
 };
 
 /**
@@ -936,6 +945,11 @@ st_screen_destroy(struct pipe_frontend_screen *fscreen)
    struct st_screen *screen = fscreen->st_screen;
 
    if (screen && screen->drawable_ht) {
+      if (util_queue_is_initialized(&screen->link_queue))
+         util_queue_destroy(&screen->link_queue);
+      if (util_queue_is_initialized(&screen->decompress_queue))
+         util_queue_destroy(&screen->decompress_queue);
+
       _mesa_hash_table_destroy(screen->drawable_ht, NULL);
       simple_mtx_destroy(&screen->st_mutex);
       FREE(screen);
@@ -944,6 +958,65 @@ st_screen_destroy(struct pipe_frontend_screen *fscreen)
 }
 
 
+/**
+ * Return one of the queues of the screen, initializing it on first use
+ * with at most max_threads threads, as the calling thread also takes part
+ * in the work.  Return NULL if there is no screen or no other CPU.
+ */
+static struct util_queue *
+st_screen_get_queue(struct st_context *st, size_t queue_offset,
+                    const char *name, unsigned max_jobs, int max_threads)
+{
+   struct pipe_frontend_screen *fscreen = st->frontend_screen;
+   if (!fscreen || !fscreen->st_screen)
+      return NULL;
+
+   int num_threads = MIN2(util_get_cpu_caps()->nr_cpus - 1, max_threads);
+   if (num_threads <= 0)
+      return NULL;
+
+   struct st_screen *screen = fscreen->st_screen;
+   struct util_queue *queue =
+      (struct util_queue *)((char *)screen + queue_offset);
+   bool initialized = true;
+
+   simple_mtx_lock(&screen->st_mutex);
+   if (!util_queue_is_initialized(queue)) {
+      initialized = util_queue_init(queue, name, max_jobs, num_threads,
+                                    UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL);
+   }
+   simple_mtx_unlock(&screen->st_mutex);
+
+   return initialized ? queue : NULL;
+}
+
+/**
+ * Return the queue of the screen that runs the per-stage parts of GLSL
+ * linking, or NULL if they should run on the linking thread.
+ */
+struct util_queue *
+st_screen_get_link_queue(struct st_context *st)
+{
+   /* The first stage runs on the linking thread, and programs have at most
+    * one other stage per thread.
+    */
+   return st_screen_get_queue(st, offsetof(struct st_screen, link_queue),
+                              "gllink", MESA_SHADER_FRAGMENT,
+                              MESA_SHADER_FRAGMENT);
+}
+
+/**
+ * Return the queue of the screen that decodes bands of compressed images,
+ * with at most max_threads threads, or NULL if they should be decoded on
+ * the calling thread.
+ */
+struct util_queue *
+st_screen_get_decompress_queue(struct st_context *st, int max_threads)
+{
+   return st_screen_get_queue(st, offsetof(struct st_screen, decompress_queue),
+                              "gldecomp", max_threads + 1, max_threads);
+}
+
 /**
  * Create a rendering context.
  */
@@ -0,0 +1,275 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* CPU decompression of the compressed formats a driver lacks, done when the
+ * application uploads them.
+ */
+
+#include "main/context.h"
+#include "main/texcompress_astc.h"
+#include "main/texcompress_bptc.h"
+#include "main/texcompress_etc.h"
+#include "main/texcompress_rgtc.h"
+#include "main/texcompress_s3tc.h"
+
+#include "state_tracker/st_context.h"
+#include "state_tracker/st_texcompress_cpu.h"
+
+#include "util/disk_cache.h"
+#include "util/format/u_format.h"
+#include "util/mesa-sha1.h"
+#include "util/u_queue.h"
+
+/* Images with fewer blocks than this are decoded on the calling thread, and
+ * bands get at least this many blocks.
+ */
+#define MIN_BLOCKS_PER_BAND 1024
+
+#define MAX_BANDS 16
+
+/* Smaller images decode faster than they load from the disk cache. */
+#define MIN_CACHED_TEXELS (256 * 256)
+
+/* Larger images would crowd the shaders out of the disk cache, whose size
+ * limit they share: this is 16 MB of RGBA8.
+ */
+#define MAX_CACHED_TEXELS (2048 * 2048)
+
+/* Only the formats with slow decoders are worth caching: S3TC, RGTC and ETC1
+ * decode about as fast as they load from the disk cache.
+ */
+static bool
+is_decode_cached(mesa_format format, unsigned width, unsigned height)
+{
+   uint64_t texels = (uint64_t)width * height;
+   if (texels < MIN_CACHED_TEXELS || texels > MAX_CACHED_TEXELS)
+      return false;
+
+   return _mesa_is_format_astc_2d(format) ||
+          _mesa_is_format_etc2(format) ||
+          _mesa_is_format_bptc(format);
+}
+
+struct decompress_band {
+   mesa_format format;
+   bool bgra;
+   uint8_t *dst;
+   unsigned dst_stride;
+   const uint8_t *src;
+   unsigned src_stride;
+   unsigned width, height;
+   struct util_queue_fence fence;
+};
+
+static void
+decompress_rows(mesa_format format, bool bgra,
+                uint8_t *dst, unsigned dst_stride,
+                const uint8_t *src, unsigned src_stride,
+                unsigned width, unsigned height)
+{
+   if (format == MESA_FORMAT_ETC1_RGB8) {
+      _mesa_etc1_unpack_rgba8888(dst, dst_stride, src, src_stride,
+                                 width, height);
+   } else if (_mesa_is_format_etc2(format)) {
+      _mesa_unpack_etc2_format(dst, dst_stride, src, src_stride,
+                               width, height, format, bgra);
+   } else if (_mesa_is_format_astc_2d(format)) {
+      _mesa_unpack_astc_2d_ldr(dst, dst_stride, src, src_stride,
+                               width, height, format);
+   } else if (_mesa_is_format_s3tc(format)) {
+      _mesa_unpack_s3tc(dst, dst_stride, src, src_stride,
+                        width, height, format);
+   } else if (_mesa_is_format_rgtc(format) ||
+              _mesa_is_format_latc(format)) {
+      _mesa_unpack_rgtc(dst, dst_stride, src, src_stride,
+                        width, height, format);
+   } else if (_mesa_is_format_bptc(format)) {
+      _mesa_unpack_bptc(dst, dst_stride, src, src_stride,
+                        width, height, format);
+   } else {
+      unreachable("unexpected format for a compressed format fallback");
+   }
+}
+
+static void
+decompress_band(void *data, void *gdata, int thread_index)
+{
+   struct decompress_band *band = data;
+
+   decompress_rows(band->format, band->bgra, band->dst, band->dst_stride,
+                   band->src, band->src_stride, band->width, band->height);
+}
+
+static unsigned
+get_num_bands(mesa_format format, unsigned width, unsigned height)
+{
+   unsigned blk_w, blk_h;
+   _mesa_get_format_block_size(format, &blk_w, &blk_h);
+
+   unsigned x_blocks = DIV_ROUND_UP(width, blk_w);
+   unsigned y_blocks = DIV_ROUND_UP(height, blk_h);
+   return MIN3(y_blocks, MAX_BANDS, x_blocks * y_blocks / MIN_BLOCKS_PER_BAND);
+}
+
+void
+st_decompress_image_in_bands(struct util_queue *queue,
+                             mesa_format format, bool bgra,
+                             uint8_t *dst, unsigned dst_stride,
+                             const uint8_t *src, unsigned src_stride,
+                             unsigned width, unsigned height)
+{
+   unsigned num_bands = 1;
+   if (queue) {
+      num_bands = MIN2(get_num_bands(format, width, height),
+                       queue->max_threads + 1);
+   }
+
+   if (num_bands <= 1) {
+      decompress_rows(format, bgra, dst, dst_stride, src, src_stride,
+                      width, height);
+      return;
+   }
+
+   unsigned blk_w, blk_h;
+   _mesa_get_format_block_size(format, &blk_w, &blk_h);
+
+   struct decompress_band bands[MAX_BANDS];
+   unsigned y_blocks = DIV_ROUND_UP(height, blk_h);
+   unsigned rows_per_band = DIV_ROUND_UP(y_blocks, num_bands);
+   num_bands = DIV_ROUND_UP(y_blocks, rows_per_band);
+
+   for (unsigned i = 0; i < num_bands; i++) {
+      unsigned y = i * rows_per_band * blk_h;
+
+      bands[i] = (struct decompress_band) {
+         .format = format,
+         .bgra = bgra,
+         .dst = dst + (size_t)y * dst_stride,
+         .dst_stride = dst_stride,
+         .src = src + (size_t)i * rows_per_band * src_stride,
+         .src_stride = src_stride,
+         .width = width,
+         .height = MIN2(rows_per_band * blk_h, height - y),
+      };
+   }
+
+   for (unsigned i = 1; i < num_bands; i++) {
+      util_queue_fence_init(&bands[i].fence);
+      util_queue_add_job(queue, &bands[i], &bands[i].fence,
+                         decompress_band, NULL, 0);
+   }
+
+   decompress_band(&bands[0], NULL, 0);
+
+   for (unsigned i = 1; i < num_bands; i++) {
+      util_queue_fence_wait(&bands[i].fence);
+      util_queue_fence_destroy(&bands[i].fence);
+   }
+}
+
+static void
+decompress_image(struct st_context *st, mesa_format format, bool bgra,
+                 uint8_t *dst, unsigned dst_stride,
+                 const uint8_t *src, unsigned src_stride,
+                 unsigned width, unsigned height)
+{
+   /* Small images don't need the queue to be started. */
+   struct util_queue *queue = NULL;
+   if (get_num_bands(format, width, height) > 1)
+      queue = st_screen_get_decompress_queue(st, MAX_BANDS - 1);
+
+   st_decompress_image_in_bands(queue, format, bgra, dst, dst_stride,
+                                src, src_stride, width, height);
+}
+
+/* The key covers what the decoded pixels depend on: the formats, the size
+ * and the compressed blocks, without the padding of the source rows.
+ */
+static void
+compute_cache_key(struct disk_cache *cache, mesa_format format,
+                  enum pipe_format dst_format,
+                  const uint8_t *src, unsigned src_stride,
+                  unsigned width, unsigned height, cache_key key)
+{
+   unsigned blk_w, blk_h;
+   _mesa_get_format_block_size(format, &blk_w, &blk_h);
+
+   const uint32_t header[] = { format, dst_format, width, height };
+   unsigned row_size = DIV_ROUND_UP(width, blk_w) * _mesa_get_format_bytes(format);
+   unsigned y_blocks = DIV_ROUND_UP(height, blk_h);
+   struct mesa_sha1 ctx;
+   unsigned char sha1[20];
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, "st_decompress_image", strlen("st_decompress_image"));
+   _mesa_sha1_update(&ctx, header, sizeof(header));
+   for (unsigned y = 0; y < y_blocks; y++)
+      _mesa_sha1_update(&ctx, src + (size_t)y * src_stride, row_size);
+   _mesa_sha1_final(&ctx, sha1);
+
+   disk_cache_compute_key(cache, sha1, sizeof(sha1), key);
+}
+
+void
+st_decompress_image(struct st_context *st, mesa_format format,
+                    uint8_t *dst, unsigned dst_stride,
+                    enum pipe_format dst_format,
+                    const uint8_t *src, unsigned src_stride,
+                    unsigned width, unsigned height)
+{
+   struct disk_cache *cache = st->decode_cache ? st->ctx->Cache : NULL;
+   bool bgra = dst_format == PIPE_FORMAT_B8G8R8A8_SRGB;
+
+   if (!cache || !is_decode_cached(format, width, height)) {
+      decompress_image(st, format, bgra, dst, dst_stride, src, src_stride,
+                       width, height);
+      return;
+   }
+
+   unsigned row_size = util_format_get_stride(dst_format, width);
+   size_t size = (size_t)row_size * height;
+   cache_key key;
+
+   compute_cache_key(cache, format, dst_format, src, src_stride,
+                     width, height, key);
+
+   /* The pixels are cached without the padding of dst. */
+   size_t decoded_size;
+   uint8_t *decoded = disk_cache_get(cache, key, &decoded_size);
+
+   if (decoded && decoded_size == size) {
+      if (dst_stride == row_size) {
+         memcpy(dst, decoded, size);
+      } else {
+         for (unsigned y = 0; y < height; y++) {
+            memcpy(dst + (size_t)y * dst_stride,
+                   decoded + (size_t)y * row_size, row_size);
+         }
+      }
+      free(decoded);
+      return;
+   }
+
+   free(decoded);
+
+   decompress_image(st, format, bgra, dst, dst_stride, src, src_stride,
+                    width, height);
+
+   /* disk_cache_put() copies dst, so only padded rows need a buffer. */
+   if (dst_stride == row_size) {
+      disk_cache_put(cache, key, dst, size, NULL);
+      return;
+   }
+
+   decoded = malloc(size);
+   if (!decoded)
+      return;
+
+   for (unsigned y = 0; y < height; y++) {
+      memcpy(decoded + (size_t)y * row_size,
+             dst + (size_t)y * dst_stride, row_size);
+   }
+
+   disk_cache_put_nocopy(cache, key, decoded, size, NULL);
+}
@@ -0,0 +1,49 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ST_TEXCOMPRESS_CPU_H
+#define ST_TEXCOMPRESS_CPU_H
+
+#include <stdint.h>
+
+#include "main/formats.h"
+#include "util/format/u_formats.h"
+
+struct st_context;
+struct util_queue;
+
+/**
+ * Decompresses a compressed image on the CPU, for drivers lacking the
+ * compressed format.
+ *
+ * The block rows of large images are split across the threads of the
+ * screen's decompression queue.  With the decode_cache option, large ASTC,
+ * ETC2 and BPTC images are also kept decoded in the disk cache, keyed by a
+ * hash of the compressed data.
+ *
+ * \param format     the compressed format of src
+ * \param dst_format the format src decompresses to, one texel per block
+ * \param src_stride in bytes per row of blocks
+ */
+void
+st_decompress_image(struct st_context *st, mesa_format format,
+                    uint8_t *dst, unsigned dst_stride,
+                    enum pipe_format dst_format,
+                    const uint8_t *src, unsigned src_stride,
+                    unsigned width, unsigned height);
+
+/**
+ * Decompresses a compressed image to RGBA8 or BGRA8, splitting its block
+ * rows into bands that are decoded on the threads of queue and on the
+ * calling thread.  Images too small to be worth splitting, or all images if
+ * queue is NULL, are decoded on the calling thread only.
+ */
+void
+st_decompress_image_in_bands(struct util_queue *queue,
+                             mesa_format format, bool bgra,
+                             uint8_t *dst, unsigned dst_stride,
+                             const uint8_t *src, unsigned src_stride,
+                             unsigned width, unsigned height);
+
+#endif /* ST_TEXCOMPRESS_CPU_H */
@@ -0,0 +1,106 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Checks that decoding compressed images in bands on a queue gives the same
+ * pixels as decoding them on a single thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main/formats.h"
+#include "state_tracker/st_texcompress_cpu.h"
+#include "util/u_math.h"
+#include "util/u_queue.h"
+
+/* Large enough to be split, with odd numbers of block rows that don't split
+ * evenly into bands, and heights ending with a partial row of blocks.
+ */
+static const struct {
+   mesa_format format;
+   bool bgra;
+   unsigned width, height;
+} images[] = {
+   { MESA_FORMAT_ETC2_RGBA8_EAC, false, 259, 401 },
+   { MESA_FORMAT_ETC2_SRGB8_ALPHA8_EAC, true, 256, 299 },
+   { MESA_FORMAT_RGB_DXT1, false, 300, 1001 },
+   { MESA_FORMAT_BPTC_RGBA_UNORM, false, 330, 329 },
+   { MESA_FORMAT_RGBA_ASTC_5x5, false, 512, 503 },
+   { MESA_FORMAT_RGBA_ASTC_12x10, false, 1000, 767 },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_6x6, false, 300, 257 },
+};
+
+/* Padding at the end of each row of decoded pixels, which must survive. */
+#define DST_PADDING 20
+
+static uint32_t
+next_random(uint32_t *state)
+{
+   *state = *state * 1103515245 + 12345;
+   return *state >> 8;
+}
+
+int main(int argc, char **argv)
+{
+   struct util_queue queue;
+   int ret = 0;
+
+   if (!util_queue_init(&queue, "test", 16, 15,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL)) {
+      fprintf(stderr, "failed to create the queue\n");
+      return 1;
+   }
+
+   for (unsigned i = 0; i < ARRAY_SIZE(images); i++) {
+      mesa_format format = images[i].format;
+      unsigned width = images[i].width;
+      unsigned height = images[i].height;
+      unsigned blk_w, blk_h;
+
+      _mesa_get_format_block_size(format, &blk_w, &blk_h);
+
+      unsigned src_stride = DIV_ROUND_UP(width, blk_w) *
+                            _mesa_get_format_bytes(format);
+      unsigned src_size = src_stride * DIV_ROUND_UP(height, blk_h);
+      unsigned dst_stride = width * 4 + DST_PADDING;
+      unsigned dst_size = dst_stride * height;
+      uint8_t *src = malloc(src_size);
+      uint8_t *expected = malloc(dst_size);
+      uint8_t *banded = malloc(dst_size);
+      uint32_t seed = i + 1;
+
+      for (unsigned j = 0; j < src_size; j++)
+         src[j] = next_random(&seed);
+
+      memset(expected, 0xcd, dst_size);
+      memset(banded, 0xcd, dst_size);
+
+      st_decompress_image_in_bands(NULL, format, images[i].bgra,
+                                   expected, dst_stride, src, src_stride,
+                                   width, height);
+      st_decompress_image_in_bands(&queue, format, images[i].bgra,
+                                   banded, dst_stride, src, src_stride,
+                                   width, height);
+
+      for (unsigned y = 0; y < height; y++) {
+         if (memcmp(expected + y * dst_stride, banded + y * dst_stride,
+                    dst_stride)) {
+            fprintf(stderr, "%s %ux%u: row %u differs when decoded in "
+                    "bands\n", _mesa_get_format_name(format),
+                    width, height, y);
+            ret = 1;
+            break;
+         }
+      }
+
+      free(src);
+      free(expected);
+      free(banded);
+   }
+
+   util_queue_destroy(&queue);
+
+   return ret;
+}
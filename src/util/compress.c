@@ -36,8 +36,11 @@
 
 #ifdef HAVE_ZSTD
 #include "zstd.h"
+#include "zdict.h"
 #endif
 
+#include <stdlib.h>
+
 #include "util/compress.h"
 #include "util/perf/cpu_trace.h"
 #include "macros.h"
@@ -166,4 +169,126 @@ util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
 #endif
 }
 
+#ifdef HAVE_ZSTD
+struct util_compress_dict {
+   /* Digested once, so using the dictionary costs nothing per call. */
+   ZSTD_CDict *cdict;
+   ZSTD_DDict *ddict;
+   unsigned id;
+};
+#endif
+
+struct util_compress_dict *
+util_compress_dict_create(const void *data, size_t size)
+{
+#ifdef HAVE_ZSTD
+   /* Raw content dictionaries have no ID, which frames compressed without a
+    * dictionary couldn't be told apart from.
+    */
+   if (ZDICT_getDictID(data, size) == 0)
+      return NULL;
+
+   struct util_compress_dict *dict = calloc(1, sizeof(*dict));
+   if (dict == NULL)
+      return NULL;
+
+   dict->cdict = ZSTD_createCDict(data, size, ZSTD_COMPRESSION_LEVEL);
+   dict->ddict = ZSTD_createDDict(data, size);
+   dict->id = ZSTD_getDictID_fromDDict(dict->ddict);
+   if (dict->cdict == NULL || dict->ddict == NULL) {
+      util_compress_dict_destroy(dict);
+      return NULL;
+   }
+
+   return dict;
+#else
+   return NULL;
+#endif
+}
+
+void
+util_compress_dict_destroy(struct util_compress_dict *dict)
+{
+   if (dict == NULL)
+      return;
+
+#ifdef HAVE_ZSTD
+   ZSTD_freeCDict(dict->cdict);
+   ZSTD_freeDDict(dict->ddict);
+#endif
+   free(dict);
+}
+
+size_t
+util_compress_dict_train(void *dict_data, size_t dict_buff_size,
+                         const void *samples, const size_t *sample_sizes,
+                         unsigned num_samples)
+{
+#ifdef HAVE_ZSTD
+   size_t ret = ZDICT_trainFromBuffer(dict_data, dict_buff_size, samples,
+                                      sample_sizes, num_samples);
+   if (ZDICT_isError(ret))
+      return 0;
+
+   return ret;
+#else
+   return 0;
+#endif
+}
+
+size_t
+util_compress_deflate_with_dict(const struct util_compress_dict *dict,
+                                const uint8_t *in_data, size_t in_data_size,
+                                uint8_t *out_data, size_t out_buff_size)
+{
+#ifdef HAVE_ZSTD
+   if (dict != NULL) {
+      MESA_TRACE_FUNC();
+      ZSTD_CCtx *cctx = ZSTD_createCCtx();
+      if (cctx == NULL)
+         return 0;
+
+      size_t ret = ZSTD_compress_usingCDict(cctx, out_data, out_buff_size,
+                                            in_data, in_data_size,
+                                            dict->cdict);
+      ZSTD_freeCCtx(cctx);
+      if (ZSTD_isError(ret))
+         return 0;
+
+      return ret;
+   }
+#endif
+
+   return util_compress_deflate(in_data, in_data_size, out_data,
+                                out_buff_size);
+}
+
+bool
+util_compress_inflate_with_dict(const struct util_compress_dict *dict,
+                                const uint8_t *in_data, size_t in_data_size,
+                                uint8_t *out_data, size_t out_data_size)
+{
+#ifdef HAVE_ZSTD
+   unsigned id = ZSTD_getDictID_fromFrame(in_data, in_data_size);
+   if (id != 0) {
+      MESA_TRACE_FUNC();
+      if (dict == NULL || dict->id != id)
+         return false;
+
+      ZSTD_DCtx *dctx = ZSTD_createDCtx();
+      if (dctx == NULL)
+         return false;
+
+      size_t ret = ZSTD_decompress_usingDDict(dctx, out_data, out_data_size,
+                                              in_data, in_data_size,
+                                              dict->ddict);
+      ZSTD_freeDCtx(dctx);
+      return !ZSTD_isError(ret);
+   }
+#endif
+
+   return util_compress_inflate(in_data, in_data_size, out_data,
+                                out_data_size);
+}
+
 #endif
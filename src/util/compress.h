@@ -26,6 +26,10 @@
 #include <stdbool.h>
 #include <inttypes.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 size_t
 util_compress_max_compressed_len(size_t in_data_size);
 
@@ -37,4 +41,43 @@ size_t
 util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
                       uint8_t *out_data, size_t out_buff_size);
 
+/* Dictionaries let small blobs share the context they would otherwise each
+ * have to build up, which is where most of their compressed size goes.  They
+ * are only supported with zstd, the functions below fall back to the plain
+ * ones when the dictionary is NULL.
+ */
+struct util_compress_dict;
+
+/* Returns NULL if the data isn't a valid dictionary, or without zstd. */
+struct util_compress_dict *
+util_compress_dict_create(const void *data, size_t size);
+
+void
+util_compress_dict_destroy(struct util_compress_dict *dict);
+
+/* Trains a dictionary from num_samples samples stored back to back, and
+ * returns its size or 0 on failure.
+ */
+size_t
+util_compress_dict_train(void *dict_data, size_t dict_buff_size,
+                         const void *samples, const size_t *sample_sizes,
+                         unsigned num_samples);
+
+/* Data compressed without a dictionary can be decompressed with any, data
+ * compressed with one only with the same.
+ */
+bool
+util_compress_inflate_with_dict(const struct util_compress_dict *dict,
+                                const uint8_t *in_data, size_t in_data_size,
+                                uint8_t *out_data, size_t out_data_size);
+
+size_t
+util_compress_deflate_with_dict(const struct util_compress_dict *dict,
+                                const uint8_t *in_data, size_t in_data_size,
+                                uint8_t *out_data, size_t out_buff_size);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -151,9 +151,6 @@ disk_cache_type_create(const char *gpu_name,
    cache->stats.enabled = debug_get_bool_option("MESA_SHADER_CACHE_SHOW_STATS",
                                                 false);
 
-   if (!disk_cache_mmap_cache_index(local, cache, path))
-      goto path_fail;
-
    max_size = 0;
 
    max_size_str = getenv("MESA_SHADER_CACHE_MAX_SIZE");
@@ -204,6 +201,10 @@ disk_cache_type_create(const char *gpu_name,
 
    cache->max_size = max_size;
 
+   /* The multi-file cache sizes its eviction index from max_size. */
+   if (!disk_cache_mmap_cache_index(local, cache, path))
+      goto path_fail;
+
    if (cache->type == DISK_CACHE_DATABASE)
       mesa_cache_db_multipart_set_size_limit(&cache->cache_db, cache->max_size);
 
@@ -244,6 +245,9 @@ disk_cache_type_create(const char *gpu_name,
    DRV_KEY_CPY(drv_key_blob, &ptr_size, ptr_size_size)
    DRV_KEY_CPY(drv_key_blob, &driver_flags, driver_flags_size)
 
+   if (!cache->path_init_failed && !cache->compression_disabled)
+      disk_cache_load_compress_dict(local, cache);
+
    /* Seed our rand function */
    s_rand_xorshift128plus(cache->seed_xorshift128plus, true);
 
@@ -322,6 +326,7 @@ disk_cache_destroy(struct disk_cache *cache)
          mesa_cache_db_multipart_close(&cache->cache_db);
 
       disk_cache_destroy_mmap(cache);
+      util_compress_dict_destroy(cache->compress_dict);
    }
 
    ralloc_free(cache);
@@ -346,6 +351,7 @@ disk_cache_remove(struct disk_cache *cache, const cache_key key)
       return;
    }
 
+   disk_cache_lru_index_remove(cache, key);
    disk_cache_evict_item(cache, filename);
 }
 
@@ -551,8 +557,11 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
 
    if (dc_job) {
       util_queue_fence_init(&dc_job->fence);
-      util_queue_add_job(&cache->cache_queue, dc_job, &dc_job->fence,
-                         cache_put, destroy_put_job, dc_job->size);
+      util_queue_add_job_with_priority(&cache->cache_queue, dc_job,
+                                       &dc_job->fence, cache_put,
+                                       destroy_put_job, dc_job->size,
+                                       UTIL_QUEUE_PRIORITY_LOW,
+                                       UTIL_QUEUE_NO_THREAD_HINT);
    }
 }
 
@@ -571,8 +580,11 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
 
    if (dc_job) {
       util_queue_fence_init(&dc_job->fence);
-      util_queue_add_job(&cache->cache_queue, dc_job, &dc_job->fence,
-                         cache_put, destroy_put_job_nocopy, dc_job->size);
+      util_queue_add_job_with_priority(&cache->cache_queue, dc_job,
+                                       &dc_job->fence, cache_put,
+                                       destroy_put_job_nocopy, dc_job->size,
+                                       UTIL_QUEUE_PRIORITY_LOW,
+                                       UTIL_QUEUE_NO_THREAD_HINT);
    }
 }
 
@@ -598,6 +610,8 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
          char *filename = disk_cache_get_cache_filename(cache, key);
          if (filename)
             buf = disk_cache_load_item(cache, filename, size);
+         if (buf)
+            disk_cache_lru_index_touch(cache, key);
       }
    }
 
@@ -611,6 +625,133 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return buf;
 }
 
+static void
+cache_get_async(void *job, void *gdata, int thread_index)
+{
+   struct disk_cache_get_request *req = (struct disk_cache_get_request *) job;
+
+   req->data = disk_cache_get(req->cache, req->key, &req->size);
+}
+
+void
+disk_cache_get_async(struct disk_cache *cache,
+                     struct disk_cache_get_request *req)
+{
+   util_queue_fence_init(&req->fence);
+   req->cache = cache;
+
+   /* The callbacks aren't known to be thread-safe. */
+   if (!util_queue_is_initialized(&cache->cache_queue) ||
+       cache->blob_get_cb) {
+      req->data = disk_cache_get(cache, req->key, &req->size);
+      return;
+   }
+
+   /* Someone will wait for the lookup, so it goes ahead of the writes. */
+   util_queue_add_job_with_priority(&cache->cache_queue, req, &req->fence,
+                                    cache_get_async, NULL, 0,
+                                    UTIL_QUEUE_PRIORITY_HIGH,
+                                    UTIL_QUEUE_NO_THREAD_HINT);
+}
+
+/* State shared by the calling thread and the queue jobs of a
+ * disk_cache_get_batch() call.  The jobs may only run after the batch is
+ * done, so they hold a reference and only touch the requests for lookups
+ * they claim.
+ */
+struct disk_cache_get_batch {
+   struct disk_cache *cache;
+   struct disk_cache_get_request *reqs;
+   unsigned num_reqs;
+   unsigned next;
+   unsigned num_done;
+   unsigned refcount;
+   struct util_queue_fence done;
+};
+
+static void
+cache_get_batch_unref(struct disk_cache_get_batch *batch)
+{
+   if (p_atomic_dec_zero(&batch->refcount)) {
+      util_queue_fence_destroy(&batch->done);
+      free(batch);
+   }
+}
+
+static void
+cache_get_batch_run(struct disk_cache_get_batch *batch)
+{
+   unsigned i;
+
+   while ((i = p_atomic_inc_return(&batch->next) - 1) < batch->num_reqs) {
+      struct disk_cache_get_request *req = &batch->reqs[i];
+
+      req->data = disk_cache_get(batch->cache, req->key, &req->size);
+
+      if (p_atomic_inc_return(&batch->num_done) == batch->num_reqs)
+         util_queue_fence_signal(&batch->done);
+   }
+}
+
+static void
+cache_get_batch_job(void *job, void *gdata, int thread_index)
+{
+   cache_get_batch_run((struct disk_cache_get_batch *) job);
+}
+
+static void
+cache_get_batch_job_cleanup(void *job, void *gdata, int thread_index)
+{
+   cache_get_batch_unref((struct disk_cache_get_batch *) job);
+}
+
+void
+disk_cache_get_batch(struct disk_cache *cache,
+                     struct disk_cache_get_request *reqs,
+                     unsigned num_reqs)
+{
+   struct disk_cache_get_batch *batch = NULL;
+   unsigned num_jobs = 0;
+
+   if (num_reqs > 1 && util_queue_is_initialized(&cache->cache_queue) &&
+       !cache->blob_get_cb) {
+      num_jobs = MIN2(num_reqs - 1, cache->cache_queue.num_threads);
+      batch = (struct disk_cache_get_batch *) calloc(1, sizeof(*batch));
+   }
+
+   if (!batch) {
+      for (unsigned i = 0; i < num_reqs; i++)
+         reqs[i].data = disk_cache_get(cache, reqs[i].key, &reqs[i].size);
+      return;
+   }
+
+   batch->cache = cache;
+   batch->reqs = reqs;
+   batch->num_reqs = num_reqs;
+   batch->refcount = num_jobs + 1;
+   util_queue_fence_init(&batch->done);
+   util_queue_fence_reset(&batch->done);
+
+   for (unsigned i = 0; i < num_jobs; i++) {
+      util_queue_add_job_with_priority(&cache->cache_queue, batch, NULL,
+                                       cache_get_batch_job,
+                                       cache_get_batch_job_cleanup, 0,
+                                       UTIL_QUEUE_PRIORITY_HIGH,
+                                       UTIL_QUEUE_NO_THREAD_HINT);
+   }
+
+   /* The lookups go ahead of queued writes, but the queue threads run at a
+    * low priority and may be in the middle of writing cache items, so do
+    * lookups on this thread as well rather than just wait.
+    */
+   cache_get_batch_run(batch);
+
+   /* Wait for the lookups the queue threads already started. */
+   util_queue_fence_wait(&batch->done);
+
+   cache_get_batch_unref(batch);
+}
+
 void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
@@ -35,6 +35,7 @@
 #include <sys/stat.h>
 #include "util/mesa-sha1.h"
 #include "util/detect_os.h"
+#include "util/u_queue.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -79,6 +80,24 @@ struct cache_item_metadata {
 
 struct disk_cache;
 
+/**
+ * A lookup done by disk_cache_get_async() or disk_cache_get_batch().
+ *
+ * Once the lookup is done, \data points to the malloc'ed item, (or is NULL
+ * if the item wasn't found), and \size holds its size.
+ */
+struct disk_cache_get_request {
+   cache_key key;
+   void *data;
+   size_t size;
+
+   /* Signalled when a lookup started by disk_cache_get_async() is done. */
+   struct util_queue_fence fence;
+
+   /* Private, set by disk_cache_get_async(). */
+   struct disk_cache *cache;
+};
+
 #ifdef HAVE_DLADDR
 static inline bool
 disk_cache_get_function_timestamp(void *ptr, uint32_t* timestamp)
@@ -229,6 +248,30 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size);
 
+/**
+ * Start looking up \req->key on the cache queue, so the item is read and
+ * decompressed while the caller does something else.
+ *
+ * The result is available in \req once util_queue_fence_wait() returns for
+ * \req->fence.  The caller must wait for and destroy the fence before
+ * freeing \req.
+ */
+void
+disk_cache_get_async(struct disk_cache *cache,
+                     struct disk_cache_get_request *req);
+
+/**
+ * Look up several items at once, spreading the reads and decompression over
+ * the cache queue and the calling thread.
+ *
+ * Returns when all the lookups are done, the fences of the requests aren't
+ * used.
+ */
+void
+disk_cache_get_batch(struct disk_cache *cache,
+                     struct disk_cache_get_request *reqs,
+                     unsigned num_reqs);
+
 /**
  * Store the name \key within the cache, (without any associated data).
  *
@@ -304,6 +347,26 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return NULL;
 }
 
+static inline void
+disk_cache_get_async(struct disk_cache *cache,
+                     struct disk_cache_get_request *req)
+{
+   req->data = NULL;
+   req->size = 0;
+   util_queue_fence_init(&req->fence);
+}
+
+static inline void
+disk_cache_get_batch(struct disk_cache *cache,
+                     struct disk_cache_get_request *reqs,
+                     unsigned num_reqs)
+{
+   for (unsigned i = 0; i < num_reqs; i++) {
+      reqs[i].data = NULL;
+      reqs[i].size = 0;
+   }
+}
+
 static inline void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
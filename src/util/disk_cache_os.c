@@ -477,12 +477,686 @@ write_all(int fd, const void *buf, size_t count)
    return done;
 }
 
+/* LRU eviction index of the multi-file cache.
+ *
+ * The index is a file next to the cache items, mapped shared by every
+ * process using the cache.  It holds a binary min-heap of (key, tick, size)
+ * entries ordered by tick, plus an open addressing table mapping keys to
+ * their heap position.  Ticks come from a counter in the index header
+ * which is bumped on every put and load, so the root of the heap is always
+ * the least recently used item and eviction never has to look at the cache
+ * directories.
+ *
+ * The index starts small and doubles when it fills up, up to a fraction of
+ * the cache size.  Its file counts towards the cache size like the items
+ * do.  If it fills up at its largest size, it stops being used and eviction
+ * goes back to scanning the cache directories, which also sees the items
+ * the index missed.  The file never shrinks, so processes which mapped a
+ * smaller index only have to remap it when they see a larger capacity.
+ *
+ * All accesses happen with an exclusive flock held on the index file.  If
+ * a process dies half way through an update the index is only ever
+ * inconsistent, never out of bounds: inconsistencies found during lookup
+ * cause the index to be reset and re-seeded.
+ */
+#define LRU_INDEX_MAGIC 0x78646c6d /* "mldx" */
+#define LRU_INDEX_VERSION 2
+#define LRU_INDEX_MIN_ENTRIES 256
+
+/* The index may use up to this fraction of the cache size. */
+#define LRU_INDEX_SIZE_DIVISOR 16
+
+/* The index has been filled from the items already in the cache. */
+#define LRU_INDEX_FLAG_SEEDED (1 << 0)
+/* The index was full at its largest size, and misses some of the items. */
+#define LRU_INDEX_FLAG_OVERFLOW (1 << 1)
+
+/* Items found while seeding use their atime as tick; items put or loaded
+ * afterwards always sort after them.
+ */
+#define LRU_INDEX_FIRST_TICK (1ull << 32)
+
+struct lru_index_header {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t flags;
+   uint32_t num_entries;
+   uint64_t tick;
+   uint32_t capacity;
+   uint32_t pad;
+   /* Size of the index file already added to the cache size. */
+   uint64_t counted_size;
+};
+
+struct lru_index_entry {
+   cache_key key;
+   uint32_t slot;
+   uint64_t tick;
+   uint64_t size;
+};
+
+struct lru_index {
+   struct disk_cache *cache;
+   struct lru_index_header *header;
+   struct lru_index_entry *entries;
+   /* Heap position + 1 of the entry hashed into each slot, 0 if empty. */
+   uint32_t *slots;
+   uint32_t slot_mask;
+};
+
+static size_t
+lru_index_file_size(uint32_t capacity)
+{
+   return sizeof(struct lru_index_header) +
+          (size_t)capacity * sizeof(struct lru_index_entry) +
+          (size_t)capacity * 2 * sizeof(uint32_t);
+}
+
+static void
+lru_index_bind(struct lru_index *idx, struct disk_cache *cache)
+{
+   idx->cache = cache;
+   idx->header = (struct lru_index_header *)cache->lru_index_mmap;
+   idx->entries = (struct lru_index_entry *)(idx->header + 1);
+   idx->slots = (uint32_t *)(idx->entries + idx->header->capacity);
+   idx->slot_mask = idx->header->capacity * 2 - 1;
+}
+
+static void
+lru_index_reset(struct lru_index *idx)
+{
+   memset(idx->slots, 0, (idx->slot_mask + 1) * sizeof(uint32_t));
+   idx->header->flags = 0;
+   idx->header->num_entries = 0;
+   idx->header->tick = LRU_INDEX_FIRST_TICK;
+}
+
+/* Maps the whole index file, which is at least as large as the index. */
+static bool
+lru_index_map(struct disk_cache *cache)
+{
+   struct stat sb;
+   if (fstat(cache->lru_index_fd, &sb) == -1)
+      return false;
+
+   void *map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    cache->lru_index_fd, 0);
+   if (map == MAP_FAILED)
+      return false;
+
+   if (cache->lru_index_mmap)
+      munmap(cache->lru_index_mmap, cache->lru_index_mmap_size);
+   cache->lru_index_mmap = map;
+   cache->lru_index_mmap_size = sb.st_size;
+   return true;
+}
+
+/* Resizes the index file, adding any growth to the cache size. */
+static bool
+lru_index_resize_file(struct disk_cache *cache, size_t size)
+{
+#if HAVE_POSIX_FALLOCATE
+   if (posix_fallocate(cache->lru_index_fd, 0, size) != 0)
+      return false;
+#else
+   if (ftruncate(cache->lru_index_fd, size) == -1)
+      return false;
+#endif
+
+   if (!lru_index_map(cache))
+      return false;
+
+   struct lru_index_header *header =
+      (struct lru_index_header *)cache->lru_index_mmap;
+   if (size > header->counted_size) {
+      p_atomic_add(&cache->size->value, size - header->counted_size);
+      header->counted_size = size;
+   }
+   return true;
+}
+
+static bool
+lru_index_lock(struct disk_cache *cache, struct lru_index *idx)
+{
+   if (!cache->lru_index_mmap)
+      return false;
+
+   /* flock() locks are per open file, so they don't exclude the other
+    * threads of this process.
+    */
+   simple_mtx_lock(&cache->lru_index_mtx);
+
+#ifdef HAVE_FLOCK
+   int err = flock(cache->lru_index_fd, LOCK_EX);
+#else
+   struct flock lock = {
+      .l_start = 0,
+      .l_len = 0, /* entire file */
+      .l_type = F_WRLCK,
+      .l_whence = SEEK_SET
+   };
+   int err = fcntl(cache->lru_index_fd, F_SETLKW, &lock);
+#endif
+   if (err == -1) {
+      simple_mtx_unlock(&cache->lru_index_mtx);
+      return false;
+   }
+
+   struct lru_index_header *header =
+      (struct lru_index_header *)cache->lru_index_mmap;
+
+   if (header->magic != LRU_INDEX_MAGIC ||
+       header->version != LRU_INDEX_VERSION) {
+      /* A new file, or one written by another version of Mesa.  Keep its
+       * size, which is already on disk, and use as much of it as fits.
+       */
+      uint32_t capacity = LRU_INDEX_MIN_ENTRIES;
+      while (lru_index_file_size(capacity * 2) <= cache->lru_index_mmap_size)
+         capacity *= 2;
+
+      header->magic = LRU_INDEX_MAGIC;
+      header->version = LRU_INDEX_VERSION;
+      header->capacity = capacity;
+      header->counted_size = 0;
+      if (!lru_index_resize_file(cache, MAX2(cache->lru_index_mmap_size,
+                                             lru_index_file_size(capacity))))
+         goto fail;
+
+      lru_index_bind(idx, cache);
+      lru_index_reset(idx);
+      return true;
+   }
+
+   /* Another process grew the index. */
+   if (lru_index_file_size(header->capacity) > cache->lru_index_mmap_size &&
+       !lru_index_map(cache))
+      goto fail;
+
+   lru_index_bind(idx, cache);
+
+   if (idx->header->num_entries > idx->header->capacity)
+      lru_index_reset(idx);
+
+   return true;
+
+fail:
+#ifdef HAVE_FLOCK
+   flock(cache->lru_index_fd, LOCK_UN);
+#else
+   lock.l_type = F_UNLCK;
+   fcntl(cache->lru_index_fd, F_SETLK, &lock);
+#endif
+   simple_mtx_unlock(&cache->lru_index_mtx);
+   return false;
+}
+
+static void
+lru_index_unlock(struct disk_cache *cache)
+{
+#ifdef HAVE_FLOCK
+   flock(cache->lru_index_fd, LOCK_UN);
+#else
+   struct flock lock = {
+      .l_start = 0,
+      .l_len = 0, /* entire file */
+      .l_type = F_UNLCK,
+      .l_whence = SEEK_SET
+   };
+   fcntl(cache->lru_index_fd, F_SETLK, &lock);
+#endif
+
+   simple_mtx_unlock(&cache->lru_index_mtx);
+}
+
+static uint32_t
+lru_index_home_slot(const struct lru_index *idx, const cache_key key)
+{
+   uint32_t hash;
+   memcpy(&hash, key, sizeof(hash));
+   return hash & idx->slot_mask;
+}
+
+static void
+lru_index_set_pos(struct lru_index *idx, uint32_t pos)
+{
+   idx->slots[idx->entries[pos].slot & idx->slot_mask] = pos + 1;
+}
+
+static void
+lru_index_swap(struct lru_index *idx, uint32_t a, uint32_t b)
+{
+   struct lru_index_entry tmp = idx->entries[a];
+   idx->entries[a] = idx->entries[b];
+   idx->entries[b] = tmp;
+   lru_index_set_pos(idx, a);
+   lru_index_set_pos(idx, b);
+}
+
+static void
+lru_index_sift_up(struct lru_index *idx, uint32_t pos)
+{
+   while (pos > 0) {
+      uint32_t parent = (pos - 1) / 2;
+      if (idx->entries[parent].tick <= idx->entries[pos].tick)
+         break;
+      lru_index_swap(idx, parent, pos);
+      pos = parent;
+   }
+}
+
+static void
+lru_index_sift_down(struct lru_index *idx, uint32_t pos)
+{
+   uint32_t count = idx->header->num_entries;
+
+   while (true) {
+      uint32_t min = pos;
+      uint32_t left = 2 * pos + 1;
+      uint32_t right = left + 1;
+
+      if (left < count && idx->entries[left].tick < idx->entries[min].tick)
+         min = left;
+      if (right < count && idx->entries[right].tick < idx->entries[min].tick)
+         min = right;
+      if (min == pos)
+         break;
+
+      lru_index_swap(idx, pos, min);
+      pos = min;
+   }
+}
+
+/* Returns the slot holding key, or the empty slot where it would be
+ * inserted.  Sets *found accordingly.  Returns -1 if the index turned out to
+ * be inconsistent, in which case it has been reset.
+ */
+static int64_t
+lru_index_find(struct lru_index *idx, const cache_key key, bool *found)
+{
+   uint32_t slot = lru_index_home_slot(idx, key);
+
+   for (unsigned i = 0; i <= idx->slot_mask; i++) {
+      uint32_t pos = idx->slots[slot];
+      if (pos == 0) {
+         *found = false;
+         return slot;
+      }
+
+      if (pos > idx->header->num_entries ||
+          idx->entries[pos - 1].slot != slot)
+         break;
+
+      if (memcmp(idx->entries[pos - 1].key, key, CACHE_KEY_SIZE) == 0) {
+         *found = true;
+         return slot;
+      }
+
+      slot = (slot + 1) & idx->slot_mask;
+   }
+
+   lru_index_reset(idx);
+   return -1;
+}
+
+/* Backward shift deletion, keeps probe sequences intact without
+ * tombstones.
+ */
+static void
+lru_index_clear_slot(struct lru_index *idx, uint32_t slot)
+{
+   uint32_t hole = slot;
+   uint32_t next = slot;
+
+   idx->slots[hole] = 0;
+
+   while (true) {
+      next = (next + 1) & idx->slot_mask;
+      uint32_t pos = idx->slots[next];
+      if (pos == 0 || pos > idx->header->num_entries)
+         break;
+
+      uint32_t home = lru_index_home_slot(idx, idx->entries[pos - 1].key);
+      bool movable = hole <= next ? (home <= hole || home > next)
+                                  : (home <= hole && home > next);
+      if (movable) {
+         idx->slots[hole] = pos;
+         idx->entries[pos - 1].slot = hole;
+         idx->slots[next] = 0;
+         hole = next;
+      }
+   }
+}
+
+static void
+lru_index_remove_at(struct lru_index *idx, uint32_t pos)
+{
+   lru_index_clear_slot(idx, idx->entries[pos].slot & idx->slot_mask);
+
+   uint32_t last = --idx->header->num_entries;
+   if (pos != last) {
+      idx->entries[pos] = idx->entries[last];
+      lru_index_set_pos(idx, pos);
+      lru_index_sift_down(idx, pos);
+      lru_index_sift_up(idx, pos);
+   }
+}
+
+/* Doubles the capacity of a full index.  The entries keep their heap
+ * positions, only the slot table moves and is rebuilt.  The new capacity is
+ * only stored once the table is complete, so the old index stays valid if
+ * this process dies half way through.
+ */
+static bool
+lru_index_grow(struct lru_index *idx)
+{
+   struct disk_cache *cache = idx->cache;
+   uint32_t capacity = idx->header->capacity * 2;
+
+   if (capacity > cache->lru_index_max_entries)
+      return false;
+
+   size_t size = lru_index_file_size(capacity);
+   if (size > cache->lru_index_mmap_size &&
+       !lru_index_resize_file(cache, size))
+      return false;
+
+   idx->header = (struct lru_index_header *)cache->lru_index_mmap;
+   idx->entries = (struct lru_index_entry *)(idx->header + 1);
+   idx->slots = (uint32_t *)(idx->entries + capacity);
+   idx->slot_mask = capacity * 2 - 1;
+   memset(idx->slots, 0, capacity * 2 * sizeof(uint32_t));
+
+   for (uint32_t pos = 0; pos < idx->header->num_entries; pos++) {
+      uint32_t slot = lru_index_home_slot(idx, idx->entries[pos].key);
+      while (idx->slots[slot])
+         slot = (slot + 1) & idx->slot_mask;
+
+      idx->entries[pos].slot = slot;
+      idx->slots[slot] = pos + 1;
+   }
+
+   idx->header->capacity = capacity;
+   return true;
+}
+
+static void
+lru_index_add(struct lru_index *idx, const cache_key key, uint64_t tick,
+              uint64_t size)
+{
+   if (idx->header->flags & LRU_INDEX_FLAG_OVERFLOW)
+      return;
+
+   bool found;
+   int64_t slot = lru_index_find(idx, key, &found);
+   if (slot < 0)
+      return;
+
+   if (found) {
+      uint32_t pos = idx->slots[slot] - 1;
+      idx->entries[pos].size = size;
+      idx->entries[pos].tick = tick;
+      lru_index_sift_down(idx, pos);
+      lru_index_sift_up(idx, pos);
+      return;
+   }
+
+   if (idx->header->num_entries == idx->header->capacity) {
+      if (!lru_index_grow(idx)) {
+         idx->header->flags |= LRU_INDEX_FLAG_OVERFLOW;
+         return;
+      }
+
+      slot = lru_index_find(idx, key, &found);
+      if (slot < 0)
+         return;
+   }
+
+   uint32_t pos = idx->header->num_entries++;
+   memcpy(idx->entries[pos].key, key, CACHE_KEY_SIZE);
+   idx->entries[pos].slot = slot;
+   idx->entries[pos].tick = tick;
+   idx->entries[pos].size = size;
+   idx->slots[slot] = pos + 1;
+   lru_index_sift_up(idx, pos);
+}
+
+static bool
+lru_index_pop(struct lru_index *idx, cache_key key, uint64_t *size)
+{
+   if (idx->header->num_entries == 0)
+      return false;
+
+   memcpy(key, idx->entries[0].key, CACHE_KEY_SIZE);
+   *size = idx->entries[0].size;
+   lru_index_remove_at(idx, 0);
+   return true;
+}
+
+/* Fill a new index from the items already in the cache directory.  This is
+ * the only time the eviction index walks the cache.
+ */
+static void
+lru_index_seed(struct disk_cache *cache, struct lru_index *idx)
+{
+   for (unsigned d = 0; d < 256; d++) {
+      char *dir_path;
+      if (asprintf(&dir_path, "%s/%02x", cache->path, d) < 0)
+         return;
+
+      DIR *dir = opendir(dir_path);
+      free(dir_path);
+      if (!dir)
+         continue;
+
+      struct dirent *dir_ent;
+      while ((dir_ent = readdir(dir)) != NULL) {
+         size_t len = strlen(dir_ent->d_name);
+         if (len != CACHE_KEY_SIZE * 2 - 2)
+            continue;
+
+         struct stat sb;
+         if (fstatat(dirfd(dir), dir_ent->d_name, &sb, 0) != 0 ||
+             !S_ISREG(sb.st_mode))
+            continue;
+
+         char hex[CACHE_KEY_SIZE * 2 + 1];
+         snprintf(hex, sizeof(hex), "%02x%s", d, dir_ent->d_name);
+
+         cache_key key;
+         bool valid = true;
+         for (unsigned i = 0; i < CACHE_KEY_SIZE && valid; i++) {
+            unsigned byte;
+            valid = sscanf(&hex[i * 2], "%2x", &byte) == 1;
+            key[i] = byte;
+         }
+         if (!valid)
+            continue;
+
+         /* Don't age items that were put since the index was created. */
+         bool found;
+         if (lru_index_find(idx, key, &found) < 0 || found)
+            continue;
+
+         uint64_t tick = MIN2((uint64_t)sb.st_atime, LRU_INDEX_FIRST_TICK - 1);
+         lru_index_add(idx, key, tick, sb.st_blocks * 512);
+         if (idx->header->flags & LRU_INDEX_FLAG_OVERFLOW)
+            break;
+      }
+      closedir(dir);
+   }
+}
+
+/* Opens the index, unless the cache is too small for even the smallest
+ * one, in which case eviction always scans the cache directories.
+ */
+static bool
+disk_cache_lru_index_open(void *mem_ctx, struct disk_cache *cache)
+{
+   uint64_t max_index_size = cache->max_size / LRU_INDEX_SIZE_DIVISOR;
+   if (lru_index_file_size(LRU_INDEX_MIN_ENTRIES) > max_index_size)
+      return false;
+
+   cache->lru_index_max_entries = LRU_INDEX_MIN_ENTRIES;
+   while (cache->lru_index_max_entries < UINT32_MAX / 4 &&
+          lru_index_file_size(cache->lru_index_max_entries * 2) <= max_index_size)
+      cache->lru_index_max_entries *= 2;
+
+   char *path = ralloc_asprintf(mem_ctx, "%s/lru_index", cache->path);
+   if (path == NULL)
+      return false;
+
+   int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if (fd == -1)
+      return false;
+
+   struct stat sb;
+   size_t size = lru_index_file_size(LRU_INDEX_MIN_ENTRIES);
+   if (fstat(fd, &sb) == -1)
+      goto fail;
+
+   /* The file is only ever grown, under the lock, so a new file can only be
+    * raced by another process creating the same one.
+    */
+   if (sb.st_size < size) {
+#if HAVE_POSIX_FALLOCATE
+      if (posix_fallocate(fd, 0, size) != 0)
+         goto fail;
+#else
+      if (ftruncate(fd, size) == -1)
+         goto fail;
+#endif
+   }
+
+   cache->lru_index_fd = fd;
+   cache->lru_index_mmap = NULL;
+   if (!lru_index_map(cache))
+      goto fail;
+
+   simple_mtx_init(&cache->lru_index_mtx, mtx_plain);
+   return true;
+
+fail:
+   close(fd);
+   return false;
+}
+
+static void
+disk_cache_lru_index_close(struct disk_cache *cache)
+{
+   if (!cache->lru_index_mmap)
+      return;
+
+   munmap(cache->lru_index_mmap, cache->lru_index_mmap_size);
+   close(cache->lru_index_fd);
+   simple_mtx_destroy(&cache->lru_index_mtx);
+   cache->lru_index_mmap = NULL;
+}
+
+static void
+disk_cache_lru_index_add(struct disk_cache *cache, const cache_key key,
+                         uint64_t size)
+{
+   struct lru_index idx;
+   if (!lru_index_lock(cache, &idx))
+      return;
+
+   lru_index_add(&idx, key, idx.header->tick++, size);
+
+   lru_index_unlock(cache);
+}
+
+void
+disk_cache_lru_index_touch(struct disk_cache *cache, const cache_key key)
+{
+   struct lru_index idx;
+   if (!lru_index_lock(cache, &idx))
+      return;
+
+   bool found;
+   int64_t slot = lru_index_find(&idx, key, &found);
+   if (slot >= 0 && found) {
+      uint32_t pos = idx.slots[slot] - 1;
+      idx.entries[pos].tick = idx.header->tick++;
+      lru_index_sift_down(&idx, pos);
+   }
+
+   lru_index_unlock(cache);
+}
+
+void
+disk_cache_lru_index_remove(struct disk_cache *cache, const cache_key key)
+{
+   struct lru_index idx;
+   if (!lru_index_lock(cache, &idx))
+      return;
+
+   bool found;
+   int64_t slot = lru_index_find(&idx, key, &found);
+   if (slot >= 0 && found)
+      lru_index_remove_at(&idx, idx.slots[slot] - 1);
+
+   lru_index_unlock(cache);
+}
+
+/* Evict the least recently used item known to the index.
+ *
+ * Returns the size of the deleted file, (or 0 if the index is unavailable,
+ * empty or overflowed).
+ */
+static size_t
+disk_cache_evict_lru_item_indexed(struct disk_cache *cache)
+{
+   struct lru_index idx;
+   if (!lru_index_lock(cache, &idx))
+      return 0;
+
+   if (!(idx.header->flags & LRU_INDEX_FLAG_SEEDED)) {
+      lru_index_seed(cache, &idx);
+      idx.header->flags |= LRU_INDEX_FLAG_SEEDED;
+   }
+
+   if (idx.header->flags & LRU_INDEX_FLAG_OVERFLOW) {
+      lru_index_unlock(cache);
+      return 0;
+   }
+
+   /* Items removed behind the index's back, (e.g. by older versions of
+    * Mesa) leave stale entries, skip over a few of them.
+    */
+   size_t size = 0;
+   cache_key key;
+   uint64_t indexed_size;
+   for (unsigned i = 0; i < 8 && !size; i++) {
+      if (!lru_index_pop(&idx, key, &indexed_size))
+         break;
+
+      char *filename = disk_cache_get_cache_filename(cache, key);
+      if (!filename)
+         break;
+
+      struct stat sb;
+      if (stat(filename, &sb) == 0 && unlink(filename) == 0)
+         size = sb.st_blocks * 512;
+      free(filename);
+   }
+
+   lru_index_unlock(cache);
+
+   return size;
+}
+
 /* Evict least recently used cache item */
 void
 disk_cache_evict_lru_item(struct disk_cache *cache)
 {
    char *dir_path;
 
+   size_t size = disk_cache_evict_lru_item_indexed(cache);
+   if (size) {
+      p_atomic_add(&cache->size->value, - (uint64_t)size);
+      return;
+   }
+
    /* With a reasonably-sized, full cache, (and with keys generated
     * from a cryptographic hash), we can choose two random hex digits
     * and reasonably expect the directory to exist with a file in it.
@@ -492,7 +1166,7 @@ disk_cache_evict_lru_item(struct disk_cache *cache)
    if (asprintf(&dir_path, "%s/%02" PRIx64 , cache->path, rand64 & 0xff) < 0)
       return;
 
-   size_t size = unlink_lru_file_from_directory(dir_path);
+   size = unlink_lru_file_from_directory(dir_path);
 
    free(dir_path);
 
@@ -609,8 +1283,10 @@ parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
 
       memcpy(uncompressed_data, data, cache_data_size);
    } else {
-      if (!util_compress_inflate(data, cache_data_size, uncompressed_data,
-                                 cf_data->uncompressed_size))
+      if (!util_compress_inflate_with_dict(cache->compress_dict,
+                                           data, cache_data_size,
+                                           uncompressed_data,
+                                           cf_data->uncompressed_size))
          goto fail;
    }
 
@@ -709,8 +1385,9 @@ create_cache_item_header_and_blob(struct disk_cache_put_job *dc_job,
       if (compressed_data == NULL)
          return false;
       compressed_size =
-         util_compress_deflate(dc_job->data, dc_job->size,
-                              compressed_data, max_buf);
+         util_compress_deflate_with_dict(dc_job->cache->compress_dict,
+                                         dc_job->data, dc_job->size,
+                                         compressed_data, max_buf);
       if (compressed_size == 0)
          goto fail;
    }
@@ -861,6 +1538,7 @@ disk_cache_write_item_to_disk(struct disk_cache_put_job *dc_job,
    }
 
    p_atomic_add(&dc_job->cache->size->value, sb.st_blocks * 512);
+   disk_cache_lru_index_add(dc_job->cache, dc_job->key, sb.st_blocks * 512);
 
  done:
    if (fd_final != -1)
@@ -1107,6 +1785,12 @@ disk_cache_mmap_cache_index(void *mem_ctx, struct disk_cache *cache,
    cache->stored_keys = cache->index_mmap + sizeof(uint64_t);
    mapped = true;
 
+   /* Eviction falls back to scanning the cache directories if the LRU index
+    * can't be used, so failing to open it is not fatal.
+    */
+   if (cache->type == DISK_CACHE_MULTI_FILE)
+      disk_cache_lru_index_open(mem_ctx, cache);
+
 path_fail:
    if (fd != -1)
       close(fd);
@@ -1117,6 +1801,7 @@ path_fail:
 void
 disk_cache_destroy_mmap(struct disk_cache *cache)
 {
+   disk_cache_lru_index_close(cache);
    munmap(cache->index_mmap, cache->index_mmap_size);
 }
 
@@ -1159,6 +1844,65 @@ disk_cache_db_load_cache_index(void *mem_ctx, struct disk_cache *cache)
 {
    return mesa_cache_db_multipart_open(&cache->cache_db, cache->path);
 }
+
+/* Return the filename of the zstd dictionary for the entries of the given
+ * driver keys, which cover the driver, its version and the cache version.
+ *
+ * Returns NULL if out of memory.
+ */
+char *
+disk_cache_get_compress_dict_filename(void *mem_ctx, const char *path,
+                                      const uint8_t *driver_keys_blob,
+                                      size_t driver_keys_blob_size)
+{
+   unsigned char sha1[20];
+   char buf[41];
+
+   _mesa_sha1_compute(driver_keys_blob, driver_keys_blob_size, sha1);
+   _mesa_sha1_format(buf, sha1);
+
+   return ralloc_asprintf(mem_ctx, "%s/zstd_dict_%s", path, buf);
+}
+
+/* Dictionaries are trained by mesa-cache-dict, and are only ever replaced
+ * by renaming a new file over them, so they can be read without locking.
+ * Entries compressed with another dictionary fail to decompress and are
+ * treated as misses.
+ */
+void
+disk_cache_load_compress_dict(void *mem_ctx, struct disk_cache *cache)
+{
+   uint8_t *data = NULL;
+
+   char *filename =
+      disk_cache_get_compress_dict_filename(mem_ctx, cache->path,
+                                            cache->driver_keys_blob,
+                                            cache->driver_keys_blob_size);
+   if (filename == NULL)
+      return;
+
+   int fd = open(filename, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return;
+
+   struct stat sb;
+   if (fstat(fd, &sb) == -1 || sb.st_size == 0 ||
+       sb.st_size > DISK_CACHE_MAX_COMPRESS_DICT_SIZE)
+      goto out;
+
+   data = malloc(sb.st_size);
+   if (data == NULL)
+      goto out;
+
+   if (read_all(fd, data, sb.st_size) == -1)
+      goto out;
+
+   cache->compress_dict = util_compress_dict_create(data, sb.st_size);
+
+ out:
+   free(data);
+   close(fd);
+}
 #endif
 
 #endif /* ENABLE_SHADER_CACHE */
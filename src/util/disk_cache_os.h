@@ -24,6 +24,7 @@
 #ifndef DISK_CACHE_OS_H
 #define DISK_CACHE_OS_H
 
+#include "util/simple_mtx.h"
 #include "util/u_queue.h"
 
 #if DETECT_OS_WINDOWS
@@ -49,6 +50,11 @@ extern "C" {
 /* The number of keys that can be stored in the index. */
 #define CACHE_INDEX_MAX_KEYS (1 << CACHE_INDEX_KEY_BITS)
 
+/* Larger zstd dictionaries are ignored, they would only slow down loading
+ * the cache for entries of the size of shaders.
+ */
+#define DISK_CACHE_MAX_COMPRESS_DICT_SIZE (1024 * 1024)
+
 enum disk_cache_type {
    DISK_CACHE_NONE,
    DISK_CACHE_MULTI_FILE,
@@ -83,6 +89,17 @@ struct disk_cache {
    /* Pointer to stored keys, (within index_mmap). */
    uint8_t *stored_keys;
 
+   /* The mmapped LRU eviction index of the multi-file cache, (see
+    * disk_cache_os.c), or NULL if it couldn't be opened.  The file lock
+    * serializes processes, the mutex serializes the threads of this one.
+    */
+   simple_mtx_t lru_index_mtx;
+   int lru_index_fd;
+   uint8_t *lru_index_mmap;
+   size_t lru_index_mmap_size;
+   /* Largest capacity the index may grow to, from the cache size. */
+   uint32_t lru_index_max_entries;
+
    /* Maximum size of all cached objects (in bytes). */
    uint64_t max_size;
 
@@ -96,6 +113,9 @@ struct disk_cache {
    /* Don't compress cached data. This is for testing purposes only. */
    bool compression_disabled;
 
+   /* The zstd dictionary of the cache directory, if one was trained. */
+   struct util_compress_dict *compress_dict;
+
    struct {
       bool enabled;
       unsigned hits;
@@ -138,6 +158,12 @@ disk_cache_evict_lru_item(struct disk_cache *cache);
 void
 disk_cache_evict_item(struct disk_cache *cache, char *filename);
 
+void
+disk_cache_lru_index_touch(struct disk_cache *cache, const cache_key key);
+
+void
+disk_cache_lru_index_remove(struct disk_cache *cache, const cache_key key);
+
 void *
 disk_cache_load_item_foz(struct disk_cache *cache, const cache_key key,
                          size_t *size);
@@ -178,6 +204,14 @@ disk_cache_db_write_item_to_disk(struct disk_cache_put_job *dc_job);
 bool
 disk_cache_db_load_cache_index(void *mem_ctx, struct disk_cache *cache);
 
+char *
+disk_cache_get_compress_dict_filename(void *mem_ctx, const char *path,
+                                      const uint8_t *driver_keys_blob,
+                                      size_t driver_keys_blob_size);
+
+void
+disk_cache_load_compress_dict(void *mem_ctx, struct disk_cache *cache);
+
 #ifdef __cplusplus
 }
 #endif
@@ -284,6 +284,9 @@
 #define DRI_CONF_TRANSCODE_CACHE(def) \
    DRI_CONF_OPT_B(transcode_cache, def, "Cache for transcode ASTC formats to DXTC if unsupported")
 
+#define DRI_CONF_DECODE_CACHE(def) \
+   DRI_CONF_OPT_B(decode_cache, def, "Cache large ASTC, ETC2 and BPTC textures decompressed on the CPU if unsupported")
+
 #define DRI_CONF_ASTC_FALLBACK(def) \
    DRI_CONF_OPT_B(astc_fallback, def, "Enable ASTC software fallback")
 
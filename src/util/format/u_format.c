@@ -36,6 +36,7 @@
 #include "util/detect_arch.h"
 #include "util/format/u_format.h"
 #include "util/format/u_format_s3tc.h"
+#include "util/u_cpu_detect.h"
 #include "util/u_math.h"
 
 /**
@@ -1229,6 +1230,16 @@ util_format_unpack_table_init(void)
       }
 #endif
 
+#if DETECT_ARCH_X86_64 && !defined(NO_FORMAT_ASM)
+      if (util_get_cpu_caps()->has_avx2) {
+         const struct util_format_unpack_description *unpack = util_format_unpack_description_avx2(format);
+         if (unpack) {
+            util_format_unpack_table[format] = unpack;
+            continue;
+         }
+      }
+#endif
+
       util_format_unpack_table[format] = util_format_unpack_description_generic(format);
    }
 }
@@ -1242,6 +1253,35 @@ util_format_unpack_description(enum pipe_format format)
    return util_format_unpack_table[format];
 }
 
+static const struct util_format_pack_description *util_format_pack_table[PIPE_FORMAT_COUNT];
+
+static void
+util_format_pack_table_init(void)
+{
+   for (enum pipe_format format = PIPE_FORMAT_NONE; format < PIPE_FORMAT_COUNT; format++) {
+#if DETECT_ARCH_X86_64 && !defined(NO_FORMAT_ASM)
+      if (util_get_cpu_caps()->has_avx2) {
+         const struct util_format_pack_description *pack = util_format_pack_description_avx2(format);
+         if (pack) {
+            util_format_pack_table[format] = pack;
+            continue;
+         }
+      }
+#endif
+
+      util_format_pack_table[format] = util_format_pack_description_generic(format);
+   }
+}
+
+const struct util_format_pack_description *
+util_format_pack_description(enum pipe_format format)
+{
+   static once_flag flag = ONCE_FLAG_INIT;
+   call_once(&flag, util_format_pack_table_init);
+
+   return util_format_pack_table[format];
+}
+
 enum pipe_format
 util_format_snorm_to_unorm(enum pipe_format format)
 {
@@ -751,3 +751,259 @@ def generate(formats):
 
                 generate_format_unpack(format, channel, native_type, suffix)
                 generate_format_pack(format, channel, native_type, suffix)
+
+
+def is_format_avx2(format):
+    '''Whether the format gets AVX2 row kernels.
+
+    These are the 32-bit RGBA8 UNORM layouts, for which both the 8unorm and
+    the float conversions boil down to a byte shuffle per pixel.'''
+
+    if format.layout != PLAIN or format.colorspace != RGB:
+        return False
+    if format.block_width != 1 or format.block_height != 1:
+        return False
+    if format.block_size() != 32:
+        return False
+    if not any(channel.type == UNSIGNED for channel in format.le_channels):
+        return False
+    for channel in format.le_channels:
+        if channel.size != 8:
+            return False
+        if channel.type == VOID:
+            continue
+        if channel.type != UNSIGNED or not channel.norm or channel.pure:
+            return False
+    return True
+
+
+def avx2_shuffle(pattern):
+    '''Return a _mm256_setr_epi8() applying the per-pixel byte pattern to all
+    the pixels of a vector, None meaning a zero byte.'''
+
+    indices = []
+    for pixel in range(4):
+        for index in pattern:
+            indices.append(-128 if index is None else pixel * 4 + index)
+    indices = indices + indices
+    return '_mm256_setr_epi8(%s)' % ', '.join(['%d' % i for i in indices])
+
+
+def generate_format_avx2(format):
+    '''Generate the AVX2 row kernels of a format.
+
+    Only the little-endian layout matters, AVX2 being x86-only.'''
+
+    name = format.short_name()
+    channels = format.le_channels
+    swizzles = format.le_swizzles
+
+    # Byte of the packed pixel each RGBA component comes from.
+    unpack = []
+    fill = 0
+    for i in range(4):
+        swizzle = swizzles[i]
+        if swizzle < 4:
+            unpack.append(channels[swizzle].shift // 8)
+        else:
+            unpack.append(None)
+            if swizzle == SWIZZLE_1:
+                fill |= 0xff << (i * 8)
+
+    # RGBA component each byte of the packed pixel comes from.
+    inv_swizzle = inv_swizzles(swizzles)
+    pack = [None] * 4
+    for i in range(4):
+        if channels[i].type != VOID:
+            pack[channels[i].shift // 8] = inv_swizzle[i]
+
+    print('static void')
+    print('util_format_%s_unpack_rgba_8unorm_avx2(uint8_t *restrict dst, const uint8_t *restrict src, unsigned width)' % name)
+    print('{')
+    print('   const __m256i shuffle = %s;' % avx2_shuffle(unpack))
+    print('   const __m256i fill = _mm256_set1_epi32(0x%08x);' % fill)
+    print('   unsigned x = unpack_rgba_8unorm_avx2(dst, src, width, shuffle, fill);')
+    print('   if (x < width)')
+    print('      util_format_%s_unpack_rgba_8unorm(dst + 4 * x, src + 4 * x, width - x);' % name)
+    print('}')
+    print()
+
+    print('static void')
+    print('util_format_%s_unpack_rgba_float_avx2(void *restrict dst, const uint8_t *restrict src, unsigned width)' % name)
+    print('{')
+    print('   const __m256i shuffle = %s;' % avx2_shuffle(unpack))
+    print('   const __m256i fill = _mm256_set1_epi32(0x%08x);' % fill)
+    print('   unsigned x = unpack_rgba_float_avx2(dst, src, width, shuffle, fill);')
+    print('   if (x < width)')
+    print('      util_format_%s_unpack_rgba_float((float *)dst + 4 * x, src + 4 * x, width - x);' % name)
+    print('}')
+    print()
+
+    for src_suffix, src_native_type in (('rgba_8unorm', 'uint8_t'), ('rgba_float', 'float')):
+        print('static void')
+        print('util_format_%s_pack_%s_avx2(uint8_t *restrict dst_row, unsigned dst_stride, const %s *restrict src_row, unsigned src_stride, unsigned width, unsigned height)' %
+              (name, src_suffix, src_native_type))
+        print('{')
+        print('   const __m256i shuffle = %s;' % avx2_shuffle(pack))
+        print('   for (unsigned y = 0; y < height; y++) {')
+        print('      unsigned x = pack_%s_avx2(dst_row, src_row, width, shuffle);' % src_suffix)
+        print('      if (x < width)')
+        print('         util_format_%s_pack_%s(dst_row + 4 * x, 0, src_row + 4 * x, 0, width - x, 1);' % (name, src_suffix))
+        print('      dst_row += dst_stride;')
+        print('      src_row += src_stride/sizeof(*src_row);')
+        print('   }')
+        print('}')
+        print()
+
+
+avx2_helpers = '''
+/* Each helper converts as many whole vectors of 8 pixels of a row as it
+ * can and returns how many pixels it did, leaving the rest of the row to
+ * the generic code.  The shuffle moves the bytes of each pixel around and
+ * zeroes the ones to fill with 0 or 0xff.
+ */
+
+static inline __m256i
+unpack_8unorm_avx2(const uint8_t *src, __m256i shuffle, __m256i fill)
+{
+   __m256i pixels = _mm256_loadu_si256((const __m256i *)src);
+   return _mm256_or_si256(_mm256_shuffle_epi8(pixels, shuffle), fill);
+}
+
+static inline unsigned
+unpack_rgba_8unorm_avx2(uint8_t *restrict dst, const uint8_t *restrict src,
+                        unsigned width, __m256i shuffle, __m256i fill)
+{
+   unsigned x;
+   for (x = 0; x + 8 <= width; x += 8) {
+      __m256i rgba = unpack_8unorm_avx2(src + 4 * x, shuffle, fill);
+      _mm256_storeu_si256((__m256i *)(dst + 4 * x), rgba);
+   }
+   return x;
+}
+
+static inline unsigned
+unpack_rgba_float_avx2(float *restrict dst, const uint8_t *restrict src,
+                       unsigned width, __m256i shuffle, __m256i fill)
+{
+   const __m256 scale = _mm256_set1_ps(1.0f / 255.0f);
+   unsigned x;
+   for (x = 0; x + 8 <= width; x += 8) {
+      __m256i rgba = unpack_8unorm_avx2(src + 4 * x, shuffle, fill);
+      __m128i half[2] = {
+         _mm256_castsi256_si128(rgba),
+         _mm256_extracti128_si256(rgba, 1),
+      };
+      for (unsigned i = 0; i < 4; i++) {
+         __m128i pair = i & 1 ? _mm_srli_si128(half[i / 2], 8) : half[i / 2];
+         __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(pair));
+         _mm256_storeu_ps(dst + 4 * x + 8 * i, _mm256_mul_ps(f, scale));
+      }
+   }
+   return x;
+}
+
+static inline unsigned
+pack_rgba_8unorm_avx2(uint8_t *restrict dst, const uint8_t *restrict src,
+                      unsigned width, __m256i shuffle)
+{
+   unsigned x;
+   for (x = 0; x + 8 <= width; x += 8) {
+      __m256i rgba = _mm256_loadu_si256((const __m256i *)(src + 4 * x));
+      _mm256_storeu_si256((__m256i *)(dst + 4 * x),
+                          _mm256_shuffle_epi8(rgba, shuffle));
+   }
+   return x;
+}
+
+/* float_to_ubyte() on 8 floats, giving one byte per 32-bit lane. */
+static inline __m256i
+float_to_ubyte_avx2(__m256 f)
+{
+   __m256 biased = _mm256_add_ps(_mm256_mul_ps(f, _mm256_set1_ps(255.0f / 256.0f)),
+                                 _mm256_set1_ps(32768.0f));
+   __m256i ub = _mm256_and_si256(_mm256_castps_si256(biased), _mm256_set1_epi32(0xff));
+   __m256 saturated = _mm256_cmp_ps(f, _mm256_set1_ps(1.0f), _CMP_GE_OQ);
+   __m256 positive = _mm256_cmp_ps(f, _mm256_setzero_ps(), _CMP_GT_OQ);
+   ub = _mm256_blendv_epi8(ub, _mm256_set1_epi32(0xff), _mm256_castps_si256(saturated));
+   return _mm256_and_si256(ub, _mm256_castps_si256(positive));
+}
+
+static inline unsigned
+pack_rgba_float_avx2(uint8_t *restrict dst, const float *restrict src,
+                     unsigned width, __m256i shuffle)
+{
+   unsigned x;
+   for (x = 0; x + 8 <= width; x += 8) {
+      const float *s = src + 4 * x;
+      __m256i a = float_to_ubyte_avx2(_mm256_loadu_ps(s));
+      __m256i b = float_to_ubyte_avx2(_mm256_loadu_ps(s + 8));
+      __m256i c = float_to_ubyte_avx2(_mm256_loadu_ps(s + 16));
+      __m256i d = float_to_ubyte_avx2(_mm256_loadu_ps(s + 24));
+      /* The packs work within 128-bit lanes, leaving the pixels in the
+       * order 0 2 4 6 1 3 5 7.
+       */
+      __m256i rgba = _mm256_packus_epi16(_mm256_packus_epi32(a, b),
+                                         _mm256_packus_epi32(c, d));
+      rgba = _mm256_permutevar8x32_epi32(rgba, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+      _mm256_storeu_si256((__m256i *)(dst + 4 * x),
+                          _mm256_shuffle_epi8(rgba, shuffle));
+   }
+   return x;
+}
+'''
+
+
+def generate_avx2(formats):
+    '''Generate the AVX2 row kernels and the tables overriding the generic
+    functions with them.'''
+
+    formats = [format for format in formats if is_format_avx2(format)]
+
+    print()
+    print('#include "util/detect_arch.h"')
+    print()
+    print('#if DETECT_ARCH_X86_64 && !defined(NO_FORMAT_ASM)')
+    print()
+    print('#include <immintrin.h>')
+    print('#include "u_format_pack.h"')
+    print(avx2_helpers)
+
+    for format in formats:
+        generate_format_avx2(format)
+
+    print('static const struct util_format_unpack_description util_format_unpack_descriptions_avx2[] = {')
+    for format in formats:
+        name = format.short_name()
+        print('   [%s] = {' % format.name)
+        print('      .unpack_rgba_8unorm = &util_format_%s_unpack_rgba_8unorm_avx2,' % name)
+        print('      .unpack_rgba = &util_format_%s_unpack_rgba_float_avx2,' % name)
+        print('   },')
+    print('};')
+    print()
+
+    print('static const struct util_format_pack_description util_format_pack_descriptions_avx2[] = {')
+    for format in formats:
+        name = format.short_name()
+        print('   [%s] = {' % format.name)
+        print('      .pack_rgba_8unorm = &util_format_%s_pack_rgba_8unorm_avx2,' % name)
+        print('      .pack_rgba_float = &util_format_%s_pack_rgba_float_avx2,' % name)
+        print('   },')
+    print('};')
+    print()
+
+    for type, func in (('unpack', 'unpack_rgba'), ('pack', 'pack_rgba_float')):
+        print('const struct util_format_%s_description *' % type)
+        print('util_format_%s_description_avx2(enum pipe_format format)' % type)
+        print('{')
+        print('   if (format >= ARRAY_SIZE(util_format_%s_descriptions_avx2))' % type)
+        print('      return NULL;')
+        print()
+        print('   if (!util_format_%s_descriptions_avx2[format].%s)' % (type, func))
+        print('      return NULL;')
+        print()
+        print('   return &util_format_%s_descriptions_avx2[format];' % type)
+        print('}')
+        print()
+
+    print('#endif /* DETECT_ARCH_X86_64 */')
@@ -193,7 +193,7 @@ def write_format_table(formats):
 
     def generate_table_getter(type):
         suffix = ""
-        if type == "unpack_":
+        if type == "unpack_" or type == "pack_":
             suffix = "_generic"
         print("ATTRIBUTE_RETURNS_NONNULL const struct util_format_%sdescription *" % type)
         print("util_format_%sdescription%s(enum pipe_format format)" % (type, suffix))
@@ -322,8 +322,14 @@ def write_format_table(formats):
 
     generate_function_getter("fetch_rgba")
 
+def write_format_table_avx2(formats):
+    write_format_table_header(sys.stdout)
+    u_format_pack.generate_avx2(formats)
+
+
 def main():
     formats = []
+    avx2 = False
 
     sys.stdout2 = open(os.devnull, "w")
 
@@ -332,10 +338,16 @@ def main():
             sys.stdout2 = sys.stdout
             sys.stdout = open(os.devnull, "w")
             continue
+        if arg == '--avx2':
+            avx2 = True
+            continue
 
         formats.extend(parse(arg))
 
-    write_format_table(formats)
+    if avx2:
+        write_format_table_avx2(formats)
+    else:
+        write_format_table(formats)
 
 if __name__ == '__main__':
     main()
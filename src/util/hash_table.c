@@ -33,11 +33,8 @@
  */
 
 /**
- * Implements an open-addressing, linear-reprobing hash table.
- *
- * For more information, see:
- *
- * http://cgit.freedesktop.org/~anholt/hash_table/tree/README
+ * Implements an open-addressing hash table, probing groups of slots through
+ * an array of control bytes.  See hash_table_group.h.
  */
 
 #include <stdlib.h>
@@ -49,6 +46,7 @@
 #include "macros.h"
 #include "u_memory.h"
 #include "fast_urem_by_const.h"
+#include "hash_table_group.h"
 #include "util/u_memory.h"
 
 #define XXH_INLINE_ALL
@@ -76,49 +74,48 @@ uint_key(unsigned id)
 static const uint32_t deleted_key_value;
 
 /**
- * From Knuth -- a good choice for hash/rehash values is p, p-2 where
- * p and p-2 are both prime.  These tables are sized to have an extra 10%
- * free to avoid exponential performance degradation as the hash table fills
+ * Prime sizes spread the start of the probes even with weak hashes.  These
+ * tables are sized to have an extra 10% free to avoid exponential performance
+ * degradation as the hash table fills
  */
 static const struct {
-   uint32_t max_entries, size, rehash;
-   uint64_t size_magic, rehash_magic;
+   uint32_t max_entries, size;
+   uint64_t size_magic;
 } hash_sizes[] = {
-#define ENTRY(max_entries, size, rehash) \
-   { max_entries, size, rehash, \
-      REMAINDER_MAGIC(size), REMAINDER_MAGIC(rehash) }
-
-   ENTRY(2,            5,            3            ),
-   ENTRY(4,            7,            5            ),
-   ENTRY(8,            13,           11           ),
-   ENTRY(16,           19,           17           ),
-   ENTRY(32,           43,           41           ),
-   ENTRY(64,           73,           71           ),
-   ENTRY(128,          151,          149          ),
-   ENTRY(256,          283,          281          ),
-   ENTRY(512,          571,          569          ),
-   ENTRY(1024,         1153,         1151         ),
-   ENTRY(2048,         2269,         2267         ),
-   ENTRY(4096,         4519,         4517         ),
-   ENTRY(8192,         9013,         9011         ),
-   ENTRY(16384,        18043,        18041        ),
-   ENTRY(32768,        36109,        36107        ),
-   ENTRY(65536,        72091,        72089        ),
-   ENTRY(131072,       144409,       144407       ),
-   ENTRY(262144,       288361,       288359       ),
-   ENTRY(524288,       576883,       576881       ),
-   ENTRY(1048576,      1153459,      1153457      ),
-   ENTRY(2097152,      2307163,      2307161      ),
-   ENTRY(4194304,      4613893,      4613891      ),
-   ENTRY(8388608,      9227641,      9227639      ),
-   ENTRY(16777216,     18455029,     18455027     ),
-   ENTRY(33554432,     36911011,     36911009     ),
-   ENTRY(67108864,     73819861,     73819859     ),
-   ENTRY(134217728,    147639589,    147639587    ),
-   ENTRY(268435456,    295279081,    295279079    ),
-   ENTRY(536870912,    590559793,    590559791    ),
-   ENTRY(1073741824,   1181116273,   1181116271   ),
-   ENTRY(2147483648ul, 2362232233ul, 2362232231ul )
+#define ENTRY(max_entries, size) \
+   { max_entries, size, REMAINDER_MAGIC(size) }
+
+   ENTRY(2,            5            ),
+   ENTRY(4,            7            ),
+   ENTRY(8,            13           ),
+   ENTRY(16,           19           ),
+   ENTRY(32,           43           ),
+   ENTRY(64,           73           ),
+   ENTRY(128,          151          ),
+   ENTRY(256,          283          ),
+   ENTRY(512,          571          ),
+   ENTRY(1024,         1153         ),
+   ENTRY(2048,         2269         ),
+   ENTRY(4096,         4519         ),
+   ENTRY(8192,         9013         ),
+   ENTRY(16384,        18043        ),
+   ENTRY(32768,        36109        ),
+   ENTRY(65536,        72091        ),
+   ENTRY(131072,       144409       ),
+   ENTRY(262144,       288361       ),
+   ENTRY(524288,       576883       ),
+   ENTRY(1048576,      1153459      ),
+   ENTRY(2097152,      2307163      ),
+   ENTRY(4194304,      4613893      ),
+   ENTRY(8388608,      9227641      ),
+   ENTRY(16777216,     18455029     ),
+   ENTRY(33554432,     36911011     ),
+   ENTRY(67108864,     73819861     ),
+   ENTRY(134217728,    147639589    ),
+   ENTRY(268435456,    295279081    ),
+   ENTRY(536870912,    590559793    ),
+   ENTRY(1073741824,   1181116273   ),
+   ENTRY(2147483648ul, 2362232233ul )
 };
 
 ASSERTED static inline bool
@@ -127,18 +124,6 @@ key_pointer_is_reserved(const struct hash_table *ht, const void *key)
    return key == NULL || key == ht->deleted_key;
 }
 
-static int
-entry_is_free(const struct hash_entry *entry)
-{
-   return entry->key == NULL;
-}
-
-static int
-entry_is_deleted(const struct hash_table *ht, struct hash_entry *entry)
-{
-   return entry->key == ht->deleted_key;
-}
-
 static int
 entry_is_present(const struct hash_table *ht, struct hash_entry *entry)
 {
@@ -154,13 +139,13 @@ _mesa_hash_table_init(struct hash_table *ht,
 {
    ht->size_index = 0;
    ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
    ht->size_magic = hash_sizes[ht->size_index].size_magic;
-   ht->rehash_magic = hash_sizes[ht->size_index].rehash_magic;
    ht->max_entries = hash_sizes[ht->size_index].max_entries;
    ht->key_hash_function = key_hash_function;
    ht->key_equals_function = key_equals_function;
-   ht->table = rzalloc_array(mem_ctx, struct hash_entry, ht->size);
+   ht->table = rzalloc_size(mem_ctx, table_alloc_size(sizeof(struct hash_entry),
+                                                      ht->size));
+   ht->ctrl = (uint8_t *)(ht->table + ht->size);
    ht->entries = 0;
    ht->deleted_entries = 0;
    ht->deleted_key = &deleted_key_value;
@@ -222,13 +207,15 @@ _mesa_hash_table_clone(struct hash_table *src, void *dst_mem_ctx)
 
    memcpy(ht, src, sizeof(struct hash_table));
 
-   ht->table = ralloc_array(ht, struct hash_entry, ht->size);
+   size_t alloc_size = table_alloc_size(sizeof(struct hash_entry), ht->size);
+   ht->table = ralloc_size(ht, alloc_size);
    if (ht->table == NULL) {
       ralloc_free(ht);
       return NULL;
    }
 
-   memcpy(ht->table, src->table, ht->size * sizeof(struct hash_entry));
+   memcpy(ht->table, src->table, alloc_size);
+   ht->ctrl = (uint8_t *)(ht->table + ht->size);
 
    return ht;
 }
@@ -257,7 +244,7 @@ _mesa_hash_table_destroy(struct hash_table *ht,
 static void
 hash_table_clear_fast(struct hash_table *ht)
 {
-   memset(ht->table, 0, sizeof(struct hash_entry) * hash_sizes[ht->size_index].size);
+   memset(ht->table, 0, table_alloc_size(sizeof(struct hash_entry), ht->size));
    ht->entries = ht->deleted_entries = 0;
 }
 
@@ -283,6 +270,7 @@ _mesa_hash_table_clear(struct hash_table *ht,
 
          entry->key = NULL;
       }
+      memset(ht->ctrl, CTRL_EMPTY, ht->size + GROUP_WIDTH);
       ht->entries = 0;
       ht->deleted_entries = 0;
    } else
@@ -311,26 +299,25 @@ hash_table_search(struct hash_table *ht, uint32_t hash, const void *key)
    assert(!key_pointer_is_reserved(ht, key));
 
    uint32_t size = ht->size;
-   uint32_t start_hash_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = 1 + util_fast_urem32(hash, ht->rehash,
-                                               ht->rehash_magic);
-   uint32_t hash_address = start_hash_address;
+   uint32_t num_groups = probe_num_groups(size);
+   uint32_t pos = util_fast_urem32(hash, size, ht->size_magic);
+   uint8_t c = ctrl_hash(hash);
 
-   do {
-      struct hash_entry *entry = ht->table + hash_address;
+   for (uint32_t i = 0; i < num_groups; i++) {
+      ctrl_group group = group_load(ht->ctrl, pos);
+      unsigned match = group_match(group, c);
+      while (match) {
+         struct hash_entry *entry = ht->table + probe_slot(pos + u_bit_scan(&match), size);
 
-      if (entry_is_free(entry)) {
-         return NULL;
-      } else if (entry_is_present(ht, entry) && entry->hash == hash) {
-         if (ht->key_equals_function(key, entry->key)) {
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key))
             return entry;
-         }
       }
 
-      hash_address += double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (hash_address != start_hash_address);
+      if (group_match(group, CTRL_EMPTY))
+         return NULL;
+
+      pos = probe_next(pos, size);
+   }
 
    return NULL;
 }
@@ -365,24 +352,23 @@ hash_table_insert_rehash(struct hash_table *ht, uint32_t hash,
                          const void *key, void *data)
 {
    uint32_t size = ht->size;
-   uint32_t start_hash_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = 1 + util_fast_urem32(hash, ht->rehash,
-                                               ht->rehash_magic);
-   uint32_t hash_address = start_hash_address;
-   do {
-      struct hash_entry *entry = ht->table + hash_address;
-
-      if (likely(entry->key == NULL)) {
+   uint32_t pos = util_fast_urem32(hash, size, ht->size_magic);
+
+   while (true) {
+      unsigned available = group_match_available(group_load(ht->ctrl, pos));
+      if (likely(available)) {
+         uint32_t slot = probe_slot(pos + ffs(available) - 1, size);
+         struct hash_entry *entry = ht->table + slot;
+
+         ctrl_set(ht->ctrl, ht->size, slot, ctrl_hash(hash));
          entry->hash = hash;
          entry->key = key;
          entry->data = data;
          return;
       }
 
-      hash_address += double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (true);
+      pos = probe_next(pos, size);
+   }
 }
 
 static void
@@ -400,8 +386,9 @@ _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
    if (new_size_index >= ARRAY_SIZE(hash_sizes))
       return;
 
-   table = rzalloc_array(ralloc_parent(ht->table), struct hash_entry,
-                         hash_sizes[new_size_index].size);
+   table = rzalloc_size(ralloc_parent(ht->table),
+                        table_alloc_size(sizeof(struct hash_entry),
+                                         hash_sizes[new_size_index].size));
    if (table == NULL)
       return;
 
@@ -410,15 +397,17 @@ _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
    ht->table = table;
    ht->size_index = new_size_index;
    ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
    ht->size_magic = hash_sizes[ht->size_index].size_magic;
-   ht->rehash_magic = hash_sizes[ht->size_index].rehash_magic;
    ht->max_entries = hash_sizes[ht->size_index].max_entries;
+   ht->ctrl = (uint8_t *)(ht->table + ht->size);
    ht->entries = 0;
    ht->deleted_entries = 0;
 
-   hash_table_foreach(&old_ht, entry) {
-      hash_table_insert_rehash(ht, entry->hash, entry->key, entry->data);
+   for (uint32_t i = 0; i < old_ht.size; i++) {
+      if (old_ht.ctrl[i] & CTRL_FULL) {
+         struct hash_entry *entry = old_ht.table + i;
+         hash_table_insert_rehash(ht, entry->hash, entry->key, entry->data);
+      }
    }
 
    ht->entries = old_ht.entries;
@@ -440,21 +429,12 @@ hash_table_get_entry(struct hash_table *ht, uint32_t hash, const void *key)
    }
 
    uint32_t size = ht->size;
-   uint32_t start_hash_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = 1 + util_fast_urem32(hash, ht->rehash,
-                                               ht->rehash_magic);
-   uint32_t hash_address = start_hash_address;
-   do {
-      struct hash_entry *entry = ht->table + hash_address;
-
-      if (!entry_is_present(ht, entry)) {
-         /* Stash the first available entry we find */
-         if (available_entry == NULL)
-            available_entry = entry;
-         if (entry_is_free(entry))
-            break;
-      }
+   uint32_t num_groups = probe_num_groups(size);
+   uint32_t pos = util_fast_urem32(hash, size, ht->size_magic);
+   uint8_t c = ctrl_hash(hash);
+   uint32_t available_slot = 0;
 
+   for (uint32_t i = 0; i < num_groups; i++) {
       /* Implement replacement when another insert happens
        * with a matching key.  This is a relatively common
        * feature of hash tables, with the alternative
@@ -466,19 +446,32 @@ hash_table_get_entry(struct hash_table *ht, uint32_t hash, const void *key)
        * required to avoid memory leaks, perform a search
        * before inserting.
        */
-      if (!entry_is_deleted(ht, entry) &&
-          entry->hash == hash &&
-          ht->key_equals_function(key, entry->key))
-         return entry;
+      ctrl_group group = group_load(ht->ctrl, pos);
+      unsigned match = group_match(group, c);
+      while (match) {
+         struct hash_entry *entry = ht->table + probe_slot(pos + u_bit_scan(&match), size);
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key))
+            return entry;
+      }
+
+      /* Stash the first available entry we find */
+      unsigned available = group_match_available(group);
+      if (available_entry == NULL && available) {
+         available_slot = probe_slot(pos + ffs(available) - 1, size);
+         available_entry = ht->table + available_slot;
+      }
 
-      hash_address += double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (hash_address != start_hash_address);
+      if (group_match(group, CTRL_EMPTY))
+         break;
+
+      pos = probe_next(pos, size);
+   }
 
    if (available_entry) {
-      if (entry_is_deleted(ht, available_entry))
+      if (ht->ctrl[available_slot] == CTRL_DELETED)
          ht->deleted_entries--;
+      ctrl_set(ht->ctrl, ht->size, available_slot, c);
       available_entry->hash = hash;
       ht->entries++;
       return available_entry;
@@ -538,6 +531,7 @@ _mesa_hash_table_remove(struct hash_table *ht,
    if (!entry)
       return;
 
+   ctrl_set(ht->ctrl, ht->size, entry - ht->table, CTRL_DELETED);
    entry->key = ht->deleted_key;
    ht->entries--;
    ht->deleted_entries++;
@@ -553,24 +547,39 @@ void _mesa_hash_table_remove_key(struct hash_table *ht,
 }
 
 /**
- * This function is an iterator over the hash_table when no deleted entries are present.
+ * This function is the iterator of hash_table_foreach_remove().
  *
- * Pass in NULL for the first entry, as in the start of a for loop.
+ * Pass in NULL for the first entry, as in the start of a for loop.  Once the
+ * table is empty, the tombstones left by the removals are cleared.
  */
 struct hash_entry *
-_mesa_hash_table_next_entry_unsafe(const struct hash_table *ht, struct hash_entry *entry)
+_mesa_hash_table_next_entry_unsafe(struct hash_table *ht, struct hash_entry *entry)
 {
-   assert(!ht->deleted_entries);
-   if (!ht->entries)
+   if (!ht->entries) {
+      memset(ht->ctrl, CTRL_EMPTY, ht->size + GROUP_WIDTH);
+      ht->deleted_entries = 0;
       return NULL;
-   if (entry == NULL)
-      entry = ht->table;
-   else
-      entry = entry + 1;
-   if (entry != ht->table + ht->size)
-      return entry->key ? entry : _mesa_hash_table_next_entry_unsafe(ht, entry);
+   }
 
-   return NULL;
+   return _mesa_hash_table_next_entry(ht, entry);
+}
+
+/**
+ * Removes the entry of the current iteration of hash_table_foreach_remove(),
+ * and returns the next one.
+ */
+struct hash_entry *
+_mesa_hash_table_remove_next_unsafe(struct hash_table *ht,
+                                    struct hash_entry *entry)
+{
+   ctrl_set(ht->ctrl, ht->size, entry - ht->table, CTRL_DELETED);
+   entry->hash = 0;
+   entry->key = NULL;
+   entry->data = NULL;
+   ht->entries--;
+   ht->deleted_entries++;
+
+   return _mesa_hash_table_next_entry_unsafe(ht, entry);
 }
 
 /**
@@ -583,18 +592,10 @@ struct hash_entry *
 _mesa_hash_table_next_entry(struct hash_table *ht,
                             struct hash_entry *entry)
 {
-   if (entry == NULL)
-      entry = ht->table;
-   else
-      entry = entry + 1;
+   uint32_t i = entry == NULL ? 0 : entry - ht->table + 1;
 
-   for (; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(ht, entry)) {
-         return entry;
-      }
-   }
-
-   return NULL;
+   i = ctrl_next_full(ht->ctrl, ht->size, i);
+   return i < ht->size ? ht->table + i : NULL;
 }
 
 /**
@@ -0,0 +1,164 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Control bytes shared by the hash_table and set implementations.
+ *
+ * Next to the entry array, the tables keep one control byte per slot, which
+ * tells whether the slot is empty, deleted, or holds an entry along with 7
+ * bits of that entry's hash.  Lookups compare the control bytes of a group of
+ * GROUP_WIDTH slots at once, and only read the entries whose hash bits match,
+ * so a probe touches a cache line of control bytes rather than one entry per
+ * slot.  This is the layout of abseil's "Swiss tables".
+ *
+ * Probing starts at the slot given by the hash modulo the table size, and
+ * moves a group at a time, wrapping around at the end of the table.
+ *
+ * The control array has GROUP_WIDTH - 1 trailing bytes mirroring the first
+ * slots, so a group can be loaded at any slot without wrapping around.  With
+ * tables smaller than a group, the same slot shows up several times in one
+ * group, which doesn't matter for lookups.
+ */
+
+#ifndef _HASH_TABLE_GROUP_H
+#define _HASH_TABLE_GROUP_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bitscan.h"
+#include "detect_arch.h"
+#include "macros.h"
+
+#if DETECT_ARCH_SSE
+#include <emmintrin.h>
+#endif
+
+#define GROUP_WIDTH 16
+
+/* A zeroed control array is an empty table, and present entries have the top
+ * bit set.
+ */
+#define CTRL_EMPTY   0x00
+#define CTRL_DELETED 0x01
+#define CTRL_FULL    0x80
+
+/* Size of the allocation holding the entries followed by the control bytes. */
+static inline size_t
+table_alloc_size(size_t entry_size, uint32_t size)
+{
+   return entry_size * size + size + GROUP_WIDTH;
+}
+
+/* The probes start at the hash modulo the table size, so the control byte
+ * takes 7 bits of a Fibonacci hash, which depend on all bits of the hash.
+ */
+static inline uint8_t
+ctrl_hash(uint32_t hash)
+{
+   return CTRL_FULL | ((hash * 0x9e3779b1u) >> 25);
+}
+
+static inline uint32_t
+probe_num_groups(uint32_t size)
+{
+   return DIV_ROUND_UP(size, GROUP_WIDTH);
+}
+
+/* Slot of a group bit, which may fall in the mirrored bytes. */
+static inline uint32_t
+probe_slot(uint32_t i, uint32_t size)
+{
+   while (i >= size)
+      i -= size;
+   return i;
+}
+
+static inline uint32_t
+probe_next(uint32_t pos, uint32_t size)
+{
+   pos += GROUP_WIDTH;
+   return pos >= size ? pos - size : pos;
+}
+
+static inline void
+ctrl_set(uint8_t *ctrl, uint32_t size, uint32_t i, uint8_t c)
+{
+   ctrl[i] = c;
+   for (uint32_t m = i + size; m < size + GROUP_WIDTH - 1; m += size)
+      ctrl[m] = c;
+}
+
+/* The control bytes of the GROUP_WIDTH slots starting at pos. */
+#if DETECT_ARCH_SSE
+typedef __m128i ctrl_group;
+
+static inline ctrl_group
+group_load(const uint8_t *ctrl, uint32_t pos)
+{
+   return _mm_loadu_si128((const __m128i *)(ctrl + pos));
+}
+
+/* Returns one bit per slot of the group whose control byte is c. */
+static inline unsigned
+group_match(ctrl_group group, uint8_t c)
+{
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+}
+
+/* Returns one bit per empty or deleted slot of the group. */
+static inline unsigned
+group_match_available(ctrl_group group)
+{
+   return ~_mm_movemask_epi8(group) & 0xffff;
+}
+#else
+typedef struct {
+   uint8_t c[GROUP_WIDTH];
+} ctrl_group;
+
+static inline ctrl_group
+group_load(const uint8_t *ctrl, uint32_t pos)
+{
+   ctrl_group group;
+   memcpy(group.c, ctrl + pos, GROUP_WIDTH);
+   return group;
+}
+
+static inline unsigned
+group_match(ctrl_group group, uint8_t c)
+{
+   unsigned mask = 0;
+   for (unsigned i = 0; i < GROUP_WIDTH; i++)
+      mask |= (unsigned)(group.c[i] == c) << i;
+   return mask;
+}
+
+static inline unsigned
+group_match_available(ctrl_group group)
+{
+   unsigned mask = 0;
+   for (unsigned i = 0; i < GROUP_WIDTH; i++)
+      mask |= (unsigned)!(group.c[i] & CTRL_FULL) << i;
+   return mask;
+}
+#endif
+
+/* Returns the first slot at or after i holding an entry, or size.
+ *
+ * Entries are usually a few bytes apart, and a plain loop beats group loads
+ * whose position depends on the previous step.
+ */
+static inline uint32_t
+ctrl_next_full(const uint8_t *ctrl, uint32_t size, uint32_t i)
+{
+   for (; i < size; i++) {
+      if (ctrl[i] & CTRL_FULL)
+         return i;
+   }
+
+   return size;
+}
+
+#endif /* _HASH_TABLE_GROUP_H */
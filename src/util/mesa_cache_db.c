@@ -11,6 +11,7 @@
 
 #if DETECT_OS_WINDOWS == 0
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -90,17 +91,42 @@ static inline bool mesa_db_truncate(FILE *file, long pos)
    return !ftruncate(fileno(file), pos);
 }
 
+/* Take an exclusive lock on a database file, counting the times it is held
+ * by another process.
+ */
+static bool
+mesa_db_flock(struct mesa_cache_db *db, FILE *file)
+{
+   if (flock(fileno(file), LOCK_EX | LOCK_NB) == 0)
+      return true;
+
+   if (errno != EWOULDBLOCK)
+      return false;
+
+   db->lock_stats.num_contended++;
+
+   return flock(fileno(file), LOCK_EX) == 0;
+}
+
 static bool
 mesa_db_lock(struct mesa_cache_db *db)
 {
+   int64_t start;
+
    simple_mtx_lock(&db->flock_mtx);
 
-   if (flock(fileno(db->cache.file), LOCK_EX) == -1)
+   start = os_time_get_nano();
+
+   if (!mesa_db_flock(db, db->cache.file))
       goto unlock_mtx;
 
-   if (flock(fileno(db->index.file), LOCK_EX) == -1)
+   if (!mesa_db_flock(db, db->index.file))
       goto unlock_cache;
 
+   db->lock_time = os_time_get_nano();
+   db->lock_stats.wait_time += db->lock_time - start;
+   db->lock_stats.num_locks++;
+
    return true;
 
 unlock_cache:
@@ -114,6 +140,12 @@ unlock_mtx:
 static void
 mesa_db_unlock(struct mesa_cache_db *db)
 {
+   uint64_t hold_time = os_time_get_nano() - db->lock_time;
+
+   db->lock_stats.hold_time += hold_time;
+   db->lock_stats.max_hold_time = MAX2(db->lock_stats.max_hold_time,
+                                       hold_time);
+
    flock(fileno(db->index.file), LOCK_UN);
    flock(fileno(db->cache.file), LOCK_UN);
    simple_mtx_unlock(&db->flock_mtx);
@@ -615,6 +647,7 @@ mesa_cache_db_open(struct mesa_cache_db *db, const char *cache_path)
       goto close_index;
 
    simple_mtx_init(&db->flock_mtx, mtx_plain);
+   memset(&db->lock_stats, 0, sizeof(db->lock_stats));
 
    db->index_db = _mesa_hash_table_u64_create(NULL);
    if (!db->index_db)
@@ -996,4 +1029,13 @@ fail:
    return 0;
 }
 
+void
+mesa_cache_db_get_lock_stats(struct mesa_cache_db *db,
+                             struct mesa_cache_db_lock_stats *stats)
+{
+   simple_mtx_lock(&db->flock_mtx);
+   *stats = db->lock_stats;
+   simple_mtx_unlock(&db->flock_mtx);
+}
+
 #endif /* DETECT_OS_WINDOWS */
@@ -13,6 +13,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "detect_os.h"
 #include "simple_mtx.h"
@@ -28,12 +29,23 @@ struct mesa_cache_db_file {
    uint64_t uuid;
 };
 
+/* Database lock statistics, times are in nanoseconds. */
+struct mesa_cache_db_lock_stats {
+   uint64_t num_locks;
+   uint64_t num_contended;
+   uint64_t wait_time;
+   uint64_t hold_time;
+   uint64_t max_hold_time;
+};
+
 struct mesa_cache_db {
    struct hash_table_u64 *index_db;
    struct mesa_cache_db_file cache;
    struct mesa_cache_db_file index;
    uint64_t max_cache_size;
    simple_mtx_t flock_mtx;
+   struct mesa_cache_db_lock_stats lock_stats;
+   int64_t lock_time;
    void *mem_ctx;
    uint64_t uuid;
    bool alive;
@@ -75,6 +87,10 @@ mesa_cache_db_has_space(struct mesa_cache_db *db, size_t blob_size);
 
 double
 mesa_cache_db_eviction_score(struct mesa_cache_db *db);
+
+void
+mesa_cache_db_get_lock_stats(struct mesa_cache_db *db,
+                             struct mesa_cache_db_lock_stats *stats);
 #else
 static inline bool
 mesa_cache_db_open(struct mesa_cache_db *db, const char *cache_path)
@@ -139,6 +155,13 @@ mesa_cache_db_eviction_score(struct mesa_cache_db *db)
 {
    return 0;
 }
+
+static inline void
+mesa_cache_db_get_lock_stats(struct mesa_cache_db *db,
+                             struct mesa_cache_db_lock_stats *stats)
+{
+   memset(stats, 0, sizeof(*stats));
+}
 #endif /* DETECT_OS_WINDOWS */
 
 #ifdef __cplusplus
@@ -0,0 +1,1224 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "detect_os.h"
+
+#if DETECT_OS_WINDOWS == 0
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "disk_cache.h"
+#include "hash_table.h"
+#include "mesa_cache_db_log.h"
+#include "os_time.h"
+#include "ralloc.h"
+#include "u_atomic.h"
+
+#define MESA_CACHE_DB_LOG_VERSION      2
+#define MESA_CACHE_DB_LOG_MAGIC        "MESA_LOG"
+#define MESA_CACHE_DB_LOG_HEADER       "header"
+
+/* Compact once there are more segments than this, a process starts a new
+ * segment whenever its current one grows past the corresponding share of
+ * the cache size.
+ */
+#define MESA_CACHE_DB_LOG_MAX_SEGMENTS 16
+
+/* Accesses are recorded in batches of this many entries. */
+#define MESA_CACHE_DB_LOG_MAX_PENDING_ACCESSES 64
+
+#define MESA_CACHE_DB_LOG_RECORD_REMOVED (1 << 0)
+#define MESA_CACHE_DB_LOG_RECORD_ACCESSED (1 << 1)
+
+struct PACKED mesa_db_log_file_header {
+   char magic[8];
+   uint32_t version;
+};
+
+/* Shared by all processes using the log, mapped from the header file.
+ *
+ * Records are ordered by sequence numbers taken from seq, which outlive
+ * reboots unlike the clocks.  The generations are bumped after every change
+ * to the segments, and to the list of segments, so readers only look at the
+ * segments when something changed.  Access records don't count as a
+ * change: they only matter to compaction, which reads all segments anyway.
+ */
+struct mesa_db_log_shared_header {
+   uint64_t seq;
+   uint64_t generation;
+   uint64_t dir_generation;
+};
+
+/* Every cache entry is a record followed by the blob.  A removed entry is a
+ * record without a blob, and so is an access to an entry, which only
+ * updates its access sequence number.  Compaction stores the last access in
+ * access_seq of the record it copies.
+ */
+struct PACKED mesa_db_log_record {
+   cache_key key;
+   uint64_t seq;
+   uint64_t access_seq;
+   uint32_t crc;
+   uint32_t size;
+   uint32_t flags;
+   uint32_t record_crc;
+};
+
+struct mesa_cache_db_log_segment {
+   struct list_head link;
+   char *name;
+   int fd;
+   uint8_t *map;
+   size_t map_size;
+   uint64_t file_size;
+   uint64_t scanned_offset;
+   bool seen;
+   bool claimed;
+};
+
+/* An entry whose segment is NULL has only been accessed in the records
+ * indexed so far, its own record is in a segment not indexed yet.
+ */
+struct mesa_db_log_hash_entry {
+   struct mesa_cache_db_log_segment *segment;
+   uint64_t offset;
+   uint64_t seq;
+   uint32_t size;
+   bool removed;
+
+   /* The last access, and the segment holding its record. */
+   uint64_t access_seq;
+   struct mesa_cache_db_log_segment *access_segment;
+
+   /* 1 + the index of the access waiting to be recorded, or 0. */
+   unsigned pending_access;
+};
+
+static uint64_t to_mesa_cache_db_hash(const uint8_t *cache_key_160bit)
+{
+   uint64_t hash = 0;
+
+   for (unsigned i = 0; i < 8; i++)
+      hash |= ((uint64_t)cache_key_160bit[i]) << i * 8;
+
+   return hash;
+}
+
+static uint32_t
+mesa_db_log_record_crc(const struct mesa_db_log_record *record)
+{
+   return util_hash_crc32(record, offsetof(struct mesa_db_log_record,
+                                           record_crc));
+}
+
+static bool
+mesa_db_log_record_valid(const struct mesa_db_log_record *record)
+{
+   return record->record_crc == mesa_db_log_record_crc(record) &&
+          (record->size || (record->flags & (MESA_CACHE_DB_LOG_RECORD_REMOVED |
+                                             MESA_CACHE_DB_LOG_RECORD_ACCESSED)));
+}
+
+static uint64_t
+mesa_db_log_record_file_size(uint32_t blob_size)
+{
+   return sizeof(struct mesa_db_log_record) + blob_size;
+}
+
+static void
+mesa_db_log_init_header(struct mesa_db_log_file_header *header)
+{
+   memcpy(header->magic, MESA_CACHE_DB_LOG_MAGIC, sizeof(header->magic));
+   header->version = MESA_CACHE_DB_LOG_VERSION;
+}
+
+/* Make sure that at least the first size bytes of the segment are mapped. */
+static bool
+mesa_db_log_map_segment(struct mesa_cache_db_log_segment *seg, uint64_t size)
+{
+   struct stat sb;
+
+   if (size <= seg->map_size)
+      return true;
+
+   if (fstat(seg->fd, &sb) == -1 || sb.st_size < size)
+      return false;
+
+   if (seg->map)
+      munmap(seg->map, seg->map_size);
+
+   seg->map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, seg->fd, 0);
+   if (seg->map == MAP_FAILED) {
+      seg->map = NULL;
+      seg->map_size = 0;
+      return false;
+   }
+
+   seg->map_size = sb.st_size;
+
+   return true;
+}
+
+static void
+mesa_db_log_index_record(struct mesa_cache_db_log *db,
+                         struct mesa_cache_db_log_segment *seg,
+                         uint64_t offset,
+                         const struct mesa_db_log_record *record)
+{
+   uint64_t hash = to_mesa_cache_db_hash(record->key);
+   uint64_t access_seq = MAX2(record->seq, record->access_seq);
+   struct mesa_db_log_hash_entry *hash_entry;
+
+   db->max_seq = MAX2(db->max_seq, access_seq);
+
+   hash_entry = _mesa_hash_table_u64_search(db->index_db, hash);
+   if (!hash_entry) {
+      hash_entry = rzalloc(db->mem_ctx, struct mesa_db_log_hash_entry);
+      if (!hash_entry)
+         return;
+
+      _mesa_hash_table_u64_insert(db->index_db, hash, hash_entry);
+   }
+
+   if (access_seq > hash_entry->access_seq) {
+      hash_entry->access_seq = access_seq;
+      hash_entry->access_segment = seg;
+   }
+
+   if (record->flags & MESA_CACHE_DB_LOG_RECORD_ACCESSED)
+      return;
+
+   /* Segments are merged in no particular order, the last written record
+    * of an entry wins.
+    */
+   if (hash_entry->segment && hash_entry->seq > record->seq)
+      return;
+
+   hash_entry->segment = seg;
+   hash_entry->offset = offset;
+   hash_entry->seq = record->seq;
+   hash_entry->size = record->size;
+   hash_entry->removed = record->flags & MESA_CACHE_DB_LOG_RECORD_REMOVED;
+}
+
+/* Index the records appended to the segment since the last scan.  Scanning
+ * stops at the first record that isn't complete yet.
+ */
+static void
+mesa_db_log_scan_segment(struct mesa_cache_db_log *db,
+                         struct mesa_cache_db_log_segment *seg)
+{
+   struct mesa_db_log_file_header header, expected_header;
+   struct mesa_db_log_record record;
+   uint64_t offset = seg->scanned_offset;
+   struct stat sb;
+
+   if (fstat(seg->fd, &sb) == -1)
+      return;
+
+   seg->file_size = sb.st_size;
+
+   if (sb.st_size <= offset || !mesa_db_log_map_segment(seg, sb.st_size))
+      return;
+
+   if (offset == 0) {
+      if (sb.st_size < sizeof(header))
+         return;
+
+      mesa_db_log_init_header(&expected_header);
+      memcpy(&header, seg->map, sizeof(header));
+
+      if (memcmp(&header, &expected_header, sizeof(header)))
+         return;
+
+      offset = sizeof(header);
+   }
+
+   while (offset + sizeof(record) <= sb.st_size) {
+      memcpy(&record, seg->map + offset, sizeof(record));
+
+      if (!mesa_db_log_record_valid(&record) ||
+          offset + mesa_db_log_record_file_size(record.size) > sb.st_size)
+         break;
+
+      mesa_db_log_index_record(db, seg, offset, &record);
+
+      offset += mesa_db_log_record_file_size(record.size);
+   }
+
+   seg->scanned_offset = offset;
+}
+
+static struct mesa_cache_db_log_segment *
+mesa_db_log_add_segment(struct mesa_cache_db_log *db, const char *name,
+                        int fd)
+{
+   struct mesa_cache_db_log_segment *seg = calloc(1, sizeof(*seg));
+   if (!seg)
+      return NULL;
+
+   seg->name = strdup(name);
+   if (!seg->name) {
+      free(seg);
+      return NULL;
+   }
+
+   seg->fd = fd;
+   seg->seen = true;
+   list_addtail(&seg->link, &db->segments);
+
+   return seg;
+}
+
+static void
+mesa_db_log_free_segment(struct mesa_cache_db_log_segment *seg)
+{
+   list_del(&seg->link);
+
+   if (seg->map)
+      munmap(seg->map, seg->map_size);
+
+   close(seg->fd);
+   free(seg->name);
+   free(seg);
+}
+
+static void
+mesa_db_log_reset_index(struct mesa_cache_db_log *db)
+{
+   _mesa_hash_table_u64_clear(db->index_db);
+   ralloc_free(db->mem_ctx);
+   db->mem_ctx = ralloc_context(NULL);
+
+   list_for_each_entry(struct mesa_cache_db_log_segment, seg,
+                       &db->segments, link)
+      seg->scanned_offset = 0;
+}
+
+static bool
+mesa_db_log_is_segment_name(const char *name)
+{
+   size_t len = strlen(name);
+
+   return len > 7 && !strncmp(name, "seg_", 4) &&
+          !strcmp(name + len - 3, ".db");
+}
+
+/* Pick up the segments created and removed by other processes. */
+static void
+mesa_db_log_scan_dir(struct mesa_cache_db_log *db)
+{
+   struct dirent *dir_ent;
+   bool removed = false;
+   DIR *dir;
+   int fd;
+
+   fd = dup(db->dir_fd);
+   if (fd == -1)
+      return;
+
+   dir = fdopendir(fd);
+   if (!dir) {
+      close(fd);
+      return;
+   }
+
+   rewinddir(dir);
+
+   list_for_each_entry(struct mesa_cache_db_log_segment, seg,
+                       &db->segments, link)
+      seg->seen = false;
+
+   while ((dir_ent = readdir(dir)) != NULL) {
+      struct mesa_cache_db_log_segment *found = NULL;
+
+      if (!mesa_db_log_is_segment_name(dir_ent->d_name))
+         continue;
+
+      list_for_each_entry(struct mesa_cache_db_log_segment, seg,
+                          &db->segments, link) {
+         if (!strcmp(seg->name, dir_ent->d_name)) {
+            found = seg;
+            break;
+         }
+      }
+
+      if (found) {
+         found->seen = true;
+         continue;
+      }
+
+      fd = openat(db->dir_fd, dir_ent->d_name, O_RDONLY | O_CLOEXEC);
+      if (fd == -1)
+         continue;
+
+      if (!mesa_db_log_add_segment(db, dir_ent->d_name, fd))
+         close(fd);
+   }
+
+   closedir(dir);
+
+   list_for_each_entry_safe(struct mesa_cache_db_log_segment, seg,
+                            &db->segments, link) {
+      if (seg->seen)
+         continue;
+
+      if (seg == db->own_segment)
+         db->own_segment = NULL;
+
+      mesa_db_log_free_segment(seg);
+      removed = true;
+   }
+
+   /* Entries of the removed segments were either evicted or moved to a
+    * new segment by compaction, start over.
+    */
+   if (removed)
+      mesa_db_log_reset_index(db);
+}
+
+/* Index everything other processes wrote since the last rescan.  The
+ * generations are read first, so changes made during the rescan are picked
+ * up by the next one.
+ */
+static void
+mesa_db_log_rescan(struct mesa_cache_db_log *db)
+{
+   uint64_t generation = p_atomic_read(&db->shared->generation);
+   uint64_t dir_generation = p_atomic_read(&db->shared->dir_generation);
+
+   if (dir_generation != db->dir_generation)
+      mesa_db_log_scan_dir(db);
+
+   db->generation = generation;
+   db->dir_generation = dir_generation;
+   db->num_segments = 0;
+   db->total_size = 0;
+
+   list_for_each_entry(struct mesa_cache_db_log_segment, seg,
+                       &db->segments, link) {
+      mesa_db_log_scan_segment(db, seg);
+
+      db->num_segments++;
+      db->total_size += seg->file_size;
+   }
+}
+
+static void
+mesa_db_log_refresh(struct mesa_cache_db_log *db)
+{
+   if (p_atomic_read(&db->shared->generation) != db->generation)
+      mesa_db_log_rescan(db);
+}
+
+/* Tells the other processes about a change, which this instance has
+ * already indexed.
+ */
+static void
+mesa_db_log_changed(struct mesa_cache_db_log *db, bool dir_changed)
+{
+   uint64_t generation;
+
+   if (dir_changed) {
+      generation = p_atomic_inc_return(&db->shared->dir_generation);
+      if (generation == db->dir_generation + 1)
+         db->dir_generation = generation;
+   }
+
+   generation = p_atomic_inc_return(&db->shared->generation);
+   if (generation == db->generation + 1)
+      db->generation = generation;
+}
+
+/* Sequence numbers keep increasing even if the header file was lost, by
+ * starting over from the largest one found in the segments.
+ */
+static uint64_t
+mesa_db_log_next_seq(struct mesa_cache_db_log *db)
+{
+   uint64_t seq, next;
+
+   do {
+      seq = p_atomic_read(&db->shared->seq);
+      next = MAX2(seq, db->max_seq) + 1;
+   } while (p_atomic_cmpxchg(&db->shared->seq, seq, next) != seq);
+
+   db->max_seq = next;
+
+   return next;
+}
+
+/* Create a new segment file, only visible to other processes once it is
+ * locked for writing.
+ */
+static int
+mesa_db_log_create_segment_file(struct mesa_cache_db_log *db,
+                                char *name, size_t name_size,
+                                int lock_op)
+{
+   static uint32_t counter;
+   struct mesa_db_log_file_header header;
+   char tmp_name[64];
+   uint32_t id = p_atomic_inc_return(&counter);
+   int fd;
+
+   snprintf(name, name_size, "seg_%016" PRIx64 "_%d_%u.db",
+            (uint64_t)os_time_get_nano(), getpid(), id);
+   snprintf(tmp_name, sizeof(tmp_name), "tmp_%s", name);
+
+   fd = openat(db->dir_fd, tmp_name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+               0644);
+   if (fd == -1)
+      return -1;
+
+   mesa_db_log_init_header(&header);
+
+   if (flock(fd, lock_op) == -1 ||
+       write(fd, &header, sizeof(header)) != sizeof(header))
+      goto fail;
+
+   return fd;
+
+fail:
+   unlinkat(db->dir_fd, tmp_name, 0);
+   close(fd);
+
+   return -1;
+}
+
+static bool
+mesa_db_log_publish_segment_file(struct mesa_cache_db_log *db,
+                                 const char *name)
+{
+   char tmp_name[64];
+
+   snprintf(tmp_name, sizeof(tmp_name), "tmp_%s", name);
+
+   if (renameat(db->dir_fd, tmp_name, db->dir_fd, name) == -1) {
+      unlinkat(db->dir_fd, tmp_name, 0);
+      return false;
+   }
+
+   return true;
+}
+
+static bool
+mesa_db_log_open_own_segment(struct mesa_cache_db_log *db)
+{
+   struct mesa_cache_db_log_segment *seg;
+   char name[64];
+   int fd;
+
+   /* The shared lock is held for as long as this process appends to the
+    * segment, which keeps compaction away from it.
+    */
+   fd = mesa_db_log_create_segment_file(db, name, sizeof(name), LOCK_SH);
+   if (fd == -1)
+      return false;
+
+   if (!mesa_db_log_publish_segment_file(db, name)) {
+      close(fd);
+      return false;
+   }
+
+   seg = mesa_db_log_add_segment(db, name, fd);
+   if (!seg) {
+      unlinkat(db->dir_fd, name, 0);
+      close(fd);
+      return false;
+   }
+
+   seg->file_size = sizeof(struct mesa_db_log_file_header);
+   seg->scanned_offset = seg->file_size;
+
+   db->own_segment = seg;
+   db->num_segments++;
+   db->total_size += seg->file_size;
+
+   mesa_db_log_changed(db, true);
+
+   return true;
+}
+
+/* Stop appending to the own segment, which makes it eligible for
+ * compaction.  The segment stays mapped for reading.
+ */
+static void
+mesa_db_log_seal_own_segment(struct mesa_cache_db_log *db)
+{
+   flock(db->own_segment->fd, LOCK_UN);
+   db->own_segment = NULL;
+}
+
+static bool
+mesa_db_log_append(struct mesa_cache_db_log *db,
+                   struct mesa_db_log_record *record,
+                   const void *blob)
+{
+   struct mesa_cache_db_log_segment *seg;
+   uint64_t record_size = mesa_db_log_record_file_size(record->size);
+   uint64_t offset;
+   struct iovec iov[2];
+
+   if (!db->own_segment && !mesa_db_log_open_own_segment(db))
+      return false;
+
+   seg = db->own_segment;
+   offset = seg->file_size;
+
+   record->seq = mesa_db_log_next_seq(db);
+   record->record_crc = mesa_db_log_record_crc(record);
+
+   iov[0].iov_base = record;
+   iov[0].iov_len = sizeof(*record);
+   iov[1].iov_base = (void *)blob;
+   iov[1].iov_len = record->size;
+
+   if (pwritev(seg->fd, iov, blob ? 2 : 1, offset) != (ssize_t)record_size) {
+      /* Records after a torn one would never be found, move on to a new
+       * segment.
+       */
+      mesa_db_log_seal_own_segment(db);
+      return false;
+   }
+
+   seg->file_size += record_size;
+   seg->scanned_offset = seg->file_size;
+   db->total_size += record_size;
+
+   mesa_db_log_index_record(db, seg, offset, record);
+   mesa_db_log_changed(db, false);
+
+   if (seg->file_size >= db->max_cache_size / MESA_CACHE_DB_LOG_MAX_SEGMENTS)
+      mesa_db_log_seal_own_segment(db);
+
+   return true;
+}
+
+/* Appends the accesses recorded since the last flush, in one write and
+ * without telling the other processes.
+ */
+static void
+mesa_db_log_flush_accesses(struct mesa_cache_db_log *db)
+{
+   struct mesa_db_log_record *records = db->pending_accesses;
+   unsigned num_records = db->num_pending_accesses;
+   struct mesa_cache_db_log_segment *seg;
+   uint64_t offset;
+   size_t size;
+
+   if (!num_records)
+      return;
+
+   db->num_pending_accesses = 0;
+
+   for (unsigned i = 0; i < num_records; i++) {
+      struct mesa_db_log_hash_entry *hash_entry =
+         _mesa_hash_table_u64_search(db->index_db,
+                                     to_mesa_cache_db_hash(records[i].key));
+      if (hash_entry)
+         hash_entry->pending_access = 0;
+   }
+
+   if (!db->own_segment && !mesa_db_log_open_own_segment(db))
+      return;
+
+   seg = db->own_segment;
+   offset = seg->file_size;
+   size = num_records * sizeof(*records);
+
+   for (unsigned i = 0; i < num_records; i++)
+      records[i].record_crc = mesa_db_log_record_crc(&records[i]);
+
+   if (pwrite(seg->fd, records, size, offset) != (ssize_t)size) {
+      mesa_db_log_seal_own_segment(db);
+      return;
+   }
+
+   seg->file_size += size;
+   seg->scanned_offset = seg->file_size;
+   db->total_size += size;
+
+   for (unsigned i = 0; i < num_records; i++) {
+      mesa_db_log_index_record(db, seg, offset, &records[i]);
+      offset += sizeof(*records);
+   }
+
+   if (seg->file_size >= db->max_cache_size / MESA_CACHE_DB_LOG_MAX_SEGMENTS)
+      mesa_db_log_seal_own_segment(db);
+}
+
+/* Records an access to an entry for eviction.  Repeated accesses to an
+ * entry only keep the last one, and the records are written once there are
+ * enough of them.  Returns whether records were written.
+ */
+static bool
+mesa_db_log_add_access(struct mesa_cache_db_log *db,
+                       struct mesa_db_log_hash_entry *hash_entry,
+                       const uint8_t *cache_key_160bit)
+{
+   struct mesa_db_log_record *record;
+   bool flushed = false;
+
+   if (hash_entry->pending_access) {
+      record = &db->pending_accesses[hash_entry->pending_access - 1];
+   } else {
+      if (db->num_pending_accesses == MESA_CACHE_DB_LOG_MAX_PENDING_ACCESSES) {
+         mesa_db_log_flush_accesses(db);
+         flushed = true;
+      }
+
+      record = &db->pending_accesses[db->num_pending_accesses++];
+      hash_entry->pending_access = db->num_pending_accesses;
+
+      memset(record, 0, sizeof(*record));
+      memcpy(record->key, cache_key_160bit, sizeof(record->key));
+      record->flags = MESA_CACHE_DB_LOG_RECORD_ACCESSED;
+   }
+
+   record->seq = mesa_db_log_next_seq(db);
+
+   return flushed;
+}
+
+static int
+entry_sort_access_seq(const void *_a, const void *_b)
+{
+   const struct mesa_db_log_hash_entry *a = *((const struct mesa_db_log_hash_entry **)_a);
+   const struct mesa_db_log_hash_entry *b = *((const struct mesa_db_log_hash_entry **)_b);
+
+   if (a->access_seq == b->access_seq)
+      return 0;
+
+   return a->access_seq > b->access_seq ? 1 : -1;
+}
+
+/* Copies the record of an entry, along with its last access. */
+static bool
+mesa_db_log_copy_entry(int fd, uint64_t offset,
+                       struct mesa_db_log_hash_entry *entry)
+{
+   struct mesa_cache_db_log_segment *seg = entry->segment;
+   uint64_t record_size = mesa_db_log_record_file_size(entry->size);
+   struct mesa_db_log_record record;
+   struct iovec iov[2];
+
+   if (!mesa_db_log_map_segment(seg, entry->offset + record_size))
+      return false;
+
+   memcpy(&record, seg->map + entry->offset, sizeof(record));
+
+   if (!entry->removed &&
+       util_hash_crc32(seg->map + entry->offset + sizeof(record),
+                       entry->size) != record.crc)
+      return false;
+
+   record.access_seq = entry->access_seq;
+   record.record_crc = mesa_db_log_record_crc(&record);
+
+   iov[0].iov_base = &record;
+   iov[0].iov_len = sizeof(record);
+   iov[1].iov_base = seg->map + entry->offset + sizeof(record);
+   iov[1].iov_len = entry->size;
+
+   return pwritev(fd, iov, 2, offset) == (ssize_t)record_size;
+}
+
+/* Keeps the last access to an entry whose record stays in a segment that
+ * isn't folded.
+ */
+static bool
+mesa_db_log_copy_access(int fd, uint64_t offset,
+                        struct mesa_db_log_hash_entry *entry)
+{
+   struct mesa_cache_db_log_segment *seg = entry->segment;
+   struct mesa_db_log_record record;
+
+   if (!mesa_db_log_map_segment(seg, entry->offset + sizeof(record)))
+      return false;
+
+   memcpy(&record, seg->map + entry->offset, sizeof(record));
+
+   record.seq = entry->access_seq;
+   record.access_seq = 0;
+   record.crc = 0;
+   record.size = 0;
+   record.flags = MESA_CACHE_DB_LOG_RECORD_ACCESSED;
+   record.record_crc = mesa_db_log_record_crc(&record);
+
+   return pwrite(fd, &record, sizeof(record), offset) == sizeof(record);
+}
+
+/* Fold all segments that aren't being appended to into a new one, keeping
+ * the most recently used entries that fit into the size budget.
+ */
+static bool
+mesa_db_log_compact_locked(struct mesa_cache_db_log *db)
+{
+   struct mesa_db_log_hash_entry **entries = NULL;
+   uint64_t budget, unclaimed_size = 0, entries_size = 0, offset;
+   unsigned num_entries = 0, num_claimed = 0, i;
+   bool success = false;
+   int64_t start;
+   char name[64];
+   int fd = -1;
+
+   /* Eviction goes by the last accesses. */
+   mesa_db_log_flush_accesses(db);
+
+   if (flock(db->compact_lock_fd, LOCK_EX | LOCK_NB) == -1) {
+      if (errno == EWOULDBLOCK)
+         db->lock_stats.num_contended++;
+      return false;
+   }
+
+   start = os_time_get_nano();
+   db->lock_stats.num_locks++;
+
+   mesa_db_log_scan_dir(db);
+   mesa_db_log_rescan(db);
+
+   /* Writers hold a shared lock on their segment, which also tells apart
+    * the segments of live processes from the ones of exited processes.
+    */
+   list_for_each_entry(struct mesa_cache_db_log_segment, seg,
+                       &db->segments, link) {
+      seg->claimed = seg != db->own_segment &&
+                     flock(seg->fd, LOCK_EX | LOCK_NB) == 0;
+
+      if (seg->claimed) {
+         num_claimed++;
+
+         /* Records appended just before the writer let go of it. */
+         mesa_db_log_scan_segment(db, seg);
+      } else {
+         unclaimed_size += seg->file_size;
+      }
+   }
+
+   if (!num_claimed ||
+       (num_claimed == 1 && db->total_size <= db->max_cache_size))
+      goto unlock;
+
+   entries = malloc(MAX2(_mesa_hash_table_num_entries(db->index_db->table), 1) *
+                    sizeof(*entries));
+   if (!entries)
+      goto unlock;
+
+   hash_table_foreach(db->index_db->table, entry) {
+      struct mesa_db_log_hash_entry *hash_entry = entry->data;
+
+      if (!hash_entry->segment || !hash_entry->segment->claimed)
+         continue;
+
+      /* Removal records are only needed to shadow older records of the
+       * segments left alone.
+       */
+      if (hash_entry->removed && num_claimed == db->num_segments)
+         continue;
+
+      entries[num_entries++] = hash_entry;
+      entries_size += mesa_db_log_record_file_size(hash_entry->size);
+   }
+
+   /* Evict down to the half of the cache size, like the regular Mesa-DB
+    * does, if the entries don't fit.  Folding the segments drops the
+    * records that are shadowed or only tell about accesses, which may be
+    * enough.
+    */
+   budget = entries_size + unclaimed_size > db->max_cache_size ?
+            db->max_cache_size / 2 : db->max_cache_size;
+   budget = budget > unclaimed_size ? budget - unclaimed_size : 0;
+
+   qsort(entries, num_entries, sizeof(*entries), entry_sort_access_seq);
+
+   /* Keep the most recently used entries. */
+   for (i = num_entries; i > 0; i--) {
+      uint64_t size = mesa_db_log_record_file_size(entries[i - 1]->size);
+
+      if (size > budget)
+         break;
+
+      budget -= size;
+   }
+
+   fd = mesa_db_log_create_segment_file(db, name, sizeof(name), LOCK_EX);
+   if (fd == -1)
+      goto unlock;
+
+   offset = sizeof(struct mesa_db_log_file_header);
+
+   for (; i < num_entries; i++) {
+      /* Drop entries that fail to verify rather than the whole cache. */
+      if (mesa_db_log_copy_entry(fd, offset, entries[i]))
+         offset += mesa_db_log_record_file_size(entries[i]->size);
+   }
+
+   hash_table_foreach(db->index_db->table, entry) {
+      struct mesa_db_log_hash_entry *hash_entry = entry->data;
+
+      if (hash_entry->segment && !hash_entry->segment->claimed &&
+          !hash_entry->removed && hash_entry->access_segment &&
+          hash_entry->access_segment->claimed &&
+          mesa_db_log_copy_access(fd, offset, hash_entry))
+         offset += sizeof(struct mesa_db_log_record);
+   }
+
+   if (!mesa_db_log_publish_segment_file(db, name))
+      goto unlock;
+
+   list_for_each_entry_safe(struct mesa_cache_db_log_segment, seg,
+                            &db->segments, link) {
+      if (!seg->claimed)
+         continue;
+
+      unlinkat(db->dir_fd, seg->name, 0);
+      mesa_db_log_free_segment(seg);
+   }
+
+   db->num_compactions++;
+   success = true;
+
+   mesa_db_log_reset_index(db);
+   mesa_db_log_changed(db, true);
+   mesa_db_log_scan_dir(db);
+   mesa_db_log_rescan(db);
+
+unlock:
+   if (fd != -1)
+      close(fd);
+
+   free(entries);
+
+   list_for_each_entry(struct mesa_cache_db_log_segment, seg,
+                       &db->segments, link) {
+      if (seg->claimed)
+         flock(seg->fd, LOCK_UN);
+
+      seg->claimed = false;
+   }
+
+   flock(db->compact_lock_fd, LOCK_UN);
+
+   uint64_t hold_time = os_time_get_nano() - start;
+   db->lock_stats.hold_time += hold_time;
+   db->lock_stats.max_hold_time = MAX2(db->lock_stats.max_hold_time,
+                                       hold_time);
+
+   /* Don't retry for every write if there is nothing to fold right now. */
+   if (success) {
+      db->compact_num_segments = 0;
+      db->compact_size = 0;
+   } else {
+      db->compact_num_segments = db->num_segments + 1;
+      db->compact_size = db->total_size +
+                         db->max_cache_size / MESA_CACHE_DB_LOG_MAX_SEGMENTS;
+   }
+
+   return success;
+}
+
+static void
+mesa_db_log_maybe_compact(struct mesa_cache_db_log *db)
+{
+   if (db->num_segments > MAX2(MESA_CACHE_DB_LOG_MAX_SEGMENTS,
+                               db->compact_num_segments) ||
+       db->total_size > MAX2(db->max_cache_size, db->compact_size))
+      mesa_db_log_compact_locked(db);
+}
+
+static bool
+mesa_db_log_map_shared_header(struct mesa_cache_db_log *db)
+{
+   struct stat sb;
+   void *map;
+   int fd;
+
+   fd = openat(db->dir_fd, MESA_CACHE_DB_LOG_HEADER,
+               O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if (fd == -1)
+      return false;
+
+   /* A new header starts over from zero, which is valid. */
+   if (fstat(fd, &sb) == -1 ||
+       (sb.st_size < sizeof(*db->shared) &&
+        ftruncate(fd, sizeof(*db->shared)) == -1)) {
+      close(fd);
+      return false;
+   }
+
+   map = mmap(NULL, sizeof(*db->shared), PROT_READ | PROT_WRITE, MAP_SHARED,
+              fd, 0);
+   close(fd);
+
+   if (map == MAP_FAILED)
+      return false;
+
+   db->shared = map;
+
+   return true;
+}
+
+bool
+mesa_cache_db_log_open(struct mesa_cache_db_log *db, const char *cache_path)
+{
+   memset(db, 0, sizeof(*db));
+
+   db->path = strdup(cache_path);
+   if (!db->path)
+      return false;
+
+   if (mkdir(db->path, 0755) == -1 && errno != EEXIST)
+      goto free_path;
+
+   db->dir_fd = open(db->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (db->dir_fd == -1)
+      goto free_path;
+
+   db->compact_lock_fd = openat(db->dir_fd, "compact.lock",
+                                O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if (db->compact_lock_fd == -1)
+      goto close_dir;
+
+   if (!mesa_db_log_map_shared_header(db))
+      goto close_lock;
+
+   db->mem_ctx = ralloc_context(NULL);
+   if (!db->mem_ctx)
+      goto unmap_header;
+
+   db->index_db = _mesa_hash_table_u64_create(NULL);
+   if (!db->index_db)
+      goto free_ctx;
+
+   db->pending_accesses = malloc(MESA_CACHE_DB_LOG_MAX_PENDING_ACCESSES *
+                                 sizeof(struct mesa_db_log_record));
+   if (!db->pending_accesses)
+      goto destroy_index;
+
+   list_inithead(&db->segments);
+   simple_mtx_init(&db->mtx, mtx_plain);
+
+   mesa_db_log_scan_dir(db);
+   mesa_db_log_rescan(db);
+
+   return true;
+
+destroy_index:
+   _mesa_hash_table_u64_destroy(db->index_db);
+free_ctx:
+   ralloc_free(db->mem_ctx);
+unmap_header:
+   munmap(db->shared, sizeof(*db->shared));
+close_lock:
+   close(db->compact_lock_fd);
+close_dir:
+   close(db->dir_fd);
+free_path:
+   free(db->path);
+
+   return false;
+}
+
+void
+mesa_cache_db_log_close(struct mesa_cache_db_log *db)
+{
+   mesa_db_log_flush_accesses(db);
+
+   list_for_each_entry_safe(struct mesa_cache_db_log_segment, seg,
+                            &db->segments, link)
+      mesa_db_log_free_segment(seg);
+
+   _mesa_hash_table_u64_destroy(db->index_db);
+   free(db->pending_accesses);
+   simple_mtx_destroy(&db->mtx);
+   ralloc_free(db->mem_ctx);
+
+   munmap(db->shared, sizeof(*db->shared));
+   close(db->compact_lock_fd);
+   close(db->dir_fd);
+   free(db->path);
+}
+
+void
+mesa_cache_db_log_set_size_limit(struct mesa_cache_db_log *db,
+                                 uint64_t max_cache_size)
+{
+   db->max_cache_size = max_cache_size;
+}
+
+void *
+mesa_cache_db_log_read_entry(struct mesa_cache_db_log *db,
+                             const uint8_t *cache_key_160bit,
+                             size_t *size)
+{
+   uint64_t hash = to_mesa_cache_db_hash(cache_key_160bit);
+   struct mesa_db_log_hash_entry *hash_entry;
+   struct mesa_cache_db_log_segment *seg;
+   struct mesa_db_log_record record;
+   void *data = NULL;
+
+   simple_mtx_lock(&db->mtx);
+
+   /* Pick up the records appended by other processes, which may have
+    * removed the entry.  This doesn't take any lock.
+    */
+   mesa_db_log_refresh(db);
+
+   hash_entry = _mesa_hash_table_u64_search(db->index_db, hash);
+
+   if (!hash_entry || !hash_entry->segment || hash_entry->removed)
+      goto fail;
+
+   seg = hash_entry->segment;
+
+   if (!mesa_db_log_map_segment(seg, hash_entry->offset +
+                                mesa_db_log_record_file_size(hash_entry->size)))
+      goto fail;
+
+   memcpy(&record, seg->map + hash_entry->offset, sizeof(record));
+
+   if (memcmp(record.key, cache_key_160bit, sizeof(record.key)) ||
+       record.size != hash_entry->size)
+      goto fail;
+
+   data = malloc(record.size);
+   if (!data)
+      goto fail;
+
+   memcpy(data, seg->map + hash_entry->offset + sizeof(record), record.size);
+
+   if (util_hash_crc32(data, record.size) != record.crc) {
+      free(data);
+      goto fail;
+   }
+
+   *size = record.size;
+
+   /* Record the access for eviction.  Reads compact the log as well as
+    * writes, so that the access records don't grow it past the size limit
+    * when nothing is written.
+    */
+   if (mesa_db_log_add_access(db, hash_entry, cache_key_160bit))
+      mesa_db_log_maybe_compact(db);
+
+   simple_mtx_unlock(&db->mtx);
+
+   return data;
+
+fail:
+   simple_mtx_unlock(&db->mtx);
+
+   return NULL;
+}
+
+bool
+mesa_cache_db_log_entry_write(struct mesa_cache_db_log *db,
+                              const uint8_t *cache_key_160bit,
+                              const void *blob, size_t blob_size)
+{
+   uint64_t hash = to_mesa_cache_db_hash(cache_key_160bit);
+   struct mesa_db_log_hash_entry *hash_entry;
+   struct mesa_db_log_record record;
+   bool success = false;
+
+   if (!blob_size || blob_size > UINT32_MAX)
+      return false;
+
+   simple_mtx_lock(&db->mtx);
+
+   mesa_db_log_refresh(db);
+
+   hash_entry = _mesa_hash_table_u64_search(db->index_db, hash);
+   if (hash_entry && hash_entry->segment && !hash_entry->removed)
+      goto unlock;
+
+   memset(&record, 0, sizeof(record));
+   memcpy(record.key, cache_key_160bit, sizeof(record.key));
+   record.crc = util_hash_crc32(blob, blob_size);
+   record.size = blob_size;
+
+   success = mesa_db_log_append(db, &record, blob);
+   if (success)
+      mesa_db_log_maybe_compact(db);
+
+unlock:
+   simple_mtx_unlock(&db->mtx);
+
+   return success;
+}
+
+bool
+mesa_cache_db_log_entry_remove(struct mesa_cache_db_log *db,
+                               const uint8_t *cache_key_160bit)
+{
+   uint64_t hash = to_mesa_cache_db_hash(cache_key_160bit);
+   struct mesa_db_log_hash_entry *hash_entry;
+   struct mesa_db_log_record record;
+   bool success = false;
+
+   simple_mtx_lock(&db->mtx);
+
+   mesa_db_log_refresh(db);
+
+   hash_entry = _mesa_hash_table_u64_search(db->index_db, hash);
+   if (!hash_entry || !hash_entry->segment || hash_entry->removed)
+      goto unlock;
+
+   memset(&record, 0, sizeof(record));
+   memcpy(record.key, cache_key_160bit, sizeof(record.key));
+   record.flags = MESA_CACHE_DB_LOG_RECORD_REMOVED;
+
+   success = mesa_db_log_append(db, &record, NULL);
+
+unlock:
+   simple_mtx_unlock(&db->mtx);
+
+   return success;
+}
+
+bool
+mesa_cache_db_log_compact(struct mesa_cache_db_log *db)
+{
+   bool success;
+
+   simple_mtx_lock(&db->mtx);
+
+   /* Let the own segment be folded as well, along with the accesses not
+    * recorded yet.
+    */
+   mesa_db_log_flush_accesses(db);
+   if (db->own_segment)
+      mesa_db_log_seal_own_segment(db);
+
+   success = mesa_db_log_compact_locked(db);
+
+   simple_mtx_unlock(&db->mtx);
+
+   return success;
+}
+
+void
+mesa_cache_db_log_get_lock_stats(struct mesa_cache_db_log *db,
+                                 struct mesa_cache_db_lock_stats *stats)
+{
+   simple_mtx_lock(&db->mtx);
+   *stats = db->lock_stats;
+   simple_mtx_unlock(&db->mtx);
+}
+
+#endif /* DETECT_OS_WINDOWS */
@@ -0,0 +1,162 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MESA_CACHE_DB_LOG_H
+#define MESA_CACHE_DB_LOG_H
+
+#include "list.h"
+#include "mesa_cache_db.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Log-structured variant of the Mesa-DB cache.
+ *
+ * Every process appends the entries it writes to a segment file of its own,
+ * so writers never wait on each other.  Readers map all segments of the
+ * directory and merge their records into an in-memory index, looking at
+ * them again only when the generation in the shared header says that
+ * something changed.  Reads append a small record of the access.  Once
+ * there are too many segments or the cache grows past its size limit, a
+ * writer folds the segments that are no longer being appended to into a
+ * single new one, dropping the least recently used entries.  This is the
+ * only step that needs a lock shared between processes, and writers skip
+ * it rather than wait if another process is already compacting.
+ */
+struct mesa_cache_db_log {
+   char *path;
+   int dir_fd;
+   int compact_lock_fd;
+
+   /* Mapped from the header file, shared with the other processes. */
+   struct mesa_db_log_shared_header *shared;
+
+   /* The shared generations at the last rescan, and the largest sequence
+    * number indexed.
+    */
+   uint64_t generation;
+   uint64_t dir_generation;
+   uint64_t max_seq;
+
+   struct hash_table_u64 *index_db;
+   void *mem_ctx;
+
+   /* Accesses not recorded in the own segment yet. */
+   struct mesa_db_log_record *pending_accesses;
+   unsigned num_pending_accesses;
+
+   /* All known segments, and the one this instance appends to. */
+   struct list_head segments;
+   struct mesa_cache_db_log_segment *own_segment;
+   unsigned num_segments;
+   uint64_t total_size;
+
+   uint64_t max_cache_size;
+   simple_mtx_t mtx;
+
+   /* Thresholds that put off compaction after an attempt that found
+    * nothing to fold.
+    */
+   unsigned compact_num_segments;
+   uint64_t compact_size;
+
+   /* Compaction lock statistics.  Contention is counted when a writer
+    * skipped compaction because another process held the lock.
+    */
+   struct mesa_cache_db_lock_stats lock_stats;
+   uint64_t num_compactions;
+};
+
+#if DETECT_OS_WINDOWS == 0
+bool
+mesa_cache_db_log_open(struct mesa_cache_db_log *db, const char *cache_path);
+
+void
+mesa_cache_db_log_close(struct mesa_cache_db_log *db);
+
+void
+mesa_cache_db_log_set_size_limit(struct mesa_cache_db_log *db,
+                                 uint64_t max_cache_size);
+
+void *
+mesa_cache_db_log_read_entry(struct mesa_cache_db_log *db,
+                             const uint8_t *cache_key_160bit,
+                             size_t *size);
+
+bool
+mesa_cache_db_log_entry_write(struct mesa_cache_db_log *db,
+                              const uint8_t *cache_key_160bit,
+                              const void *blob, size_t blob_size);
+
+bool
+mesa_cache_db_log_entry_remove(struct mesa_cache_db_log *db,
+                               const uint8_t *cache_key_160bit);
+
+bool
+mesa_cache_db_log_compact(struct mesa_cache_db_log *db);
+
+void
+mesa_cache_db_log_get_lock_stats(struct mesa_cache_db_log *db,
+                                 struct mesa_cache_db_lock_stats *stats);
+#else
+static inline bool
+mesa_cache_db_log_open(struct mesa_cache_db_log *db, const char *cache_path)
+{
+   return false;
+}
+
+static inline void
+mesa_cache_db_log_close(struct mesa_cache_db_log *db)
+{
+}
+
+static inline void
+mesa_cache_db_log_set_size_limit(struct mesa_cache_db_log *db,
+                                 uint64_t max_cache_size)
+{
+}
+
+static inline void *
+mesa_cache_db_log_read_entry(struct mesa_cache_db_log *db,
+                             const uint8_t *cache_key_160bit,
+                             size_t *size)
+{
+   return NULL;
+}
+
+static inline bool
+mesa_cache_db_log_entry_write(struct mesa_cache_db_log *db,
+                              const uint8_t *cache_key_160bit,
+                              const void *blob, size_t blob_size)
+{
+   return false;
+}
+
+static inline bool
+mesa_cache_db_log_entry_remove(struct mesa_cache_db_log *db,
+                               const uint8_t *cache_key_160bit)
+{
+   return false;
+}
+
+static inline bool
+mesa_cache_db_log_compact(struct mesa_cache_db_log *db)
+{
+   return false;
+}
+
+static inline void
+mesa_cache_db_log_get_lock_stats(struct mesa_cache_db_log *db,
+                                 struct mesa_cache_db_lock_stats *stats)
+{
+   memset(stats, 0, sizeof(*stats));
+}
+#endif /* DETECT_OS_WINDOWS */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MESA_CACHE_DB_LOG_H */
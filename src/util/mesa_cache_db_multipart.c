@@ -4,13 +4,44 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <inttypes.h>
 #include <sys/stat.h>
 
 #include "detect_os.h"
+#include "log.h"
 #include "string.h"
 #include "mesa_cache_db_multipart.h"
 #include "u_debug.h"
 
+#if DETECT_OS_WINDOWS == 0
+static bool
+mesa_cache_db_multipart_open_log(struct mesa_cache_db_multipart *db,
+                                 const char *cache_path)
+{
+   char *log_path = NULL;
+   bool db_opened;
+
+   if (asprintf(&log_path, "%s/log", cache_path) == -1)
+      return false;
+
+   db->log = calloc(1, sizeof(*db->log));
+   if (!db->log) {
+      free(log_path);
+      return false;
+   }
+
+   db_opened = mesa_cache_db_log_open(db->log, log_path);
+   free(log_path);
+
+   if (!db_opened) {
+      free(db->log);
+      db->log = NULL;
+   }
+
+   return db_opened;
+}
+#endif
+
 bool
 mesa_cache_db_multipart_open(struct mesa_cache_db_multipart *db,
                              const char *cache_path)
@@ -21,6 +52,9 @@ mesa_cache_db_multipart_open(struct mesa_cache_db_multipart *db,
    char *part_path = NULL;
    unsigned int i;
 
+   if (debug_get_bool_option("MESA_DISK_CACHE_DATABASE_LOG", false))
+      return mesa_cache_db_multipart_open_log(db, cache_path);
+
    db->num_parts = debug_get_num_option("MESA_DISK_CACHE_DATABASE_NUM_PARTS", 50);
 
    db->parts = calloc(db->num_parts, sizeof(*db->parts));
@@ -63,9 +97,33 @@ close_db:
 #endif
 }
 
+static void
+mesa_cache_db_multipart_print_lock_stats(struct mesa_cache_db_multipart *db)
+{
+   struct mesa_cache_db_lock_stats stats;
+
+   mesa_cache_db_multipart_get_lock_stats(db, &stats);
+
+   mesa_logi("Mesa-DB %s: %" PRIu64 " locks, %" PRIu64 " contended, "
+             "%.3f ms waiting, %.3f ms held, %.3f ms longest hold",
+             db->log ? "compaction lock" : "file locks",
+             stats.num_locks, stats.num_contended,
+             stats.wait_time / 1e6, stats.hold_time / 1e6,
+             stats.max_hold_time / 1e6);
+}
+
 void
 mesa_cache_db_multipart_close(struct mesa_cache_db_multipart *db)
 {
+   if (debug_get_bool_option("MESA_DISK_CACHE_DATABASE_STATS", false))
+      mesa_cache_db_multipart_print_lock_stats(db);
+
+   if (db->log) {
+      mesa_cache_db_log_close(db->log);
+      free(db->log);
+      return;
+   }
+
    while (db->num_parts--)
       mesa_cache_db_close(&db->parts[db->num_parts]);
 
@@ -76,6 +134,11 @@ void
 mesa_cache_db_multipart_set_size_limit(struct mesa_cache_db_multipart *db,
                                        uint64_t max_cache_size)
 {
+   if (db->log) {
+      mesa_cache_db_log_set_size_limit(db->log, max_cache_size);
+      return;
+   }
+
    for (unsigned int i = 0; i < db->num_parts; i++)
       mesa_cache_db_set_size_limit(&db->parts[i],
                                    max_cache_size / db->num_parts);
@@ -88,6 +151,9 @@ mesa_cache_db_multipart_read_entry(struct mesa_cache_db_multipart *db,
 {
    unsigned last_read_part = db->last_read_part;
 
+   if (db->log)
+      return mesa_cache_db_log_read_entry(db->log, cache_key_160bit, size);
+
    for (unsigned int i = 0; i < db->num_parts; i++) {
       unsigned int part = (last_read_part + i) % db->num_parts;
 
@@ -128,6 +194,10 @@ mesa_cache_db_multipart_entry_write(struct mesa_cache_db_multipart *db,
    unsigned last_written_part = db->last_written_part;
    int wpart = -1;
 
+   if (db->log)
+      return mesa_cache_db_log_entry_write(db->log, cache_key_160bit,
+                                           blob, blob_size);
+
    for (unsigned int i = 0; i < db->num_parts; i++) {
       unsigned int part = (last_written_part + i) % db->num_parts;
 
@@ -155,6 +225,36 @@ void
 mesa_cache_db_multipart_entry_remove(struct mesa_cache_db_multipart *db,
                                      const uint8_t *cache_key_160bit)
 {
+   if (db->log) {
+      mesa_cache_db_log_entry_remove(db->log, cache_key_160bit);
+      return;
+   }
+
    for (unsigned int i = 0; i < db->num_parts; i++)
       mesa_cache_db_entry_remove(&db->parts[i], cache_key_160bit);
 }
+
+void
+mesa_cache_db_multipart_get_lock_stats(struct mesa_cache_db_multipart *db,
+                                       struct mesa_cache_db_lock_stats *stats)
+{
+   struct mesa_cache_db_lock_stats part_stats;
+
+   if (db->log) {
+      mesa_cache_db_log_get_lock_stats(db->log, stats);
+      return;
+   }
+
+   memset(stats, 0, sizeof(*stats));
+
+   for (unsigned int i = 0; i < db->num_parts; i++) {
+      mesa_cache_db_get_lock_stats(&db->parts[i], &part_stats);
+
+      stats->num_locks += part_stats.num_locks;
+      stats->num_contended += part_stats.num_contended;
+      stats->wait_time += part_stats.wait_time;
+      stats->hold_time += part_stats.hold_time;
+      stats->max_hold_time = MAX2(stats->max_hold_time,
+                                  part_stats.max_hold_time);
+   }
+}
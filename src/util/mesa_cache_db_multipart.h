@@ -8,12 +8,16 @@
 #define MESA_CACHE_DB_MULTIPART_H
 
 #include "mesa_cache_db.h"
+#include "mesa_cache_db_log.h"
 
 struct mesa_cache_db_multipart {
    struct mesa_cache_db *parts;
    unsigned int num_parts;
    volatile unsigned int last_read_part;
    volatile unsigned int last_written_part;
+
+   /* Used instead of the parts if MESA_DISK_CACHE_DATABASE_LOG is set. */
+   struct mesa_cache_db_log *log;
 };
 
 bool
@@ -41,4 +45,8 @@ void
 mesa_cache_db_multipart_entry_remove(struct mesa_cache_db_multipart *db,
                                      const uint8_t *cache_key_160bit);
 
+void
+mesa_cache_db_multipart_get_lock_stats(struct mesa_cache_db_multipart *db,
+                                       struct mesa_cache_db_lock_stats *stats);
+
 #endif /* MESA_CACHE_DB_MULTIPART_H */
@@ -417,7 +417,7 @@ u_trace_is_enabled(enum u_trace_type type)
 static void
 queue_init(struct u_trace_context *utctx)
 {
-   if (utctx->queue.jobs)
+   if (util_queue_is_initialized(&utctx->queue))
       return;
 
    bool ret = util_queue_init(
@@ -507,7 +507,7 @@ u_trace_context_fini(struct u_trace_context *utctx)
       fflush(utctx->out);
    }
 
-   if (!utctx->queue.jobs)
+   if (!util_queue_is_initialized(&utctx->queue))
       return;
    util_queue_finish(&utctx->queue);
    util_queue_destroy(&utctx->queue);
@@ -74,8 +74,11 @@
 #include <stdlib.h>
 
 #include "blob.h"
+#include "log.h"
+#include "os_time.h"
 #include "ralloc.h"
 #include "util/bitset.h"
+#include "util/u_debug.h"
 #include "util/u_dynarray.h"
 #include "u_math.h"
 #include "register_allocate.h"
@@ -472,6 +475,14 @@ ra_set_deserialize(void *mem_ctx, struct blob_reader *blob)
    return regs;
 }
 
+/* Past this many nodes, the adjacency bitmatrix would take more than 1MB
+ * and grows quadratically, while the interference of large shaders is mostly
+ * sparse, so edges go in a hash set instead.
+ */
+#define RA_SPARSE_ADJACENCY_NODES 4096
+
+#define RA_EDGE_DELETED UINT64_MAX
+
 static uint64_t
 ra_get_num_adjacency_bits(uint64_t n)
 {
@@ -487,24 +498,152 @@ ra_get_adjacency_bit_index(unsigned n1, unsigned n2)
    return ra_get_num_adjacency_bits(k1) + k2;
 }
 
+static size_t
+ra_get_graph_memory(const struct ra_graph *g)
+{
+   size_t size = sizeof(*g) + g->alloc * sizeof(struct ra_node);
+
+   /* The scratch arrays. */
+   size += g->alloc * sizeof(unsigned int) +
+           BITSET_WORDS(g->alloc) * (3 * sizeof(BITSET_WORD) +
+                                     2 * sizeof(unsigned int));
+
+   if (g->sparse) {
+      size += sizeof(uint64_t) << g->edges.size_log2;
+   } else {
+      size += BITSET_WORDS(ra_get_num_adjacency_bits(g->alloc)) *
+              sizeof(BITSET_WORD);
+   }
+
+   return size + g->adjacency_list_bytes;
+}
+
+static void
+ra_update_memory_stats(struct ra_graph *g)
+{
+   g->stats.memory = ra_get_graph_memory(g);
+   g->stats.peak_memory = MAX2(g->stats.peak_memory, g->stats.memory);
+}
+
+static uint64_t
+ra_get_edge_key(unsigned n1, unsigned n2)
+{
+   assert(n1 != n2);
+   return (uint64_t)MAX2(n1, n2) << 32 | MIN2(n1, n2);
+}
+
+/**
+ * Returns the slot holding the key, or the empty slot ending its probe
+ * sequence.
+ */
+static uint64_t *
+ra_find_edge_slot(struct ra_graph *g, uint64_t key)
+{
+   unsigned mask = (1u << g->edges.size_log2) - 1;
+   unsigned i = (key * 0x9e3779b97f4a7c15ull) >> (64 - g->edges.size_log2);
+
+   while (g->edges.keys[i] != key && g->edges.keys[i] != 0)
+      i = (i + 1) & mask;
+
+   return &g->edges.keys[i];
+}
+
+/**
+ * Rehashes the edge set, dropping deleted markers, into a size that keeps
+ * it at most half full with the current edges.
+ */
+static void
+ra_rehash_edges(struct ra_graph *g)
+{
+   uint64_t *old_keys = g->edges.keys;
+   unsigned old_size = old_keys ? 1u << g->edges.size_log2 : 0;
+
+   g->edges.size_log2 = MAX2(util_logbase2_ceil(g->stats.edges * 2), 10);
+   g->edges.keys = rzalloc_array(g, uint64_t, 1u << g->edges.size_log2);
+   g->edges.used = 0;
+
+   for (unsigned i = 0; i < old_size; i++) {
+      if (old_keys[i] != 0 && old_keys[i] != RA_EDGE_DELETED) {
+         *ra_find_edge_slot(g, old_keys[i]) = old_keys[i];
+         g->edges.used++;
+      }
+   }
+
+   ralloc_free(old_keys);
+}
+
+/**
+ * Moves the edges of the first nodes, which are all in the bitmatrix and
+ * the adjacency lists, to the edge set and frees the bitmatrix.
+ */
+static void
+ra_make_adjacency_sparse(struct ra_graph *g, unsigned int num_nodes)
+{
+   g->sparse = true;
+   ra_rehash_edges(g);
+
+   for (unsigned n = 0; n < num_nodes; n++) {
+      util_dynarray_foreach(&g->nodes[n].adjacency_list, unsigned int, n2p) {
+         if (*n2p < n) {
+            *ra_find_edge_slot(g, ra_get_edge_key(n, *n2p)) =
+               ra_get_edge_key(n, *n2p);
+            g->edges.used++;
+         }
+      }
+   }
+
+   ralloc_free(g->adjacency);
+   g->adjacency = NULL;
+}
+
 static bool
-ra_test_adjacency_bit(struct ra_graph *g, unsigned n1, unsigned n2)
+ra_test_adjacency(struct ra_graph *g, unsigned n1, unsigned n2)
 {
+   if (g->sparse) {
+      uint64_t key = ra_get_edge_key(n1, n2);
+      return *ra_find_edge_slot(g, key) == key;
+   }
+
    uint64_t index = ra_get_adjacency_bit_index(n1, n2);
    return BITSET_TEST(g->adjacency, index);
 }
 
 static void
-ra_set_adjacency_bit(struct ra_graph *g, unsigned n1, unsigned n2)
+ra_set_adjacency(struct ra_graph *g, unsigned n1, unsigned n2)
 {
-   unsigned index = ra_get_adjacency_bit_index(n1, n2);
+   g->stats.edges++;
+
+   if (g->sparse) {
+      /* Keep the set at most 3/4 full, counting the deleted markers. */
+      if ((g->edges.used + 1) * 4 > (3u << g->edges.size_log2)) {
+         ra_rehash_edges(g);
+         ra_update_memory_stats(g);
+      }
+
+      uint64_t key = ra_get_edge_key(n1, n2);
+      *ra_find_edge_slot(g, key) = key;
+      g->edges.used++;
+      return;
+   }
+
+   uint64_t index = ra_get_adjacency_bit_index(n1, n2);
    BITSET_SET(g->adjacency, index);
 }
 
 static void
-ra_clear_adjacency_bit(struct ra_graph *g, unsigned n1, unsigned n2)
+ra_clear_adjacency(struct ra_graph *g, unsigned n1, unsigned n2)
 {
-   unsigned index = ra_get_adjacency_bit_index(n1, n2);
+   g->stats.edges--;
+
+   if (g->sparse) {
+      uint64_t key = ra_get_edge_key(n1, n2);
+      uint64_t *slot = ra_find_edge_slot(g, key);
+      assert(*slot == key);
+      *slot = RA_EDGE_DELETED;
+      return;
+   }
+
+   uint64_t index = ra_get_adjacency_bit_index(n1, n2);
    BITSET_CLEAR(g->adjacency, index);
 }
 
@@ -517,14 +656,20 @@ ra_add_node_adjacency(struct ra_graph *g, unsigned int n1, unsigned int n2)
    int n2_class = g->nodes[n2].class;
    g->nodes[n1].q_total += g->regs->classes[n1_class]->q[n2_class];
 
-   util_dynarray_append(&g->nodes[n1].adjacency_list, unsigned int, n2);
+   struct util_dynarray *list = &g->nodes[n1].adjacency_list;
+   unsigned old_capacity = list->capacity;
+   util_dynarray_append(list, unsigned int, n2);
+   if (list->capacity != old_capacity) {
+      g->adjacency_list_bytes += list->capacity - old_capacity;
+      ra_update_memory_stats(g);
+   }
 }
 
 static void
 ra_node_remove_adjacency(struct ra_graph *g, unsigned int n1, unsigned int n2)
 {
    assert(n1 != n2);
-   ra_clear_adjacency_bit(g, n1, n2);
+   ra_clear_adjacency(g, n1, n2);
 
    int n1_class = g->nodes[n1].class;
    int n2_class = g->nodes[n2].class;
@@ -546,9 +691,14 @@ ra_realloc_interference_graph(struct ra_graph *g, unsigned int alloc)
    assert(g->alloc % BITSET_WORDBITS == 0);
    alloc = align(alloc, BITSET_WORDBITS);
    g->nodes = rerzalloc(g, g->nodes, struct ra_node, g->alloc, alloc);
-   g->adjacency = rerzalloc(g, g->adjacency, BITSET_WORD,
-                            BITSET_WORDS(ra_get_num_adjacency_bits(g->alloc)),
-                            BITSET_WORDS(ra_get_num_adjacency_bits(alloc)));
+
+   if (!g->sparse && alloc > RA_SPARSE_ADJACENCY_NODES) {
+      ra_make_adjacency_sparse(g, g->alloc);
+   } else if (!g->sparse) {
+      g->adjacency = rerzalloc(g, g->adjacency, BITSET_WORD,
+                               BITSET_WORDS(ra_get_num_adjacency_bits(g->alloc)),
+                               BITSET_WORDS(ra_get_num_adjacency_bits(alloc)));
+   }
 
    /* Initialize new nodes. */
    for (unsigned i = g->alloc; i < alloc; i++) {
@@ -575,6 +725,7 @@ ra_realloc_interference_graph(struct ra_graph *g, unsigned int alloc)
                                 bitset_count);
 
    g->alloc = alloc;
+   ra_update_memory_stats(g);
 }
 
 struct ra_graph *
@@ -636,8 +787,8 @@ ra_add_node_interference(struct ra_graph *g,
                          unsigned int n1, unsigned int n2)
 {
    assert(n1 < g->count && n2 < g->count);
-   if (n1 != n2 && !ra_test_adjacency_bit(g, n1, n2)) {
-      ra_set_adjacency_bit(g, n1, n2);
+   if (n1 != n2 && !ra_test_adjacency(g, n1, n2)) {
+      ra_set_adjacency(g, n1, n2);
       ra_add_node_adjacency(g, n1, n2);
       ra_add_node_adjacency(g, n2, n1);
    }
@@ -975,11 +1126,37 @@ ra_select(struct ra_graph *g)
    return true;
 }
 
+DEBUG_GET_ONCE_BOOL_OPTION(print_stats, "MESA_RA_STATS", false)
+
 bool
 ra_allocate(struct ra_graph *g)
 {
+   int64_t start = os_time_get_nano();
+
    ra_simplify(g);
-   return ra_select(g);
+   bool success = ra_select(g);
+
+   g->stats.allocate_calls++;
+   g->stats.allocate_ns += os_time_get_nano() - start;
+
+   if (debug_get_option_print_stats()) {
+      mesa_logi("ra: %u nodes, %u edges, %s adjacency, %zu KiB peak, "
+                "%u allocations in %.3f ms%s",
+                g->count, g->stats.edges, g->sparse ? "sparse" : "dense",
+                g->stats.peak_memory / 1024, g->stats.allocate_calls,
+                g->stats.allocate_ns / 1000000.0,
+                success ? "" : ", failed");
+   }
+
+   return success;
+}
+
+void
+ra_get_graph_stats(const struct ra_graph *g, struct ra_graph_stats *stats)
+{
+   *stats = g->stats;
+   stats->nodes = g->count;
+   stats->sparse = g->sparse;
 }
 
 unsigned int
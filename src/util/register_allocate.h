@@ -29,6 +29,8 @@
 #define REGISTER_ALLOCATE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "util/bitset.h"
 
 #ifdef __cplusplus
@@ -133,6 +135,32 @@ void ra_set_node_spill_cost(struct ra_graph *g, unsigned int n, float cost);
 int ra_get_best_spill_node(struct ra_graph *g);
 /** @} */
 
+/** @{ Statistics
+ *
+ * Graphs past a few thousand nodes switch from an adjacency bitmatrix,
+ * which grows quadratically, to a hash set of edges.  These counters let
+ * drivers see what that costs on their largest shaders.  Setting
+ * MESA_RA_STATS=1 logs them on every ra_allocate() call.
+ */
+struct ra_graph_stats {
+   unsigned int nodes;
+   unsigned int edges;
+
+   /** Whether interference is stored in the sparse edge set. */
+   bool sparse;
+
+   /** Bytes used by the graph, now and at most since it was created. */
+   size_t memory;
+   size_t peak_memory;
+
+   /** Calls to ra_allocate() and the total time they took. */
+   unsigned int allocate_calls;
+   uint64_t allocate_ns;
+};
+
+void ra_get_graph_stats(const struct ra_graph *g, struct ra_graph_stats *stats);
+/** @} */
+
 
 #ifdef __cplusplus
 }  // extern "C"
@@ -130,7 +130,27 @@ struct ra_graph {
     * the variables that need register allocation.
     */
    struct ra_node *nodes;
+
+   /**
+    * Triangular bitmatrix of which nodes interfere, used up to
+    * RA_SPARSE_ADJACENCY_NODES allocated nodes.
+    */
    BITSET_WORD *adjacency;
+
+   /**
+    * Open-addressed hash set of interfering node pairs, used instead of the
+    * bitmatrix for larger graphs.  Each key holds the higher node index in
+    * its top 32 bits and the lower one in its bottom 32 bits, so 0 marks an
+    * empty slot.
+    */
+   struct {
+      uint64_t *keys;
+      unsigned int size_log2;
+      /** Slots holding a key or a deleted marker. */
+      unsigned int used;
+   } edges;
+   bool sparse;
+
    unsigned int count; /**< count of nodes. */
 
    unsigned int alloc; /**< count of nodes allocated. */
@@ -138,6 +158,10 @@ struct ra_graph {
    ra_select_reg_callback select_reg_callback;
    void *select_reg_callback_data;
 
+   /** Capacity of all the adjacency lists, in bytes. */
+   size_t adjacency_list_bytes;
+   struct ra_graph_stats stats;
+
    /* Temporary data for the algorithm to scratch around in */
    struct {
       unsigned int *stack;
@@ -41,55 +41,54 @@
 #include "ralloc.h"
 #include "set.h"
 #include "fast_urem_by_const.h"
-
-/*
- * From Knuth -- a good choice for hash/rehash values is p, p-2 where
- * p and p-2 are both prime.  These tables are sized to have an extra 10%
- * free to avoid exponential performance degradation as the hash table fills
- */
+#include "hash_table_group.h"
 
 static const uint32_t deleted_key_value;
 static const void *deleted_key = &deleted_key_value;
 
+/**
+ * Prime sizes spread the start of the probes even with weak hashes.  These
+ * tables are sized to have an extra 10% free to avoid exponential performance
+ * degradation as the hash table fills
+ */
 static const struct {
-   uint32_t max_entries, size, rehash;
-   uint64_t size_magic, rehash_magic;
+   uint32_t max_entries, size;
+   uint64_t size_magic;
 } hash_sizes[] = {
-#define ENTRY(max_entries, size, rehash) \
-   { max_entries, size, rehash, \
-      REMAINDER_MAGIC(size), REMAINDER_MAGIC(rehash) }
-
-   ENTRY(2,            5,            3            ),
-   ENTRY(4,            7,            5            ),
-   ENTRY(8,            13,           11           ),
-   ENTRY(16,           19,           17           ),
-   ENTRY(32,           43,           41           ),
-   ENTRY(64,           73,           71           ),
-   ENTRY(128,          151,          149          ),
-   ENTRY(256,          283,          281          ),
-   ENTRY(512,          571,          569          ),
-   ENTRY(1024,         1153,         1151         ),
-   ENTRY(2048,         2269,         2267         ),
-   ENTRY(4096,         4519,         4517         ),
-   ENTRY(8192,         9013,         9011         ),
-   ENTRY(16384,        18043,        18041        ),
-   ENTRY(32768,        36109,        36107        ),
-   ENTRY(65536,        72091,        72089        ),
-   ENTRY(131072,       144409,       144407       ),
-   ENTRY(262144,       288361,       288359       ),
-   ENTRY(524288,       576883,       576881       ),
-   ENTRY(1048576,      1153459,      1153457      ),
-   ENTRY(2097152,      2307163,      2307161      ),
-   ENTRY(4194304,      4613893,      4613891      ),
-   ENTRY(8388608,      9227641,      9227639      ),
-   ENTRY(16777216,     18455029,     18455027     ),
-   ENTRY(33554432,     36911011,     36911009     ),
-   ENTRY(67108864,     73819861,     73819859     ),
-   ENTRY(134217728,    147639589,    147639587    ),
-   ENTRY(268435456,    295279081,    295279079    ),
-   ENTRY(536870912,    590559793,    590559791    ),
-   ENTRY(1073741824,   1181116273,   1181116271   ),
-   ENTRY(2147483648ul, 2362232233ul, 2362232231ul )
+#define ENTRY(max_entries, size) \
+   { max_entries, size, REMAINDER_MAGIC(size) }
+
+   ENTRY(2,            5            ),
+   ENTRY(4,            7            ),
+   ENTRY(8,            13           ),
+   ENTRY(16,           19           ),
+   ENTRY(32,           43           ),
+   ENTRY(64,           73           ),
+   ENTRY(128,          151          ),
+   ENTRY(256,          283          ),
+   ENTRY(512,          571          ),
+   ENTRY(1024,         1153         ),
+   ENTRY(2048,         2269         ),
+   ENTRY(4096,         4519         ),
+   ENTRY(8192,         9013         ),
+   ENTRY(16384,        18043        ),
+   ENTRY(32768,        36109        ),
+   ENTRY(65536,        72091        ),
+   ENTRY(131072,       144409       ),
+   ENTRY(262144,       288361       ),
+   ENTRY(524288,       576883       ),
+   ENTRY(1048576,      1153459      ),
+   ENTRY(2097152,      2307163      ),
+   ENTRY(4194304,      4613893      ),
+   ENTRY(8388608,      9227641      ),
+   ENTRY(16777216,     18455029     ),
+   ENTRY(33554432,     36911011     ),
+   ENTRY(67108864,     73819861     ),
+   ENTRY(134217728,    147639589    ),
+   ENTRY(268435456,    295279081    ),
+   ENTRY(536870912,    590559793    ),
+   ENTRY(1073741824,   1181116273   ),
+   ENTRY(2147483648ul, 2362232233ul )
 };
 
 ASSERTED static inline bool
@@ -98,18 +97,6 @@ key_pointer_is_reserved(const void *key)
    return key == NULL || key == deleted_key;
 }
 
-static int
-entry_is_free(struct set_entry *entry)
-{
-   return entry->key == NULL;
-}
-
-static int
-entry_is_deleted(struct set_entry *entry)
-{
-   return entry->key == deleted_key;
-}
-
 static int
 entry_is_present(struct set_entry *entry)
 {
@@ -124,13 +111,13 @@ _mesa_set_init(struct set *ht, void *mem_ctx,
 {
    ht->size_index = 0;
    ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
    ht->size_magic = hash_sizes[ht->size_index].size_magic;
-   ht->rehash_magic = hash_sizes[ht->size_index].rehash_magic;
    ht->max_entries = hash_sizes[ht->size_index].max_entries;
    ht->key_hash_function = key_hash_function;
    ht->key_equals_function = key_equals_function;
-   ht->table = rzalloc_array(mem_ctx, struct set_entry, ht->size);
+   ht->table = rzalloc_size(mem_ctx, table_alloc_size(sizeof(struct set_entry),
+                                                      ht->size));
+   ht->ctrl = (uint8_t *)(ht->table + ht->size);
    ht->entries = 0;
    ht->deleted_entries = 0;
 
@@ -188,13 +175,15 @@ _mesa_set_clone(struct set *set, void *dst_mem_ctx)
 
    memcpy(clone, set, sizeof(struct set));
 
-   clone->table = ralloc_array(clone, struct set_entry, clone->size);
+   size_t alloc_size = table_alloc_size(sizeof(struct set_entry), clone->size);
+   clone->table = ralloc_size(clone, alloc_size);
    if (clone->table == NULL) {
       ralloc_free(clone);
       return NULL;
    }
 
-   memcpy(clone->table, set->table, clone->size * sizeof(struct set_entry));
+   memcpy(clone->table, set->table, alloc_size);
+   clone->ctrl = (uint8_t *)(clone->table + clone->size);
 
    return clone;
 }
@@ -224,7 +213,7 @@ _mesa_set_destroy(struct set *ht, void (*delete_function)(struct set_entry *entr
 static void
 set_clear_fast(struct set *ht)
 {
-   memset(ht->table, 0, sizeof(struct set_entry) * hash_sizes[ht->size_index].size);
+   memset(ht->table, 0, table_alloc_size(sizeof(struct set_entry), ht->size));
    ht->entries = ht->deleted_entries = 0;
 }
 
@@ -249,6 +238,7 @@ _mesa_set_clear(struct set *set, void (*delete_function)(struct set_entry *entry
 
          entry->key = NULL;
       }
+      memset(set->ctrl, CTRL_EMPTY, set->size + GROUP_WIDTH);
       set->entries = 0;
       set->deleted_entries = 0;
    } else
@@ -266,25 +256,25 @@ set_search(const struct set *ht, uint32_t hash, const void *key)
    assert(!key_pointer_is_reserved(key));
 
    uint32_t size = ht->size;
-   uint32_t start_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = util_fast_urem32(hash, ht->rehash,
-                                           ht->rehash_magic) + 1;
-   uint32_t hash_address = start_address;
-   do {
-      struct set_entry *entry = ht->table + hash_address;
-
-      if (entry_is_free(entry)) {
-         return NULL;
-      } else if (entry_is_present(entry) && entry->hash == hash) {
-         if (ht->key_equals_function(key, entry->key)) {
+   uint32_t num_groups = probe_num_groups(size);
+   uint32_t pos = util_fast_urem32(hash, size, ht->size_magic);
+   uint8_t c = ctrl_hash(hash);
+
+   for (uint32_t i = 0; i < num_groups; i++) {
+      ctrl_group group = group_load(ht->ctrl, pos);
+      unsigned match = group_match(group, c);
+      while (match) {
+         struct set_entry *entry = ht->table + probe_slot(pos + u_bit_scan(&match), size);
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key))
             return entry;
-         }
       }
 
-      hash_address += double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (hash_address != start_address);
+      if (group_match(group, CTRL_EMPTY))
+         return NULL;
+
+      pos = probe_next(pos, size);
+   }
 
    return NULL;
 }
@@ -309,22 +299,22 @@ static void
 set_add_rehash(struct set *ht, uint32_t hash, const void *key)
 {
    uint32_t size = ht->size;
-   uint32_t start_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = util_fast_urem32(hash, ht->rehash,
-                                           ht->rehash_magic) + 1;
-   uint32_t hash_address = start_address;
-   do {
-      struct set_entry *entry = ht->table + hash_address;
-      if (likely(entry->key == NULL)) {
+   uint32_t pos = util_fast_urem32(hash, size, ht->size_magic);
+
+   while (true) {
+      unsigned available = group_match_available(group_load(ht->ctrl, pos));
+      if (likely(available)) {
+         uint32_t slot = probe_slot(pos + ffs(available) - 1, size);
+         struct set_entry *entry = ht->table + slot;
+
+         ctrl_set(ht->ctrl, ht->size, slot, ctrl_hash(hash));
          entry->hash = hash;
          entry->key = key;
          return;
       }
 
-      hash_address = hash_address + double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (true);
+      pos = probe_next(pos, size);
+   }
 }
 
 static void
@@ -342,8 +332,9 @@ set_rehash(struct set *ht, unsigned new_size_index)
    if (new_size_index >= ARRAY_SIZE(hash_sizes))
       return;
 
-   table = rzalloc_array(ralloc_parent(ht->table), struct set_entry,
-                         hash_sizes[new_size_index].size);
+   table = rzalloc_size(ralloc_parent(ht->table),
+                        table_alloc_size(sizeof(struct set_entry),
+                                         hash_sizes[new_size_index].size));
    if (table == NULL)
       return;
 
@@ -352,15 +343,17 @@ set_rehash(struct set *ht, unsigned new_size_index)
    ht->table = table;
    ht->size_index = new_size_index;
    ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
    ht->size_magic = hash_sizes[ht->size_index].size_magic;
-   ht->rehash_magic = hash_sizes[ht->size_index].rehash_magic;
    ht->max_entries = hash_sizes[ht->size_index].max_entries;
+   ht->ctrl = (uint8_t *)(ht->table + ht->size);
    ht->entries = 0;
    ht->deleted_entries = 0;
 
-   set_foreach(&old_ht, entry) {
-      set_add_rehash(ht, entry->hash, entry->key);
+   for (uint32_t i = 0; i < old_ht.size; i++) {
+      if (old_ht.ctrl[i] & CTRL_FULL) {
+         struct set_entry *entry = old_ht.table + i;
+         set_add_rehash(ht, entry->hash, entry->key);
+      }
    }
 
    ht->entries = old_ht.entries;
@@ -403,38 +396,42 @@ set_search_or_add(struct set *ht, uint32_t hash, const void *key, bool *found)
    }
 
    uint32_t size = ht->size;
-   uint32_t start_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = util_fast_urem32(hash, ht->rehash,
-                                           ht->rehash_magic) + 1;
-   uint32_t hash_address = start_address;
-   do {
-      struct set_entry *entry = ht->table + hash_address;
-
-      if (!entry_is_present(entry)) {
-         /* Stash the first available entry we find */
-         if (available_entry == NULL)
-            available_entry = entry;
-         if (entry_is_free(entry))
-            break;
+   uint32_t num_groups = probe_num_groups(size);
+   uint32_t pos = util_fast_urem32(hash, size, ht->size_magic);
+   uint8_t c = ctrl_hash(hash);
+   uint32_t available_slot = 0;
+
+   for (uint32_t i = 0; i < num_groups; i++) {
+      ctrl_group group = group_load(ht->ctrl, pos);
+      unsigned match = group_match(group, c);
+      while (match) {
+         struct set_entry *entry = ht->table + probe_slot(pos + u_bit_scan(&match), size);
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key)) {
+            if (found)
+               *found = true;
+            return entry;
+         }
       }
 
-      if (!entry_is_deleted(entry) &&
-          entry->hash == hash &&
-          ht->key_equals_function(key, entry->key)) {
-         if (found)
-            *found = true;
-         return entry;
+      /* Stash the first available entry we find */
+      unsigned available = group_match_available(group);
+      if (available_entry == NULL && available) {
+         available_slot = probe_slot(pos + ffs(available) - 1, size);
+         available_entry = ht->table + available_slot;
       }
 
-      hash_address = hash_address + double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (hash_address != start_address);
+      if (group_match(group, CTRL_EMPTY))
+         break;
+
+      pos = probe_next(pos, size);
+   }
 
    if (available_entry) {
       /* There is no matching entry, create it. */
-      if (entry_is_deleted(available_entry))
+      if (ht->ctrl[available_slot] == CTRL_DELETED)
          ht->deleted_entries--;
+      ctrl_set(ht->ctrl, ht->size, available_slot, c);
       available_entry->hash = hash;
       available_entry->key = key;
       ht->entries++;
@@ -546,6 +543,7 @@ _mesa_set_remove(struct set *ht, struct set_entry *entry)
    if (!entry)
       return;
 
+   ctrl_set(ht->ctrl, ht->size, entry - ht->table, CTRL_DELETED);
    entry->key = deleted_key;
    ht->entries--;
    ht->deleted_entries++;
@@ -561,24 +559,37 @@ _mesa_set_remove_key(struct set *set, const void *key)
 }
 
 /**
- * This function is an iterator over the set when no deleted entries are present.
+ * This function is the iterator of set_foreach_remove().
  *
- * Pass in NULL for the first entry, as in the start of a for loop.
+ * Pass in NULL for the first entry, as in the start of a for loop.  Once the
+ * set is empty, the tombstones left by the removals are cleared.
  */
 struct set_entry *
-_mesa_set_next_entry_unsafe(const struct set *ht, struct set_entry *entry)
+_mesa_set_next_entry_unsafe(struct set *ht, struct set_entry *entry)
 {
-   assert(!ht->deleted_entries);
-   if (!ht->entries)
+   if (!ht->entries) {
+      memset(ht->ctrl, CTRL_EMPTY, ht->size + GROUP_WIDTH);
+      ht->deleted_entries = 0;
       return NULL;
-   if (entry == NULL)
-      entry = ht->table;
-   else
-      entry = entry + 1;
-   if (entry != ht->table + ht->size)
-      return entry->key ? entry : _mesa_set_next_entry_unsafe(ht, entry);
+   }
 
-   return NULL;
+   return _mesa_set_next_entry(ht, entry);
+}
+
+/**
+ * Removes the entry of the current iteration of set_foreach_remove(), and
+ * returns the next one.
+ */
+struct set_entry *
+_mesa_set_remove_next_unsafe(struct set *ht, struct set_entry *entry)
+{
+   ctrl_set(ht->ctrl, ht->size, entry - ht->table, CTRL_DELETED);
+   entry->hash = 0;
+   entry->key = NULL;
+   ht->entries--;
+   ht->deleted_entries++;
+
+   return _mesa_set_next_entry_unsafe(ht, entry);
 }
 
 /**
@@ -590,18 +601,10 @@ _mesa_set_next_entry_unsafe(const struct set *ht, struct set_entry *entry)
 struct set_entry *
 _mesa_set_next_entry(const struct set *ht, struct set_entry *entry)
 {
-   if (entry == NULL)
-      entry = ht->table;
-   else
-      entry = entry + 1;
+   uint32_t i = entry == NULL ? 0 : entry - ht->table + 1;
 
-   for (; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(entry)) {
-         return entry;
-      }
-   }
-
-   return NULL;
+   i = ctrl_next_full(ht->ctrl, ht->size, i);
+   return i < ht->size ? ht->table + i : NULL;
 }
 
 /**
@@ -43,12 +43,12 @@ struct set_entry {
 struct set {
    void *mem_ctx;
    struct set_entry *table;
+   /* One control byte per entry, allocated along with the table. */
+   uint8_t *ctrl;
    uint32_t (*key_hash_function)(const void *key);
    bool (*key_equals_function)(const void *a, const void *b);
    uint32_t size;
-   uint32_t rehash;
    uint64_t size_magic;
-   uint64_t rehash_magic;
    uint32_t max_entries;
    uint32_t size_index;
    uint32_t entries;
@@ -112,7 +112,9 @@ _mesa_set_remove_key(struct set *set, const void *key);
 struct set_entry *
 _mesa_set_next_entry(const struct set *set, struct set_entry *entry);
 struct set_entry *
-_mesa_set_next_entry_unsafe(const struct set *set, struct set_entry *entry);
+_mesa_set_next_entry_unsafe(struct set *set, struct set_entry *entry);
+struct set_entry *
+_mesa_set_remove_next_unsafe(struct set *set, struct set_entry *entry);
 
 struct set *
 _mesa_pointer_set_create(void *mem_ctx);
@@ -131,13 +133,15 @@ _mesa_set_intersects(struct set *a, struct set *b);
         entry = _mesa_set_next_entry(set, entry))
 
 /**
- * This foreach function destroys the table as it iterates.
+ * This foreach function destroys the set as it iterates, each entry is
+ * removed at the end of its iteration.  Breaking out of the loop leaves the
+ * current entry and the ones not visited yet in the set.
  * It is not safe to use when inserting or removing entries.
  */
 #define set_foreach_remove(set, entry)                              \
    for (struct set_entry *entry = _mesa_set_next_entry_unsafe(set, NULL);  \
         (set)->entries;                                              \
-        entry->hash = 0, entry->key = (void*)NULL, (set)->entries--, entry = _mesa_set_next_entry_unsafe(set, entry))
+        entry = _mesa_set_remove_next_unsafe(set, entry))
 
 #ifdef __cplusplus
 } /* extern C */
@@ -28,6 +28,9 @@
 #include <stdbool.h>
 #include <string.h>
 
+/* Number of remote frees a child pool gathers before returning them. */
+#define SLAB_MAGAZINE_SIZE 64
+
 #define SLAB_MAGIC_ALLOCATED 0xcafe4321
 #define SLAB_MAGIC_FREE 0x7ee01234
 
@@ -95,6 +98,67 @@ slab_free_orphaned(struct slab_element_header *elt)
       free(page);
 }
 
+static void
+slab_free_orphaned_list(struct slab_element_header *elt)
+{
+   while (elt) {
+      struct slab_element_header *next = elt->next;
+      slab_free_orphaned(elt);
+      elt = next;
+   }
+}
+
+/* Moves the elements of the magazine to the migrated lists of their owners.
+ * Must be called with the parent mutex held. Returns the elements whose
+ * owner has been destroyed, which the caller must pass to
+ * slab_free_orphaned_list after unlocking.
+ */
+static struct slab_element_header *
+slab_flush_magazine_locked(struct slab_child_pool *pool)
+{
+   struct slab_element_header *orphaned = NULL;
+
+   while (pool->magazine) {
+      struct slab_element_header *elt = pool->magazine;
+      pool->magazine = elt->next;
+
+      /* The owner may have been destroyed since the element was freed. */
+      intptr_t owner_int = p_atomic_read(&elt->owner);
+
+      if (!(owner_int & 1)) {
+         struct slab_child_pool *owner = (struct slab_child_pool *)owner_int;
+         elt->next = owner->migrated;
+         owner->migrated = elt;
+      } else {
+         elt->next = orphaned;
+         orphaned = elt;
+      }
+   }
+
+   pool->num_magazine = 0;
+   pool->stats.remote_batches++;
+
+   return orphaned;
+}
+
+static void
+slab_flush_magazine(struct slab_child_pool *pool)
+{
+   simple_mtx_lock(&pool->parent->mutex);
+   struct slab_element_header *orphaned = slab_flush_magazine_locked(pool);
+   simple_mtx_unlock(&pool->parent->mutex);
+
+   slab_free_orphaned_list(orphaned);
+}
+
+static void
+slab_add_stats(struct slab_stats *dst, const struct slab_stats *src)
+{
+   dst->frees += src->frees;
+   dst->remote_frees += src->remote_frees;
+   dst->remote_batches += src->remote_batches;
+}
+
 /**
  * Create a parent pool for the allocation of same-sized objects.
  *
@@ -111,6 +175,7 @@ slab_create_parent(struct slab_parent_pool *parent,
                                     sizeof(intptr_t));
    parent->num_elements = num_items;
    parent->item_size = item_size;
+   memset(&parent->stats, 0, sizeof(parent->stats));
 }
 
 void
@@ -129,6 +194,9 @@ void slab_create_child(struct slab_child_pool *pool,
    pool->pages = NULL;
    pool->free = NULL;
    pool->migrated = NULL;
+   pool->magazine = NULL;
+   pool->num_magazine = 0;
+   memset(&pool->stats, 0, sizeof(pool->stats));
 }
 
 /**
@@ -144,6 +212,11 @@ void slab_destroy_child(struct slab_child_pool *pool)
 
    simple_mtx_lock(&pool->parent->mutex);
 
+   struct slab_element_header *orphaned = NULL;
+   if (pool->magazine)
+      orphaned = slab_flush_magazine_locked(pool);
+   slab_add_stats(&pool->parent->stats, &pool->stats);
+
    while (pool->pages) {
       struct slab_page_header *page = pool->pages;
       pool->pages = page->u.next;
@@ -163,11 +236,9 @@ void slab_destroy_child(struct slab_child_pool *pool)
 
    simple_mtx_unlock(&pool->parent->mutex);
 
-   while (pool->free) {
-      struct slab_element_header *elt = pool->free;
-      pool->free = elt->next;
-      slab_free_orphaned(elt);
-   }
+   slab_free_orphaned_list(orphaned);
+   slab_free_orphaned_list(pool->free);
+   pool->free = NULL;
 
    /* Guard against use-after-free. */
    pool->parent = NULL;
@@ -210,13 +281,20 @@ slab_alloc(struct slab_child_pool *pool)
 
    if (!pool->free) {
       /* First, collect elements that belong to us but were freed from a
-       * different child pool.
+       * different child pool, and return the ones we hold for other pools
+       * while we have the mutex.
        */
+      struct slab_element_header *orphaned = NULL;
+
       simple_mtx_lock(&pool->parent->mutex);
+      if (pool->magazine)
+         orphaned = slab_flush_magazine_locked(pool);
       pool->free = pool->migrated;
       pool->migrated = NULL;
       simple_mtx_unlock(&pool->parent->mutex);
 
+      slab_free_orphaned_list(orphaned);
+
       /* Now allocate a new page. */
       if (!pool->free && !slab_add_new_page(pool))
          return NULL;
@@ -250,7 +328,8 @@ slab_zalloc(struct slab_child_pool *pool)
  *
  * Freeing an object in a different child pool from the one where it was
  * allocated is allowed, as long the pool belong to the same parent. No
- * additional locking is required in this case.
+ * additional locking is required in this case. The object goes back to its
+ * owner with the next batch of such frees from this pool.
  */
 void slab_free(struct slab_child_pool *pool, void *ptr)
 {
@@ -260,6 +339,8 @@ void slab_free(struct slab_child_pool *pool, void *ptr)
    CHECK_MAGIC(elt, SLAB_MAGIC_ALLOCATED);
    SET_MAGIC(elt, SLAB_MAGIC_FREE);
 
+   pool->stats.frees++;
+
    if (p_atomic_read(&elt->owner) == (intptr_t)pool) {
       /* This is the simple case: The caller guarantees that we can safely
        * access the free list.
@@ -269,12 +350,22 @@ void slab_free(struct slab_child_pool *pool, void *ptr)
       return;
    }
 
-   /* The slow case: migration or an orphaned page. */
-   if (pool->parent)
-      simple_mtx_lock(&pool->parent->mutex);
+   pool->stats.remote_frees++;
 
-   /* Note: we _must_ re-read elt->owner here because the owning child pool
-    * may have been destroyed by another thread in the meantime.
+   if (pool->parent) {
+      /* Migration or an orphaned page: both are handled when the magazine
+       * is flushed under the mutex.
+       */
+      elt->next = pool->magazine;
+      pool->magazine = elt;
+      if (++pool->num_magazine == SLAB_MAGAZINE_SIZE)
+         slab_flush_magazine(pool);
+      return;
+   }
+
+   /* The freeing pool was destroyed already, so there is no mutex to batch
+    * under.  Note: we _must_ re-read elt->owner here because the owning
+    * child pool may have been destroyed by another thread in the meantime.
     */
    owner_int = p_atomic_read(&elt->owner);
 
@@ -282,12 +373,7 @@ void slab_free(struct slab_child_pool *pool, void *ptr)
       struct slab_child_pool *owner = (struct slab_child_pool *)owner_int;
       elt->next = owner->migrated;
       owner->migrated = elt;
-      if (pool->parent)
-         simple_mtx_unlock(&pool->parent->mutex);
    } else {
-      if (pool->parent)
-         simple_mtx_unlock(&pool->parent->mutex);
-
       slab_free_orphaned(elt);
    }
 }
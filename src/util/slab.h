@@ -32,8 +32,10 @@
  *
  * Allocations obtained from one child pool should usually be freed in the
  * same child pool. Freeing an allocation in a different child pool associated
- * to the same parent is allowed (and requires no locking by the caller), but
- * it is discouraged because it implies a performance penalty.
+ * to the same parent is allowed (and requires no locking by the caller). Such
+ * remote frees are gathered in a small magazine in the freeing pool and
+ * returned to their owners in batches, so that a thread freeing what another
+ * one allocated only takes the parent mutex once per batch.
  *
  * For convenience and to ease the transition, there is also a set of wrapper
  * functions around a single parent-child pair.
@@ -42,6 +44,8 @@
 #ifndef SLAB_H
 #define SLAB_H
 
+#include <stdint.h>
+
 #include "simple_mtx.h"
 
 #ifdef __cplusplus
@@ -51,11 +55,25 @@ extern "C" {
 struct slab_element_header;
 struct slab_page_header;
 
+struct slab_stats {
+   /* Objects freed with a child pool as the argument of slab_free. */
+   uint64_t frees;
+
+   /* Those that were owned by a different child pool. */
+   uint64_t remote_frees;
+
+   /* Batches in which remote frees were returned to their owners. */
+   uint64_t remote_batches;
+};
+
 struct slab_parent_pool {
    simple_mtx_t mutex;
    unsigned element_size;
    unsigned num_elements;
    unsigned item_size;
+
+   /* Totals of the child pools destroyed so far, protected by the mutex. */
+   struct slab_stats stats;
 };
 
 struct slab_child_pool {
@@ -72,6 +90,15 @@ struct slab_child_pool {
     * This list is protected by the parent mutex.
     */
    struct slab_element_header *migrated;
+
+   /* Elements owned by other pools that were freed with this pool as the
+    * argument to slab_free, waiting to be moved to their owners' migrated
+    * lists in one batch.
+    */
+   struct slab_element_header *magazine;
+   unsigned num_magazine;
+
+   struct slab_stats stats;
 };
 
 void slab_create_parent(struct slab_parent_pool *parent,
@@ -30,6 +30,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <ftw.h>
+#include <dirent.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <inttypes.h>
@@ -37,9 +38,11 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "util/compress.h"
 #include "util/mesa-sha1.h"
 #include "util/disk_cache.h"
 #include "util/disk_cache_os.h"
+#include "util/mesa_cache_db_log.h"
 #include "util/ralloc.h"
 
 #ifdef ENABLE_SHADER_CACHE
@@ -546,6 +549,183 @@ test_put_and_get_between_instances(const char *driver_id)
    disk_cache_destroy(cache2);
 }
 
+static void
+test_put_and_get_lru_order(const char *driver_id)
+{
+   cache_key keys[3], big_key;
+   uint8_t data[3][64];
+   struct disk_cache *cache;
+   uint8_t *big;
+
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "1M", 1);
+   cache = disk_cache_create("test_lru_order", driver_id, 0);
+
+   /* The size of the cache also counts the eviction index, created by the
+    * first put.
+    */
+   uint64_t first_size = 0;
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++) {
+      memset(data[i], i + 1, sizeof(data[i]));
+      disk_cache_compute_key(cache, data[i], sizeof(data[i]), keys[i]);
+      disk_cache_put(cache, keys[i], data[i], sizeof(data[i]), NULL);
+
+      /* disk_cache_put() hands things off to a pool of threads, wait for
+       * each item so they're put in order.
+       */
+      disk_cache_wait_for_idle(cache);
+
+      if (i == 0)
+         first_size = p_atomic_read(&cache->size->value);
+   }
+
+   /* Loading the first item makes the second one the least recently used. */
+   EXPECT_TRUE(does_cache_contain(cache, keys[0]));
+
+   /* Add an item that only fits once exactly one of the small ones is
+    * evicted.
+    */
+   uint64_t size = p_atomic_read(&cache->size->value);
+   uint64_t item_size = (size - first_size) / (ARRAY_SIZE(keys) - 1);
+   size_t big_size = cache->max_size - size + item_size;
+   big = (uint8_t *) calloc(1, big_size);
+   disk_cache_compute_key(cache, big, big_size, big_key);
+   disk_cache_put(cache, big_key, big, big_size, NULL);
+   free(big);
+
+   disk_cache_wait_for_idle(cache);
+
+   EXPECT_TRUE(does_cache_contain(cache, keys[0]))
+      << "recently loaded item survives eviction";
+   EXPECT_FALSE(does_cache_contain(cache, keys[1]))
+      << "least recently used item is evicted";
+   EXPECT_TRUE(does_cache_contain(cache, keys[2]))
+      << "recently put item survives eviction";
+   EXPECT_TRUE(does_cache_contain(cache, big_key))
+      << "new item is added after eviction";
+
+   disk_cache_destroy(cache);
+}
+
+/* Puts more items than the smallest eviction index holds, and checks that
+ * the index grows, is counted in the cache size and still evicts the least
+ * recently used item.
+ */
+static void
+test_lru_index_grow(const char *driver_id)
+{
+   const unsigned num_items = 300;
+   cache_key *keys = (cache_key *) calloc(num_items, sizeof(cache_key));
+   cache_key big_key;
+   struct disk_cache *cache;
+   uint8_t *big;
+
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "4M", 1);
+   cache = disk_cache_create("test_lru_grow", driver_id, 0);
+
+   for (unsigned i = 0; i < num_items; i++) {
+      uint32_t data[16];
+      for (unsigned j = 0; j < ARRAY_SIZE(data); j++)
+         data[j] = i * ARRAY_SIZE(data) + j;
+      disk_cache_compute_key(cache, data, sizeof(data), keys[i]);
+      disk_cache_put(cache, keys[i], data, sizeof(data), NULL);
+      disk_cache_wait_for_idle(cache);
+   }
+
+   uint64_t items_size = 0;
+   for (unsigned i = 0; i < num_items; i++) {
+      struct stat sb;
+      char *filename = disk_cache_get_cache_filename(cache, keys[i]);
+      ASSERT_EQ(stat(filename, &sb), 0) << "cache item exists";
+      items_size += sb.st_blocks * 512;
+      free(filename);
+   }
+
+   struct stat sb;
+   char *index_path;
+   ASSERT_GT(asprintf(&index_path, "%s/lru_index", cache->path), 0);
+   ASSERT_EQ(stat(index_path, &sb), 0) << "eviction index exists";
+   free(index_path);
+
+   /* Each entry takes a heap entry and two slots, 48 bytes. */
+   EXPECT_GE(sb.st_size, num_items * 48) << "eviction index grew";
+   EXPECT_EQ(p_atomic_read(&cache->size->value), items_size + sb.st_size)
+      << "cache size counts the items and the eviction index";
+
+   /* Load the first item, and force exactly one eviction. */
+   EXPECT_TRUE(does_cache_contain(cache, keys[0]));
+
+   uint64_t size = p_atomic_read(&cache->size->value);
+   size_t big_size = cache->max_size - size + items_size / num_items;
+   big = (uint8_t *) calloc(1, big_size);
+   disk_cache_compute_key(cache, big, big_size, big_key);
+   disk_cache_put(cache, big_key, big, big_size, NULL);
+   free(big);
+
+   disk_cache_wait_for_idle(cache);
+
+   EXPECT_TRUE(does_cache_contain(cache, keys[0]))
+      << "recently loaded item survives eviction";
+   EXPECT_FALSE(does_cache_contain(cache, keys[1]))
+      << "least recently used item is evicted";
+   EXPECT_TRUE(does_cache_contain(cache, keys[num_items - 1]))
+      << "item tracked after the index grew survives eviction";
+
+   free(keys);
+   disk_cache_destroy(cache);
+}
+
+static void
+test_get_batch_and_async(const char *driver_id)
+{
+   struct disk_cache_get_request reqs[9], req;
+   uint8_t data[ARRAY_SIZE(reqs)][256];
+   struct disk_cache *cache;
+
+   cache = disk_cache_create("test_get_batch", driver_id, 0);
+
+   /* Put all items but the last one. */
+   for (unsigned i = 0; i < ARRAY_SIZE(reqs); i++) {
+      memset(data[i], i + 1, sizeof(data[i]));
+      disk_cache_compute_key(cache, data[i], sizeof(data[i]), reqs[i].key);
+      if (i != ARRAY_SIZE(reqs) - 1)
+         disk_cache_put(cache, reqs[i].key, data[i], sizeof(data[i]), NULL);
+   }
+
+   disk_cache_wait_for_idle(cache);
+
+   disk_cache_get_batch(cache, reqs, ARRAY_SIZE(reqs));
+
+   for (unsigned i = 0; i < ARRAY_SIZE(reqs) - 1; i++) {
+      ASSERT_NE(reqs[i].data, nullptr) << "disk_cache_get_batch of existing item";
+      EXPECT_EQ(reqs[i].size, sizeof(data[i])) << "disk_cache_get_batch of existing item (size)";
+      EXPECT_EQ(memcmp(reqs[i].data, data[i], sizeof(data[i])), 0)
+         << "disk_cache_get_batch of existing item (contents)";
+      free(reqs[i].data);
+   }
+   EXPECT_EQ(reqs[ARRAY_SIZE(reqs) - 1].data, nullptr)
+      << "disk_cache_get_batch of missing item";
+
+   memcpy(req.key, reqs[3].key, sizeof(cache_key));
+   disk_cache_get_async(cache, &req);
+   util_queue_fence_wait(&req.fence);
+   util_queue_fence_destroy(&req.fence);
+
+   ASSERT_NE(req.data, nullptr) << "disk_cache_get_async of existing item";
+   EXPECT_EQ(req.size, sizeof(data[3])) << "disk_cache_get_async of existing item (size)";
+   EXPECT_EQ(memcmp(req.data, data[3], sizeof(data[3])), 0)
+      << "disk_cache_get_async of existing item (contents)";
+   free(req.data);
+
+   memcpy(req.key, reqs[ARRAY_SIZE(reqs) - 1].key, sizeof(cache_key));
+   disk_cache_get_async(cache, &req);
+   util_queue_fence_wait(&req.fence);
+   util_queue_fence_destroy(&req.fence);
+
+   EXPECT_EQ(req.data, nullptr) << "disk_cache_get_async of missing item";
+
+   disk_cache_destroy(cache);
+}
+
 static void
 test_put_and_get_between_instances_with_eviction(const char *driver_id)
 {
@@ -675,6 +855,121 @@ test_put_and_get_between_instances_with_eviction(const char *driver_id)
    disk_cache_destroy(cache[0]);
    disk_cache_destroy(cache[1]);
 }
+#ifdef HAVE_ZSTD
+#define DICT_NUM_SAMPLES 256
+#define DICT_SAMPLE_SIZE 1024
+
+/* Fills a sample with words out of a small vocabulary, which makes for
+ * entries that share a lot of content but little within each entry, like
+ * the shaders of a driver.
+ */
+static void
+fill_dict_sample(char *sample, unsigned seed)
+{
+   static const char *const words[] = {
+      "vec4", "load_ubo", "fmul", "ffma", "iadd", "store_output", "ssa_",
+      "block", "loop", "if", "phi", "intrinsic", "deref_var", "shader_in",
+      "shader_out", "texture", "sampler", "uniform", "const", "bcsel",
+   };
+   unsigned pos = 0;
+
+   while (pos < DICT_SAMPLE_SIZE - 1) {
+      seed = seed * 1103515245u + 12345u;
+      const char *word = words[(seed >> 16) % ARRAY_SIZE(words)];
+      size_t len = MIN2(strlen(word), DICT_SAMPLE_SIZE - 1 - pos);
+      memcpy(sample + pos, word, len);
+      pos += len;
+      if (pos < DICT_SAMPLE_SIZE - 1)
+         sample[pos++] = '0' + (seed >> 8) % 10;
+   }
+   sample[pos] = '\0';
+}
+
+static off_t
+cache_item_size(struct disk_cache *cache, const cache_key key)
+{
+   char *filename = disk_cache_get_cache_filename(cache, key);
+   struct stat sb;
+
+   if (filename == NULL || stat(filename, &sb) != 0)
+      sb.st_size = 0;
+   free(filename);
+
+   return sb.st_size;
+}
+
+/* Entries written with a dictionary are smaller, entries written before it
+ * was trained stay readable, and instances without the dictionary miss
+ * the entries written with it.
+ */
+static void
+test_put_and_get_with_compress_dict(void *mem_ctx, const char *driver_id)
+{
+   char *samples = (char *) malloc(DICT_NUM_SAMPLES * DICT_SAMPLE_SIZE);
+   size_t sizes[DICT_NUM_SAMPLES];
+   for (unsigned i = 0; i < DICT_NUM_SAMPLES; i++) {
+      fill_dict_sample(samples + i * DICT_SAMPLE_SIZE, i);
+      sizes[i] = DICT_SAMPLE_SIZE;
+   }
+
+   /* Not one of the training samples. */
+   char blob[DICT_SAMPLE_SIZE];
+   fill_dict_sample(blob, DICT_NUM_SAMPLES);
+
+   uint8_t plain_key[20], dict_key[20];
+   char *result;
+   size_t size;
+
+   struct disk_cache *cache = disk_cache_create("test_compress_dict",
+                                                driver_id, 0);
+   EXPECT_EQ(cache->compress_dict, nullptr);
+
+   disk_cache_compute_key(cache, "plain", 5, plain_key);
+   disk_cache_put(cache, plain_key, blob, sizeof(blob), NULL);
+   disk_cache_wait_for_idle(cache);
+
+   char dict[8192];
+   size_t dict_size = util_compress_dict_train(dict, sizeof(dict), samples,
+                                               sizes, DICT_NUM_SAMPLES);
+   ASSERT_NE(dict_size, 0);
+
+   char *filename =
+      disk_cache_get_compress_dict_filename(mem_ctx, cache->path,
+                                            cache->driver_keys_blob,
+                                            cache->driver_keys_blob_size);
+   FILE *f = fopen(filename, "wb");
+   ASSERT_NE(f, nullptr);
+   EXPECT_EQ(fwrite(dict, 1, dict_size, f), dict_size);
+   fclose(f);
+
+   struct disk_cache *dict_cache = disk_cache_create("test_compress_dict",
+                                                     driver_id, 0);
+   EXPECT_NE(dict_cache->compress_dict, nullptr);
+
+   result = (char *) disk_cache_get(dict_cache, plain_key, &size);
+   EXPECT_STREQ(result, blob) << "entry written without the dictionary";
+   free(result);
+
+   disk_cache_compute_key(cache, "dict", 4, dict_key);
+   disk_cache_put(dict_cache, dict_key, blob, sizeof(blob), NULL);
+   disk_cache_wait_for_idle(dict_cache);
+
+   result = (char *) disk_cache_get(dict_cache, dict_key, &size);
+   EXPECT_STREQ(result, blob) << "entry written with the dictionary";
+   EXPECT_EQ(size, sizeof(blob));
+   free(result);
+
+   EXPECT_LT(cache_item_size(cache, dict_key),
+             cache_item_size(cache, plain_key));
+
+   result = (char *) disk_cache_get(cache, dict_key, &size);
+   EXPECT_EQ(result, nullptr) << "entry written with an unknown dictionary";
+
+   disk_cache_destroy(dict_cache);
+   disk_cache_destroy(cache);
+   free(samples);
+}
+#endif /* HAVE_ZSTD */
 #endif /* ENABLE_SHADER_CACHE */
 
 class Cache : public ::testing::Test {
@@ -713,6 +1008,21 @@ run_tests:
    int err = rmrf_local(CACHE_TEST_TMP);
    EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
 
+   test_put_and_get_lru_order(driver_id);
+
+   err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+
+   test_lru_index_grow(driver_id);
+
+   err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+
+   test_get_batch_and_async(driver_id);
+
+   err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+
    if (compress) {
       compress = false;
       goto run_tests;
@@ -720,6 +1030,20 @@ run_tests:
 #endif
 }
 
+TEST_F(Cache, CompressDict)
+{
+#if !defined(ENABLE_SHADER_CACHE) || !defined(HAVE_ZSTD)
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE or HAVE_ZSTD not defined.";
+#else
+   test_disk_cache_create(mem_ctx, CACHE_DIR_NAME, "make_check");
+
+   test_put_and_get_with_compress_dict(mem_ctx, "make_check");
+
+   int err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+#endif
+}
+
 TEST_F(Cache, SingleFile)
 {
    const char *driver_id;
@@ -1282,6 +1606,324 @@ TEST_F(Cache, DatabaseMultipartEviction)
 #endif
 }
 
+static unsigned
+count_log_segments(const char *path)
+{
+   struct dirent *dir_ent;
+   unsigned count = 0;
+   DIR *dir;
+
+   dir = opendir(path);
+   if (!dir)
+      return 0;
+
+   while ((dir_ent = readdir(dir)) != NULL) {
+      if (!strncmp(dir_ent->d_name, "seg_", 4))
+         count++;
+   }
+
+   closedir(dir);
+
+   return count;
+}
+
+static uint64_t
+log_segments_size(const char *path)
+{
+   struct dirent *dir_ent;
+   uint64_t size = 0;
+   struct stat sb;
+   DIR *dir;
+
+   dir = opendir(path);
+   if (!dir)
+      return 0;
+
+   while ((dir_ent = readdir(dir)) != NULL) {
+      if (strncmp(dir_ent->d_name, "seg_", 4) ||
+          fstatat(dirfd(dir), dir_ent->d_name, &sb, 0) == -1)
+         continue;
+
+      size += sb.st_size;
+   }
+
+   closedir(dir);
+
+   return size;
+}
+
+/* The generation in the header file, which tells the other processes that
+ * the log changed.  The header holds the sequence number first.
+ */
+static uint64_t
+log_generation(const char *path)
+{
+   uint64_t header[2] = {0};
+   char *header_path;
+
+   if (asprintf(&header_path, "%s/header", path) < 0)
+      return 0;
+
+   FILE *f = fopen(header_path, "rb");
+   free(header_path);
+   if (!f)
+      return 0;
+
+   if (fread(header, sizeof(header), 1, f) != 1)
+      header[1] = 0;
+   fclose(f);
+
+   return header[1];
+}
+
+static void
+test_log_compaction(void)
+{
+   const char *path = CACHE_TEST_TMP "/log";
+   struct mesa_cache_db_lock_stats stats;
+   struct mesa_cache_db_log db[2];
+   uint8_t keys[6][20], blob[1000];
+   unsigned int i, j;
+   size_t size;
+   void *result;
+
+   int err = mkdir(CACHE_TEST_TMP, 0755);
+   if (err != 0 && errno != EEXIST) {
+      fprintf(stderr, "Error creating %s: %s\n", CACHE_TEST_TMP, strerror(errno));
+      GTEST_FAIL();
+   }
+
+   /* Two instances behave like two processes, each of them writes its own
+    * segments.  The size limit makes every entry fill up a segment.
+    */
+   for (i = 0; i < ARRAY_SIZE(db); i++) {
+      ASSERT_TRUE(mesa_cache_db_log_open(&db[i], path));
+      mesa_cache_db_log_set_size_limit(&db[i], 16 * 1024);
+   }
+
+   for (i = 0; i < ARRAY_SIZE(keys); i++) {
+      memset(keys[i], i + 1, sizeof(keys[i]));
+      memset(blob, i + 1, sizeof(blob));
+      EXPECT_TRUE(mesa_cache_db_log_entry_write(&db[i % 2], keys[i],
+                                                blob, sizeof(blob)));
+   }
+
+   EXPECT_EQ(count_log_segments(path), ARRAY_SIZE(keys));
+
+   /* Every instance sees the entries of the other one. */
+   for (i = 0; i < ARRAY_SIZE(db); i++) {
+      for (j = 0; j < ARRAY_SIZE(keys); j++) {
+         result = mesa_cache_db_log_read_entry(&db[i], keys[j], &size);
+         EXPECT_NE(result, nullptr) << "read of entry written by any instance";
+         EXPECT_EQ(size, sizeof(blob));
+         EXPECT_EQ(((uint8_t *)result)[0], j + 1);
+         free(result);
+      }
+   }
+
+   EXPECT_TRUE(mesa_cache_db_log_entry_remove(&db[1], keys[5]));
+   result = mesa_cache_db_log_read_entry(&db[0], keys[5], &size);
+   EXPECT_EQ(result, nullptr) << "read of removed entry";
+
+   /* The second instance is still appending to the segment holding the
+    * removal, compaction folds all the others into one.
+    */
+   EXPECT_TRUE(mesa_cache_db_log_compact(&db[0]));
+   EXPECT_EQ(count_log_segments(path), 2);
+
+   for (i = 0; i < ARRAY_SIZE(db); i++) {
+      for (j = 0; j < ARRAY_SIZE(keys); j++) {
+         result = mesa_cache_db_log_read_entry(&db[i], keys[j], &size);
+         if (j == 5) {
+            EXPECT_EQ(result, nullptr) << "read of removed entry after compaction";
+         } else {
+            EXPECT_NE(result, nullptr) << "read of entry after compaction";
+            EXPECT_EQ(size, sizeof(blob));
+         }
+         free(result);
+      }
+   }
+
+   /* Exceeding the size limit evicts down to half of it, keeping the most
+    * recently used entries.  The last one read is the fifth.
+    */
+   mesa_cache_db_log_set_size_limit(&db[0], 4 * 1024);
+   EXPECT_TRUE(mesa_cache_db_log_compact(&db[0]));
+
+   for (j = 0; j < ARRAY_SIZE(keys); j++) {
+      result = mesa_cache_db_log_read_entry(&db[0], keys[j], &size);
+      if (j == 4)
+         EXPECT_NE(result, nullptr) << "read of most recently used entry after eviction";
+      else
+         EXPECT_EQ(result, nullptr) << "read of evicted entry";
+      free(result);
+   }
+
+   mesa_cache_db_log_get_lock_stats(&db[0], &stats);
+   EXPECT_EQ(stats.num_locks, 2);
+   EXPECT_EQ(stats.num_contended, 0);
+
+   for (i = 0; i < ARRAY_SIZE(db); i++)
+      mesa_cache_db_log_close(&db[i]);
+}
+
+static void
+test_log_access_order(void)
+{
+   const char *path = CACHE_TEST_TMP "/log_lru";
+   struct mesa_cache_db_log db;
+   uint8_t keys[3][20], blob[1000];
+   unsigned int i;
+   size_t size;
+   void *result;
+
+   ASSERT_TRUE(mesa_cache_db_log_open(&db, path));
+   mesa_cache_db_log_set_size_limit(&db, 16 * 1024);
+
+   for (i = 0; i < ARRAY_SIZE(keys); i++) {
+      memset(keys[i], i + 1, sizeof(keys[i]));
+      memset(blob, i + 1, sizeof(blob));
+      EXPECT_TRUE(mesa_cache_db_log_entry_write(&db, keys[i],
+                                                blob, sizeof(blob)));
+   }
+
+   /* Order by sequence numbers doesn't depend on the header file that
+    * hands them out, which starts over if it is lost.
+    */
+   EXPECT_TRUE(mesa_cache_db_log_entry_remove(&db, keys[1]));
+   mesa_cache_db_log_close(&db);
+
+   char *header_path;
+   ASSERT_GT(asprintf(&header_path, "%s/header", path), 0);
+   EXPECT_EQ(unlink(header_path), 0);
+   free(header_path);
+
+   ASSERT_TRUE(mesa_cache_db_log_open(&db, path));
+   mesa_cache_db_log_set_size_limit(&db, 16 * 1024);
+
+   result = mesa_cache_db_log_read_entry(&db, keys[1], &size);
+   EXPECT_EQ(result, nullptr) << "read of removed entry after reopening";
+
+   memset(blob, 2, sizeof(blob));
+   EXPECT_TRUE(mesa_cache_db_log_entry_write(&db, keys[1], blob, sizeof(blob)));
+   result = mesa_cache_db_log_read_entry(&db, keys[1], &size);
+   EXPECT_NE(result, nullptr) << "read of entry written again after its removal";
+   free(result);
+
+   /* Reading the first entry makes it the most recently used one, and the
+    * only one kept when evicting down to half of the size limit.
+    */
+   result = mesa_cache_db_log_read_entry(&db, keys[0], &size);
+   EXPECT_NE(result, nullptr);
+   free(result);
+
+   mesa_cache_db_log_set_size_limit(&db, 3 * 1024);
+   EXPECT_TRUE(mesa_cache_db_log_compact(&db));
+
+   for (i = 0; i < ARRAY_SIZE(keys); i++) {
+      result = mesa_cache_db_log_read_entry(&db, keys[i], &size);
+      if (i == 0)
+         EXPECT_NE(result, nullptr) << "read of most recently used entry after eviction";
+      else
+         EXPECT_EQ(result, nullptr) << "read of least recently used entry after eviction";
+      free(result);
+   }
+
+   mesa_cache_db_log_close(&db);
+}
+
+static void
+test_log_read_only(void)
+{
+   const char *path = CACHE_TEST_TMP "/log_reads";
+   const unsigned size_limit = 16 * 1024;
+   const unsigned num_reads = 20000;
+   struct mesa_cache_db_log db;
+   uint8_t keys[100][20], blob[10];
+   uint64_t generation;
+   unsigned int i;
+   size_t size;
+   void *result;
+
+   ASSERT_TRUE(mesa_cache_db_log_open(&db, path));
+   mesa_cache_db_log_set_size_limit(&db, size_limit);
+
+   for (i = 0; i < ARRAY_SIZE(keys); i++) {
+      /* Compaction, like the one of the regular Mesa-DB, misses entries
+       * whose keys start with the 64-bit values 0 and 1.  SHA-1 keys
+       * practically never do.
+       */
+      memset(keys[i], 0xff, sizeof(keys[i]));
+      memcpy(keys[i], &i, sizeof(i));
+      memset(blob, i, sizeof(blob));
+      EXPECT_TRUE(mesa_cache_db_log_entry_write(&db, keys[i],
+                                                blob, sizeof(blob)));
+   }
+
+   generation = log_generation(path);
+
+   /* Only reading records accesses, which must neither grow the log past
+    * the size limit nor make the other processes rescan it for every read.
+    */
+   for (i = 0; i < num_reads; i++) {
+      result = mesa_cache_db_log_read_entry(&db, keys[i % ARRAY_SIZE(keys)],
+                                            &size);
+      EXPECT_NE(result, nullptr) << "read of entry during read-only workload";
+      free(result);
+
+      if (i % 1000 == 999) {
+         EXPECT_LE(log_segments_size(path), 2 * size_limit)
+            << "log size after reads";
+      }
+   }
+
+   EXPECT_LT(log_generation(path) - generation, num_reads / 16);
+
+   for (i = 0; i < ARRAY_SIZE(keys); i++) {
+      result = mesa_cache_db_log_read_entry(&db, keys[i], &size);
+      EXPECT_NE(result, nullptr) << "read of entry after read-only workload";
+      EXPECT_EQ(size, sizeof(blob));
+      free(result);
+   }
+
+   mesa_cache_db_log_close(&db);
+}
+
+TEST_F(Cache, DatabaseLog)
+{
+   const char *driver_id = "make_check_uncompressed";
+
+#ifndef ENABLE_SHADER_CACHE
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE not defined.";
+#else
+   setenv("MESA_DISK_CACHE_DATABASE", "true", 1);
+   setenv("MESA_DISK_CACHE_DATABASE_LOG", "true", 1);
+
+   test_disk_cache_create(mem_ctx, CACHE_DIR_NAME_DB, driver_id);
+
+   test_put_and_get(false, driver_id);
+
+   test_put_key_and_get_key(driver_id);
+
+   test_put_and_get_between_instances(driver_id);
+
+   unsetenv("MESA_DISK_CACHE_DATABASE_LOG");
+   unsetenv("MESA_DISK_CACHE_DATABASE");
+
+   int err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+
+   test_log_compaction();
+
+   test_log_access_order();
+
+   test_log_read_only();
+
+   err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+#endif
+}
+
 static void
 test_put_and_get_disabled(const char *driver_id)
 {
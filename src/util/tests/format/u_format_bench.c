@@ -0,0 +1,134 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Throughput of the row pack/unpack functions of a few common formats, as
+ * picked for the CPU by util_format_(un)pack_description() and as generated
+ * for any CPU, in megapixels per second.
+ *
+ * Usage: u_format_bench [iterations]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/format/u_format.h"
+#include "util/os_time.h"
+
+#define WIDTH 1024
+#define HEIGHT 64
+
+static const enum pipe_format formats[] = {
+   PIPE_FORMAT_R8G8B8A8_UNORM,
+   PIPE_FORMAT_B8G8R8A8_UNORM,
+   PIPE_FORMAT_B8G8R8X8_UNORM,
+   PIPE_FORMAT_A8R8G8B8_UNORM,
+   PIPE_FORMAT_B5G6R5_UNORM,
+};
+
+static float rgba_float[HEIGHT][WIDTH][4];
+static uint8_t rgba_8unorm[HEIGHT][WIDTH][4];
+static uint8_t packed[HEIGHT][WIDTH * 16];
+
+enum op {
+   UNPACK_RGBA_8UNORM,
+   UNPACK_RGBA_FLOAT,
+   PACK_RGBA_8UNORM,
+   PACK_RGBA_FLOAT,
+   NUM_OPS,
+};
+
+static const char *op_names[NUM_OPS] = {
+   "unpack_8unorm",
+   "unpack_float",
+   "pack_8unorm",
+   "pack_float",
+};
+
+/* Returns the megapixels per second of an operation, or 0 if the format
+ * doesn't have it.
+ */
+static double
+run(const struct util_format_pack_description *pack,
+    const struct util_format_unpack_description *unpack,
+    enum op op, unsigned iterations)
+{
+   if ((op == UNPACK_RGBA_8UNORM && !unpack->unpack_rgba_8unorm) ||
+       (op == UNPACK_RGBA_FLOAT && !unpack->unpack_rgba) ||
+       (op == PACK_RGBA_8UNORM && !pack->pack_rgba_8unorm) ||
+       (op == PACK_RGBA_FLOAT && !pack->pack_rgba_float))
+      return 0;
+
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < iterations; i++) {
+      switch (op) {
+      case UNPACK_RGBA_8UNORM:
+         for (unsigned y = 0; y < HEIGHT; y++)
+            unpack->unpack_rgba_8unorm(rgba_8unorm[y][0], packed[y], WIDTH);
+         break;
+      case UNPACK_RGBA_FLOAT:
+         for (unsigned y = 0; y < HEIGHT; y++)
+            unpack->unpack_rgba(rgba_float[y], packed[y], WIDTH);
+         break;
+      case PACK_RGBA_8UNORM:
+         pack->pack_rgba_8unorm(packed[0], sizeof(packed[0]),
+                                rgba_8unorm[0][0], sizeof(rgba_8unorm[0]),
+                                WIDTH, HEIGHT);
+         break;
+      case PACK_RGBA_FLOAT:
+         pack->pack_rgba_float(packed[0], sizeof(packed[0]),
+                               rgba_float[0][0], sizeof(rgba_float[0]),
+                               WIDTH, HEIGHT);
+         break;
+      default:
+         unreachable("bad op");
+      }
+   }
+
+   int64_t ns = os_time_get_nano() - start;
+
+   return (double)WIDTH * HEIGHT * iterations * 1e3 / ns;
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned iterations = argc > 1 ? atoi(argv[1]) : 200;
+
+   for (unsigned y = 0; y < HEIGHT; y++) {
+      for (unsigned x = 0; x < WIDTH; x++) {
+         for (unsigned c = 0; c < 4; c++) {
+            rgba_8unorm[y][x][c] = (x * 7 + y * 13 + c * 61) & 0xff;
+            rgba_float[y][x][c] = rgba_8unorm[y][x][c] / 255.0f;
+         }
+      }
+   }
+   memset(packed, 0x5a, sizeof(packed));
+
+   printf("%-24s %-14s %10s %10s %8s\n", "format", "operation",
+          "generic", "selected", "speedup");
+
+   for (unsigned f = 0; f < ARRAY_SIZE(formats); f++) {
+      enum pipe_format format = formats[f];
+
+      for (enum op op = 0; op < NUM_OPS; op++) {
+         double generic = run(util_format_pack_description_generic(format),
+                              util_format_unpack_description_generic(format),
+                              op, iterations);
+         double selected = run(util_format_pack_description(format),
+                               util_format_unpack_description(format),
+                               op, iterations);
+         if (!generic)
+            continue;
+
+         printf("%-24s %-14s %10.1f %10.1f %7.2fx\n",
+                util_format_short_name(format), op_names[op],
+                generic, selected, selected / generic);
+      }
+   }
+
+   return 0;
+}
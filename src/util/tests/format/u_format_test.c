@@ -778,6 +778,132 @@ test_format_metadata(const struct util_format_description *format_desc,
    return success;
 }
 
+/* Pixels per row in test_format_rows(), enough to go through the vector
+ * loops of the optimized functions as well as their scalar tails.
+ */
+#define ROW_WIDTH 67
+
+/*
+ * Checks that the pack and unpack functions picked for the CPU give the same
+ * results as the generic ones on whole rows, made of the test cases of the
+ * format, values around the float to unorm rounding points and random data.
+ */
+static bool
+test_format_rows(const struct util_format_description *format_desc)
+{
+   const struct util_format_pack_description *pack =
+      util_format_pack_description(format_desc->format);
+   const struct util_format_unpack_description *unpack =
+      util_format_unpack_description(format_desc->format);
+   const struct util_format_pack_description *pack_generic =
+      util_format_pack_description_generic(format_desc->format);
+   const struct util_format_unpack_description *unpack_generic =
+      util_format_unpack_description_generic(format_desc->format);
+   static const float edges[] = {
+      -1.0f, -0.0f, 0.0f, FLT_MIN, 0.5f / 255.0f, 1.0f / 255.0f, 0.5f,
+      127.5f / 255.0f, 254.5f / 255.0f, 1.0f - FLT_EPSILON, 1.0f, 2.0f,
+      NAN, INFINITY, -INFINITY,
+   };
+   const unsigned bytes = format_desc->block.bits / 8;
+   float rgba_float[2][ROW_WIDTH][4], unpacked_float[2][ROW_WIDTH][4];
+   uint8_t rgba_8unorm[2][ROW_WIDTH][4], unpacked_8unorm[2][ROW_WIDTH][4];
+   uint8_t src[2][ROW_WIDTH * UTIL_FORMAT_MAX_PACKED_BYTES];
+   uint8_t packed[2][2][ROW_WIDTH * UTIL_FORMAT_MAX_PACKED_BYTES];
+   const struct util_format_test_case *tests[ROW_WIDTH];
+   unsigned num_tests = 0;
+   uint32_t seed = 1;
+   bool success = true;
+
+   if (format_desc->block.width != 1 || format_desc->block.height != 1 ||
+       format_desc->block.bits % 8 != 0)
+      return true;
+
+   if (pack->pack_rgba_float == pack_generic->pack_rgba_float &&
+       pack->pack_rgba_8unorm == pack_generic->pack_rgba_8unorm &&
+       unpack->unpack_rgba == unpack_generic->unpack_rgba &&
+       unpack->unpack_rgba_8unorm == unpack_generic->unpack_rgba_8unorm)
+      return true;
+
+   printf("Testing util_format_%s rows ...\n", format_desc->short_name);
+   fflush(stdout);
+
+   for (unsigned i = 0; i < util_format_nr_test_cases; ++i) {
+      if (util_format_test_cases[i].format == format_desc->format &&
+          num_tests < ROW_WIDTH)
+         tests[num_tests++] = &util_format_test_cases[i];
+   }
+
+   for (unsigned row = 0; row < 2; ++row) {
+      for (unsigned x = 0; x < ROW_WIDTH; ++x) {
+         /* One pixel in every (num_tests + 1) is random. */
+         unsigned t = (x + row) % (num_tests + 1);
+
+         for (unsigned c = 0; c < 4; ++c) {
+            seed = seed * 1103515245 + 12345;
+            rgba_8unorm[row][x][c] = seed >> 24;
+
+            if (t < num_tests)
+               rgba_float[row][x][c] = (float) tests[t]->unpacked[0][0][c];
+            else if (seed & 0x100)
+               rgba_float[row][x][c] = edges[(seed >> 9) % ARRAY_SIZE(edges)];
+            else
+               rgba_float[row][x][c] = (seed >> 8) / (float) (1 << 24);
+         }
+
+         for (unsigned b = 0; b < bytes; ++b) {
+            seed = seed * 1103515245 + 12345;
+            src[row][x * bytes + b] = t < num_tests ? tests[t]->packed[b] : seed >> 24;
+         }
+      }
+   }
+
+#  define CHECK(func, results) \
+   if (memcmp(results[0], results[1], sizeof(results[0])) != 0) { \
+      printf("FAILED: %s differs from the generic function\n", #func); \
+      success = false; \
+   }
+
+   for (unsigned i = 0; i < 2; ++i) {
+      const struct util_format_unpack_description *u = i ? unpack_generic : unpack;
+
+      memset(unpacked_float[i], 0, sizeof(unpacked_float[i]));
+      memset(unpacked_8unorm[i], 0, sizeof(unpacked_8unorm[i]));
+      if (u->unpack_rgba)
+         u->unpack_rgba(unpacked_float[i], src[0], ROW_WIDTH);
+      if (u->unpack_rgba_8unorm)
+         u->unpack_rgba_8unorm(unpacked_8unorm[i][0], src[0], ROW_WIDTH);
+   }
+   CHECK(unpack_rgba, unpacked_float);
+   CHECK(unpack_rgba_8unorm, unpacked_8unorm);
+
+   /* The pack functions take two rows, to check the strides too. */
+   for (unsigned i = 0; i < 2; ++i) {
+      const struct util_format_pack_description *p = i ? pack_generic : pack;
+
+      memset(packed[i], 0, sizeof(packed[i]));
+      if (p->pack_rgba_float)
+         p->pack_rgba_float(packed[i][0], sizeof(packed[i][0]),
+                            rgba_float[0][0], sizeof(rgba_float[0]),
+                            ROW_WIDTH, 2);
+   }
+   CHECK(pack_rgba_float, packed);
+
+   for (unsigned i = 0; i < 2; ++i) {
+      const struct util_format_pack_description *p = i ? pack_generic : pack;
+
+      memset(packed[i], 0, sizeof(packed[i]));
+      if (p->pack_rgba_8unorm)
+         p->pack_rgba_8unorm(packed[i][0], sizeof(packed[i][0]),
+                             rgba_8unorm[0][0], sizeof(rgba_8unorm[0]),
+                             ROW_WIDTH, 2);
+   }
+   CHECK(pack_rgba_8unorm, packed);
+
+#  undef CHECK
+
+   return success;
+}
+
 static bool
 test_all(void)
 {
@@ -857,6 +983,9 @@ test_all(void)
 
       TEST_FORMAT_METADATA(norm_flags);
 
+      if (!test_format_rows(format_desc))
+         success = false;
+
 #     undef TEST_ONE_FUNC
 #     undef TEST_ONE_FORMAT
    }
@@ -0,0 +1,230 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Microbenchmarks for the hash table and set.
+ *
+ * Each case runs over tables of growing sizes and reports the time per
+ * operation.  The keys are heap pointers hashed with _mesa_hash_pointer(),
+ * like the NIR instruction and variable tables, and strings, like the GLSL
+ * symbol tables.
+ *
+ * Usage: hash_table_bench [iterations]
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/hash_table.h"
+#include "util/os_time.h"
+#include "util/ralloc.h"
+#include "util/set.h"
+
+static const unsigned sizes[] = { 8, 64, 1024, 16384, 262144 };
+
+static unsigned iterations = 1;
+
+static void
+report(const char *name, unsigned size, int64_t start, unsigned ops)
+{
+   double ns = (double)(os_time_get_nano() - start) / ops;
+   printf("%-28s %8u %10.2f ns/op\n", name, size, ns);
+}
+
+static void **
+create_pointer_keys(void *mem_ctx, unsigned count)
+{
+   void **keys = ralloc_array(mem_ctx, void *, count);
+
+   /* Spread the keys over the heap like instructions would be. */
+   for (unsigned i = 0; i < count; i++)
+      keys[i] = ralloc_size(mem_ctx, 48);
+
+   return keys;
+}
+
+static char **
+create_string_keys(void *mem_ctx, unsigned count)
+{
+   char **keys = ralloc_array(mem_ctx, char *, count);
+
+   for (unsigned i = 0; i < count; i++)
+      keys[i] = ralloc_asprintf(mem_ctx, "gl_variable_%u_%x", i, i * 2654435761u);
+
+   return keys;
+}
+
+static void
+bench_hash_table_pointers(unsigned size)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   void **keys = create_pointer_keys(mem_ctx, 2 * size);
+   unsigned ops = size * iterations;
+   int64_t start;
+
+   start = os_time_get_nano();
+   for (unsigned it = 0; it < iterations; it++) {
+      struct hash_table *ht = _mesa_pointer_hash_table_create(NULL);
+      for (unsigned i = 0; i < size; i++)
+         _mesa_hash_table_insert(ht, keys[i], keys[i]);
+      _mesa_hash_table_destroy(ht, NULL);
+   }
+   report("hash_table insert", size, start, ops);
+
+   struct hash_table *ht = _mesa_pointer_hash_table_create(mem_ctx);
+   for (unsigned i = 0; i < size; i++)
+      _mesa_hash_table_insert(ht, keys[i], keys[i]);
+
+   start = os_time_get_nano();
+   for (unsigned it = 0; it < iterations; it++) {
+      for (unsigned i = 0; i < size; i++) {
+         ASSERTED struct hash_entry *entry = _mesa_hash_table_search(ht, keys[i]);
+         assert(entry && entry->data == keys[i]);
+      }
+   }
+   report("hash_table search hit", size, start, ops);
+
+   start = os_time_get_nano();
+   for (unsigned it = 0; it < iterations; it++) {
+      for (unsigned i = size; i < 2 * size; i++) {
+         ASSERTED struct hash_entry *entry = _mesa_hash_table_search(ht, keys[i]);
+         assert(entry == NULL);
+      }
+   }
+   report("hash_table search miss", size, start, ops);
+
+   start = os_time_get_nano();
+   for (unsigned it = 0; it < iterations; it++) {
+      unsigned count = 0;
+      hash_table_foreach(ht, entry)
+         count++;
+      assert(count == size);
+   }
+   report("hash_table iterate", size, start, ops);
+
+   /* Remove and re-add half of the entries, which leaves deleted slots
+    * behind for the probes to skip.
+    */
+   start = os_time_get_nano();
+   for (unsigned it = 0; it < iterations; it++) {
+      for (unsigned i = 0; i < size; i += 2)
+         _mesa_hash_table_remove_key(ht, keys[i]);
+      for (unsigned i = 0; i < size; i += 2)
+         _mesa_hash_table_insert(ht, keys[i], keys[i]);
+   }
+   report("hash_table remove+insert", size, start, ops);
+
+   ralloc_free(mem_ctx);
+}
+
+static void
+bench_hash_table_strings(unsigned size)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   char **keys = create_string_keys(mem_ctx, 2 * size);
+   unsigned ops = size * iterations;
+   int64_t start;
+
+   struct hash_table *ht = _mesa_hash_table_create(mem_ctx, _mesa_hash_string,
+                                                   _mesa_key_string_equal);
+   for (unsigned i = 0; i < size; i++)
+      _mesa_hash_table_insert(ht, keys[i], keys[i]);
+
+   start = os_time_get_nano();
+   for (unsigned it = 0; it < iterations; it++) {
+      for (unsigned i = 0; i < size; i++) {
+         ASSERTED struct hash_entry *entry = _mesa_hash_table_search(ht, keys[i]);
+         assert(entry && entry->data == keys[i]);
+      }
+   }
+   report("hash_table string hit", size, start, ops);
+
+   start = os_time_get_nano();
+   for (unsigned it = 0; it < iterations; it++) {
+      for (unsigned i = size; i < 2 * size; i++) {
+         ASSERTED struct hash_entry *entry = _mesa_hash_table_search(ht, keys[i]);
+         assert(entry == NULL);
+      }
+   }
+   report("hash_table string miss", size, start, ops);
+
+   ralloc_free(mem_ctx);
+}
+
+static void
+bench_set_pointers(unsigned size)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   void **keys = create_pointer_keys(mem_ctx, 2 * size);
+   unsigned ops = size * iterations;
+   int64_t start;
+
+   start = os_time_get_nano();
+   for (unsigned it = 0; it < iterations; it++) {
+      struct set *set = _mesa_pointer_set_create(NULL);
+      for (unsigned i = 0; i < size; i++)
+         _mesa_set_add(set, keys[i]);
+      _mesa_set_destroy(set, NULL);
+   }
+   report("set add", size, start, ops);
+
+   struct set *set = _mesa_pointer_set_create(mem_ctx);
+   for (unsigned i = 0; i < size; i++)
+      _mesa_set_add(set, keys[i]);
+
+   start = os_time_get_nano();
+   for (unsigned it = 0; it < iterations; it++) {
+      for (unsigned i = 0; i < 2 * size; i++) {
+         ASSERTED struct set_entry *entry = _mesa_set_search(set, keys[i]);
+         assert((entry != NULL) == (i < size));
+      }
+   }
+   report("set search hit+miss", size, start, 2 * ops);
+
+   start = os_time_get_nano();
+   for (unsigned it = 0; it < iterations; it++) {
+      for (unsigned i = 0; i < size; i++) {
+         bool found;
+         _mesa_set_search_or_add(set, keys[i], &found);
+         assert(found);
+      }
+   }
+   report("set search_or_add", size, start, ops);
+
+   /* Empty the set the way the zink batch states do, then refill it. */
+   start = os_time_get_nano();
+   for (unsigned it = 0; it < iterations; it++) {
+      set_foreach_remove(set, entry) {
+      }
+      for (unsigned i = 0; i < size; i++)
+         _mesa_set_add(set, keys[i]);
+   }
+   report("set foreach_remove+add", size, start, ops);
+
+   ralloc_free(mem_ctx);
+}
+
+int
+main(int argc, char **argv)
+{
+   if (argc > 1)
+      iterations = MAX2(atoi(argv[1]), 1);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(sizes); i++) {
+      /* Keep the total work per size about the same. */
+      unsigned size = sizes[i];
+      unsigned saved_iterations = iterations;
+      iterations *= MAX2(262144 / size / 16, 1);
+
+      bench_hash_table_pointers(size);
+      bench_hash_table_strings(size);
+      bench_set_pointers(size);
+
+      iterations = saved_iterations;
+   }
+
+   return 0;
+}
@@ -103,6 +103,32 @@ int main()
    assert(!ht->entries);
    assert(!ht->deleted_entries);
 
+   /* Breaking out of hash_table_foreach_remove() leaves exactly the entries
+    * not removed yet.
+    */
+   for (i = 0; i < SIZE; ++i) {
+      flags[i] = false;
+      _mesa_hash_table_insert(ht, make_key(i), &flags[i]);
+   }
+   uint32_t removed = 0;
+   hash_table_foreach_remove(ht, entry) {
+      if (removed == SIZE / 2)
+         break;
+      *(bool *)entry->data = true;
+      removed++;
+   }
+   assert(ht->entries == SIZE - removed);
+   for (i = 0; i < SIZE; ++i) {
+      struct hash_entry *entry = _mesa_hash_table_search(ht, make_key(i));
+      assert(!entry == flags[i]);
+      assert(!entry || entry->data == &flags[i]);
+   }
+   hash_table_foreach_remove(ht, entry) {
+      assert(!*(bool *)entry->data);
+   }
+   assert(!ht->entries);
+   assert(!ht->deleted_entries);
+
    _mesa_hash_table_destroy(ht, NULL);
 
    return 0;
@@ -279,3 +279,66 @@ TEST_F(ra_test, serialization_roundtrip)
    blob_finish(&blob);
 }
 
+
+/* Builds an interval graph large enough to switch to sparse adjacency while
+ * nodes are added, and checks that it is colored like a dense one would be.
+ */
+TEST_F(ra_test, sparse_adjacency)
+{
+   const unsigned num_nodes = 10000, window = 8;
+   struct ra_regs *regs = ra_alloc_reg_set(mem_ctx, 16, false);
+   struct ra_class *c = ra_alloc_reg_class(regs);
+   for (unsigned i = 0; i < 16; i++)
+      ra_class_add_reg(c, i);
+   ra_set_finalize(regs, NULL);
+
+   struct ra_graph *g = ra_alloc_interference_graph(regs, 64);
+   for (unsigned i = 0; i < 64; i++)
+      ra_set_node_class(g, i, c);
+
+   unsigned num_edges = 0;
+   for (unsigned i = 0; i < num_nodes; i++) {
+      if (i >= 64)
+         ra_add_node(g, c);
+
+      for (unsigned j = i >= window ? i - window + 1 : 0; j < i; j++) {
+         ra_add_node_interference(g, i, j);
+         /* Duplicates are ignored. */
+         ra_add_node_interference(g, j, i);
+         num_edges++;
+      }
+   }
+
+   struct ra_graph_stats stats;
+   ra_get_graph_stats(g, &stats);
+   EXPECT_TRUE(stats.sparse);
+   EXPECT_EQ(stats.nodes, num_nodes);
+   EXPECT_EQ(stats.edges, num_edges);
+   EXPECT_GE(stats.peak_memory, stats.memory);
+   /* Far below the 16MB the bitmatrix would take for the 16k allocated
+    * nodes.
+    */
+   EXPECT_LT(stats.peak_memory, 4u * 1024 * 1024);
+
+   /* Resetting a node drops its edges in both directions. */
+   ra_reset_node_interference(g, 100);
+   ra_get_graph_stats(g, &stats);
+   EXPECT_EQ(stats.edges, num_edges - 2 * (window - 1));
+   for (unsigned j = 100 - window + 1; j < 100 + window; j++) {
+      if (j != 100)
+         ra_add_node_interference(g, 100, j);
+   }
+   ra_get_graph_stats(g, &stats);
+   EXPECT_EQ(stats.edges, num_edges);
+
+   ASSERT_TRUE(ra_allocate(g));
+   ra_get_graph_stats(g, &stats);
+   EXPECT_EQ(stats.allocate_calls, 1);
+
+   for (unsigned i = 0; i < num_nodes; i++) {
+      for (unsigned j = i + 1; j < MIN2(i + window, num_nodes); j++)
+         ASSERT_NE(ra_get_node_reg(g, i), ra_get_node_reg(g, j));
+   }
+
+   ralloc_free(g);
+}
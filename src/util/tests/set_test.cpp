@@ -64,10 +64,13 @@ TEST(set, basic)
    unsigned count = s->entries;
    set_foreach_remove(s, he) {
       EXPECT_TRUE(he->key == a || he->key == b);
-      EXPECT_EQ(s->entries, count--);
-      EXPECT_EQ(s->deleted_entries, 0);
+      /* Every iteration removes its entry before moving to the next one. */
+      EXPECT_EQ(s->entries, count);
+      EXPECT_EQ(s->deleted_entries, 2 - count);
+      count--;
    }
    EXPECT_EQ(s->entries, 0);
+   EXPECT_EQ(s->deleted_entries, 0);
    set_foreach(s, he) {
       GTEST_FAIL();
    }
@@ -171,3 +174,61 @@ TEST(set, search_or_add)
 
    _mesa_set_destroy(s, NULL);
 }
+
+TEST(set, reuse_after_remove)
+{
+   struct set *s = _mesa_set_create(NULL, hash_int, cmp_int);
+   int keys[100];
+
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++)
+      keys[i] = i;
+
+   /* Fill the set through several groups of slots, with a deleted entry in
+    * front of every other one.
+    */
+   for (unsigned round = 0; round < 3; round++) {
+      for (unsigned i = 0; i < ARRAY_SIZE(keys); i++)
+         _mesa_set_add(s, &keys[i]);
+      EXPECT_EQ(s->entries, ARRAY_SIZE(keys));
+
+      for (unsigned i = 0; i < ARRAY_SIZE(keys); i += 2)
+         _mesa_set_remove_key(s, &keys[i]);
+      EXPECT_EQ(s->entries, ARRAY_SIZE(keys) / 2);
+
+      for (unsigned i = 0; i < ARRAY_SIZE(keys); i++)
+         EXPECT_EQ(_mesa_set_search(s, &keys[i]) != NULL, (i & 1) != 0);
+
+      _mesa_set_clear(s, NULL);
+   }
+
+   /* set_foreach_remove() must leave a set that can be refilled. */
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++)
+      _mesa_set_add(s, &keys[i]);
+   set_foreach_remove(s, entry) {
+   }
+   EXPECT_EQ(s->entries, 0);
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++)
+      EXPECT_FALSE(_mesa_set_search(s, &keys[i]));
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++)
+      _mesa_set_add(s, &keys[i]);
+   EXPECT_EQ(s->entries, ARRAY_SIZE(keys));
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++)
+      EXPECT_TRUE(_mesa_set_search(s, &keys[i]));
+
+   /* Breaking out of set_foreach_remove() leaves exactly the entries not
+    * removed yet.
+    */
+   bool removed[ARRAY_SIZE(keys)] = { false };
+   unsigned num_removed = 0;
+   set_foreach_remove(s, entry) {
+      if (num_removed == ARRAY_SIZE(keys) / 2)
+         break;
+      removed[(const int *)entry->key - keys] = true;
+      num_removed++;
+   }
+   EXPECT_EQ(s->entries, ARRAY_SIZE(keys) - num_removed);
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++)
+      EXPECT_EQ(_mesa_set_search(s, &keys[i]) == NULL, removed[i]);
+
+   _mesa_set_destroy(s, NULL);
+}
@@ -0,0 +1,127 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Microbenchmarks for the slab allocator.
+ *
+ * "local" allocates and frees objects in the same child pool.  "remote" has
+ * one thread allocating objects from its pool and handing them to another
+ * thread which frees them in its own pool, the way threaded contexts free
+ * transfers on the driver thread, and reports how often the frees were
+ * remote and how many batches returned them.
+ *
+ * Usage: slab_bench [operations]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c11/threads.h"
+#include "util/os_time.h"
+#include "util/slab.h"
+#include "util/u_atomic.h"
+
+#define RING_SIZE 1024
+#define BATCH 16
+
+struct bench {
+   struct slab_parent_pool parent;
+   struct slab_child_pool producer, consumer;
+   unsigned ops;
+
+   /* Single-producer, single-consumer ring of objects to free. */
+   void *ring[RING_SIZE];
+   unsigned head, tail;
+};
+
+static int
+consumer_thread(void *data)
+{
+   struct bench *b = data;
+
+   for (unsigned done = 0; done < b->ops;) {
+      unsigned head = p_atomic_read(&b->head);
+      unsigned tail = b->tail;
+      if (head == tail) {
+         thrd_yield();
+         continue;
+      }
+
+      for (; tail != head; tail++, done++)
+         slab_free(&b->consumer, b->ring[tail % RING_SIZE]);
+      p_atomic_set(&b->tail, tail);
+   }
+
+   return 0;
+}
+
+static void
+run_remote(struct bench *b)
+{
+   thrd_t consumer;
+
+   int64_t start = os_time_get_nano();
+   thrd_create(&consumer, consumer_thread, b);
+
+   for (unsigned i = 0; i < b->ops; i += BATCH) {
+      unsigned head = b->head;
+      while (head + BATCH - p_atomic_read(&b->tail) > RING_SIZE)
+         thrd_yield();
+
+      for (unsigned j = 0; j < BATCH; j++) {
+         /* Touch the objects like a user would. */
+         uint32_t *obj = slab_alloc(&b->producer);
+         obj[0] = i + j;
+         b->ring[(head + j) % RING_SIZE] = obj;
+      }
+      p_atomic_set(&b->head, head + BATCH);
+   }
+
+   thrd_join(consumer, NULL);
+   int64_t ns = os_time_get_nano() - start;
+
+   printf("remote %10.1f ns/op, %" PRIu64 " of %" PRIu64 " frees remote "
+          "in %" PRIu64 " batches\n", (double)ns / b->ops,
+          b->consumer.stats.remote_frees, b->consumer.stats.frees,
+          b->consumer.stats.remote_batches);
+}
+
+static void
+run_local(struct bench *b)
+{
+   void *objects[BATCH];
+
+   int64_t start = os_time_get_nano();
+   for (unsigned i = 0; i < b->ops; i += BATCH) {
+      for (unsigned j = 0; j < BATCH; j++)
+         objects[j] = slab_alloc(&b->producer);
+      for (unsigned j = 0; j < BATCH; j++)
+         slab_free(&b->producer, objects[j]);
+   }
+   int64_t ns = os_time_get_nano() - start;
+
+   printf("local  %10.1f ns/op\n", (double)ns / b->ops);
+}
+
+int
+main(int argc, char **argv)
+{
+   struct bench *b = calloc(1, sizeof(*b));
+   b->ops = argc > 1 ? atoi(argv[1]) : 10000000;
+   b->ops = b->ops / BATCH * BATCH;
+
+   slab_create_parent(&b->parent, 64, 64);
+   slab_create_child(&b->producer, &b->parent);
+   slab_create_child(&b->consumer, &b->parent);
+
+   run_local(b);
+   run_remote(b);
+
+   slab_destroy_child(&b->consumer);
+   slab_destroy_child(&b->producer);
+   slab_destroy_parent(&b->parent);
+   free(b);
+
+   return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <gtest/gtest.h>
+
+#include <set>
+
+#include "util/slab.h"
+
+#define NUM_OBJECTS 1000
+/* Objects fill their pages exactly. */
+#define OBJECTS_PER_PAGE 40
+
+TEST(slab, remote_frees_return_to_owner)
+{
+   struct slab_parent_pool parent;
+   struct slab_child_pool owner, other;
+
+   slab_create_parent(&parent, 32, OBJECTS_PER_PAGE);
+   slab_create_child(&owner, &parent);
+   slab_create_child(&other, &parent);
+
+   std::set<void *> allocated;
+   void *objects[NUM_OBJECTS];
+   for (unsigned i = 0; i < NUM_OBJECTS; i++) {
+      objects[i] = slab_alloc(&owner);
+      allocated.insert(objects[i]);
+   }
+
+   for (unsigned i = 0; i < NUM_OBJECTS; i++)
+      slab_free(&other, objects[i]);
+
+   EXPECT_EQ(other.stats.frees, NUM_OBJECTS);
+   EXPECT_EQ(other.stats.remote_frees, NUM_OBJECTS);
+   /* Only full magazines were returned so far. */
+   EXPECT_EQ(other.stats.remote_batches, NUM_OBJECTS / 64);
+
+   /* Allocating from the other pool returns the rest. */
+   void *p = slab_alloc(&other);
+   EXPECT_EQ(other.stats.remote_batches, NUM_OBJECTS / 64 + 1);
+   slab_free(&other, p);
+
+   /* The owner reuses all of its objects without new pages. */
+   for (unsigned i = 0; i < NUM_OBJECTS; i++) {
+      objects[i] = slab_alloc(&owner);
+      EXPECT_EQ(allocated.count(objects[i]), 1);
+   }
+   for (unsigned i = 0; i < NUM_OBJECTS; i++)
+      slab_free(&owner, objects[i]);
+   EXPECT_EQ(owner.stats.remote_frees, 0);
+
+   slab_destroy_child(&other);
+   slab_destroy_child(&owner);
+
+   EXPECT_EQ(parent.stats.frees, 2 * NUM_OBJECTS + 1);
+   EXPECT_EQ(parent.stats.remote_frees, NUM_OBJECTS);
+   slab_destroy_parent(&parent);
+}
+
+TEST(slab, remote_frees_of_destroyed_owner)
+{
+   struct slab_parent_pool parent;
+   struct slab_child_pool owner, other;
+
+   slab_create_parent(&parent, 32, OBJECTS_PER_PAGE);
+   slab_create_child(&owner, &parent);
+   slab_create_child(&other, &parent);
+
+   void *objects[NUM_OBJECTS];
+   for (unsigned i = 0; i < NUM_OBJECTS; i++)
+      objects[i] = slab_alloc(&owner);
+
+   /* Some objects are in the magazine when the owner goes away, the rest
+    * are freed after, and the pages are freed once all of them are.
+    */
+   for (unsigned i = 0; i < NUM_OBJECTS / 2 + 10; i++)
+      slab_free(&other, objects[i]);
+   slab_destroy_child(&owner);
+   for (unsigned i = NUM_OBJECTS / 2 + 10; i < NUM_OBJECTS; i++)
+      slab_free(&other, objects[i]);
+
+   EXPECT_EQ(other.stats.remote_frees, NUM_OBJECTS);
+
+   slab_destroy_child(&other);
+   slab_destroy_parent(&parent);
+}
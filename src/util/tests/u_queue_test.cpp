@@ -0,0 +1,238 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <gtest/gtest.h>
+
+#include "c11/threads.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_queue.h"
+
+struct order_job {
+   struct util_queue_fence fence;
+   unsigned id;
+   unsigned *order;
+   unsigned *num_done;
+};
+
+static void
+record_execute(void *data, void *gdata, int thread_index)
+{
+   struct order_job *job = (struct order_job *)data;
+   job->order[p_atomic_inc_return(job->num_done) - 1] = job->id;
+}
+
+static void
+gate_execute(void *data, void *gdata, int thread_index)
+{
+   util_queue_fence_wait((struct util_queue_fence *)data);
+}
+
+TEST(u_queue, priorities)
+{
+   struct util_queue queue;
+   ASSERT_TRUE(util_queue_init(&queue, "test", 16, 1, 0, NULL));
+
+   /* Hold the thread until all jobs are queued. */
+   struct util_queue_fence gate, gate_done;
+   util_queue_fence_init(&gate);
+   util_queue_fence_reset(&gate);
+   util_queue_fence_init(&gate_done);
+   util_queue_add_job(&queue, &gate, &gate_done, gate_execute, NULL, 0);
+
+   static const enum util_queue_priority priorities[] = {
+      UTIL_QUEUE_PRIORITY_LOW, UTIL_QUEUE_PRIORITY_NORMAL,
+      UTIL_QUEUE_PRIORITY_HIGH, UTIL_QUEUE_PRIORITY_LOW,
+      UTIL_QUEUE_PRIORITY_HIGH, UTIL_QUEUE_PRIORITY_NORMAL,
+   };
+   struct order_job jobs[ARRAY_SIZE(priorities)];
+   unsigned order[ARRAY_SIZE(priorities)];
+   unsigned num_done = 0;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(jobs); i++) {
+      jobs[i].id = i;
+      jobs[i].order = order;
+      jobs[i].num_done = &num_done;
+      util_queue_fence_init(&jobs[i].fence);
+      util_queue_add_job_with_priority(&queue, &jobs[i], &jobs[i].fence,
+                                       record_execute, NULL, 0, priorities[i],
+                                       UTIL_QUEUE_NO_THREAD_HINT);
+   }
+
+   util_queue_fence_signal(&gate);
+   util_queue_finish(&queue);
+
+   /* By priority, then in the order they were added. */
+   static const unsigned expected[] = { 2, 4, 1, 5, 0, 3 };
+   ASSERT_EQ(num_done, ARRAY_SIZE(expected));
+   for (unsigned i = 0; i < ARRAY_SIZE(expected); i++)
+      EXPECT_EQ(order[i], expected[i]);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(jobs); i++)
+      util_queue_fence_destroy(&jobs[i].fence);
+   util_queue_fence_destroy(&gate_done);
+   util_queue_fence_destroy(&gate);
+   util_queue_destroy(&queue);
+}
+
+static void
+count_cleanup(void *data, void *gdata, int thread_index)
+{
+   struct order_job *job = (struct order_job *)data;
+   p_atomic_inc(job->num_done);
+}
+
+TEST(u_queue, drop_job)
+{
+   struct util_queue queue;
+   ASSERT_TRUE(util_queue_init(&queue, "test", 16, 1, 0, NULL));
+
+   struct util_queue_fence gate, gate_done;
+   util_queue_fence_init(&gate);
+   util_queue_fence_reset(&gate);
+   util_queue_fence_init(&gate_done);
+   util_queue_add_job(&queue, &gate, &gate_done, gate_execute, NULL, 0);
+
+   unsigned order[1];
+   unsigned num_done = 0;
+   struct order_job job;
+   job.id = 0;
+   job.order = order;
+   job.num_done = &num_done;
+   util_queue_fence_init(&job.fence);
+   util_queue_add_job(&queue, &job, &job.fence, record_execute,
+                      count_cleanup, 0);
+
+   /* The job is removed without running, and only cleaned up. */
+   util_queue_drop_job(&queue, &job.fence);
+   EXPECT_TRUE(util_queue_fence_is_signalled(&job.fence));
+   EXPECT_EQ(num_done, 1);
+
+   util_queue_fence_signal(&gate);
+   util_queue_finish(&queue);
+   EXPECT_EQ(num_done, 1);
+
+   util_queue_fence_destroy(&job.fence);
+   util_queue_fence_destroy(&gate_done);
+   util_queue_fence_destroy(&gate);
+   util_queue_destroy(&queue);
+}
+
+#define NUM_PARENTS 64
+#define NUM_CHILDREN 8
+
+struct spawn_state {
+   struct util_queue queue;
+   unsigned num_done;
+   unsigned bad_hints;
+};
+
+static void
+child_execute(void *data, void *gdata, int thread_index)
+{
+   struct spawn_state *state = (struct spawn_state *)data;
+   p_atomic_inc(&state->num_done);
+}
+
+static void
+parent_execute(void *data, void *gdata, int thread_index)
+{
+   struct spawn_state *state = (struct spawn_state *)data;
+
+   if (thread_index >= (int)state->queue.max_threads)
+      p_atomic_inc(&state->bad_hints);
+
+   /* Jobs added by jobs go to the lanes of the current thread, and other
+    * threads steal them.
+    */
+   for (unsigned i = 0; i < NUM_CHILDREN; i++) {
+      util_queue_add_job_with_priority(&state->queue, state, NULL,
+                                       child_execute, NULL, 0,
+                                       UTIL_QUEUE_PRIORITY_NORMAL,
+                                       UTIL_QUEUE_NO_THREAD_HINT);
+   }
+   p_atomic_inc(&state->num_done);
+}
+
+/* util_queue_finish waits for the jobs added before it, including the ones
+ * those jobs add, on all threads.
+ */
+TEST(u_queue, finish_with_stealing)
+{
+   struct spawn_state *state = (struct spawn_state *)calloc(1, sizeof(*state));
+   ASSERT_TRUE(util_queue_init(&state->queue, "test", 8, 4,
+                               UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL));
+
+   for (unsigned i = 0; i < NUM_PARENTS; i++) {
+      util_queue_add_job_with_priority(&state->queue, state, NULL,
+                                       parent_execute, NULL, 0,
+                                       UTIL_QUEUE_PRIORITY_NORMAL, i);
+   }
+
+   util_queue_finish(&state->queue);
+   EXPECT_EQ(state->num_done, NUM_PARENTS * (NUM_CHILDREN + 1));
+   EXPECT_EQ(state->bad_hints, 0);
+
+   util_queue_destroy(&state->queue);
+   free(state);
+}
+
+#define NUM_BEFORE_FINISH 32
+
+struct producer_state {
+   struct util_queue queue;
+   unsigned num_before_done;
+   bool stop;
+};
+
+static void
+sleep_execute(void *data, void *gdata, int thread_index)
+{
+   os_time_sleep(500);
+}
+
+static void
+before_execute(void *data, void *gdata, int thread_index)
+{
+   struct producer_state *state = (struct producer_state *)data;
+
+   os_time_sleep(500);
+   p_atomic_inc(&state->num_before_done);
+}
+
+static int
+producer_thread(void *data)
+{
+   struct producer_state *state = (struct producer_state *)data;
+
+   while (!p_atomic_read(&state->stop))
+      util_queue_add_job(&state->queue, state, NULL, sleep_execute, NULL, 0);
+   return 0;
+}
+
+/* util_queue_finish returns once the jobs added before it are done, even
+ * while another thread keeps the queue full.
+ */
+TEST(u_queue, finish_with_concurrent_producer)
+{
+   struct producer_state *state =
+      (struct producer_state *)calloc(1, sizeof(*state));
+   ASSERT_TRUE(util_queue_init(&state->queue, "test", 8, 2, 0, NULL));
+
+   thrd_t producer;
+   ASSERT_EQ(thrd_create(&producer, producer_thread, state), thrd_success);
+
+   for (unsigned i = 0; i < NUM_BEFORE_FINISH; i++)
+      util_queue_add_job(&state->queue, state, NULL, before_execute, NULL, 0);
+
+   util_queue_finish(&state->queue);
+   EXPECT_EQ(p_atomic_read(&state->num_before_done), NUM_BEFORE_FINISH);
+
+   p_atomic_set(&state->stop, true);
+   thrd_join(producer, NULL);
+
+   util_queue_finish(&state->queue);
+   util_queue_destroy(&state->queue);
+   free(state);
+}
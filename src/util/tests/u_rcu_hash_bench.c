@@ -0,0 +1,202 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Contention benchmark for shader cache lookups.
+ *
+ * Threads look up and reference objects in a shared cache, the way pipeline
+ * compilation threads hit the live shader and pipeline caches.  It compares
+ * a hash table behind a simple_mtx, which is what the caches used, with
+ * util_rcu_hash read-side sections.  Every 256th operation of each thread
+ * removes and re-adds an object, which synchronizes the table.
+ *
+ * Usage: rcu_hash_bench [max threads] [operations per thread]
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c11/threads.h"
+#include "util/hash_table.h"
+#include "util/os_time.h"
+#include "util/simple_mtx.h"
+#include "util/u_atomic.h"
+#include "util/u_rcu_hash.h"
+
+#define NUM_OBJECTS 4096
+
+struct object {
+   uint32_t key[5];
+   int32_t ref_cnt;
+};
+
+struct bench {
+   bool rcu;
+   bool writes;
+   unsigned ops;
+
+   simple_mtx_t lock;
+   struct hash_table *ht;
+   struct util_rcu_hash *rcu_ht;
+
+   struct object objects[NUM_OBJECTS];
+};
+
+static uint32_t
+key_hash(const void *key)
+{
+   return *(const uint32_t *)key;
+}
+
+static bool
+key_equals(const void *a, const void *b)
+{
+   return memcmp(a, b, sizeof(((struct object *)0)->key)) == 0;
+}
+
+static bool
+try_ref(struct object *obj)
+{
+   int32_t count = p_atomic_read(&obj->ref_cnt);
+   while (count != 0) {
+      int32_t old = p_atomic_cmpxchg(&obj->ref_cnt, count, count + 1);
+      if (old == count)
+         return true;
+      count = old;
+   }
+   return false;
+}
+
+static struct object *
+lookup(struct bench *b, const struct object *key)
+{
+   uint32_t hash = key_hash(key->key);
+   struct object *obj = NULL;
+
+   if (b->rcu) {
+      unsigned token = util_rcu_hash_read_lock(b->rcu_ht);
+      struct util_rcu_hash_entry *entry =
+         util_rcu_hash_search(b->rcu_ht, hash, key->key);
+      if (entry && try_ref(entry->data))
+         obj = entry->data;
+      util_rcu_hash_read_unlock(b->rcu_ht, token);
+   } else {
+      simple_mtx_lock(&b->lock);
+      struct hash_entry *entry =
+         _mesa_hash_table_search_pre_hashed(b->ht, hash, key->key);
+      if (entry) {
+         obj = entry->data;
+         p_atomic_inc(&obj->ref_cnt);
+      }
+      simple_mtx_unlock(&b->lock);
+   }
+
+   return obj;
+}
+
+static void
+readd(struct bench *b, struct object *obj)
+{
+   uint32_t hash = key_hash(obj->key);
+
+   simple_mtx_lock(&b->lock);
+   if (b->rcu) {
+      util_rcu_hash_remove(b->rcu_ht, hash, obj->key);
+      simple_mtx_unlock(&b->lock);
+      util_rcu_hash_synchronize(b->rcu_ht);
+      simple_mtx_lock(&b->lock);
+      util_rcu_hash_insert(b->rcu_ht, hash, obj->key, obj);
+   } else {
+      _mesa_hash_table_remove_key(b->ht, obj->key);
+      _mesa_hash_table_insert_pre_hashed(b->ht, hash, obj->key, obj);
+   }
+   simple_mtx_unlock(&b->lock);
+}
+
+static int
+thread_func(void *data)
+{
+   struct bench *b = data;
+   uint32_t seed = (uint32_t)(uintptr_t)&seed;
+
+   for (unsigned i = 0; i < b->ops; i++) {
+      seed = seed * 1664525u + 1013904223u;
+      struct object *obj = &b->objects[seed % NUM_OBJECTS];
+
+      if (b->writes && i % 256 == 255) {
+         readd(b, obj);
+         continue;
+      }
+
+      struct object *found = lookup(b, obj);
+      if (found)
+         p_atomic_dec(&found->ref_cnt);
+   }
+
+   return 0;
+}
+
+static void
+run(struct bench *b, unsigned num_threads)
+{
+   thrd_t threads[64];
+
+   int64_t start = os_time_get_nano();
+   for (unsigned i = 0; i < num_threads; i++)
+      thrd_create(&threads[i], thread_func, b);
+   for (unsigned i = 0; i < num_threads; i++)
+      thrd_join(threads[i], NULL);
+   int64_t ns = os_time_get_nano() - start;
+
+   printf("%-10s %-12s %2u threads %10.2f ns/op %10.2f Mops/s\n",
+          b->rcu ? "rcu_hash" : "mtx+table",
+          b->writes ? "1/256 writes" : "reads",
+          num_threads, (double)ns / b->ops,
+          (double)b->ops * num_threads / ns * 1000.0);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned max_threads = argc > 1 ? MIN2(atoi(argv[1]), 64) : 8;
+   struct bench *b = calloc(1, sizeof(*b));
+
+   b->ops = argc > 2 ? atoi(argv[2]) : 1000000;
+   simple_mtx_init(&b->lock, mtx_plain);
+   b->ht = _mesa_hash_table_create(NULL, key_hash, key_equals);
+   b->rcu_ht = util_rcu_hash_create(key_equals);
+
+   for (unsigned i = 0; i < NUM_OBJECTS; i++) {
+      struct object *obj = &b->objects[i];
+      for (unsigned j = 0; j < ARRAY_SIZE(obj->key); j++)
+         obj->key[j] = (i + j) * 2654435761u;
+      obj->ref_cnt = 1;
+
+      _mesa_hash_table_insert(b->ht, obj->key, obj);
+      util_rcu_hash_insert(b->rcu_ht, key_hash(obj->key), obj->key, obj);
+   }
+
+   for (unsigned writes = 0; writes < 2; writes++) {
+      for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+         b->writes = writes;
+
+         b->rcu = false;
+         run(b, threads);
+         b->rcu = true;
+         run(b, threads);
+      }
+   }
+
+   for (unsigned i = 0; i < NUM_OBJECTS; i++)
+      assert(b->objects[i].ref_cnt == 1);
+
+   util_rcu_hash_destroy(b->rcu_ht, NULL);
+   _mesa_hash_table_destroy(b->ht, NULL);
+   simple_mtx_destroy(&b->lock);
+   free(b);
+
+   return 0;
+}
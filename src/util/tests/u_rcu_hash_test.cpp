@@ -0,0 +1,149 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <gtest/gtest.h>
+
+#include "c11/threads.h"
+#include "util/u_atomic.h"
+#include "util/u_rcu_hash.h"
+
+struct object {
+   uint32_t key;
+   uint32_t alive;
+};
+
+static bool
+key_equals(const void *a, const void *b)
+{
+   return *(const uint32_t *)a == *(const uint32_t *)b;
+}
+
+static uint32_t
+key_hash(uint32_t key)
+{
+   /* Collide a few keys to exercise the chains. */
+   return key & ~3u;
+}
+
+TEST(rcu_hash, insert_search_remove)
+{
+   struct util_rcu_hash *ht = util_rcu_hash_create(key_equals);
+   static struct object objects[1000];
+
+   for (uint32_t i = 0; i < ARRAY_SIZE(objects); i++) {
+      objects[i].key = i;
+      EXPECT_TRUE(util_rcu_hash_insert(ht, key_hash(i), &objects[i].key,
+                                       &objects[i]));
+   }
+   EXPECT_EQ(ht->entries, ARRAY_SIZE(objects));
+
+   unsigned token = util_rcu_hash_read_lock(ht);
+   for (uint32_t i = 0; i < ARRAY_SIZE(objects); i++) {
+      struct util_rcu_hash_entry *entry =
+         util_rcu_hash_search(ht, key_hash(i), &i);
+      ASSERT_TRUE(entry != NULL);
+      EXPECT_EQ(entry->data, &objects[i]);
+   }
+   uint32_t missing = ARRAY_SIZE(objects);
+   EXPECT_EQ(util_rcu_hash_search(ht, key_hash(missing), &missing), nullptr);
+   util_rcu_hash_read_unlock(ht, token);
+
+   /* Replacing keeps the count. */
+   uint32_t key = 5;
+   EXPECT_TRUE(util_rcu_hash_insert(ht, key_hash(key), &key, &objects[0]));
+   EXPECT_EQ(ht->entries, ARRAY_SIZE(objects));
+   EXPECT_EQ(util_rcu_hash_search(ht, key_hash(key), &key)->data, &objects[0]);
+
+   for (uint32_t i = 0; i < ARRAY_SIZE(objects); i += 2)
+      EXPECT_TRUE(util_rcu_hash_remove(ht, key_hash(i), &i));
+   EXPECT_FALSE(util_rcu_hash_remove(ht, key_hash(0), &objects[0].key));
+   EXPECT_EQ(ht->entries, ARRAY_SIZE(objects) / 2);
+
+   util_rcu_hash_synchronize(ht);
+
+   unsigned count = 0;
+   util_rcu_hash_foreach(ht, entry) {
+      EXPECT_EQ(*(const uint32_t *)entry->key % 2, 1);
+      count++;
+   }
+   EXPECT_EQ(count, ARRAY_SIZE(objects) / 2);
+
+   util_rcu_hash_destroy(ht, NULL);
+}
+
+#define NUM_KEYS 256
+#define NUM_READERS 4
+
+struct stress {
+   struct util_rcu_hash *ht;
+   struct object objects[NUM_KEYS];
+   uint32_t done;
+   uint32_t failures;
+};
+
+static int
+reader_thread(void *data)
+{
+   struct stress *s = (struct stress *)data;
+
+   for (uint32_t i = 0; !p_atomic_read(&s->done); i = (i + 1) % NUM_KEYS) {
+      unsigned token = util_rcu_hash_read_lock(s->ht);
+      struct util_rcu_hash_entry *entry =
+         util_rcu_hash_search(s->ht, key_hash(i), &i);
+      if (entry) {
+         struct object *obj = (struct object *)entry->data;
+         if (obj->key != i || !p_atomic_read(&obj->alive))
+            p_atomic_inc(&s->failures);
+      }
+      util_rcu_hash_read_unlock(s->ht, token);
+   }
+
+   return 0;
+}
+
+/* Readers must never find an object that the writer already considers freed,
+ * while the writer grows the table and removes and re-adds entries.
+ */
+TEST(rcu_hash, concurrent_readers)
+{
+   struct stress *s = (struct stress *)calloc(1, sizeof(*s));
+   s->ht = util_rcu_hash_create(key_equals);
+
+   thrd_t readers[NUM_READERS];
+   for (unsigned i = 0; i < NUM_READERS; i++)
+      ASSERT_EQ(thrd_create(&readers[i], reader_thread, s), thrd_success);
+
+   for (uint32_t i = 0; i < NUM_KEYS; i++) {
+      s->objects[i].key = i;
+      s->objects[i].alive = 1;
+      util_rcu_hash_insert(s->ht, key_hash(i), &s->objects[i].key,
+                           &s->objects[i]);
+   }
+
+   for (unsigned round = 0; round < 50; round++) {
+      for (uint32_t i = round % 3; i < NUM_KEYS; i += 3)
+         util_rcu_hash_remove(s->ht, key_hash(i), &i);
+
+      util_rcu_hash_synchronize(s->ht);
+
+      for (uint32_t i = round % 3; i < NUM_KEYS; i += 3)
+         p_atomic_set(&s->objects[i].alive, 0);
+      thrd_yield();
+      for (uint32_t i = round % 3; i < NUM_KEYS; i += 3) {
+         p_atomic_set(&s->objects[i].alive, 1);
+         util_rcu_hash_insert(s->ht, key_hash(i), &s->objects[i].key,
+                              &s->objects[i]);
+      }
+   }
+
+   p_atomic_set(&s->done, 1);
+   for (unsigned i = 0; i < NUM_READERS; i++)
+      thrd_join(readers[i], NULL);
+
+   EXPECT_EQ(s->failures, 0);
+   EXPECT_EQ(s->ht->entries, NUM_KEYS);
+
+   util_rcu_hash_destroy(s->ht, NULL);
+   free(s);
+}
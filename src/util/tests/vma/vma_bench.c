@@ -0,0 +1,78 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Allocation stress benchmark for util_vma_heap.
+ *
+ * Fragments a heap into a given number of small holes, the way drivers with
+ * many suballocated or sparse BOs do, then measures allocating and freeing
+ * blocks that fit the holes and blocks that only fit past all of them, from
+ * both ends of the heap.
+ *
+ * util_vma_heap validates itself on every call in builds with assertions,
+ * so time it in a release build.
+ *
+ * Usage: vma_bench [max holes] [operations]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/os_time.h"
+#include "util/u_math.h"
+#include "util/vma.h"
+
+#define PAGE_SIZE 4096
+
+static void
+run(unsigned num_holes, unsigned ops, bool alloc_high, uint64_t size)
+{
+   struct util_vma_heap heap;
+   uint64_t heap_size = (uint64_t)(num_holes * 2 + 1024) * PAGE_SIZE * 64;
+   util_vma_heap_init(&heap, PAGE_SIZE, heap_size);
+   heap.alloc_high = alloc_high;
+
+   /* Leave a one page hole every two pages from the top or the bottom, and
+    * the rest of the heap free at the other end.
+    */
+   uint64_t *blocks = malloc(num_holes * 2 * sizeof(*blocks));
+   for (unsigned i = 0; i < num_holes * 2; i++)
+      blocks[i] = util_vma_heap_alloc(&heap, PAGE_SIZE, PAGE_SIZE);
+   for (unsigned i = 0; i < num_holes * 2; i += 2)
+      util_vma_heap_free(&heap, blocks[i], PAGE_SIZE);
+
+   int64_t start = os_time_get_nano();
+   for (unsigned i = 0; i < ops; i++) {
+      uint64_t addr = util_vma_heap_alloc(&heap, size, PAGE_SIZE);
+      if (addr == 0)
+         abort();
+      util_vma_heap_free(&heap, addr, size);
+   }
+   int64_t ns = os_time_get_nano() - start;
+
+   printf("%-5s %7u holes %8" PRIu64 " KiB blocks %10.1f ns/op\n",
+          alloc_high ? "high" : "low", num_holes, size / 1024,
+          (double)ns / ops);
+
+   for (unsigned i = 1; i < num_holes * 2; i += 2)
+      util_vma_heap_free(&heap, blocks[i], PAGE_SIZE);
+   free(blocks);
+   util_vma_heap_finish(&heap);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned max_holes = argc > 1 ? atoi(argv[1]) : 100000;
+   unsigned ops = argc > 2 ? atoi(argv[2]) : 100000;
+
+   for (unsigned alloc_high = 0; alloc_high < 2; alloc_high++) {
+      for (unsigned holes = 1000; holes <= max_holes; holes *= 10) {
+         run(holes, ops, alloc_high, PAGE_SIZE);
+         run(holes, ops, alloc_high, 16 * PAGE_SIZE);
+      }
+   }
+
+   return 0;
+}
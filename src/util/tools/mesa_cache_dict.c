@@ -0,0 +1,473 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Trains zstd dictionaries for the entries of a shader cache, and reports
+ * how much smaller they would make them.
+ *
+ * It walks a cache directory, reading the entries of the multi-file cache,
+ * the single-file (fossilize) cache and the database cache alike, and groups
+ * them by cache directory and driver keys, which is what a dictionary is
+ * specific to.  Dictionaries are trained on half of the entries of a group
+ * and measured on the other half, so the savings don't count what the
+ * dictionary learned from the very entries it compresses.
+ *
+ * With --write, a dictionary trained on all entries is written to the cache
+ * directory, where disk_cache picks it up for the entries it writes from then
+ * on.  Entries compressed with a previous dictionary of the same group are
+ * treated as misses from then on, and recreated.
+ *
+ * Usage: mesa-cache-dict [--write] [--size BYTES] CACHE_DIR
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util/compress.h"
+#include "util/crc32.h"
+#include "util/disk_cache.h"
+#include "util/disk_cache_os.h"
+#include "util/fossilize_db.h"
+#include "util/macros.h"
+#include "util/ralloc.h"
+#include "util/u_dynarray.h"
+
+#define DEFAULT_DICT_SIZE (64 * 1024)
+
+/* Fewer samples don't make for a useful dictionary, zstd wants a few times
+ * more bytes of samples than the size of the dictionary.
+ */
+#define MIN_SAMPLES 16
+
+/* See mesa_cache_db.c. */
+#define MESA_CACHE_DB_HEADER_SIZE (8 + 4 + 8)
+#define MESA_CACHE_DB_ENTRY_HEADER_SIZE (CACHE_KEY_SIZE + 4 + 4)
+
+/* See fossilize_db.c. */
+#define FOZ_MAGIC_SIZE 16
+
+struct group {
+   char *dir;
+   uint8_t *keys;
+   size_t keys_size;
+   const char *driver_id;
+   const char *gpu_name;
+
+   struct util_compress_dict *dict;
+
+   unsigned num_entries;
+   size_t stored_size;
+
+   /* The uncompressed entries, back to back. */
+   struct util_dynarray samples;
+   struct util_dynarray sample_sizes;
+};
+
+static void *mem_ctx;
+static struct util_dynarray groups;
+static unsigned num_skipped;
+
+static struct group *
+get_group(const char *dir, const uint8_t *keys, size_t keys_size)
+{
+   util_dynarray_foreach(&groups, struct group, g) {
+      if (g->keys_size == keys_size && memcmp(g->keys, keys, keys_size) == 0 &&
+          strcmp(g->dir, dir) == 0)
+         return g;
+   }
+
+   struct group *g = util_dynarray_grow(&groups, struct group, 1);
+   memset(g, 0, sizeof(*g));
+   g->dir = ralloc_strdup(mem_ctx, dir);
+   g->keys = ralloc_size(mem_ctx, keys_size);
+   memcpy(g->keys, keys, keys_size);
+   g->keys_size = keys_size;
+   g->driver_id = (const char *)g->keys + 1;
+   g->gpu_name = g->driver_id + strlen(g->driver_id) + 1;
+   util_dynarray_init(&g->samples, mem_ctx);
+   util_dynarray_init(&g->sample_sizes, mem_ctx);
+
+   /* Entries may already be compressed with a dictionary. */
+   char *filename =
+      disk_cache_get_compress_dict_filename(mem_ctx, dir, keys, keys_size);
+   int fd = open(filename, O_RDONLY | O_CLOEXEC);
+   if (fd != -1) {
+      struct stat sb;
+      if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+         void *data = malloc(sb.st_size);
+         if (data && read(fd, data, sb.st_size) == sb.st_size)
+            g->dict = util_compress_dict_create(data, sb.st_size);
+         free(data);
+      }
+      close(fd);
+   }
+
+   return g;
+}
+
+/* Returns the size of the driver keys at the start of a cache item, which
+ * are the cache version, the driver and GPU names, the pointer size and the
+ * driver flags, see disk_cache_type_create().
+ */
+static size_t
+driver_keys_size(const uint8_t *item, size_t size)
+{
+   size_t offset = 1;
+
+   for (unsigned i = 0; i < 2; i++) {
+      if (offset >= size)
+         return 0;
+      const uint8_t *end = memchr(item + offset, 0, size - offset);
+      if (end == NULL)
+         return 0;
+      offset = end - item + 1;
+   }
+
+   offset += 1 + sizeof(uint64_t);
+   return offset <= size ? offset : 0;
+}
+
+/* Parses a cache item the way parse_and_validate_cache_item() does. */
+static void
+add_cache_item(const char *dir, const uint8_t *item, size_t size)
+{
+   size_t keys_size = driver_keys_size(item, size);
+   if (keys_size == 0)
+      goto skip;
+
+   /* blob_write_uint32() aligns the metadata. */
+   size_t offset = ALIGN_POT(keys_size, sizeof(uint32_t));
+   uint32_t md_type, num_keys;
+   if (offset + sizeof(md_type) > size)
+      goto skip;
+   memcpy(&md_type, item + offset, sizeof(md_type));
+   offset += sizeof(md_type);
+
+   if (md_type == CACHE_ITEM_TYPE_GLSL) {
+      if (offset + sizeof(num_keys) > size)
+         goto skip;
+      memcpy(&num_keys, item + offset, sizeof(num_keys));
+      offset += sizeof(num_keys) + (size_t)num_keys * CACHE_KEY_SIZE;
+   }
+
+   struct cache_entry_file_data cf_data;
+   if (offset + sizeof(cf_data) > size)
+      goto skip;
+   memcpy(&cf_data, item + offset, sizeof(cf_data));
+   offset += sizeof(cf_data);
+
+   const uint8_t *data = item + offset;
+   size_t data_size = size - offset;
+   if (cf_data.crc32 != util_hash_crc32(data, data_size))
+      goto skip;
+
+   struct group *g = get_group(dir, item, keys_size);
+   uint8_t *sample = util_dynarray_grow(&g->samples, uint8_t,
+                                        cf_data.uncompressed_size);
+   if (sample == NULL)
+      goto skip;
+
+   if (!util_compress_inflate_with_dict(g->dict, data, data_size, sample,
+                                        cf_data.uncompressed_size)) {
+      g->samples.size -= cf_data.uncompressed_size;
+      goto skip;
+   }
+
+   util_dynarray_append(&g->sample_sizes, size_t, cf_data.uncompressed_size);
+   g->stored_size += data_size;
+   g->num_entries++;
+   return;
+
+ skip:
+   num_skipped++;
+}
+
+static void
+read_foz_db(const char *dir, const uint8_t *file, size_t size)
+{
+   size_t offset = FOZ_MAGIC_SIZE;
+
+   while (offset + FOSSILIZE_BLOB_HASH_LENGTH +
+          sizeof(struct foz_payload_header) <= size) {
+      struct foz_payload_header header;
+      memcpy(&header, file + offset + FOSSILIZE_BLOB_HASH_LENGTH,
+             sizeof(header));
+      offset += FOSSILIZE_BLOB_HASH_LENGTH + sizeof(header);
+
+      if (header.payload_size > size - offset)
+         break;
+
+      add_cache_item(dir, file + offset, header.payload_size);
+      offset += header.payload_size;
+   }
+}
+
+static void
+read_mesa_cache_db(const char *dir, const uint8_t *file, size_t size)
+{
+   size_t offset = MESA_CACHE_DB_HEADER_SIZE;
+
+   while (offset + MESA_CACHE_DB_ENTRY_HEADER_SIZE <= size) {
+      uint32_t entry_size;
+      memcpy(&entry_size, file + offset + CACHE_KEY_SIZE + 4,
+             sizeof(entry_size));
+      offset += MESA_CACHE_DB_ENTRY_HEADER_SIZE;
+
+      if (entry_size > size - offset)
+         break;
+
+      add_cache_item(dir, file + offset, entry_size);
+      offset += entry_size;
+   }
+}
+
+static int
+visit_file(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+   if (type != FTW_F || sb->st_size == 0)
+      return 0;
+
+   const char *name = path + ftw->base;
+   if (strncmp(name, "zstd_dict_", 10) == 0 || strcmp(name, "index") == 0 ||
+       strcmp(name, "lru_index") == 0 || strstr(name, "_idx.foz") ||
+       strstr(name, ".idx"))
+      return 0;
+
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return 0;
+
+   uint8_t *file = malloc(sb->st_size);
+   if (file == NULL || read(fd, file, sb->st_size) != sb->st_size) {
+      free(file);
+      close(fd);
+      return 0;
+   }
+   close(fd);
+
+   /* The cache directories of the database and multi-file caches are one
+    * level up, the one of the fossilize cache has its files.
+    */
+   char *dir = ralloc_strndup(NULL, path, ftw->base - 1);
+   char *parent = ralloc_strdup(dir, dir);
+   char *slash = strrchr(parent, '/');
+   if (slash)
+      *slash = '\0';
+
+   if (strcmp(name, "foz_cache.foz") == 0)
+      read_foz_db(dir, file, sb->st_size);
+   else if (strcmp(name, "mesa_cache.db") == 0)
+      read_mesa_cache_db(parent, file, sb->st_size);
+   else
+      add_cache_item(parent, file, sb->st_size);
+
+   ralloc_free(dir);
+   free(file);
+   return 0;
+}
+
+/* Returns the total compressed size of the samples [first, end) picked with
+ * the given stride.
+ */
+static size_t
+compressed_size(const struct group *g, const struct util_compress_dict *dict,
+                unsigned first, unsigned stride)
+{
+   const size_t *sizes = util_dynarray_begin(&g->sample_sizes);
+   const uint8_t *sample = util_dynarray_begin(&g->samples);
+   size_t total = 0;
+
+   for (unsigned i = 0; i < g->num_entries; i++) {
+      if (i >= first && (i - first) % stride == 0) {
+         size_t max_size = util_compress_max_compressed_len(sizes[i]);
+         uint8_t *out = malloc(max_size);
+         total += util_compress_deflate_with_dict(dict, sample, sizes[i],
+                                                  out, max_size);
+         free(out);
+      }
+      sample += sizes[i];
+   }
+
+   return total;
+}
+
+/* Trains a dictionary on the samples picked with the given stride. */
+static struct util_compress_dict *
+train(const struct group *g, unsigned stride, size_t dict_size,
+      void *dict_data, size_t *trained_size)
+{
+   struct util_dynarray samples, sizes;
+   util_dynarray_init(&samples, NULL);
+   util_dynarray_init(&sizes, NULL);
+
+   const size_t *all_sizes = util_dynarray_begin(&g->sample_sizes);
+   const uint8_t *sample = util_dynarray_begin(&g->samples);
+   for (unsigned i = 0; i < g->num_entries; i++) {
+      if (i % stride == 0) {
+         memcpy(util_dynarray_grow(&samples, uint8_t, all_sizes[i]), sample,
+                all_sizes[i]);
+         util_dynarray_append(&sizes, size_t, all_sizes[i]);
+      }
+      sample += all_sizes[i];
+   }
+
+   *trained_size =
+      util_compress_dict_train(dict_data, dict_size,
+                               util_dynarray_begin(&samples),
+                               util_dynarray_begin(&sizes),
+                               util_dynarray_num_elements(&sizes, size_t));
+
+   util_dynarray_fini(&samples);
+   util_dynarray_fini(&sizes);
+
+   if (*trained_size == 0)
+      return NULL;
+
+   return util_compress_dict_create(dict_data, *trained_size);
+}
+
+static bool
+write_dict(const struct group *g, const void *data, size_t size)
+{
+   char *filename = disk_cache_get_compress_dict_filename(mem_ctx, g->dir,
+                                                          g->keys,
+                                                          g->keys_size);
+   char *tmp = ralloc_asprintf(mem_ctx, "%s.tmp%d", filename, (int)getpid());
+
+   FILE *f = fopen(tmp, "wb");
+   if (f == NULL)
+      return false;
+
+   bool ok = fwrite(data, 1, size, f) == size;
+   ok = fclose(f) == 0 && ok;
+
+   /* Processes may be loading the dictionary, replace it atomically. */
+   if (!ok || rename(tmp, filename) != 0) {
+      unlink(tmp);
+      return false;
+   }
+
+   printf("  wrote %s\n", filename);
+   return true;
+}
+
+static double
+percent(size_t part, size_t total)
+{
+   return total ? 100.0 * part / total : 0.0;
+}
+
+static void
+usage(const char *name)
+{
+   fprintf(stderr,
+           "Usage: %s [--write] [--size BYTES] CACHE_DIR\n"
+           "\n"
+           "  -w, --write   write the dictionaries to the cache directories\n"
+           "  -s, --size    size of the dictionaries (default %u)\n",
+           name, DEFAULT_DICT_SIZE);
+}
+
+int
+main(int argc, char **argv)
+{
+   static const struct option options[] = {
+      { "write", no_argument, NULL, 'w' },
+      { "size", required_argument, NULL, 's' },
+      { "help", no_argument, NULL, 'h' },
+      { NULL, 0, NULL, 0 },
+   };
+   size_t dict_size = DEFAULT_DICT_SIZE;
+   bool write = false;
+   int opt;
+
+   while ((opt = getopt_long(argc, argv, "ws:h", options, NULL)) != -1) {
+      switch (opt) {
+      case 'w':
+         write = true;
+         break;
+      case 's':
+         dict_size = strtoul(optarg, NULL, 0);
+         break;
+      default:
+         usage(argv[0]);
+         return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+   }
+
+   if (optind != argc - 1 || dict_size == 0 ||
+       dict_size > DISK_CACHE_MAX_COMPRESS_DICT_SIZE) {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   mem_ctx = ralloc_context(NULL);
+   util_dynarray_init(&groups, mem_ctx);
+
+   if (nftw(argv[optind], visit_file, 16, FTW_PHYS) != 0) {
+      fprintf(stderr, "Failed to walk %s: %s\n", argv[optind],
+              strerror(errno));
+      return EXIT_FAILURE;
+   }
+
+   if (num_skipped)
+      printf("Skipped %u files or entries that aren't valid cache items.\n",
+             num_skipped);
+
+   void *dict_data = ralloc_size(mem_ctx, dict_size);
+   int ret = EXIT_SUCCESS;
+
+   util_dynarray_foreach(&groups, struct group, g) {
+      size_t raw_size = util_dynarray_num_elements(&g->samples, uint8_t);
+
+      printf("%s\n  %s, %s: %u entries, %zu bytes, %zu stored (%.1f%%)%s\n",
+             g->dir, g->driver_id, g->gpu_name, g->num_entries, raw_size,
+             g->stored_size, percent(g->stored_size, raw_size),
+             g->dict ? ", already with a dictionary" : "");
+
+      if (g->num_entries < 2 * MIN_SAMPLES) {
+         printf("  not enough entries to train a dictionary\n");
+         continue;
+      }
+
+      /* Train on even entries, measure on odd ones. */
+      size_t trained_size;
+      struct util_compress_dict *dict = train(g, 2, dict_size, dict_data,
+                                              &trained_size);
+      if (dict == NULL) {
+         printf("  failed to train a dictionary\n");
+         ret = EXIT_FAILURE;
+         continue;
+      }
+
+      size_t plain = compressed_size(g, NULL, 1, 2);
+      size_t with_dict = compressed_size(g, dict, 1, 2);
+      util_compress_dict_destroy(dict);
+
+      printf("  held-out entries: %zu bytes compressed, %zu with a %zu byte "
+             "dictionary (%.1f%% smaller)\n", plain, with_dict, trained_size,
+             percent(plain - MIN2(with_dict, plain), plain));
+
+      if (write) {
+         dict = train(g, 1, dict_size, dict_data, &trained_size);
+         if (dict == NULL || !write_dict(g, dict_data, trained_size)) {
+            fprintf(stderr, "  failed to write the dictionary\n");
+            ret = EXIT_FAILURE;
+         }
+         util_compress_dict_destroy(dict);
+      }
+   }
+
+   util_dynarray_foreach(&groups, struct group, g)
+      util_compress_dict_destroy(g->dict);
+   ralloc_free(mem_ctx);
+
+   return ret;
+}
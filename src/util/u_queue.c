@@ -26,6 +26,8 @@
 
 #include "u_queue.h"
 
+#include <stdatomic.h>
+
 #include "c11/threads.h"
 #include "util/u_cpu_detect.h"
 #include "util/os_time.h"
@@ -241,6 +243,204 @@ util_queue_fence_destroy(struct util_queue_fence *fence)
  * util_queue implementation
  */
 
+/* util_queue_finish waits for epochs rather than for barrier jobs, so it
+ * neither depends on the order in which the threads take jobs nor waits for
+ * the jobs added after it was called.
+ *
+ * Every job is counted in the epoch that was current when it was added, or
+ * in the epoch of the job that added it. util_queue_finish starts a new
+ * epoch and waits for the previous one to drain. An epoch also counts itself
+ * while it's current, and its predecessor until that drains, so it can't
+ * drain before all jobs added before it are done.
+ */
+struct util_queue_epoch {
+   int num_pending;
+   struct util_queue_epoch *next; /* set when it stops being current */
+   struct util_queue_fence drained;
+};
+
+/* Ring buffer of jobs that grows as needed. */
+struct util_queue_lane {
+   struct util_queue_job *jobs;
+   unsigned capacity;
+   unsigned read_idx;
+   unsigned num_jobs; /* also read without the lock to skip empty lanes */
+};
+
+struct util_queue_worker {
+   simple_mtx_t lock;
+   struct util_queue *queue;
+   unsigned index;
+   struct util_queue_lane lanes[UTIL_QUEUE_NUM_PRIORITIES];
+   struct util_queue_epoch *epoch; /* of the running job */
+   struct util_queue_fence finish_fence; /* see util_queue_finish_with_barrier */
+};
+
+/* The worker of the current thread, if it's a queue thread. */
+static __THREAD_INITIAL_EXEC struct util_queue_worker *current_worker;
+
+static struct util_queue_epoch *
+util_queue_epoch_create(int num_pending)
+{
+   struct util_queue_epoch *epoch =
+      (struct util_queue_epoch*)calloc(1, sizeof(*epoch));
+   if (!epoch)
+      return NULL;
+
+   epoch->num_pending = num_pending;
+   util_queue_fence_init(&epoch->drained);
+   return epoch;
+}
+
+/* Drops a reference of the epoch, and signals it and releases its successor
+ * once it drained. The thread waiting for a drained epoch frees it.
+ */
+static void
+util_queue_epoch_release(struct util_queue_epoch *epoch)
+{
+   while (epoch && p_atomic_dec_zero(&epoch->num_pending)) {
+      struct util_queue_epoch *next = epoch->next;
+
+      util_queue_fence_signal(&epoch->drained);
+      epoch = next;
+   }
+}
+
+static struct util_queue_job *
+lane_job(struct util_queue_lane *lane, unsigned i)
+{
+   return &lane->jobs[(lane->read_idx + i) % lane->capacity];
+}
+
+static void
+lane_push(struct util_queue_lane *lane, const struct util_queue_job *job)
+{
+   if (lane->num_jobs == lane->capacity) {
+      unsigned capacity = MAX2(lane->capacity * 2, 8);
+      struct util_queue_job *jobs =
+         (struct util_queue_job*)malloc(capacity * sizeof(*jobs));
+      assert(jobs);
+
+      /* Copy all queued jobs into the new list. */
+      for (unsigned i = 0; i < lane->num_jobs; i++)
+         jobs[i] = *lane_job(lane, i);
+
+      free(lane->jobs);
+      lane->jobs = jobs;
+      lane->capacity = capacity;
+      lane->read_idx = 0;
+   }
+
+   *lane_job(lane, lane->num_jobs) = *job;
+   p_atomic_set(&lane->num_jobs, lane->num_jobs + 1);
+}
+
+static bool
+lane_pop(struct util_queue_lane *lane, struct util_queue_job *job)
+{
+   if (lane->num_jobs == 0)
+      return false;
+
+   *job = *lane_job(lane, 0);
+   lane->read_idx = (lane->read_idx + 1) % lane->capacity;
+   p_atomic_set(&lane->num_jobs, lane->num_jobs - 1);
+   return true;
+}
+
+/* Takes the oldest job of a lane of the worker. */
+static bool
+util_queue_worker_pop(struct util_queue *queue,
+                      struct util_queue_worker *worker,
+                      unsigned lane, struct util_queue_job *job)
+{
+   if (p_atomic_read(&worker->lanes[lane].num_jobs) == 0)
+      return false;
+
+   simple_mtx_lock(&worker->lock);
+   bool found = lane_pop(&worker->lanes[lane], job);
+   if (found) {
+      p_atomic_dec(&queue->num_queued);
+      p_atomic_add(&queue->total_jobs_size, -job->job_size);
+   }
+   simple_mtx_unlock(&worker->lock);
+
+   if (found) {
+      /* Either the waiter sees the new free slot, or we see the waiter. */
+      atomic_thread_fence(memory_order_seq_cst);
+      if (p_atomic_read(&queue->num_space_waiters) > 0) {
+         mtx_lock(&queue->lock);
+         cnd_broadcast(&queue->has_space_cond);
+         mtx_unlock(&queue->lock);
+      }
+   }
+
+   return found;
+}
+
+/* Takes the job to run next: the thread's own jobs come first within a
+ * priority, then the ones it can steal from the other threads.
+ */
+static bool
+util_queue_get_job(struct util_queue *queue, struct util_queue_worker *worker,
+                   struct util_queue_job *job)
+{
+   for (unsigned p = 0; p < UTIL_QUEUE_NUM_PRIORITIES; p++) {
+      for (unsigned i = 0; i < queue->max_threads; i++) {
+         struct util_queue_worker *victim =
+            &queue->workers[(worker->index + i) % queue->max_threads];
+
+         if (util_queue_worker_pop(queue, victim, p, job))
+            return true;
+      }
+   }
+
+   return false;
+}
+
+static void
+util_queue_wait_for_job(struct util_queue *queue,
+                        struct util_queue_worker *worker)
+{
+   mtx_lock(&queue->lock);
+   p_atomic_inc(&queue->num_idle_threads);
+
+   /* Either the thread adding a job sees this one idle, or this one sees
+    * the job.
+    */
+   atomic_thread_fence(memory_order_seq_cst);
+
+   while (worker->index < queue->num_threads &&
+          p_atomic_read(&queue->num_queued) <= 0)
+      cnd_wait(&queue->has_queued_cond, &queue->lock);
+
+   p_atomic_dec(&queue->num_idle_threads);
+   mtx_unlock(&queue->lock);
+}
+
+/* Signals the fences of the jobs left when all threads are terminated. */
+static void
+util_queue_signal_remaining_jobs(struct util_queue *queue)
+{
+   for (unsigned t = 0; t < queue->max_threads; t++) {
+      struct util_queue_worker *worker = &queue->workers[t];
+
+      simple_mtx_lock(&worker->lock);
+      for (unsigned l = 0; l < UTIL_QUEUE_NUM_PRIORITIES; l++) {
+         struct util_queue_job job;
+
+         while (lane_pop(&worker->lanes[l], &job)) {
+            p_atomic_dec(&queue->num_queued);
+            p_atomic_add(&queue->total_jobs_size, -job.job_size);
+
+            if (job.job && job.fence)
+               util_queue_fence_signal(job.fence);
+            util_queue_epoch_release(job.epoch);
+         }
+      }
+      simple_mtx_unlock(&worker->lock);
+   }
+}
+
 struct thread_input {
    struct util_queue *queue;
    int thread_index;
@@ -251,6 +451,7 @@ util_queue_thread_func(void *input)
 {
    struct util_queue *queue = ((struct thread_input*)input)->queue;
    int thread_index = ((struct thread_input*)input)->thread_index;
+   struct util_queue_worker *worker = &queue->workers[thread_index];
 
    free(input);
 
@@ -279,59 +480,43 @@ util_queue_thread_func(void *input)
       u_thread_setname(name);
    }
 
+   current_worker = worker;
+
    while (1) {
       struct util_queue_job job;
 
-      mtx_lock(&queue->lock);
-      assert(queue->num_queued >= 0 && queue->num_queued <= queue->max_jobs);
-
-      /* wait if the queue is empty */
-      while (thread_index < queue->num_threads && queue->num_queued == 0)
-         cnd_wait(&queue->has_queued_cond, &queue->lock);
-
       /* only kill threads that are above "num_threads" */
-      if (thread_index >= queue->num_threads) {
-         mtx_unlock(&queue->lock);
+      if (thread_index >= p_atomic_read(&queue->num_threads))
          break;
-      }
-
-      job = queue->jobs[queue->read_idx];
-      memset(&queue->jobs[queue->read_idx], 0, sizeof(struct util_queue_job));
-      queue->read_idx = (queue->read_idx + 1) % queue->max_jobs;
 
-      queue->num_queued--;
-      cnd_signal(&queue->has_space_cond);
-      if (job.job)
-         queue->total_jobs_size -= job.job_size;
-      mtx_unlock(&queue->lock);
+      /* wait if the queue is empty */
+      if (!util_queue_get_job(queue, worker, &job)) {
+         util_queue_wait_for_job(queue, worker);
+         continue;
+      }
 
       if (job.job) {
+         /* Jobs added by this one are part of its epoch. */
+         worker->epoch = job.epoch;
          job.execute(job.job, job.global_data, thread_index);
          if (job.fence)
             util_queue_fence_signal(job.fence);
          if (job.cleanup)
             job.cleanup(job.job, job.global_data, thread_index);
+         worker->epoch = NULL;
       }
+      util_queue_epoch_release(job.epoch);
    }
 
+   current_worker = NULL;
+
    /* signal remaining jobs if all threads are being terminated */
    mtx_lock(&queue->lock);
-   if (queue->num_threads == 0) {
-      for (unsigned i = queue->read_idx; i != queue->write_idx;
-           i = (i + 1) % queue->max_jobs) {
-         if (queue->jobs[i].job) {
-            if (queue->jobs[i].fence)
-               util_queue_fence_signal(queue->jobs[i].fence);
-            queue->jobs[i].job = NULL;
-         }
-      }
-      queue->read_idx = queue->write_idx;
-      queue->num_queued = 0;
-   }
+   if (queue->num_threads == 0)
+      util_queue_signal_remaining_jobs(queue);
    mtx_unlock(&queue->lock);
    return 0;
 }
-
 static bool
 util_queue_create_thread(struct util_queue *queue, unsigned index)
 {
@@ -442,7 +627,6 @@ util_queue_init(struct util_queue *queue,
       snprintf(queue->name, sizeof(queue->name), "%s", name);
    }
 
-   queue->create_threads_on_demand = true;
    queue->flags = flags;
    queue->max_threads = num_threads;
    queue->num_threads = 1;
@@ -455,11 +639,24 @@ util_queue_init(struct util_queue *queue,
    cnd_init(&queue->has_queued_cond);
    cnd_init(&queue->has_space_cond);
 
-   queue->jobs = (struct util_queue_job*)
-                 calloc(max_jobs, sizeof(struct util_queue_job));
-   if (!queue->jobs)
+   simple_mtx_init(&queue->epoch_lock, mtx_plain);
+   simple_mtx_init(&queue->finish_lock, mtx_plain);
+   queue->epoch = util_queue_epoch_create(1);
+   if (!queue->epoch)
+      goto fail;
+
+   queue->workers = (struct util_queue_worker*)
+                    calloc(queue->max_threads, sizeof(struct util_queue_worker));
+   if (!queue->workers)
       goto fail;
 
+   for (i = 0; i < queue->max_threads; i++) {
+      simple_mtx_init(&queue->workers[i].lock, mtx_plain);
+      util_queue_fence_init(&queue->workers[i].finish_fence);
+      queue->workers[i].queue = queue;
+      queue->workers[i].index = i;
+   }
+
    queue->threads = (thrd_t*) calloc(queue->max_threads, sizeof(thrd_t));
    if (!queue->threads)
       goto fail;
@@ -484,12 +681,24 @@ util_queue_init(struct util_queue *queue,
 fail:
    free(queue->threads);
 
-   if (queue->jobs) {
-      cnd_destroy(&queue->has_space_cond);
-      cnd_destroy(&queue->has_queued_cond);
-      mtx_destroy(&queue->lock);
-      free(queue->jobs);
+   if (queue->workers) {
+      for (i = 0; i < queue->max_threads; i++) {
+         util_queue_fence_destroy(&queue->workers[i].finish_fence);
+         simple_mtx_destroy(&queue->workers[i].lock);
+      }
+      free(queue->workers);
+   }
+
+   if (queue->epoch) {
+      util_queue_fence_destroy(&queue->epoch->drained);
+      free(queue->epoch);
    }
+
+   simple_mtx_destroy(&queue->epoch_lock);
+   simple_mtx_destroy(&queue->finish_lock);
+   cnd_destroy(&queue->has_space_cond);
+   cnd_destroy(&queue->has_queued_cond);
+   mtx_destroy(&queue->lock);
    /* also util_queue_is_initialized can be used to check for success */
    memset(queue, 0, sizeof(*queue));
    return false;
@@ -530,14 +739,6 @@ util_queue_kill_threads(struct util_queue *queue, unsigned keep_num_threads,
    }
 }
 
-static void
-util_queue_finish_execute(void *data, void *gdata, int num_thread)
-{
-   util_barrier *barrier = data;
-   if (util_barrier_wait(barrier))
-      util_barrier_destroy(barrier);
-}
-
 void
 util_queue_destroy(struct util_queue *queue)
 {
@@ -547,13 +748,48 @@ util_queue_destroy(struct util_queue *queue)
    if (queue->head.next != NULL)
       remove_from_atexit_list(queue);
 
+   if (queue->workers) {
+      for (unsigned i = 0; i < queue->max_threads; i++) {
+         for (unsigned l = 0; l < UTIL_QUEUE_NUM_PRIORITIES; l++)
+            free(queue->workers[i].lanes[l].jobs);
+         util_queue_fence_destroy(&queue->workers[i].finish_fence);
+         simple_mtx_destroy(&queue->workers[i].lock);
+      }
+   }
+
+   if (queue->epoch) {
+      util_queue_fence_destroy(&queue->epoch->drained);
+      free(queue->epoch);
+   }
+   simple_mtx_destroy(&queue->epoch_lock);
+   simple_mtx_destroy(&queue->finish_lock);
+
    cnd_destroy(&queue->has_space_cond);
    cnd_destroy(&queue->has_queued_cond);
    mtx_destroy(&queue->lock);
-   free(queue->jobs);
+   free(queue->workers);
    free(queue->threads);
 }
 
+/* Wakes up idle threads after adding a job. */
+static void
+util_queue_wake_idle_threads(struct util_queue *queue, bool all, bool locked)
+{
+   /* Either the idle thread sees the new job, or we see the idle thread. */
+   atomic_thread_fence(memory_order_seq_cst);
+   if (p_atomic_read(&queue->num_idle_threads) == 0)
+      return;
+
+   if (!locked)
+      mtx_lock(&queue->lock);
+   if (all)
+      cnd_broadcast(&queue->has_queued_cond);
+   else
+      cnd_signal(&queue->has_queued_cond);
+   if (!locked)
+      mtx_unlock(&queue->lock);
+}
+
 static void
 util_queue_add_job_locked(struct util_queue *queue,
                           void *job,
@@ -561,15 +797,13 @@ util_queue_add_job_locked(struct util_queue *queue,
                           util_queue_execute_func execute,
                           util_queue_execute_func cleanup,
                           const size_t job_size,
+                          enum util_queue_priority priority,
+                          int thread_hint,
                           bool locked)
 {
-   struct util_queue_job *ptr;
+   unsigned num_threads = p_atomic_read(&queue->num_threads);
 
-   if (!locked)
-      mtx_lock(&queue->lock);
-   if (queue->num_threads == 0) {
-      if (!locked)
-         mtx_unlock(&queue->lock);
+   if (num_threads == 0) {
       /* well no good option here, but any leaks will be
        * short-lived as things are shutting down..
        */
@@ -579,67 +813,88 @@ util_queue_add_job_locked(struct util_queue *queue,
    if (fence)
       util_queue_fence_reset(fence);
 
-   assert(queue->num_queued >= 0 && queue->num_queued <= queue->max_jobs);
-
    /* Scale the number of threads up if there's already one job waiting. */
-   if (queue->num_queued > 0 &&
-       queue->create_threads_on_demand &&
-       execute != util_queue_finish_execute &&
-       queue->num_threads < queue->max_threads) {
-      util_queue_adjust_num_threads(queue, queue->num_threads + 1, true);
-   }
-
-   if (queue->num_queued == queue->max_jobs) {
-      if (queue->flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL &&
-          queue->total_jobs_size + job_size < S_256MB) {
-         /* If the queue is full, make it larger to avoid waiting for a free
-          * slot.
-          */
-         unsigned new_max_jobs = queue->max_jobs + 8;
-         struct util_queue_job *jobs =
-            (struct util_queue_job*)calloc(new_max_jobs,
-                                           sizeof(struct util_queue_job));
-         assert(jobs);
-
-         /* Copy all queued jobs into the new list. */
-         unsigned num_jobs = 0;
-         unsigned i = queue->read_idx;
-
-         do {
-            jobs[num_jobs++] = queue->jobs[i];
-            i = (i + 1) % queue->max_jobs;
-         } while (i != queue->write_idx);
-
-         assert(num_jobs == queue->num_queued);
-
-         free(queue->jobs);
-         queue->jobs = jobs;
-         queue->read_idx = 0;
-         queue->write_idx = num_jobs;
-         queue->max_jobs = new_max_jobs;
-      } else {
-         /* Wait until there is a free slot. */
-         while (queue->num_queued == queue->max_jobs)
-            cnd_wait(&queue->has_space_cond, &queue->lock);
-      }
+   if (p_atomic_read(&queue->num_queued) > 0 &&
+       num_threads < queue->max_threads) {
+      util_queue_adjust_num_threads(queue, num_threads + 1, locked);
+      num_threads = MAX2(p_atomic_read(&queue->num_threads), 1);
    }
 
-   ptr = &queue->jobs[queue->write_idx];
-   assert(ptr->job == NULL);
-   ptr->job = job;
-   ptr->global_data = queue->global_data;
-   ptr->fence = fence;
-   ptr->execute = execute;
-   ptr->cleanup = cleanup;
-   ptr->job_size = job_size;
+   if (p_atomic_read(&queue->num_queued) >= queue->max_jobs &&
+       !(queue->flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL &&
+         p_atomic_read(&queue->total_jobs_size) + job_size < S_256MB)) {
+      /* Wait until there is a free slot. If the queue can be resized, the
+       * lanes just grow instead.
+       */
+      if (!locked)
+         mtx_lock(&queue->lock);
+      p_atomic_inc(&queue->num_space_waiters);
 
-   queue->write_idx = (queue->write_idx + 1) % queue->max_jobs;
-   queue->total_jobs_size += ptr->job_size;
+      /* Either the thread taking a job sees us waiting, or we see the free
+       * slot.
+       */
+      atomic_thread_fence(memory_order_seq_cst);
 
-   queue->num_queued++;
-   cnd_signal(&queue->has_queued_cond);
-   if (!locked)
-      mtx_unlock(&queue->lock);
+      while (p_atomic_read(&queue->num_queued) >= queue->max_jobs)
+         cnd_wait(&queue->has_space_cond, &queue->lock);
+
+      p_atomic_dec(&queue->num_space_waiters);
+      if (!locked)
+         mtx_unlock(&queue->lock);
+   }
+
+   struct util_queue_worker *worker;
+   if (thread_hint != UTIL_QUEUE_NO_THREAD_HINT) {
+      worker = &queue->workers[thread_hint % num_threads];
+   } else if (current_worker && current_worker->queue == queue) {
+      /* Jobs added by a job likely use its data, keep them on its thread. */
+      worker = current_worker;
+   } else {
+      worker = &queue->workers[p_atomic_inc_return(&queue->next_thread) %
+                               num_threads];
+   }
+
+   struct util_queue_epoch *epoch;
+   if (current_worker && current_worker->queue == queue &&
+       current_worker->epoch) {
+      /* The running job holds a reference of its epoch. */
+      epoch = current_worker->epoch;
+      p_atomic_inc(&epoch->num_pending);
+   } else {
+      simple_mtx_lock(&queue->epoch_lock);
+      epoch = queue->epoch;
+      p_atomic_inc(&epoch->num_pending);
+      simple_mtx_unlock(&queue->epoch_lock);
+   }
+
+   struct util_queue_job new_job = {
+      .job = job,
+      .global_data = queue->global_data,
+      .job_size = job_size,
+      .fence = fence,
+      .execute = execute,
+      .cleanup = cleanup,
+      .epoch = epoch,
+   };
+
+   simple_mtx_lock(&worker->lock);
+   lane_push(&worker->lanes[priority], &new_job);
+   p_atomic_inc(&queue->num_queued);
+   p_atomic_add(&queue->total_jobs_size, job_size);
+   simple_mtx_unlock(&worker->lock);
+
+   util_queue_wake_idle_threads(queue, false, locked);
+
+   /* The threads may have been terminated since the check above, and won't
+    * run the job.
+    */
+   if (unlikely(p_atomic_read(&queue->num_threads) == 0)) {
+      if (!locked)
+         mtx_lock(&queue->lock);
+      util_queue_signal_remaining_jobs(queue);
+      if (!locked)
+         mtx_unlock(&queue->lock);
+   }
 }
 
 void
@@ -651,7 +906,23 @@ util_queue_add_job(struct util_queue *queue,
                    const size_t job_size)
 {
    util_queue_add_job_locked(queue, job, fence, execute, cleanup, job_size,
-                             false);
+                             UTIL_QUEUE_PRIORITY_NORMAL,
+                             UTIL_QUEUE_NO_THREAD_HINT, false);
+}
+
+void
+util_queue_add_job_with_priority(struct util_queue *queue,
+                                 void *job,
+                                 struct util_queue_fence *fence,
+                                 util_queue_execute_func execute,
+                                 util_queue_execute_func cleanup,
+                                 const size_t job_size,
+                                 enum util_queue_priority priority,
+                                 int thread_hint)
+{
+   assert(priority < UTIL_QUEUE_NUM_PRIORITIES);
+   util_queue_add_job_locked(queue, job, fence, execute, cleanup, job_size,
+                             priority, thread_hint, false);
 }
 
 /**
@@ -672,20 +943,34 @@ util_queue_drop_job(struct util_queue *queue, struct util_queue_fence *fence)
    if (util_queue_fence_is_signalled(fence))
       return;
 
-   mtx_lock(&queue->lock);
-   for (unsigned i = queue->read_idx; i != queue->write_idx;
-        i = (i + 1) % queue->max_jobs) {
-      if (queue->jobs[i].fence == fence) {
-         if (queue->jobs[i].cleanup)
-            queue->jobs[i].cleanup(queue->jobs[i].job, queue->global_data, -1);
-
-         /* Just clear it. The threads will treat as a no-op job. */
-         memset(&queue->jobs[i], 0, sizeof(queue->jobs[i]));
-         removed = true;
-         break;
+   for (unsigned t = 0; t < queue->max_threads && !removed; t++) {
+      struct util_queue_worker *worker = &queue->workers[t];
+
+      simple_mtx_lock(&worker->lock);
+      for (unsigned l = 0; l < UTIL_QUEUE_NUM_PRIORITIES && !removed; l++) {
+         struct util_queue_lane *lane = &worker->lanes[l];
+
+         for (unsigned i = 0; i < lane->num_jobs; i++) {
+            struct util_queue_job *ptr = lane_job(lane, i);
+
+            if (ptr->fence == fence) {
+               if (ptr->cleanup)
+                  ptr->cleanup(ptr->job, queue->global_data, -1);
+               p_atomic_add(&queue->total_jobs_size, -ptr->job_size);
+
+               /* Just clear it. The threads will treat as a no-op job, which
+                * still leaves its epoch.
+                */
+               struct util_queue_epoch *epoch = ptr->epoch;
+               memset(ptr, 0, sizeof(*ptr));
+               ptr->epoch = epoch;
+               removed = true;
+               break;
+            }
+         }
       }
+      simple_mtx_unlock(&worker->lock);
    }
-   mtx_unlock(&queue->lock);
 
    if (removed)
       util_queue_fence_signal(fence);
@@ -694,51 +979,99 @@ util_queue_drop_job(struct util_queue *queue, struct util_queue_fence *fence)
 }
 
 /**
- * Wait until all previously added jobs have completed.
+ * Wait until all previously added jobs have completed, including the jobs
+ * that they add. Jobs added while waiting, except by those jobs, aren't
+ * waited for.
  */
-void
-util_queue_finish(struct util_queue *queue)
+static void
+util_queue_finish_execute(void *data, void *gdata, int num_thread)
+{
+   util_barrier *barrier = data;
+   if (util_barrier_wait(barrier))
+      util_barrier_destroy(barrier);
+}
+
+/* Fallback of util_queue_finish for when no epoch can be allocated: blocks
+ * every thread in a barrier job, which they only reach once the jobs queued
+ * before are done. Unlike epochs, this doesn't wait for the jobs that these
+ * jobs add.
+ *
+ * The barrier jobs get the lowest priority that has jobs queued: as jobs are
+ * taken by priority and then in order, they run after those jobs, but not
+ * after jobs of a higher priority that keep being added.
+ */
+static void
+util_queue_finish_with_barrier(struct util_queue *queue)
 {
    util_barrier barrier;
-   struct util_queue_fence *fences;
 
-   /* If 2 threads were adding jobs for 2 different barries at the same time,
-    * a deadlock would happen, because 1 barrier requires that all threads
-    * wait for it exclusively.
+   /* The fences of the workers are shared by all callers. */
+   simple_mtx_lock(&queue->finish_lock);
+
+   /* Keeps the number of threads from shrinking below the barrier's count
+    * while the jobs are added.
     */
    mtx_lock(&queue->lock);
 
-   /* The number of threads can be changed to 0, e.g. by the atexit handler. */
-   if (!queue->num_threads) {
+   unsigned num_threads = p_atomic_read(&queue->num_threads);
+   if (!num_threads) {
       mtx_unlock(&queue->lock);
+      simple_mtx_unlock(&queue->finish_lock);
       return;
    }
 
-   /* We need to disable adding new threads in util_queue_add_job because
-    * the finish operation requires a fixed number of threads.
-    *
-    * Also note that util_queue_add_job can unlock the mutex if there is not
-    * enough space in the queue and wait for space.
-    */
-   queue->create_threads_on_demand = false;
+   enum util_queue_priority priority = UTIL_QUEUE_PRIORITY_HIGH;
+   for (unsigned t = 0; t < queue->max_threads; t++) {
+      for (unsigned l = priority + 1; l < UTIL_QUEUE_NUM_PRIORITIES; l++) {
+         if (p_atomic_read(&queue->workers[t].lanes[l].num_jobs))
+            priority = (enum util_queue_priority)l;
+      }
+   }
 
-   fences = malloc(queue->num_threads * sizeof(*fences));
-   util_barrier_init(&barrier, queue->num_threads);
+   util_barrier_init(&barrier, num_threads);
 
-   for (unsigned i = 0; i < queue->num_threads; ++i) {
-      util_queue_fence_init(&fences[i]);
-      util_queue_add_job_locked(queue, &barrier, &fences[i],
-                                util_queue_finish_execute, NULL, 0, true);
+   for (unsigned i = 0; i < num_threads; ++i) {
+      util_queue_add_job_locked(queue, &barrier,
+                                &queue->workers[i].finish_fence,
+                                util_queue_finish_execute, NULL, 0,
+                                priority, i, true);
    }
-   queue->create_threads_on_demand = true;
    mtx_unlock(&queue->lock);
 
-   for (unsigned i = 0; i < queue->num_threads; ++i) {
-      util_queue_fence_wait(&fences[i]);
-      util_queue_fence_destroy(&fences[i]);
+   for (unsigned i = 0; i < num_threads; ++i)
+      util_queue_fence_wait(&queue->workers[i].finish_fence);
+
+   simple_mtx_unlock(&queue->finish_lock);
+}
+
+void
+util_queue_finish(struct util_queue *queue)
+{
+   /* The number of threads can be changed to 0, e.g. by the atexit handler. */
+   if (!p_atomic_read(&queue->num_threads))
+      return;
+
+   /* The new epoch counts itself while it's current, and the previous one
+    * until that drains.
+    */
+   struct util_queue_epoch *next = util_queue_epoch_create(2);
+   if (!next) {
+      util_queue_finish_with_barrier(queue);
+      return;
    }
 
-   free(fences);
+   simple_mtx_lock(&queue->epoch_lock);
+   struct util_queue_epoch *epoch = queue->epoch;
+   epoch->next = next;
+   util_queue_fence_reset(&epoch->drained);
+   queue->epoch = next;
+   simple_mtx_unlock(&queue->epoch_lock);
+
+   util_queue_epoch_release(epoch);
+
+   util_queue_fence_wait(&epoch->drained);
+   util_queue_fence_destroy(&epoch->drained);
+   free(epoch);
 }
 
 int64_t
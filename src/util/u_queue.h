@@ -28,6 +28,15 @@
  *
  * Jobs can be added from any thread. After that, the wait call can be used
  * to wait for completion of the job.
+ *
+ * Each thread has its own FIFO lanes of jobs, one per priority, behind a
+ * lock of its own. Jobs added from outside the queue are spread over the
+ * threads, and jobs added by a job go to the lanes of the thread running it,
+ * unless a thread hint says otherwise. Threads run the jobs of their lanes
+ * and steal from the other threads' lanes when theirs are empty, and no job
+ * runs while a job of higher priority is waiting in any lane. Jobs of the
+ * same priority run in the order they were added when there is only one
+ * thread.
  */
 
 #ifndef U_QUEUE_H
@@ -192,6 +201,20 @@ util_queue_fence_wait_timeout(struct util_queue_fence *fence,
 
 typedef void (*util_queue_execute_func)(void *job, void *gdata, int thread_index);
 
+enum util_queue_priority {
+   /* Jobs that someone is waiting for, like blocking shader compiles. */
+   UTIL_QUEUE_PRIORITY_HIGH,
+   UTIL_QUEUE_PRIORITY_NORMAL,
+   /* Background work, like disk cache writes. */
+   UTIL_QUEUE_PRIORITY_LOW,
+   UTIL_QUEUE_NUM_PRIORITIES,
+};
+
+/* Lets the queue pick the thread of a job. */
+#define UTIL_QUEUE_NO_THREAD_HINT -1
+
+struct util_queue_epoch;
+
 struct util_queue_job {
    void *job;
    void *global_data;
@@ -199,24 +222,31 @@ struct util_queue_job {
    struct util_queue_fence *fence;
    util_queue_execute_func execute;
    util_queue_execute_func cleanup;
+   struct util_queue_epoch *epoch; /* counts the job until it's done */
 };
 
+struct util_queue_worker;
+
 /* Put this into your context. */
 struct util_queue {
    char name[14]; /* 13 characters = the thread name without the index */
-   mtx_t lock;
-   bool create_threads_on_demand;
+   mtx_t lock; /* for creating threads, and sleeping while idle or full */
    cnd_t has_queued_cond;
    cnd_t has_space_cond;
    thrd_t *threads;
    unsigned flags;
    int num_queued;
+   int num_idle_threads;
+   int num_space_waiters;
    unsigned max_threads;
    unsigned num_threads; /* decreasing this number will terminate threads */
+   unsigned next_thread; /* thread of the next job added from outside */
    int max_jobs;
-   int write_idx, read_idx; /* ring buffer pointers */
    size_t total_jobs_size;  /* memory use of all jobs in the queue */
-   struct util_queue_job *jobs;
+   struct util_queue_worker *workers; /* one per thread, max_threads of them */
+   simple_mtx_t epoch_lock; /* for switching to a new epoch */
+   struct util_queue_epoch *epoch; /* the epoch of jobs added now */
+   simple_mtx_t finish_lock; /* for finishing without an epoch */
    void *global_data;
 
    /* for cleanup at exit(), protected by exit_mutex */
@@ -238,6 +268,19 @@ void util_queue_add_job(struct util_queue *queue,
                         util_queue_execute_func execute,
                         util_queue_execute_func cleanup,
                         const size_t job_size);
+
+/* Same as util_queue_add_job, with a priority and the index of the thread that
+ * should run the job, for example because it has the job's data in its
+ * caches. The thread index is a hint, other threads may still steal the job.
+ */
+void util_queue_add_job_with_priority(struct util_queue *queue,
+                                      void *job,
+                                      struct util_queue_fence *fence,
+                                      util_queue_execute_func execute,
+                                      util_queue_execute_func cleanup,
+                                      const size_t job_size,
+                                      enum util_queue_priority priority,
+                                      int thread_hint);
 void util_queue_drop_job(struct util_queue *queue,
                          struct util_queue_fence *fence);
 
@@ -0,0 +1,327 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "u_rcu_hash.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "c11/threads.h"
+#include "detect_arch.h"
+#include "u_atomic.h"
+#include "u_thread.h"
+
+#define INITIAL_SIZE_LOG2 4
+
+/* Each thread counts itself on the reader slot it was given on its first
+ * read-side section, so threads rarely share a cache line.
+ */
+static unsigned next_reader_slot;
+static __THREAD_INITIAL_EXEC unsigned reader_slot_plus_one;
+
+static inline unsigned
+bucket_index(const struct util_rcu_hash_buckets *buckets, uint32_t hash)
+{
+   return (hash * 0x9e3779b1u) >> (32 - buckets->size_log2);
+}
+
+static struct util_rcu_hash_buckets *
+buckets_create(unsigned size_log2)
+{
+   return calloc(1, sizeof(struct util_rcu_hash_buckets) +
+                    (sizeof(struct util_rcu_hash_entry *) << size_log2));
+}
+
+/* Frees the buckets along with their entries. */
+static void
+buckets_free(struct util_rcu_hash_buckets *buckets)
+{
+   for (unsigned i = 0; i < (1u << buckets->size_log2); i++) {
+      struct util_rcu_hash_entry *entry = buckets->heads[i];
+      while (entry != NULL) {
+         struct util_rcu_hash_entry *next = entry->next;
+         free(entry);
+         entry = next;
+      }
+   }
+   free(buckets);
+}
+
+struct util_rcu_hash *
+util_rcu_hash_create(bool (*key_equals_function)(const void *a,
+                                                 const void *b))
+{
+   struct util_rcu_hash *ht = CALLOC_STRUCT_CL(util_rcu_hash);
+   if (ht == NULL)
+      return NULL;
+
+   ht->buckets = buckets_create(INITIAL_SIZE_LOG2);
+   if (ht->buckets == NULL) {
+      FREE_CL(ht);
+      return NULL;
+   }
+
+   ht->buckets->size_log2 = INITIAL_SIZE_LOG2;
+   ht->key_equals_function = key_equals_function;
+   simple_mtx_init(&ht->retire_lock, mtx_plain);
+   util_dynarray_init(&ht->retired, NULL);
+
+   return ht;
+}
+
+static void
+free_retired(struct util_dynarray *retired)
+{
+   util_dynarray_foreach(retired, void *, ptr)
+      free(*ptr);
+   util_dynarray_fini(retired);
+}
+
+void
+util_rcu_hash_destroy(struct util_rcu_hash *ht,
+                      void (*delete_function)(struct util_rcu_hash_entry *entry))
+{
+   if (ht == NULL)
+      return;
+
+   if (delete_function) {
+      util_rcu_hash_foreach(ht, entry)
+         delete_function(entry);
+   }
+   buckets_free(ht->buckets);
+
+   free_retired(&ht->retired);
+   simple_mtx_destroy(&ht->retire_lock);
+   FREE_CL(ht);
+}
+
+unsigned
+util_rcu_hash_read_lock(struct util_rcu_hash *ht)
+{
+   unsigned slot = reader_slot_plus_one;
+   if (unlikely(slot == 0)) {
+      slot = p_atomic_inc_return(&next_reader_slot) %
+             UTIL_RCU_HASH_READER_SLOTS + 1;
+      reader_slot_plus_one = slot;
+   }
+   slot--;
+
+   unsigned idx = p_atomic_read(&ht->epoch) & 1;
+   p_atomic_inc(&ht->readers[slot].count[idx]);
+
+   /* Order the count before the loads of the section, so that a writer
+    * which doesn't see it can't have retired anything this reader sees.
+    * Locked instructions already are full barriers on x86.
+    */
+#if !DETECT_ARCH_X86 && !DETECT_ARCH_X86_64
+   atomic_thread_fence(memory_order_seq_cst);
+#endif
+
+   return slot * 2 + idx;
+}
+
+void
+util_rcu_hash_read_unlock(struct util_rcu_hash *ht, unsigned token)
+{
+   p_atomic_dec(&ht->readers[token / 2].count[token & 1]);
+}
+
+struct util_rcu_hash_entry *
+util_rcu_hash_search(struct util_rcu_hash *ht, uint32_t hash, const void *key)
+{
+   struct util_rcu_hash_buckets *buckets = p_atomic_read(&ht->buckets);
+   struct util_rcu_hash_entry *entry =
+      p_atomic_read(&buckets->heads[bucket_index(buckets, hash)]);
+
+   for (; entry != NULL; entry = p_atomic_read(&entry->next)) {
+      if (entry->hash == hash && ht->key_equals_function(entry->key, key))
+         return entry;
+   }
+
+   return NULL;
+}
+
+struct util_rcu_hash_entry *
+util_rcu_hash_next_entry(struct util_rcu_hash *ht,
+                         struct util_rcu_hash_entry *entry)
+{
+   const struct util_rcu_hash_buckets *buckets = ht->buckets;
+   unsigned b = 0;
+
+   if (entry != NULL) {
+      if (entry->next != NULL)
+         return entry->next;
+      b = bucket_index(buckets, entry->hash) + 1;
+   }
+
+   for (; b < (1u << buckets->size_log2); b++) {
+      if (buckets->heads[b] != NULL)
+         return buckets->heads[b];
+   }
+
+   return NULL;
+}
+
+static void
+retire(struct util_rcu_hash *ht, void *ptr)
+{
+   simple_mtx_lock(&ht->retire_lock);
+   void **slot = util_dynarray_grow(&ht->retired, void *, 1);
+   /* Without memory to remember it, the allocation is leaked, as there is
+    * no telling when readers are done with it.
+    */
+   if (slot != NULL)
+      *slot = ptr;
+   simple_mtx_unlock(&ht->retire_lock);
+}
+
+/* Copies the entries into a bucket array twice as large.  Readers may still
+ * be walking the old chains, so they are retired whole rather than relinked.
+ */
+static void
+grow(struct util_rcu_hash *ht)
+{
+   struct util_rcu_hash_buckets *old = ht->buckets;
+   struct util_rcu_hash_buckets *buckets = buckets_create(old->size_log2 + 1);
+   if (buckets == NULL)
+      return;
+
+   buckets->size_log2 = old->size_log2 + 1;
+
+   for (unsigned i = 0; i < (1u << old->size_log2); i++) {
+      for (struct util_rcu_hash_entry *entry = old->heads[i];
+           entry != NULL; entry = entry->next) {
+         struct util_rcu_hash_entry *copy = malloc(sizeof(*copy));
+         if (copy == NULL) {
+            /* Keep the old buckets, with longer chains. */
+            buckets_free(buckets);
+            return;
+         }
+
+         unsigned b = bucket_index(buckets, entry->hash);
+         *copy = *entry;
+         copy->next = buckets->heads[b];
+         buckets->heads[b] = copy;
+      }
+   }
+
+   simple_mtx_lock(&ht->retire_lock);
+   unsigned num_retired = ht->entries + 1;
+   void **retired = util_dynarray_grow(&ht->retired, void *, num_retired);
+   if (retired == NULL) {
+      simple_mtx_unlock(&ht->retire_lock);
+      buckets_free(buckets);
+      return;
+   }
+
+   for (unsigned i = 0; i < (1u << old->size_log2); i++) {
+      for (struct util_rcu_hash_entry *entry = old->heads[i];
+           entry != NULL; entry = entry->next)
+         *retired++ = entry;
+   }
+   *retired = old;
+   simple_mtx_unlock(&ht->retire_lock);
+
+   p_atomic_set(&ht->buckets, buckets);
+}
+
+bool
+util_rcu_hash_insert(struct util_rcu_hash *ht, uint32_t hash,
+                     const void *key, void *data)
+{
+   struct util_rcu_hash_buckets *buckets = ht->buckets;
+   struct util_rcu_hash_entry **link = &buckets->heads[bucket_index(buckets, hash)];
+
+   for (; *link != NULL; link = &(*link)->next) {
+      struct util_rcu_hash_entry *entry = *link;
+      if (entry->hash != hash || !ht->key_equals_function(entry->key, key))
+         continue;
+
+      /* Readers may be looking at the entry, so swap in a new one. */
+      struct util_rcu_hash_entry *replacement = malloc(sizeof(*replacement));
+      if (replacement == NULL)
+         return false;
+
+      replacement->next = entry->next;
+      replacement->hash = hash;
+      replacement->key = key;
+      replacement->data = data;
+      p_atomic_set(link, replacement);
+      retire(ht, entry);
+      return true;
+   }
+
+   if (ht->entries >= (1u << buckets->size_log2)) {
+      grow(ht);
+      buckets = ht->buckets;
+   }
+
+   struct util_rcu_hash_entry *entry = malloc(sizeof(*entry));
+   if (entry == NULL)
+      return false;
+
+   unsigned b = bucket_index(buckets, hash);
+   entry->next = buckets->heads[b];
+   entry->hash = hash;
+   entry->key = key;
+   entry->data = data;
+   p_atomic_set(&buckets->heads[b], entry);
+   ht->entries++;
+
+   return true;
+}
+
+bool
+util_rcu_hash_remove(struct util_rcu_hash *ht, uint32_t hash, const void *key)
+{
+   struct util_rcu_hash_buckets *buckets = ht->buckets;
+   struct util_rcu_hash_entry **link = &buckets->heads[bucket_index(buckets, hash)];
+
+   for (; *link != NULL; link = &(*link)->next) {
+      struct util_rcu_hash_entry *entry = *link;
+      if (entry->hash != hash || !ht->key_equals_function(entry->key, key))
+         continue;
+
+      /* The entry keeps its next pointer for the readers still on it. */
+      p_atomic_set(link, entry->next);
+      retire(ht, entry);
+      ht->entries--;
+      return true;
+   }
+
+   return false;
+}
+
+static void
+wait_for_readers(struct util_rcu_hash *ht, unsigned idx)
+{
+   for (unsigned i = 0; i < UTIL_RCU_HASH_READER_SLOTS; i++) {
+      while (p_atomic_read(&ht->readers[i].count[idx]) != 0)
+         thrd_yield();
+   }
+}
+
+void
+util_rcu_hash_synchronize(struct util_rcu_hash *ht)
+{
+   simple_mtx_lock(&ht->retire_lock);
+
+   struct util_dynarray retired = ht->retired;
+   util_dynarray_init(&ht->retired, NULL);
+
+   /* Flip twice: a reader may have read the epoch just before the first
+    * flip and only count itself on the old counter after the first wait.
+    */
+   for (unsigned i = 0; i < 2; i++) {
+      atomic_thread_fence(memory_order_seq_cst);
+      unsigned idx = ht->epoch & 1;
+      p_atomic_set(&ht->epoch, ht->epoch + 1);
+      atomic_thread_fence(memory_order_seq_cst);
+      wait_for_readers(ht, idx);
+   }
+
+   simple_mtx_unlock(&ht->retire_lock);
+
+   free_retired(&retired);
+}
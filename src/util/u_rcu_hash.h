@@ -0,0 +1,129 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Hash table with lock-free lookups, for caches that are searched from many
+ * threads and rarely modified.
+ *
+ * Readers enter a read-side section with util_rcu_hash_read_lock(), search
+ * without taking any lock, and leave with util_rcu_hash_read_unlock().  The
+ * entries they find stay valid until they leave the section, so they can
+ * take a reference on the data before that.
+ *
+ * Writers must be serialized by the caller, usually with the lock it already
+ * had around the table.  They can also search without entering a read-side
+ * section.  Removed and replaced entries, and the bucket arrays left behind
+ * by growing the table, are only freed by util_rcu_hash_synchronize(), which
+ * waits for the readers that might still see them.  The keys and data of
+ * removed entries must likewise stay alive until then, so a cache that frees
+ * an object on removal calls util_rcu_hash_synchronize() in between.
+ *
+ * The grace periods work like Linux's SRCU: readers count themselves on one
+ * of two counters, which are spread over a few cache lines to keep threads
+ * from bouncing them, and synchronizing flips the counter that new readers
+ * use before waiting for the old one to drain.
+ */
+
+#ifndef U_RCU_HASH_H
+#define U_RCU_HASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "simple_mtx.h"
+#include "u_dynarray.h"
+#include "u_memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UTIL_RCU_HASH_READER_SLOTS 16
+
+struct util_rcu_hash_entry {
+   struct util_rcu_hash_entry *next;
+   uint32_t hash;
+   const void *key;
+   void *data;
+};
+
+struct util_rcu_hash_buckets {
+   unsigned size_log2;
+   struct util_rcu_hash_entry *heads[];
+};
+
+struct util_rcu_hash {
+   /* Only replaced by writers, and read atomically. */
+   struct util_rcu_hash_buckets *buckets;
+   bool (*key_equals_function)(const void *a, const void *b);
+   uint32_t entries;
+
+   /* Memory waiting for a grace period, and the lock serializing grace
+    * periods.  Both are internal, writers don't need to hold anything else
+    * than their own lock to retire entries.
+    */
+   simple_mtx_t retire_lock;
+   struct util_dynarray retired;
+   unsigned epoch;
+
+   EXCLUSIVE_CACHELINE(uint32_t count[2]) readers[UTIL_RCU_HASH_READER_SLOTS];
+};
+
+struct util_rcu_hash *
+util_rcu_hash_create(bool (*key_equals_function)(const void *a,
+                                                 const void *b));
+
+/* There may be no readers or writers left. */
+void
+util_rcu_hash_destroy(struct util_rcu_hash *ht,
+                      void (*delete_function)(struct util_rcu_hash_entry *entry));
+
+/* Enter a read-side section, returning a token for the matching unlock.
+ * Sections can be nested but should be short, as they hold back
+ * util_rcu_hash_synchronize().
+ */
+unsigned
+util_rcu_hash_read_lock(struct util_rcu_hash *ht);
+
+void
+util_rcu_hash_read_unlock(struct util_rcu_hash *ht, unsigned token);
+
+/* Must be called in a read-side section or by a writer. */
+struct util_rcu_hash_entry *
+util_rcu_hash_search(struct util_rcu_hash *ht, uint32_t hash, const void *key);
+
+/* Writer only.  Adds an entry, or replaces the one with an equal key.
+ * Returns false when out of memory.
+ */
+bool
+util_rcu_hash_insert(struct util_rcu_hash *ht, uint32_t hash,
+                     const void *key, void *data);
+
+/* Writer only.  Returns whether an entry with an equal key was removed. */
+bool
+util_rcu_hash_remove(struct util_rcu_hash *ht, uint32_t hash, const void *key);
+
+/* Waits for the read-side sections that may still see removed entries, and
+ * frees the memory retired before the call.  Must not be called in a
+ * read-side section.
+ */
+void
+util_rcu_hash_synchronize(struct util_rcu_hash *ht);
+
+/* Writer only.  Returns the entry after the given one, or the first one
+ * with NULL.
+ */
+struct util_rcu_hash_entry *
+util_rcu_hash_next_entry(struct util_rcu_hash *ht,
+                         struct util_rcu_hash_entry *entry);
+
+#define util_rcu_hash_foreach(ht, entry)                                      \
+   for (struct util_rcu_hash_entry *entry = util_rcu_hash_next_entry(ht, NULL); \
+        entry != NULL; entry = util_rcu_hash_next_entry(ht, entry))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* U_RCU_HASH_H */
@@ -28,26 +28,201 @@
 #include "util/u_math.h"
 #include "util/vma.h"
 
+/* Holes are kept in a red-black tree ordered by address, where each node also
+ * knows the size of the largest hole in its subtree.  Walking the holes that
+ * are large enough for an allocation, from either end of the address space,
+ * can then skip over whole subtrees of smaller holes, which keeps allocation
+ * O(log n) in the number of holes while choosing the same hole a walk over
+ * all of them in address order would.
+ */
 struct util_vma_hole {
-   struct list_head link;
+   struct rb_node node;
    uint64_t offset;
    uint64_t size;
+
+   /** Size of the largest hole in this subtree. */
+   uint64_t max_size;
 };
 
-#define util_vma_foreach_hole(_hole, _heap) \
-   list_for_each_entry(struct util_vma_hole, _hole, &(_heap)->holes, link)
+static inline struct util_vma_hole *
+util_vma_hole_from_node(struct rb_node *node)
+{
+   return node ? rb_node_data(struct util_vma_hole, node, node) : NULL;
+}
+
+static inline uint64_t
+util_vma_node_max_size(struct rb_node *node)
+{
+   return node ? util_vma_hole_from_node(node)->max_size : 0;
+}
 
-#define util_vma_foreach_hole_safe(_hole, _heap) \
-   list_for_each_entry_safe(struct util_vma_hole, _hole, &(_heap)->holes, link)
+static void
+util_vma_hole_update_max(struct rb_node *node)
+{
+   struct util_vma_hole *hole = util_vma_hole_from_node(node);
+   hole->max_size = MAX3(hole->size, util_vma_node_max_size(node->left),
+                         util_vma_node_max_size(node->right));
+}
 
-#define util_vma_foreach_hole_safe_rev(_hole, _heap) \
-   list_for_each_entry_safe_rev(struct util_vma_hole, _hole, &(_heap)->holes, link)
+/* Updates the subtree sizes after the size of a hole changed in place. */
+static void
+util_vma_hole_resized(struct util_vma_hole *hole)
+{
+   for (struct rb_node *node = &hole->node; node; node = rb_node_parent(node))
+      util_vma_hole_update_max(node);
+}
+
+static int
+util_vma_hole_cmp(const struct rb_node *a, const struct rb_node *b)
+{
+   const struct util_vma_hole *hole_a =
+      rb_node_data(struct util_vma_hole, a, node);
+   const struct util_vma_hole *hole_b =
+      rb_node_data(struct util_vma_hole, b, node);
+
+   return hole_b->offset < hole_a->offset ? -1 : 1;
+}
+
+static void
+util_vma_heap_insert_hole(struct util_vma_heap *heap,
+                          uint64_t offset, uint64_t size)
+{
+   struct util_vma_hole *hole = calloc(1, sizeof(*hole));
+   hole->offset = offset;
+   hole->size = size;
+
+   rb_augmented_tree_insert(&heap->holes, &hole->node, util_vma_hole_cmp,
+                            util_vma_hole_update_max);
+}
+
+static void
+util_vma_heap_remove_hole(struct util_vma_heap *heap,
+                          struct util_vma_hole *hole)
+{
+   rb_augmented_tree_remove(&heap->holes, &hole->node,
+                            util_vma_hole_update_max);
+   free(hole);
+}
+
+/* Returns the lowest hole of at least the given size in the subtree. */
+static struct rb_node *
+util_vma_subtree_first_fit(struct rb_node *node, uint64_t size)
+{
+   while (node) {
+      if (util_vma_node_max_size(node->left) >= size)
+         node = node->left;
+      else if (util_vma_hole_from_node(node)->size >= size)
+         return node;
+      else if (util_vma_node_max_size(node->right) >= size)
+         node = node->right;
+      else
+         return NULL;
+   }
+
+   return NULL;
+}
+
+/* Returns the highest hole of at least the given size in the subtree. */
+static struct rb_node *
+util_vma_subtree_last_fit(struct rb_node *node, uint64_t size)
+{
+   while (node) {
+      if (util_vma_node_max_size(node->right) >= size)
+         node = node->right;
+      else if (util_vma_hole_from_node(node)->size >= size)
+         return node;
+      else if (util_vma_node_max_size(node->left) >= size)
+         node = node->left;
+      else
+         return NULL;
+   }
+
+   return NULL;
+}
+
+/* Returns the next hole above the given one of at least the given size. */
+static struct util_vma_hole *
+util_vma_hole_next_fit(struct util_vma_hole *hole, uint64_t size)
+{
+   struct rb_node *node = &hole->node;
+
+   while (true) {
+      struct rb_node *next = util_vma_subtree_first_fit(node->right, size);
+      if (next)
+         return util_vma_hole_from_node(next);
+
+      /* Go up to the first ancestor above this subtree. */
+      struct rb_node *parent = rb_node_parent(node);
+      while (parent && node == parent->right) {
+         node = parent;
+         parent = rb_node_parent(node);
+      }
+      if (!parent)
+         return NULL;
+
+      node = parent;
+      if (util_vma_hole_from_node(node)->size >= size)
+         return util_vma_hole_from_node(node);
+   }
+}
+
+/* Returns the next hole below the given one of at least the given size. */
+static struct util_vma_hole *
+util_vma_hole_prev_fit(struct util_vma_hole *hole, uint64_t size)
+{
+   struct rb_node *node = &hole->node;
+
+   while (true) {
+      struct rb_node *prev = util_vma_subtree_last_fit(node->left, size);
+      if (prev)
+         return util_vma_hole_from_node(prev);
+
+      /* Go up to the first ancestor below this subtree. */
+      struct rb_node *parent = rb_node_parent(node);
+      while (parent && node == parent->left) {
+         node = parent;
+         parent = rb_node_parent(node);
+      }
+      if (!parent)
+         return NULL;
+
+      node = parent;
+      if (util_vma_hole_from_node(node)->size >= size)
+         return util_vma_hole_from_node(node);
+   }
+}
+
+/* Returns the highest hole starting at or below the given offset. */
+static struct util_vma_hole *
+util_vma_heap_find_hole_below(struct util_vma_heap *heap, uint64_t offset)
+{
+   struct util_vma_hole *found = NULL;
+   struct rb_node *node = heap->holes.root;
+
+   while (node) {
+      struct util_vma_hole *hole = util_vma_hole_from_node(node);
+      if (hole->offset <= offset) {
+         found = hole;
+         node = node->right;
+      } else {
+         node = node->left;
+      }
+   }
+
+   return found;
+}
+
+#define util_vma_foreach_hole(_hole, _heap) \
+   rb_tree_foreach(struct util_vma_hole, _hole, &(_heap)->holes, node)
+
+#define util_vma_foreach_hole_rev(_hole, _heap) \
+   rb_tree_foreach_rev(struct util_vma_hole, _hole, &(_heap)->holes, node)
 
 void
 util_vma_heap_init(struct util_vma_heap *heap,
                    uint64_t start, uint64_t size)
 {
-   list_inithead(&heap->holes);
+   rb_tree_init(&heap->holes);
    heap->free_size = 0;
    if (size > 0)
       util_vma_heap_free(heap, start, size);
@@ -59,41 +234,58 @@ util_vma_heap_init(struct util_vma_heap *heap,
    heap->nospan_shift = 0;
 }
 
+/* Iterating in order would walk up through holes that were already freed,
+ * so free children first.
+ */
+static void
+util_vma_free_subtree(struct rb_node *node)
+{
+   while (node) {
+      struct rb_node *right = node->right;
+      util_vma_free_subtree(node->left);
+      free(util_vma_hole_from_node(node));
+      node = right;
+   }
+}
+
 void
 util_vma_heap_finish(struct util_vma_heap *heap)
 {
-   util_vma_foreach_hole_safe(hole, heap)
-      free(hole);
+   util_vma_free_subtree(heap->holes.root);
 }
 
 #ifndef NDEBUG
 static void
 util_vma_heap_validate(struct util_vma_heap *heap)
 {
+   rb_tree_validate(&heap->holes);
+
    uint64_t free_size = 0;
-   uint64_t prev_offset = 0;
+   struct util_vma_hole *prev = NULL;
    util_vma_foreach_hole(hole, heap) {
       assert(hole->offset > 0);
       assert(hole->size > 0);
+      assert(hole->max_size == MAX3(hole->size,
+                                    util_vma_node_max_size(hole->node.left),
+                                    util_vma_node_max_size(hole->node.right)));
 
       free_size += hole->size;
 
-      if (&hole->link == heap->holes.next) {
-         /* This must be the top-most hole.  Assert that, if it overflows, it
-          * overflows to 0, i.e. 2^64.
+      if (prev) {
+         /* The lower hole must not overflow and must end strictly below this
+          * one.  If prev->size + prev->offset == hole->offset, then we
+          * failed to join holes during a util_vma_heap_free.
           */
-         assert(hole->size + hole->offset == 0 ||
-                hole->size + hole->offset > hole->offset);
-      } else {
-         /* This is not the top-most hole so it must not overflow and, in
-          * fact, must be strictly lower than the top-most hole.  If
-          * hole->size + hole->offset == prev_offset, then we failed to join
-          * holes during a util_vma_heap_free.
-          */
-         assert(hole->size + hole->offset > hole->offset &&
-                hole->size + hole->offset < prev_offset);
+         assert(prev->size + prev->offset > prev->offset &&
+                prev->size + prev->offset < hole->offset);
       }
-      prev_offset = hole->offset;
+      prev = hole;
+   }
+
+   /* The top-most hole may only overflow to 0, i.e. 2^64. */
+   if (prev) {
+      assert(prev->size + prev->offset == 0 ||
+             prev->size + prev->offset > prev->offset);
    }
 
    assert(free_size == heap->free_size);
@@ -112,8 +304,7 @@ util_vma_hole_alloc(struct util_vma_heap *heap,
 
    if (offset == hole->offset && size == hole->size) {
       /* Just get rid of the hole. */
-      list_del(&hole->link);
-      free(hole);
+      util_vma_heap_remove_hole(heap, hole);
       goto done;
    }
 
@@ -122,6 +313,7 @@ util_vma_hole_alloc(struct util_vma_heap *heap,
    if (waste == 0) {
       /* We allocated at the top.  Shrink the hole down. */
       hole->size -= size;
+      util_vma_hole_resized(hole);
       goto done;
    }
 
@@ -129,25 +321,18 @@ util_vma_hole_alloc(struct util_vma_heap *heap,
       /* We allocated at the bottom. Shrink the hole up. */
       hole->offset += size;
       hole->size -= size;
+      util_vma_hole_resized(hole);
       goto done;
    }
 
    /* We allocated in the middle.  We need to split the old hole into two
-    * holes, one high and one low.
-    */
-   struct util_vma_hole *high_hole = calloc(1, sizeof(*hole));
-   high_hole->offset = offset + size;
-   high_hole->size = waste;
-
-   /* Adjust the hole to be the amount of space left at he bottom of the
-    * original hole.
+    * holes, one high and one low.  Adjust the hole to be the amount of space
+    * left at the bottom of the original hole, and add a new one above.
     */
    hole->size = offset - hole->offset;
+   util_vma_hole_resized(hole);
 
-   /* Place the new hole before the old hole so that the list is in order
-    * from high to low.
-    */
-   list_addtail(&high_hole->link, &hole->link);
+   util_vma_heap_insert_hole(heap, offset + size, waste);
 
  done:
    heap->free_size -= size;
@@ -172,9 +357,10 @@ util_vma_heap_alloc(struct util_vma_heap *heap,
    }
 
    if (heap->alloc_high) {
-      util_vma_foreach_hole_safe(hole, heap) {
-         if (size > hole->size)
-            continue;
+      struct rb_node *last = util_vma_subtree_last_fit(heap->holes.root, size);
+      for (struct util_vma_hole *hole = util_vma_hole_from_node(last); hole;
+           hole = util_vma_hole_prev_fit(hole, size)) {
+         assert(size <= hole->size);
 
          /* Compute the offset as the highest address where a chunk of the
           * given size can be without going over the top of the hole.
@@ -209,9 +395,10 @@ util_vma_heap_alloc(struct util_vma_heap *heap,
          return offset;
       }
    } else {
-      util_vma_foreach_hole_safe_rev(hole, heap) {
-         if (size > hole->size)
-            continue;
+      struct rb_node *first = util_vma_subtree_first_fit(heap->holes.root, size);
+      for (struct util_vma_hole *hole = util_vma_hole_from_node(first); hole;
+           hole = util_vma_hole_next_fit(hole, size)) {
+         assert(size <= hole->size);
 
          uint64_t offset = hole->offset;
 
@@ -262,25 +449,16 @@ util_vma_heap_alloc_addr(struct util_vma_heap *heap,
     */
    assert(offset + size == 0 || offset + size > offset);
 
-   /* Find the hole if one exists. */
-   util_vma_foreach_hole_safe(hole, heap) {
-      if (hole->offset > offset)
-         continue;
-
-      /* Holes are ordered high-to-low so the first hole we find with
-       * hole->offset <= is our hole.  If it's not big enough to contain the
-       * requested range, then the allocation fails.
-       */
-      assert(hole->offset <= offset);
-      if (hole->size < offset - hole->offset + size)
-         return false;
-
-      util_vma_hole_alloc(heap, hole, offset, size);
-      return true;
-   }
+   /* The only hole that can contain the range is the highest one starting at
+    * or below it.  If it's not big enough to contain the requested range,
+    * then the allocation fails.
+    */
+   struct util_vma_hole *hole = util_vma_heap_find_hole_below(heap, offset);
+   if (hole == NULL || hole->size < offset - hole->offset + size)
+      return false;
 
-   /* We didn't find a suitable hole */
-   return false;
+   util_vma_hole_alloc(heap, hole, offset, size);
+   return true;
 }
 
 void
@@ -303,14 +481,10 @@ util_vma_heap_free(struct util_vma_heap *heap,
    util_vma_heap_validate(heap);
 
    /* Find immediately higher and lower holes if they exist. */
-   struct util_vma_hole *high_hole = NULL, *low_hole = NULL;
-   util_vma_foreach_hole(hole, heap) {
-      if (hole->offset <= offset) {
-         low_hole = hole;
-         break;
-      }
-      high_hole = hole;
-   }
+   struct util_vma_hole *low_hole = util_vma_heap_find_hole_below(heap, offset);
+   struct util_vma_hole *high_hole = low_hole ?
+      util_vma_hole_from_node(rb_node_next(&low_hole->node)) :
+      util_vma_hole_from_node(rb_tree_first(&heap->holes));
 
    if (high_hole)
       assert(offset + size <= high_hole->offset);
@@ -325,27 +499,20 @@ util_vma_heap_free(struct util_vma_heap *heap,
    if (low_adjacent && high_adjacent) {
       /* Merge the two holes */
       low_hole->size += size + high_hole->size;
-      list_del(&high_hole->link);
-      free(high_hole);
+      util_vma_heap_remove_hole(heap, high_hole);
+      util_vma_hole_resized(low_hole);
    } else if (low_adjacent) {
       /* Merge into the low hole */
       low_hole->size += size;
+      util_vma_hole_resized(low_hole);
    } else if (high_adjacent) {
       /* Merge into the high hole */
       high_hole->offset = offset;
       high_hole->size += size;
+      util_vma_hole_resized(high_hole);
    } else {
       /* Neither hole is adjacent; make a new one */
-      struct util_vma_hole *hole = calloc(1, sizeof(*hole));
-
-      hole->offset = offset;
-      hole->size = size;
-
-      /* Add it after the high hole so we maintain high-to-low ordering */
-      if (high_hole)
-         list_add(&hole->link, &high_hole->link);
-      else
-         list_add(&hole->link, &heap->holes);
+      util_vma_heap_insert_hole(heap, offset, size);
    }
 
    heap->free_size += size;
@@ -359,7 +526,7 @@ util_vma_heap_print(struct util_vma_heap *heap, FILE *fp,
    fprintf(fp, "%sutil_vma_heap:\n", tab);
 
    uint64_t total_free = 0;
-   util_vma_foreach_hole(hole, heap) {
+   util_vma_foreach_hole_rev(hole, heap) {
       fprintf(fp, "%s    hole: offset = %"PRIu64" (0x%"PRIx64"), "
               "size = %"PRIu64" (0x%"PRIx64")\n",
               tab, hole->offset, hole->offset, hole->size, hole->size);
@@ -28,6 +28,7 @@
 #include "vk_device.h"
 #include "vk_log.h"
 #include "vk_physical_device.h"
+#include "vk_util.h"
 
 #include "compiler/nir/nir_serialize.h"
 
@@ -35,7 +36,7 @@
 #include "util/u_debug.h"
 #include "util/disk_cache.h"
 #include "util/hash_table.h"
-#include "util/set.h"
+#include "util/u_rcu_hash.h"
 
 #define vk_pipeline_cache_log(cache, ...)                                      \
    if (cache->base.client_visible)                                             \
@@ -149,21 +150,40 @@ vk_pipeline_cache_unlock(struct vk_pipeline_cache *cache)
       simple_mtx_unlock(&cache->lock);
 }
 
-/* cache->lock must be held when calling */
-static void
+/* cache->lock must be held when calling.  Returns whether the object was
+ * removed, in which case lookups may still see it until the next
+ * util_rcu_hash_synchronize(), and the reference owned by the cache must only
+ * be dropped after that.
+ */
+static bool
 vk_pipeline_cache_remove_object(struct vk_pipeline_cache *cache,
                                 uint32_t hash,
                                 struct vk_pipeline_cache_object *object)
 {
-   struct set_entry *entry =
-      _mesa_set_search_pre_hashed(cache->object_cache, hash, object);
-   if (entry && entry->key == (const void *)object) {
-      /* Drop the reference owned by the cache */
-      if (!cache->weak_ref)
-         vk_pipeline_cache_object_unref(cache->base.device, object);
+   struct util_rcu_hash_entry *entry =
+      util_rcu_hash_search(cache->object_cache, hash, object);
+   if (entry && entry->data == (void *)object)
+      return util_rcu_hash_remove(cache->object_cache, hash, object);
+
+   return false;
+}
+
+/* Takes a reference on an object found without holding cache->lock, unless
+ * it is already being destroyed.
+ */
+static bool
+vk_pipeline_cache_object_try_ref(struct vk_pipeline_cache_object *object)
+{
+   uint32_t ref_cnt = p_atomic_read(&object->ref_cnt);
 
-      _mesa_set_remove(cache->object_cache, entry);
+   while (ref_cnt != 0) {
+      uint32_t old = p_atomic_cmpxchg(&object->ref_cnt, ref_cnt, ref_cnt + 1);
+      if (old == ref_cnt)
+         return true;
+      ref_cnt = old;
    }
+
+   return false;
 }
 
 static inline struct vk_pipeline_cache_object *
@@ -192,8 +212,11 @@ vk_pipeline_cache_object_unref(struct vk_device *device, struct vk_pipeline_cach
          vk_pipeline_cache_remove_object(weak_owner, hash, object);
       }
       vk_pipeline_cache_unlock(weak_owner);
-      if (destroy)
+      if (destroy) {
+         /* Wait for the lookups that may still be looking at the object */
+         util_rcu_hash_synchronize(weak_owner->object_cache);
          object->ops->destroy(device, object);
+      }
    }
 }
 
@@ -290,39 +313,67 @@ vk_pipeline_cache_insert_object(struct vk_pipeline_cache *cache,
    uint32_t hash = object_key_hash(object);
 
    vk_pipeline_cache_lock(cache);
-   bool found = false;
-   struct set_entry *entry = _mesa_set_search_or_add_pre_hashed(
-       cache->object_cache, hash, object, &found);
-
-   struct vk_pipeline_cache_object *result = NULL;
-   /* add reference to either the found or inserted object */
-   if (found) {
-       struct vk_pipeline_cache_object *found_object = (void *)entry->key;
-       if (found_object->ops != object->ops) {
-          /* The found object in the cache isn't fully formed. Replace it. */
-          assert(!cache->weak_ref);
-          assert(found_object->ops == &vk_raw_data_cache_object_ops);
-          assert(object->ref_cnt == 1);
-          entry->key = object;
-          object = found_object;
-       }
-
-      result = vk_pipeline_cache_object_ref((void *)entry->key);
-   } else {
-      result = object;
+   struct util_rcu_hash_entry *entry =
+      util_rcu_hash_search(cache->object_cache, hash, object);
+
+   struct vk_pipeline_cache_object *result = object;
+   struct vk_pipeline_cache_object *unref_object = NULL;
+   bool replaced = false;
+   if (entry != NULL) {
+      struct vk_pipeline_cache_object *found_object = entry->data;
+      if (found_object->ops != object->ops) {
+         /* The found object in the cache isn't fully formed. Replace it. */
+         assert(!cache->weak_ref);
+         assert(found_object->ops == &vk_raw_data_cache_object_ops);
+         assert(object->ref_cnt == 1);
+         if (util_rcu_hash_insert(cache->object_cache, hash, object, object)) {
+            vk_pipeline_cache_object_ref(object);
+            unref_object = found_object;
+            replaced = true;
+         }
+      } else {
+         /* add reference to the found object */
+         result = vk_pipeline_cache_object_ref(found_object);
+         unref_object = object;
+      }
+   } else if (util_rcu_hash_insert(cache->object_cache, hash, object, object)) {
       if (!cache->weak_ref)
-         vk_pipeline_cache_object_ref(result);
+         vk_pipeline_cache_object_ref(object);
       else
-         vk_pipeline_cache_object_weak_ref(cache, result);
+         vk_pipeline_cache_object_weak_ref(cache, object);
    }
    vk_pipeline_cache_unlock(cache);
 
-   if (found) {
-      vk_pipeline_cache_object_unref(cache->base.device, object);
-   }
+   /* Lookups may still be looking at the replaced object */
+   if (replaced)
+      util_rcu_hash_synchronize(cache->object_cache);
+
+   if (unref_object != NULL)
+      vk_pipeline_cache_object_unref(cache->base.device, unref_object);
+
    return result;
 }
 
+/* Deserializes and inserts an object found in the disk cache, freeing the
+ * data.
+ */
+static struct vk_pipeline_cache_object *
+vk_pipeline_cache_insert_disk_object(struct vk_pipeline_cache *cache,
+                                     const void *key_data, size_t key_size,
+                                     void *data, size_t data_size,
+                                     const struct vk_pipeline_cache_object_ops *ops)
+{
+   struct vk_pipeline_cache_object *object =
+      vk_pipeline_cache_object_deserialize(cache, key_data, key_size,
+                                           data, data_size, ops);
+   free(data);
+
+   if (object == NULL)
+      return NULL;
+
+   return vk_pipeline_cache_insert_object(cache, object);
+}
+
 struct vk_pipeline_cache_object *
 vk_pipeline_cache_lookup_object(struct vk_pipeline_cache *cache,
                                 const void *key_data, size_t key_size,
@@ -344,15 +395,15 @@ vk_pipeline_cache_lookup_object(struct vk_pipeline_cache *cache,
    struct vk_pipeline_cache_object *object = NULL;
 
    if (cache != NULL && cache->object_cache != NULL) {
-      vk_pipeline_cache_lock(cache);
-      struct set_entry *entry =
-         _mesa_set_search_pre_hashed(cache->object_cache, hash, &key);
-      if (entry) {
-         object = vk_pipeline_cache_object_ref((void *)entry->key);
+      unsigned token = util_rcu_hash_read_lock(cache->object_cache);
+      struct util_rcu_hash_entry *entry =
+         util_rcu_hash_search(cache->object_cache, hash, &key);
+      if (entry && vk_pipeline_cache_object_try_ref(entry->data)) {
+         object = entry->data;
          if (cache_hit != NULL)
             *cache_hit = true;
       }
-      vk_pipeline_cache_unlock(cache);
+      util_rcu_hash_read_unlock(cache->object_cache, token);
    }
 
    if (object == NULL) {
@@ -364,14 +415,10 @@ vk_pipeline_cache_lookup_object(struct vk_pipeline_cache *cache,
          size_t data_size;
          uint8_t *data = disk_cache_get(disk_cache, cache_key, &data_size);
          if (data) {
-            object = vk_pipeline_cache_object_deserialize(cache,
-                                                          key_data, key_size,
-                                                          data, data_size,
-                                                          ops);
-            free(data);
-            if (object != NULL) {
-               return vk_pipeline_cache_insert_object(cache, object);
-            }
+            return vk_pipeline_cache_insert_disk_object(cache,
+                                                        key_data, key_size,
+                                                        data, data_size,
+                                                        ops);
          }
       }
 
@@ -398,8 +445,14 @@ vk_pipeline_cache_lookup_object(struct vk_pipeline_cache *cache,
                                "Deserializing pipeline cache object failed");
 
          vk_pipeline_cache_lock(cache);
-         vk_pipeline_cache_remove_object(cache, hash, object);
+         bool removed = vk_pipeline_cache_remove_object(cache, hash, object);
          vk_pipeline_cache_unlock(cache);
+         if (removed) {
+            /* Drop the reference owned by the cache */
+            util_rcu_hash_synchronize(cache->object_cache);
+            if (!cache->weak_ref)
+               vk_pipeline_cache_object_unref(cache->base.device, object);
+         }
          vk_pipeline_cache_object_unref(cache->base.device, object);
          return NULL;
       }
@@ -413,6 +466,82 @@ vk_pipeline_cache_lookup_object(struct vk_pipeline_cache *cache,
    return object;
 }
 
+void
+vk_pipeline_cache_lookup_objects(struct vk_pipeline_cache *cache,
+                                 const void *key_data, size_t key_size,
+                                 uint32_t count,
+                                 const struct vk_pipeline_cache_object_ops *ops,
+                                 struct vk_pipeline_cache_object **objects)
+{
+   const uint8_t *keys = key_data;
+
+   if (cache->object_cache == NULL) {
+      memset(objects, 0, count * sizeof(*objects));
+      return;
+   }
+
+   struct disk_cache *disk_cache = cache->base.device->physical->disk_cache;
+   uint32_t num_misses = 0;
+
+   STACK_ARRAY(bool, missed, count);
+   STACK_ARRAY(struct disk_cache_get_request, reqs, count);
+
+   /* Find the objects that have to come from the disk cache. */
+   if (!cache->skip_disk_cache && disk_cache && missed && reqs) {
+      unsigned token = util_rcu_hash_read_lock(cache->object_cache);
+      for (uint32_t i = 0; i < count; i++) {
+         struct vk_pipeline_cache_object key = {
+            .key_data = keys + i * key_size,
+            .key_size = key_size,
+         };
+
+         missed[i] = util_rcu_hash_search(cache->object_cache,
+                                          object_key_hash(&key),
+                                          &key) == NULL;
+         if (missed[i])
+            num_misses++;
+      }
+      util_rcu_hash_read_unlock(cache->object_cache, token);
+   }
+
+   /* Load all of them at once, so the disk cache reads and decompresses them
+    * in parallel.
+    */
+   if (num_misses > 1) {
+      uint32_t r = 0;
+      for (uint32_t i = 0; i < count; i++) {
+         if (missed[i]) {
+            disk_cache_compute_key(disk_cache, keys + i * key_size, key_size,
+                                   reqs[r++].key);
+         }
+      }
+
+      disk_cache_get_batch(disk_cache, reqs, num_misses);
+   }
+
+   uint32_t r = 0;
+   for (uint32_t i = 0; i < count; i++) {
+      const void *key = keys + i * key_size;
+
+      if (num_misses > 1 && missed[i]) {
+         objects[i] = NULL;
+         if (reqs[r].data != NULL) {
+            objects[i] =
+               vk_pipeline_cache_insert_disk_object(cache, key, key_size,
+                                                    reqs[r].data, reqs[r].size,
+                                                    ops);
+         }
+         r++;
+      } else {
+         objects[i] = vk_pipeline_cache_lookup_object(cache, key, key_size,
+                                                      ops, NULL);
+      }
+   }
+
+   STACK_ARRAY_FINISH(reqs);
+   STACK_ARRAY_FINISH(missed);
+}
+
 struct vk_pipeline_cache_object *
 vk_pipeline_cache_add_object(struct vk_pipeline_cache *cache,
                              struct vk_pipeline_cache_object *object)
@@ -641,8 +770,7 @@ vk_pipeline_cache_create(struct vk_device *device,
 
    if (info->force_enable ||
        debug_get_bool_option("VK_ENABLE_PIPELINE_CACHE", true)) {
-      cache->object_cache = _mesa_set_create(NULL, object_key_hash,
-                                             object_keys_equal);
+      cache->object_cache = util_rcu_hash_create(object_keys_equal);
    }
 
    if (cache->object_cache && pCreateInfo->initialDataSize > 0) {
@@ -659,13 +787,13 @@ vk_pipeline_cache_destroy(struct vk_pipeline_cache *cache,
 {
    if (cache->object_cache) {
       if (!cache->weak_ref) {
-         set_foreach(cache->object_cache, entry) {
-            vk_pipeline_cache_object_unref(cache->base.device, (void *)entry->key);
+         util_rcu_hash_foreach(cache->object_cache, entry) {
+            vk_pipeline_cache_object_unref(cache->base.device, entry->data);
          }
       } else {
          assert(cache->object_cache->entries == 0);
       }
-      _mesa_set_destroy(cache->object_cache, NULL);
+      util_rcu_hash_destroy(cache->object_cache, NULL);
    }
    simple_mtx_destroy(&cache->lock);
    vk_object_free(cache->base.device, pAllocator, cache);
@@ -736,8 +864,8 @@ vk_common_GetPipelineCacheData(VkDevice _device,
 
    VkResult result = VK_SUCCESS;
    if (cache->object_cache != NULL) {
-      set_foreach(cache->object_cache, entry) {
-         struct vk_pipeline_cache_object *object = (void *)entry->key;
+      util_rcu_hash_foreach(cache->object_cache, entry) {
+         struct vk_pipeline_cache_object *object = entry->data;
 
          if (object->ops->serialize == NULL)
             continue;
@@ -803,6 +931,10 @@ vk_common_MergePipelineCaches(VkDevice _device,
    if (!dst->object_cache)
       return VK_SUCCESS;
 
+   /* Objects replaced in dst, which lookups may still be looking at */
+   struct util_dynarray replaced;
+   util_dynarray_init(&replaced, NULL);
+
    vk_pipeline_cache_lock(dst);
 
    for (uint32_t i = 0; i < srcCacheCount; i++) {
@@ -818,27 +950,29 @@ vk_common_MergePipelineCaches(VkDevice _device,
 
       vk_pipeline_cache_lock(src);
 
-      set_foreach(src->object_cache, src_entry) {
-         struct vk_pipeline_cache_object *src_object = (void *)src_entry->key;
+      util_rcu_hash_foreach(src->object_cache, src_entry) {
+         struct vk_pipeline_cache_object *src_object = src_entry->data;
 
-         bool found_in_dst = false;
-         struct set_entry *dst_entry =
-            _mesa_set_search_or_add_pre_hashed(dst->object_cache,
-                                               src_entry->hash,
-                                               src_object, &found_in_dst);
-         if (found_in_dst) {
-            struct vk_pipeline_cache_object *dst_object = (void *)dst_entry->key;
+         struct util_rcu_hash_entry *dst_entry =
+            util_rcu_hash_search(dst->object_cache, src_entry->hash,
+                                 src_object);
+         if (dst_entry != NULL) {
+            struct vk_pipeline_cache_object *dst_object = dst_entry->data;
             if (dst_object->ops == &vk_raw_data_cache_object_ops &&
-                src_object->ops != &vk_raw_data_cache_object_ops) {
+                src_object->ops != &vk_raw_data_cache_object_ops &&
+                util_rcu_hash_insert(dst->object_cache, src_entry->hash,
+                                     src_object, src_object)) {
                /* Even though dst has the object, it only has the blob version
                 * which isn't as useful.  Replace it with the real object.
                 */
-               vk_pipeline_cache_object_unref(device, dst_object);
-               dst_entry->key = vk_pipeline_cache_object_ref(src_object);
+               vk_pipeline_cache_object_ref(src_object);
+               util_dynarray_append(&replaced,
+                                    struct vk_pipeline_cache_object *,
+                                    dst_object);
             }
-         } else {
+         } else if (util_rcu_hash_insert(dst->object_cache, src_entry->hash,
+                                         src_object, src_object)) {
             /* We inserted src_object in dst so it needs a reference */
-            assert(dst_entry->key == (const void *)src_object);
             vk_pipeline_cache_object_ref(src_object);
          }
       }
@@ -848,5 +982,12 @@ vk_common_MergePipelineCaches(VkDevice _device,
 
    vk_pipeline_cache_unlock(dst);
 
+   if (replaced.size > 0) {
+      util_rcu_hash_synchronize(dst->object_cache);
+      util_dynarray_foreach(&replaced, struct vk_pipeline_cache_object *, object)
+         vk_pipeline_cache_object_unref(device, *object);
+   }
+   util_dynarray_fini(&replaced);
+
    return VK_SUCCESS;
 }
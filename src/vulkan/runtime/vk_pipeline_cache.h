@@ -36,8 +36,8 @@ extern "C" {
 struct blob;
 struct blob_reader;
 
-/* #include "util/set.h" */
-struct set;
+/* #include "util/u_rcu_hash.h" */
+struct util_rcu_hash;
 
 /* #include "compiler/nir/nir.h" */
 struct nir_shader;
@@ -158,10 +158,10 @@ struct vk_pipeline_cache {
 
    struct vk_pipeline_cache_header header;
 
-   /** Protects object_cache */
+   /** Serializes changes to object_cache, lookups don't take it */
    simple_mtx_t lock;
 
-   struct set *object_cache;
+   struct util_rcu_hash *object_cache;
 };
 
 VK_DEFINE_NONDISP_HANDLE_CASTS(vk_pipeline_cache, base, VkPipelineCache,
@@ -234,6 +234,21 @@ vk_pipeline_cache_lookup_object(struct vk_pipeline_cache *cache,
                                 const struct vk_pipeline_cache_object_ops *ops,
                                 bool *cache_hit);
 
+/** Looks up several objects in the cache at once
+ *
+ * This is equivalent to calling vk_pipeline_cache_lookup_object() for each
+ * of the count keys of key_size bytes packed in key_data, and returns a
+ * reference to each object found in objects, (or NULL).  Objects missing
+ * from the in-memory cache are looked up in the disk cache in one batch, so
+ * their reads and decompression happen in parallel.
+ */
+void
+vk_pipeline_cache_lookup_objects(struct vk_pipeline_cache *cache,
+                                 const void *key_data, size_t key_size,
+                                 uint32_t count,
+                                 const struct vk_pipeline_cache_object_ops *ops,
+                                 struct vk_pipeline_cache_object **objects);
+
 /** Adds an object to the pipeline cache
  *
  * This function adds the given object to the pipeline cache.  We do not